@@ -65,6 +65,11 @@ public:
 		//
 	}
 
+	// 只关闭写入，不会 yield。
+	bool is_stackless() const OVERRIDE {
+		return true;
+	}
+
 protected:
 	void really_perform(const boost::shared_ptr<Session> &session) OVERRIDE {
 		POSEIDON_PROFILE_ME;
@@ -81,6 +86,11 @@ public:
 		//
 	}
 
+	// 只发送一个状态，不会 yield。
+	bool is_stackless() const OVERRIDE {
+		return true;
+	}
+
 protected:
 	void really_perform(const boost::shared_ptr<Session> &session) OVERRIDE {
 		POSEIDON_PROFILE_ME;
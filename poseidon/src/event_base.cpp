@@ -11,6 +11,10 @@ Event_base::~Event_base(){
 	//
 }
 
+bool Event_base::get_coalescing_key(boost::uint64_t & /*key*/) const {
+	return false;
+}
+
 void sync_raise_event(const boost::shared_ptr<Event_base> &event){
 	Event_dispatcher::sync_raise(event);
 }
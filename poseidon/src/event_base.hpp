@@ -5,12 +5,17 @@
 #define POSEIDON_EVENT_BASE_HPP_
 
 #include <boost/shared_ptr.hpp>
+#include <boost/cstdint.hpp>
 
 namespace Poseidon {
 
 class Event_base {
 public:
 	virtual ~Event_base();
+
+public:
+	// 如果返回 true，异步触发的这个事件可以与尚未处理的、类型和 key 都相同的事件合并，响应器只会收到最后一个。
+	virtual bool get_coalescing_key(boost::uint64_t &key) const;
 };
 
 extern void sync_raise_event(const boost::shared_ptr<Event_base> &event);
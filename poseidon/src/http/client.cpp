@@ -81,6 +81,11 @@ public:
 		//
 	}
 
+	// 只关闭写入，不会 yield。
+	bool is_stackless() const OVERRIDE {
+		return true;
+	}
+
 protected:
 	void really_perform(const boost::shared_ptr<Client> &client) OVERRIDE {
 		POSEIDON_PROFILE_ME;
@@ -72,7 +72,7 @@ void Low_level_session::on_receive(Stream_buffer data){
 void Low_level_session::on_shutdown_timer(boost::uint64_t now){
 	POSEIDON_PROFILE_ME;
 
-	// timer 线程读取需要锁。
+	// epoll 线程读取需要锁。
 	const AUTO(upgraded_session, get_upgraded_session());
 	if(upgraded_session){
 		upgraded_session->on_shutdown_timer(now);
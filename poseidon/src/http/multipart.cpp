@@ -42,6 +42,12 @@ Multipart::Multipart(std::string boundary, std::istream &is)
 	POSEIDON_THROW_UNLESS(is, Basic_exception, Rcnts::view("Http::Multipart parser error"));
 }
 
+Multipart::Multipart(std::string boundary, const Stream_buffer &buffer)
+	: m_boundary(STD_MOVE(boundary)), m_elements()
+{
+	parse(buffer);
+}
+
 void Multipart::random_boundary(){
 	POSEIDON_PROFILE_ME;
 
@@ -200,6 +206,76 @@ void Multipart::parse(std::istream &is){
 
 	m_elements.swap(elements);
 }
+void Multipart::parse(const Stream_buffer &buffer){
+	POSEIDON_PROFILE_ME;
+	POSEIDON_THROW_UNLESS(!m_boundary.empty(), Basic_exception, Rcnts::view("Multipart boundary not set"));
+
+	std::string delimiter;
+	delimiter.reserve(m_boundary.size() + 2);
+	delimiter += "--";
+	delimiter += m_boundary;
+
+	VALUE_TYPE(m_elements) elements;
+
+	Stream_buffer queue(buffer);
+	AUTO(pos, queue.find(delimiter));
+	if(pos < 0){
+		m_elements.swap(elements);
+		return;
+	}
+	queue.discard(static_cast<std::size_t>(pos) + delimiter.size());
+	for(;;){
+		int ch = queue.get();
+		if(ch == '-'){
+			POSEIDON_THROW_UNLESS(queue.get() == '-', Basic_exception, Rcnts::view("Invalid multipart termination boundary"));
+			break;
+		}
+		if(ch == '\r'){
+			ch = queue.get();
+		}
+		POSEIDON_THROW_UNLESS(ch == '\n', Basic_exception, Rcnts::view("Invalid multipart boundary"));
+
+		pos = queue.find(delimiter);
+		if(pos < 0){
+			break;
+		}
+		AUTO(segment, queue.cut_off(static_cast<std::size_t>(pos)));
+		queue.discard(delimiter.size());
+
+		Multipart_element elem;
+		for(;;){
+			const AUTO(lf_offset, segment.find('\n'));
+			std::string line;
+			if(lf_offset < 0){
+				line = segment.dump_string();
+				segment.clear();
+			} else {
+				line = segment.cut_off(static_cast<std::size_t>(lf_offset)).dump_string();
+				segment.discard();
+			}
+			try_pop(line, '\r');
+			if(line.empty()){
+				break;
+			}
+			const AUTO(colon, line.find(':'));
+			POSEIDON_THROW_UNLESS(colon != std::string::npos, Basic_exception, Rcnts::view("Invalid HTTP header"));
+			Rcnts key(line.data(), colon);
+			line.erase(0, colon + 1);
+			std::string value(trim(STD_MOVE(line)));
+			elem.headers.set(STD_MOVE(key), STD_MOVE(value));
+		}
+		if(segment.back() == '\n'){
+			segment.unput();
+			if(segment.back() == '\r'){
+				segment.unput();
+			}
+		}
+		elem.entity = STD_MOVE(segment);
+		elements.push_back(STD_MOVE(elem));
+	}
+
+	m_elements.swap(elements);
+}
 
 }
 }
@@ -46,6 +46,7 @@ public:
 		//
 	}
 	Multipart(std::string boundary, std::istream &is);
+	Multipart(std::string boundary, const Stream_buffer &buffer);
 #ifndef POSEIDON_CXX11
 	Multipart(const Multipart &rhs)
 		: m_boundary(rhs.m_boundary), m_elements(rhs.m_elements)
@@ -196,6 +197,8 @@ public:
 	Stream_buffer dump() const;
 	void dump(std::ostream &os) const;
 	void parse(std::istream &is);
+	// 一次性解析整个缓冲区，各个元素的数据与 buffer 共享存储。
+	void parse(const Stream_buffer &buffer);
 };
 
 inline void swap(Multipart &lhs, Multipart &rhs) NOEXCEPT {
@@ -37,22 +37,7 @@ bool Server_reader::put_encoded_data(Stream_buffer encoded, bool dont_parse_get_
 		const bool expecting_new_line = (m_size_expecting == content_length_expecting_endl);
 
 		if(expecting_new_line){
-			std::ptrdiff_t lf_offset = 0;
-			Stream_buffer::Enumeration_cookie cookie;
-			for(;;){
-				const void *data, *pos;
-				std::size_t size;
-				if(!m_queue.enumerate_chunk(&data, &size, cookie)){
-					lf_offset = -1;
-					break;
-				}
-				pos = std::memchr(data, '\n', size);
-				if(pos){
-					lf_offset += static_cast<const char *>(pos) - static_cast<const char *>(data);
-					break;
-				}
-				lf_offset += static_cast<std::ptrdiff_t>(size);
-			}
+			const AUTO(lf_offset, m_queue.find('\n'));
 			if(lf_offset < 0){
 				// 没找到换行符。
 				const AUTO(max_line_length, Main_config::get<std::size_t>("http_max_header_line_length", 8192));
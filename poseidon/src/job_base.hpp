@@ -20,6 +20,11 @@ public:
 	// 如果一个任务被推迟执行且 Category 非空，
 	// 则所有具有相同 Category 的后续任务都会被推迟，以维持其相对顺序。
 	virtual boost::weak_ptr<const void> get_category() const = 0;
+	// 如果任务从不等待尚未完成的 promise，可以返回 true。这样的任务直接在工作线程的栈上运行，不需要分配纤程栈和切换上下文。
+	// 在这样的任务中调用 Job_dispatcher::yield() 等待尚未完成的 promise 会抛出异常。
+	virtual bool is_stackless() const {
+		return false;
+	}
 	virtual void perform() = 0;
 };
 
@@ -32,6 +32,7 @@
 #include "checked_arithmetic.hpp"
 #include "system_http_servlet_base.hpp"
 #include "json.hpp"
+#include "stream_buffer.hpp"
 #include <signal.h>
 #include <unistd.h>
 #include <stdio.h>
@@ -172,12 +173,259 @@ namespace {
 				obj.set(Rcnts::view("listening"), elem.listening);
 				obj.set(Rcnts::view("readable"), elem.readable);
 				obj.set(Rcnts::view("writable"), elem.writable);
+				obj.set(Rcnts::view("shard"), elem.shard);
 				arr.push_back(STD_MOVE_IDN(obj));
 			}
 			resp.set(Rcnts::view("sockets"), STD_MOVE_IDN(arr));
 		}
 	};
 
+	struct System_http_servlet_buffer_pool : public System_http_servlet_base {
+		const char * get_uri() const FINAL {
+			return "/poseidon/buffer_pool";
+		}
+		void handle_get(Json_object &resp) const FINAL {
+			resp.set(Rcnts::view("description"), "Retreive statistics about the chunk pool of stream buffers in this process.");
+			static const char *const s_param_info[][2] = {
+				{ NULLPTR }
+			};
+			resp.set(Rcnts::view("parameters"), make_help(s_param_info));
+		}
+		void handle_post(Json_object &resp, Json_object /*req*/) const FINAL {
+			// .classes = all size classes. A chunk size of zero denotes chunks that are too large to be pooled.
+			boost::container::vector<Stream_buffer::Pool_snapshot_element> snapshot;
+			Stream_buffer::snapshot_pool(snapshot);
+			Json_array arr;
+			for(AUTO(it, snapshot.begin()); it != snapshot.end(); ++it){
+				const AUTO_REF(elem, *it);
+				Json_object obj;
+				obj.set(Rcnts::view("chunk_size"), elem.chunk_size);
+				obj.set(Rcnts::view("system_allocations"), elem.system_allocations);
+				obj.set(Rcnts::view("system_deallocations"), elem.system_deallocations);
+				obj.set(Rcnts::view("depot_fetches"), elem.depot_fetches);
+				obj.set(Rcnts::view("depot_returns"), elem.depot_returns);
+				obj.set(Rcnts::view("depot_chunks"), elem.depot_chunks);
+				arr.push_back(STD_MOVE_IDN(obj));
+			}
+			resp.set(Rcnts::view("classes"), STD_MOVE_IDN(arr));
+		}
+	};
+
+	struct System_http_servlet_fiber_stacks : public System_http_servlet_base {
+		const char * get_uri() const FINAL {
+			return "/poseidon/fiber_stacks";
+		}
+		void handle_get(Json_object &resp) const FINAL {
+			resp.set(Rcnts::view("description"), "Retreive statistics about fiber stacks of the job dispatcher in this process.");
+			static const char *const s_param_info[][2] = {
+				{ NULLPTR }
+			};
+			resp.set(Rcnts::view("parameters"), make_help(s_param_info));
+		}
+		void handle_post(Json_object &resp, Json_object /*req*/) const FINAL {
+			// .high_water_histogram = number of fibers whose stack usage did not exceed `limit` bytes. A limit of zero denotes the last bucket.
+			Job_dispatcher::Stack_snapshot snapshot;
+			Job_dispatcher::snapshot_stacks(snapshot);
+			resp.set(Rcnts::view("stack_size"), snapshot.stack_size);
+			resp.set(Rcnts::view("guard_size"), snapshot.guard_size);
+			resp.set(Rcnts::view("system_allocations"), snapshot.system_allocations);
+			resp.set(Rcnts::view("system_deallocations"), snapshot.system_deallocations);
+			resp.set(Rcnts::view("cache_hits"), snapshot.cache_hits);
+			resp.set(Rcnts::view("stacks_in_use"), snapshot.stacks_in_use);
+			resp.set(Rcnts::view("stacks_cached"), snapshot.stacks_cached);
+			resp.set(Rcnts::view("high_water_max"), snapshot.high_water_max);
+			resp.set(Rcnts::view("high_water_samples"), snapshot.high_water_samples);
+			resp.set(Rcnts::view("high_water_average"), (snapshot.high_water_samples != 0) ? (snapshot.high_water_total / snapshot.high_water_samples) : 0);
+			Json_array arr;
+			for(AUTO(it, snapshot.high_water_histogram.begin()); it != snapshot.high_water_histogram.end(); ++it){
+				const AUTO_REF(bucket, *it);
+				Json_object obj;
+				obj.set(Rcnts::view("limit"), bucket.limit);
+				obj.set(Rcnts::view("count"), bucket.count);
+				arr.push_back(STD_MOVE_IDN(obj));
+			}
+			resp.set(Rcnts::view("high_water_histogram"), STD_MOVE_IDN(arr));
+		}
+	};
+
+	struct System_http_servlet_timer_jitter : public System_http_servlet_base {
+		const char * get_uri() const FINAL {
+			return "/poseidon/timer_jitter";
+		}
+		void handle_get(Json_object &resp) const FINAL {
+			resp.set(Rcnts::view("description"), "Retreive statistics about how late timers have been triggered in this process.");
+			static const char *const s_param_info[][2] = {
+				{ "clear", "If set to `true`, all data will be purged." },
+				{ NULLPTR }
+			};
+			resp.set(Rcnts::view("parameters"), make_help(s_param_info));
+		}
+		void handle_post(Json_object &resp, Json_object req) const FINAL {
+			bool clear = false;
+			if(req.has("clear")){
+				try {
+					clear = req.get("clear").get<bool>();
+				} catch(std::exception &e){
+					POSEIDON_LOG_WARNING("std::exception thrown: ", e.what());
+					resp.set(Rcnts::view("error"), "Invalid parameter `clear`: It shall be a `Boolean`.");
+					return;
+				}
+			}
+
+			// All times are in microseconds.
+			// .histogram = number of timers that were triggered no more than `limit` microseconds late. A limit of zero denotes the last bucket.
+			Timer_daemon::Jitter_snapshot snapshot;
+			Timer_daemon::snapshot_jitter(snapshot);
+			if(clear){
+				Timer_daemon::clear_jitter();
+			}
+			resp.set(Rcnts::view("timerfd"), snapshot.timerfd);
+			resp.set(Rcnts::view("max"), snapshot.max);
+			resp.set(Rcnts::view("samples"), snapshot.samples);
+			resp.set(Rcnts::view("average"), (snapshot.samples != 0) ? (snapshot.total / snapshot.samples) : 0);
+			Json_array arr;
+			for(AUTO(it, snapshot.histogram.begin()); it != snapshot.histogram.end(); ++it){
+				const AUTO_REF(bucket, *it);
+				Json_object obj;
+				obj.set(Rcnts::view("limit"), bucket.limit);
+				obj.set(Rcnts::view("count"), bucket.count);
+				arr.push_back(STD_MOVE_IDN(obj));
+			}
+			resp.set(Rcnts::view("histogram"), STD_MOVE_IDN(arr));
+		}
+	};
+
+	struct System_http_servlet_events : public System_http_servlet_base {
+		const char * get_uri() const FINAL {
+			return "/poseidon/events";
+		}
+		void handle_get(Json_object &resp) const FINAL {
+			resp.set(Rcnts::view("description"), "Retreive statistics about events that have been raised in this process.");
+			static const char *const s_param_info[][2] = {
+				{ "clear", "If set to `true`, all data will be purged." },
+				{ NULLPTR }
+			};
+			resp.set(Rcnts::view("parameters"), make_help(s_param_info));
+		}
+		void handle_post(Json_object &resp, Json_object req) const FINAL {
+			bool clear = false;
+			if(req.has("clear")){
+				try {
+					clear = req.get("clear").get<bool>();
+				} catch(std::exception &e){
+					POSEIDON_LOG_WARNING("std::exception thrown: ", e.what());
+					resp.set(Rcnts::view("error"), "Invalid parameter `clear`: It shall be a `Boolean`.");
+					return;
+				}
+			}
+
+			// All times are in microseconds.
+			// .queue_time = time elapsed from `async_raise()` until listeners are called.
+			boost::container::vector<Event_dispatcher::Event_snapshot> snapshot;
+			Event_dispatcher::snapshot_events(snapshot);
+			if(clear){
+				Event_dispatcher::clear_event_counters();
+			}
+			Json_array arr;
+			for(AUTO(it, snapshot.begin()); it != snapshot.end(); ++it){
+				const AUTO_REF(event, *it);
+				Json_object obj;
+				obj.set(Rcnts::view("type"), event.type_info->name());
+				obj.set(Rcnts::view("listener_count"), event.listener_count);
+				obj.set(Rcnts::view("sync_raises"), event.sync_raises);
+				obj.set(Rcnts::view("async_raises"), event.async_raises);
+				obj.set(Rcnts::view("coalesced"), event.coalesced);
+				obj.set(Rcnts::view("listener_calls"), event.listener_calls);
+				obj.set(Rcnts::view("exceptions"), event.exceptions);
+				obj.set(Rcnts::view("total_time"), event.total_time);
+				obj.set(Rcnts::view("max_time"), event.max_time);
+				obj.set(Rcnts::view("total_queue_time"), event.total_queue_time);
+				obj.set(Rcnts::view("max_queue_time"), event.max_queue_time);
+				arr.push_back(STD_MOVE_IDN(obj));
+			}
+			resp.set(Rcnts::view("events"), STD_MOVE_IDN(arr));
+		}
+	};
+
+#ifdef POSEIDON_ENABLE_MYSQL
+	struct System_http_servlet_mysql : public System_http_servlet_base {
+		const char * get_uri() const FINAL {
+			return "/poseidon/mysql";
+		}
+		void handle_get(Json_object &resp) const FINAL {
+			resp.set(Rcnts::view("description"), "Retreive statistics about SQL, tables and the result cache of the MySQL daemon.");
+			static const char *const s_param_info[][2] = {
+				{ "clear", "If set to `true`, all data will be purged." },
+				{ NULLPTR }
+			};
+			resp.set(Rcnts::view("parameters"), make_help(s_param_info));
+		}
+		void handle_post(Json_object &resp, Json_object req) const FINAL {
+			bool clear = false;
+			if(req.has("clear")){
+				try {
+					clear = req.get("clear").get<bool>();
+				} catch(std::exception &e){
+					POSEIDON_LOG_WARNING("std::exception thrown: ", e.what());
+					resp.set(Rcnts::view("error"), "Invalid parameter `clear`: It shall be a `Boolean`.");
+					return;
+				}
+			}
+
+			// .elapsed = milliseconds since counters were cleared.
+			// .bytes_per_second = (sql_bytes + parameter_bytes) per second within that period.
+			// All times in `tables` are in microseconds.
+			// .latency = time elapsed from enqueueing an operation until it completes.
+			// .pending = operations of this table in all MySQL threads that have not completed.
+			// .cache.size = estimated bytes of memory used by cached results.
+			// .cache.hit_rate = hits / (hits + misses).
+			Mysql_daemon::Statistics_snapshot snapshot;
+			Mysql_daemon::snapshot_statistics(snapshot);
+			boost::container::vector<Mysql_daemon::Table_snapshot> tables;
+			Mysql_daemon::snapshot_tables(tables);
+			Mysql_daemon::Cache_snapshot cache;
+			Mysql_daemon::snapshot_cache(cache);
+			if(clear){
+				Mysql_daemon::clear_statistics();
+			}
+			resp.set(Rcnts::view("elapsed"), snapshot.elapsed);
+			resp.set(Rcnts::view("statements"), snapshot.statements);
+			resp.set(Rcnts::view("sql_bytes"), snapshot.sql_bytes);
+			resp.set(Rcnts::view("parameter_bytes"), snapshot.parameter_bytes);
+			resp.set(Rcnts::view("bytes_per_second"), (snapshot.elapsed != 0) ? ((snapshot.sql_bytes + snapshot.parameter_bytes) * 1000 / snapshot.elapsed) : 0);
+			resp.set(Rcnts::view("full_saves"), snapshot.full_saves);
+			resp.set(Rcnts::view("partial_saves"), snapshot.partial_saves);
+			resp.set(Rcnts::view("skipped_saves"), snapshot.skipped_saves);
+			Json_array arr;
+			for(AUTO(it, tables.begin()); it != tables.end(); ++it){
+				const AUTO_REF(table, *it);
+				Json_object obj;
+				obj.set(Rcnts::view("table"), table.table);
+				obj.set(Rcnts::view("pending"), table.pending);
+				obj.set(Rcnts::view("operations"), table.operations);
+				obj.set(Rcnts::view("failures"), table.failures);
+				obj.set(Rcnts::view("total_latency"), table.total_latency);
+				obj.set(Rcnts::view("max_latency"), table.max_latency);
+				obj.set(Rcnts::view("total_execution_time"), table.total_execution_time);
+				obj.set(Rcnts::view("max_execution_time"), table.max_execution_time);
+				arr.push_back(STD_MOVE_IDN(obj));
+			}
+			resp.set(Rcnts::view("tables"), STD_MOVE_IDN(arr));
+			Json_object cache_obj;
+			cache_obj.set(Rcnts::view("max_size"), cache.max_size);
+			cache_obj.set(Rcnts::view("entries"), cache.entries);
+			cache_obj.set(Rcnts::view("size"), cache.size);
+			cache_obj.set(Rcnts::view("hits"), cache.hits);
+			cache_obj.set(Rcnts::view("misses"), cache.misses);
+			cache_obj.set(Rcnts::view("hit_rate"), (cache.hits + cache.misses != 0) ? (static_cast<double>(cache.hits) / static_cast<double>(cache.hits + cache.misses)) : 0.0);
+			cache_obj.set(Rcnts::view("evictions"), cache.evictions);
+			cache_obj.set(Rcnts::view("invalidations"), cache.invalidations);
+			cache_obj.set(Rcnts::view("rejections"), cache.rejections);
+			resp.set(Rcnts::view("cache"), STD_MOVE_IDN(cache_obj));
+		}
+	};
+#endif
+
 	struct System_http_servlet_profiler : public System_http_servlet_base {
 		const char * get_uri() const FINAL {
 			return "/poseidon/profiler";
@@ -450,6 +698,13 @@ int main(int argc, char **argv, char **/*envp*/){
 		system_http_servlets.push_back(System_http_server::register_servlet(boost::make_shared<System_http_servlet_logger>()));
 		system_http_servlets.push_back(System_http_server::register_servlet(boost::make_shared<System_http_servlet_network>()));
 		system_http_servlets.push_back(System_http_server::register_servlet(boost::make_shared<System_http_servlet_profiler>()));
+		system_http_servlets.push_back(System_http_server::register_servlet(boost::make_shared<System_http_servlet_buffer_pool>()));
+		system_http_servlets.push_back(System_http_server::register_servlet(boost::make_shared<System_http_servlet_fiber_stacks>()));
+		system_http_servlets.push_back(System_http_server::register_servlet(boost::make_shared<System_http_servlet_timer_jitter>()));
+		system_http_servlets.push_back(System_http_server::register_servlet(boost::make_shared<System_http_servlet_events>()));
+#ifdef POSEIDON_ENABLE_MYSQL
+		system_http_servlets.push_back(System_http_server::register_servlet(boost::make_shared<System_http_servlet_mysql>()));
+#endif
 		system_http_servlets.push_back(System_http_server::register_servlet(boost::make_shared<System_http_servlet_modules>()));
 
 		if(!all_logs){
@@ -33,12 +33,75 @@ namespace {
 		}
 	};
 
+	struct Statement_closer {
+		CONSTEXPR ::MYSQL_STMT * operator()() const NOEXCEPT {
+			return NULLPTR;
+		}
+		void operator()(::MYSQL_STMT *stmt) const NOEXCEPT {
+			::mysql_stmt_close(stmt);
+		}
+	};
+
 	struct Field_comparator {
 		bool operator()(const char *lhs, const char *rhs) const NOEXCEPT {
 			return std::strcmp(lhs, rhs) < 0;
 		}
 	};
 
+	bool parse_boolean(const char *data, std::size_t size){
+		return (size != 0) && (std::strcmp(data, "0") != 0);
+	}
+	boost::int64_t parse_signed(const char *data){
+		char *eptr;
+		const boost::int64_t value = ::strtoll(data, &eptr, 0);
+		POSEIDON_THROW_UNLESS(*eptr == 0, Basic_exception, Rcnts::view("Could not convert field data to `long long`"));
+		return value;
+	}
+	boost::uint64_t parse_unsigned(const char *data){
+		char *eptr;
+		const boost::uint64_t value = ::strtoull(data, &eptr, 0);
+		POSEIDON_THROW_UNLESS(*eptr == 0, Basic_exception, Rcnts::view("Could not convert field data to `unsigned long long`"));
+		return value;
+	}
+	double parse_double(const char *data){
+		char *eptr;
+		const double value = ::strtod(data, &eptr);
+		POSEIDON_THROW_UNLESS(*eptr == 0, Basic_exception, Rcnts::view("Could not convert field data to `double`"));
+		return value;
+	}
+	Uuid parse_uuid(const char *data, std::size_t size){
+		POSEIDON_THROW_UNLESS(size == 36, Basic_exception, Rcnts::view("Invalid UUID string length"));
+		Uuid value;
+		value.from_string(*reinterpret_cast<const char (*)[36]>(data));
+		return value;
+	}
+
+	// 二进制协议的结果。整数、浮点数和日期时间按照原生类型接收，其余的按照字节串接收。
+	enum Column_kind {
+		column_integer   = 1,
+		column_double    = 2,
+		column_datetime  = 3,
+		column_bytes     = 4,
+	};
+
+	struct Binary_column {
+		Column_kind kind;
+		::my_bool is_unsigned;
+		long long integer;
+		double real;
+		::MYSQL_TIME time;
+		boost::container::vector<char> bytes;
+		unsigned long length;
+		::my_bool is_null;
+		::my_bool error;
+	};
+
+	struct Cached_statement {
+		Unique_handle<Statement_closer> stmt;
+		unsigned long thread_id;
+		boost::uint64_t last_used;
+	};
+
 	class Delegated_connection FINAL : public Connection {
 	private:
 		Rcnts m_schema;
@@ -50,10 +113,26 @@ namespace {
 		::MYSQL_ROW m_row;
 		unsigned long *m_lengths;
 
+		// 预处理语句缓存，淘汰最久没有使用的语句。
+		std::size_t m_statement_cache_size;
+		boost::container::map<std::string, Cached_statement> m_statements;
+		boost::uint64_t m_use_counter;
+
+		boost::container::vector< ::MYSQL_BIND> m_param_binds;
+		boost::container::vector< ::MYSQL_TIME> m_param_times;
+
+		::MYSQL_STMT *m_stmt; // 如果不为空，当前结果集来自这个预处理语句。
+		Unique_handle<Result_deleter> m_stmt_metadata;
+		boost::container::vector<Binary_column> m_columns;
+		boost::container::vector< ::MYSQL_BIND> m_result_binds;
+		bool m_has_binary_row;
+
 	public:
-		Delegated_connection(const char *server_addr, boost::uint16_t server_port, const char *user_name, const char *password, const char *schema, bool use_ssl, const char *charset)
+		Delegated_connection(const char *server_addr, boost::uint16_t server_port, const char *user_name, const char *password, const char *schema, bool use_ssl, const char *charset, std::size_t statement_cache_size)
 			: m_schema(schema)
 			, m_row(NULLPTR), m_lengths(NULLPTR)
+			, m_statement_cache_size(std::max<std::size_t>(statement_cache_size, 1)), m_statements(), m_use_counter(0)
+			, m_stmt(NULLPTR), m_has_binary_row(false)
 		{
 			POSEIDON_PROFILE_ME;
 
@@ -70,9 +149,155 @@ namespace {
 		}
 
 	private:
+		::MYSQL_STMT * require_statement(const char *sql, std::size_t len){
+			POSEIDON_PROFILE_ME;
+
+			const unsigned long thread_id = ::mysql_thread_id(m_mysql.get());
+			std::string key(sql, len);
+			AUTO(it, m_statements.find(key));
+			if(it != m_statements.end()){
+				if(it->second.thread_id == thread_id){
+					it->second.last_used = ++m_use_counter;
+					return it->second.stmt.get();
+				}
+				// 连接被自动重连过，之前的语句已经失效了。
+				POSEIDON_LOG_DEBUG("Discarding stale prepared statement: ", key);
+				m_statements.erase(it);
+			}
+			while(m_statements.size() >= m_statement_cache_size){
+				AUTO(victim, m_statements.begin());
+				for(AUTO(test, m_statements.begin()); test != m_statements.end(); ++test){
+					if(test->second.last_used < victim->second.last_used){
+						victim = test;
+					}
+				}
+				POSEIDON_LOG_DEBUG("Evicting prepared statement: ", victim->first);
+				m_statements.erase(victim);
+			}
+
+			Unique_handle<Statement_closer> stmt;
+			POSEIDON_THROW_UNLESS(stmt.reset(::mysql_stmt_init(m_mysql.get())), Exception, m_schema, ::mysql_errno(m_mysql.get()), Rcnts(::mysql_error(m_mysql.get())));
+			if(::mysql_stmt_prepare(stmt.get(), sql, len) != 0){
+				POSEIDON_THROW(Exception, m_schema, ::mysql_stmt_errno(stmt.get()), Rcnts(::mysql_stmt_error(stmt.get())));
+			}
+			static CONSTEXPR const ::my_bool s_true_value = true;
+			POSEIDON_THROW_UNLESS(::mysql_stmt_attr_set(stmt.get(), STMT_ATTR_UPDATE_MAX_LENGTH, &s_true_value) == 0, Basic_exception, Rcnts::view("::mysql_stmt_attr_set() failed, trying to set STMT_ATTR_UPDATE_MAX_LENGTH"));
+			POSEIDON_LOG_DEBUG("Prepared statement: ", key);
+
+			AUTO_REF(elem, m_statements[STD_MOVE(key)]);
+			elem.stmt.reset(STD_MOVE(stmt));
+			elem.thread_id = thread_id;
+			elem.last_used = ++m_use_counter;
+			return elem.stmt.get();
+		}
+		__attribute__((__noreturn__)) void throw_statement_error(const char *sql, std::size_t len, ::MYSQL_STMT *stmt){
+			const unsigned long code = ::mysql_stmt_errno(stmt);
+			Rcnts message(::mysql_stmt_error(stmt));
+			// 出错的语句可能已经失效了，下次重新准备。
+			m_statements.erase(std::string(sql, len));
+			POSEIDON_THROW(Exception, m_schema, code, STD_MOVE(message));
+		}
+		void bind_binary_results(const char *sql, std::size_t len, ::MYSQL_STMT *stmt){
+			POSEIDON_PROFILE_ME;
+
+			// 缓存整个结果集，这样才能知道每一列的最大长度。
+			if(::mysql_stmt_store_result(stmt) != 0){
+				throw_statement_error(sql, len, stmt);
+			}
+			if(!m_stmt_metadata.reset(::mysql_stmt_result_metadata(stmt))){
+				throw_statement_error(sql, len, stmt);
+			}
+			const AUTO(fields, ::mysql_fetch_fields(m_stmt_metadata.get()));
+			const AUTO(count, ::mysql_num_fields(m_stmt_metadata.get()));
+			m_columns.resize(count);
+			m_result_binds.resize(count);
+			m_fields.reserve(count);
+			for(std::size_t i = 0; i < count; ++i){
+				const AUTO_REF(field, fields[i]);
+				AUTO_REF(column, m_columns.at(i));
+				AUTO_REF(bind, m_result_binds.at(i));
+				std::memset(&bind, 0, sizeof(bind));
+				switch(field.type){
+				case MYSQL_TYPE_TINY:
+				case MYSQL_TYPE_SHORT:
+				case MYSQL_TYPE_INT24:
+				case MYSQL_TYPE_LONG:
+				case MYSQL_TYPE_LONGLONG:
+				case MYSQL_TYPE_YEAR:
+					column.kind = column_integer;
+					column.is_unsigned = (field.flags & UNSIGNED_FLAG) != 0;
+					bind.buffer_type = MYSQL_TYPE_LONGLONG;
+					bind.buffer = &column.integer;
+					bind.is_unsigned = column.is_unsigned;
+					break;
+				case MYSQL_TYPE_FLOAT:
+				case MYSQL_TYPE_DOUBLE:
+					column.kind = column_double;
+					bind.buffer_type = MYSQL_TYPE_DOUBLE;
+					bind.buffer = &column.real;
+					break;
+				case MYSQL_TYPE_DATE:
+				case MYSQL_TYPE_DATETIME:
+				case MYSQL_TYPE_TIMESTAMP:
+					column.kind = column_datetime;
+					bind.buffer_type = MYSQL_TYPE_DATETIME;
+					bind.buffer = &column.time;
+					break;
+				default:
+					column.kind = column_bytes;
+					column.bytes.resize(field.max_length + 1);
+					bind.buffer_type = MYSQL_TYPE_STRING;
+					bind.buffer = column.bytes.data();
+					bind.buffer_length = field.max_length + 1;
+					break;
+				}
+				bind.length = &column.length;
+				bind.is_null = &column.is_null;
+				bind.error = &column.error;
+
+				const char *const name = field.name;
+				POSEIDON_THROW_UNLESS(m_fields.emplace(name, i).second, Basic_exception, Rcnts::view("Duplicate field"));
+				POSEIDON_LOG_TRACE("MySQL binary result field: name = ", name, ", index = ", i, ", type = ", static_cast<int>(field.type));
+			}
+			if(::mysql_stmt_bind_result(stmt, m_result_binds.data()) != 0){
+				throw_statement_error(sql, len, stmt);
+			}
+			m_stmt = stmt;
+		}
+
+		bool find_column_and_check(const Binary_column *&column, const char *name) const {
+			POSEIDON_PROFILE_ME;
+
+			if(!m_has_binary_row){
+				POSEIDON_LOG_WARNING("No more results available.");
+				return false;
+			}
+			const AUTO(it, m_fields.find(name));
+			if(it == m_fields.end()){
+				POSEIDON_LOG_WARNING("Field not found: name = ", name);
+				return false;
+			}
+			column = &(m_columns.at(it->second));
+			if(column->is_null){
+				POSEIDON_LOG_DEBUG("Field is `null`: name = ", name);
+				return false;
+			}
+			return true;
+		}
 		bool find_field_and_check(const char *&data, std::size_t &size, const char *name) const {
 			POSEIDON_PROFILE_ME;
 
+			if(m_stmt){
+				// 以文本形式读取二进制结果。
+				const Binary_column *column;
+				if(!find_column_and_check(column, name)){
+					return false;
+				}
+				POSEIDON_THROW_UNLESS(column->kind == column_bytes, Basic_exception, Rcnts::view("Field is not a string"));
+				data = column->bytes.data();
+				size = column->length;
+				return true;
+			}
 			if(!m_row){
 				POSEIDON_LOG_WARNING("No more results available.");
 				return false;
@@ -113,6 +338,31 @@ namespace {
 				POSEIDON_LOG_DEBUG("No result was returned from MySQL server.");
 			}
 		}
+		void execute_prepared_explicit(const char *sql, std::size_t len, const Statement_parameters &params) OVERRIDE {
+			POSEIDON_PROFILE_ME;
+
+			discard_result();
+
+			POSEIDON_LOG_DEBUG("Executing prepared statement: ", std::string(sql, len), ", params = ", params.size());
+			const AUTO(stmt, require_statement(sql, len));
+			POSEIDON_THROW_UNLESS(::mysql_stmt_param_count(stmt) == params.size(), Basic_exception, Rcnts::view("Number of statement parameters mismatch"));
+			if(!params.empty()){
+				m_param_binds.resize(params.size());
+				m_param_times.resize(params.size());
+				params.internal_bind(m_param_binds.data(), m_param_times.data());
+				if(::mysql_stmt_bind_param(stmt, m_param_binds.data()) != 0){
+					throw_statement_error(sql, len, stmt);
+				}
+			}
+			if(::mysql_stmt_execute(stmt) != 0){
+				throw_statement_error(sql, len, stmt);
+			}
+			if(::mysql_stmt_field_count(stmt) != 0){
+				bind_binary_results(sql, len, stmt);
+			} else {
+				POSEIDON_LOG_DEBUG("No result was returned from MySQL server.");
+			}
+		}
 		void discard_result() NOEXCEPT OVERRIDE {
 			POSEIDON_PROFILE_ME;
 
@@ -120,6 +370,15 @@ namespace {
 			m_fields.clear();
 			m_row = NULLPTR;
 			m_lengths = NULLPTR;
+
+			if(m_stmt){
+				::mysql_stmt_free_result(m_stmt);
+				m_stmt = NULLPTR;
+			}
+			m_stmt_metadata.reset();
+			m_columns.clear();
+			m_result_binds.clear();
+			m_has_binary_row = false;
 		}
 
 		boost::uint64_t get_insert_id() const OVERRIDE {
@@ -129,6 +388,23 @@ namespace {
 		bool fetch_row() OVERRIDE {
 			POSEIDON_PROFILE_ME;
 
+			if(m_stmt){
+				m_has_binary_row = false;
+				const int err = ::mysql_stmt_fetch(m_stmt);
+				if(err == MYSQL_NO_DATA){
+					POSEIDON_LOG_DEBUG("No more data.");
+					return false;
+				}
+				POSEIDON_THROW_UNLESS(err != 1, Exception, m_schema, ::mysql_stmt_errno(m_stmt), Rcnts(::mysql_stmt_error(m_stmt)));
+				POSEIDON_THROW_UNLESS(err != MYSQL_DATA_TRUNCATED, Basic_exception, Rcnts::view("MySQL binary result truncated"));
+				for(AUTO(it, m_columns.begin()); it != m_columns.end(); ++it){
+					if((it->kind == column_bytes) && !it->is_null){
+						it->bytes.at(it->length) = 0;
+					}
+				}
+				m_has_binary_row = true;
+				return true;
+			}
 			if(m_fields.empty()){
 				POSEIDON_LOG_DEBUG("Empty set returned from MySQL server.");
 				return false;
@@ -149,10 +425,29 @@ namespace {
 			POSEIDON_LOG_TRACE("Getting field as `boolean`: ", name);
 
 			bool value = false;
+			if(m_stmt){
+				const Binary_column *column;
+				if(find_column_and_check(column, name)){
+					switch(column->kind){
+					case column_integer:
+						value = column->integer != 0;
+						break;
+					case column_double:
+						value = column->real != 0;
+						break;
+					case column_bytes:
+						value = parse_boolean(column->bytes.data(), column->length);
+						break;
+					default:
+						POSEIDON_THROW(Basic_exception, Rcnts::view("Could not convert field data to `bool`"));
+					}
+				}
+				return value;
+			}
 			const char *data;
 			std::size_t size;
 			if(find_field_and_check(data, size, name)){
-				value = (size != 0) && (std::strcmp(data, "0") != 0);
+				value = parse_boolean(data, size);
 			}
 			return value;
 		}
@@ -161,12 +456,29 @@ namespace {
 			POSEIDON_LOG_TRACE("Getting field as `signed`: ", name);
 
 			boost::int64_t value = 0;
+			if(m_stmt){
+				const Binary_column *column;
+				if(find_column_and_check(column, name)){
+					switch(column->kind){
+					case column_integer:
+						value = column->integer;
+						break;
+					case column_double:
+						value = static_cast<boost::int64_t>(column->real);
+						break;
+					case column_bytes:
+						value = parse_signed(column->bytes.data());
+						break;
+					default:
+						POSEIDON_THROW(Basic_exception, Rcnts::view("Could not convert field data to `long long`"));
+					}
+				}
+				return value;
+			}
 			const char *data;
 			std::size_t size;
 			if(find_field_and_check(data, size, name)){
-				char *eptr;
-				value = ::strtoll(data, &eptr, 0);
-				POSEIDON_THROW_UNLESS(*eptr == 0, Basic_exception, Rcnts::view("Could not convert field data to `long long`"));
+				value = parse_signed(data);
 			}
 			return value;
 		}
@@ -175,12 +487,29 @@ namespace {
 			POSEIDON_LOG_TRACE("Getting field as `unsigned`: ", name);
 
 			boost::uint64_t value = 0;
+			if(m_stmt){
+				const Binary_column *column;
+				if(find_column_and_check(column, name)){
+					switch(column->kind){
+					case column_integer:
+						value = static_cast<boost::uint64_t>(column->integer);
+						break;
+					case column_double:
+						value = static_cast<boost::uint64_t>(column->real);
+						break;
+					case column_bytes:
+						value = parse_unsigned(column->bytes.data());
+						break;
+					default:
+						POSEIDON_THROW(Basic_exception, Rcnts::view("Could not convert field data to `unsigned long long`"));
+					}
+				}
+				return value;
+			}
 			const char *data;
 			std::size_t size;
 			if(find_field_and_check(data, size, name)){
-				char *eptr;
-				value = ::strtoull(data, &eptr, 0);
-				POSEIDON_THROW_UNLESS(*eptr == 0, Basic_exception, Rcnts::view("Could not convert field data to `unsigned long long`"));
+				value = parse_unsigned(data);
 			}
 			return value;
 		}
@@ -189,12 +518,33 @@ namespace {
 			POSEIDON_LOG_TRACE("Getting field as `double`: ", name);
 
 			double value = 0;
+			if(m_stmt){
+				const Binary_column *column;
+				if(find_column_and_check(column, name)){
+					switch(column->kind){
+					case column_integer:
+						if(column->is_unsigned){
+							value = static_cast<double>(static_cast<boost::uint64_t>(column->integer));
+						} else {
+							value = static_cast<double>(column->integer);
+						}
+						break;
+					case column_double:
+						value = column->real;
+						break;
+					case column_bytes:
+						value = parse_double(column->bytes.data());
+						break;
+					default:
+						POSEIDON_THROW(Basic_exception, Rcnts::view("Could not convert field data to `double`"));
+					}
+				}
+				return value;
+			}
 			const char *data;
 			std::size_t size;
 			if(find_field_and_check(data, size, name)){
-				char *eptr;
-				value = ::strtod(data, &eptr);
-				POSEIDON_THROW_UNLESS(*eptr == 0, Basic_exception, Rcnts::view("Could not convert field data to `double`"));
+				value = parse_double(data);
 			}
 			return value;
 		}
@@ -203,6 +553,35 @@ namespace {
 			POSEIDON_LOG_TRACE("Getting field as `string`: ", name);
 
 			std::string value;
+			if(m_stmt){
+				const Binary_column *column;
+				if(find_column_and_check(column, name)){
+					char str[64];
+					std::size_t len;
+					switch(column->kind){
+					case column_integer:
+						if(column->is_unsigned){
+							len = (unsigned)std::sprintf(str, "%llu", static_cast<unsigned long long>(column->integer));
+						} else {
+							len = (unsigned)std::sprintf(str, "%lld", column->integer);
+						}
+						value.assign(str, len);
+						break;
+					case column_double:
+						len = (unsigned)std::sprintf(str, "%.17g", column->real);
+						value.assign(str, len);
+						break;
+					case column_datetime:
+						len = (unsigned)std::sprintf(str, "%04u-%02u-%02u %02u:%02u:%02u", column->time.year, column->time.month, column->time.day, column->time.hour, column->time.minute, column->time.second);
+						value.assign(str, len);
+						break;
+					default:
+						value.assign(column->bytes.data(), column->length);
+						break;
+					}
+				}
+				return value;
+			}
 			const char *data;
 			std::size_t size;
 			if(find_field_and_check(data, size, name)){
@@ -215,6 +594,24 @@ namespace {
 			POSEIDON_LOG_TRACE("Getting field as `datetime`: ", name);
 
 			boost::uint64_t value = 0;
+			if(m_stmt){
+				const Binary_column *column;
+				if(find_column_and_check(column, name)){
+					switch(column->kind){
+					case column_datetime: {
+						const AUTO_REF(time, column->time);
+						Date_time dt = { time.year, time.month, time.day, time.hour, time.minute, time.second, static_cast<unsigned>(time.second_part / 1000) };
+						value = assemble_time(dt);
+						break; }
+					case column_bytes:
+						value = scan_time(column->bytes.data());
+						break;
+					default:
+						POSEIDON_THROW(Basic_exception, Rcnts::view("Could not convert field data to `datetime`"));
+					}
+				}
+				return value;
+			}
 			const char *data;
 			std::size_t size;
 			if(find_field_and_check(data, size, name)){
@@ -230,8 +627,7 @@ namespace {
 			const char *data;
 			std::size_t size;
 			if(find_field_and_check(data, size, name)){
-				POSEIDON_THROW_UNLESS(size == 36, Basic_exception, Rcnts::view("Invalid UUID string length"));
-				value.from_string(*reinterpret_cast<const char (*)[36]>(data));
+				value = parse_uuid(data, size);
 			}
 			return value;
 		}
@@ -250,8 +646,8 @@ namespace {
 	};
 }
 
-boost::shared_ptr<Connection> Connection::create(const char *server_addr, boost::uint16_t server_port, const char *user_name, const char *password, const char *schema, bool use_ssl, const char *charset){
-	return boost::make_shared<Delegated_connection>(server_addr, server_port, user_name, password, schema, use_ssl, charset);
+boost::shared_ptr<Connection> Connection::create(const char *server_addr, boost::uint16_t server_port, const char *user_name, const char *password, const char *schema, bool use_ssl, const char *charset, std::size_t statement_cache_size){
+	return boost::make_shared<Delegated_connection>(server_addr, server_port, user_name, password, schema, use_ssl, charset, statement_cache_size);
 }
 
 Connection::~Connection(){
@@ -8,6 +8,7 @@
 #include "../cxx_util.hpp"
 #include "../uuid.hpp"
 #include "../fwd.hpp"
+#include "statement_parameters.hpp"
 #include <string>
 #include <cstring>
 #include <boost/cstdint.hpp>
@@ -18,13 +19,16 @@ namespace Mysql {
 
 class Connection : NONCOPYABLE {
 public:
-	static boost::shared_ptr<Connection> create(const char *server_addr, boost::uint16_t server_port, const char *user_name, const char *password, const char *schema, bool use_ssl, const char *charset);
+	// statement_cache_size 是每个连接缓存的预处理语句的最大数量。
+	static boost::shared_ptr<Connection> create(const char *server_addr, boost::uint16_t server_port, const char *user_name, const char *password, const char *schema, bool use_ssl, const char *charset, std::size_t statement_cache_size = 64);
 
 public:
 	virtual ~Connection();
 
 public:
 	virtual void execute_sql_explicit(const char *sql, std::size_t len) = 0;
+	// 以 SQL 文本为键缓存预处理语句，参数使用 `?` 占位。结果使用二进制协议传输，同样使用 fetch_row() 和 get_*() 读取。
+	virtual void execute_prepared_explicit(const char *sql, std::size_t len, const Statement_parameters &params) = 0;
 	virtual void discard_result() NOEXCEPT = 0;
 
 	virtual boost::uint64_t get_insert_id() const = 0;
@@ -48,6 +52,16 @@ public:
 	void execute_sql(const std::string &sql){
 		execute_sql_explicit(sql.data(), sql.size());
 	}
+
+	void execute_prepared(const char *sql, std::size_t len, const Statement_parameters &params){
+		execute_prepared_explicit(sql, len, params);
+	}
+	void execute_prepared(const char *sql, const Statement_parameters &params){
+		execute_prepared_explicit(sql, std::strlen(sql), params);
+	}
+	void execute_prepared(const std::string &sql, const Statement_parameters &params){
+		execute_prepared_explicit(sql.data(), sql.size(), params);
+	}
 };
 
 }
@@ -13,6 +13,7 @@ class String_escaper;
 class Date_time_formatter;
 class Uuid_formatter;
 
+class Statement_parameters;
 class Connection;
 class Object_base;
 
@@ -38,7 +38,7 @@ try {
 	if(!is_auto_saving_enabled()){
 		return false;
 	}
-	Mysql_daemon::enqueue_for_saving(virtual_shared_from_this<Object_base>(), true, false);
+	Mysql_daemon::enqueue_for_saving(virtual_shared_from_this<Object_base>(), true, false, true);
 	return true;
 } catch(std::exception &e){
 	POSEIDON_LOG_ERROR("std::exception thrown: what = ", e.what());
@@ -55,6 +55,79 @@ void Object_base::set_combined_write_stamp(void *stamp) const NOEXCEPT {
 	atomic_store(m_combined_write_stamp, stamp, memory_order_release);
 }
 
+bool Object_base::is_persistent() const NOEXCEPT {
+	return atomic_load(m_persistent, memory_order_consume);
+}
+boost::uint64_t Object_base::get_persistent_generation() const NOEXCEPT {
+	return atomic_load(m_persistent_generation, memory_order_consume);
+}
+void Object_base::set_persistent(bool persistent, boost::uint64_t generation) const NOEXCEPT {
+	atomic_store(m_persistent_generation, generation, memory_order_relaxed);
+	atomic_store(m_persistent, persistent, memory_order_release);
+}
+
+std::size_t Object_base::count_fields_in_set(const Field_set &fields) NOEXCEPT {
+	std::size_t count = 0;
+	for(std::size_t i = 0; i < fields.size(); ++i){
+		AUTO(word, fields[i]);
+		while(word != 0){
+			word &= word - 1;
+			++count;
+		}
+	}
+	return count;
+}
+
+std::size_t Object_base::add_field(){
+	const std::size_t index = m_field_count++;
+	if(index / 64 >= m_dirty_fields.size()){
+		m_dirty_fields.push_back(0);
+	}
+	return index;
+}
+void Object_base::mark_field_dirty(std::size_t index) const NOEXCEPT {
+	AUTO_REF(word, m_dirty_fields[index / 64]);
+	atomic_store(word, atomic_load(word, memory_order_relaxed) | (boost::uint64_t)1 << (index % 64), memory_order_release);
+}
+
+std::size_t Object_base::get_dirty_field_count() const NOEXCEPT {
+	std::size_t count = 0;
+	for(std::size_t i = 0; i < m_dirty_fields.size(); ++i){
+		AUTO(word, atomic_load(m_dirty_fields[i], memory_order_consume));
+		while(word != 0){
+			word &= word - 1;
+			++count;
+		}
+	}
+	return count;
+}
+void Object_base::take_dirty_fields(Field_set &fields) const {
+	const Recursive_mutex::Unique_lock lock(m_mutex);
+	fields.resize(m_dirty_fields.size());
+	for(std::size_t i = 0; i < m_dirty_fields.size(); ++i){
+		fields[i] = atomic_exchange(m_dirty_fields[i], (boost::uint64_t)0, memory_order_acq_rel);
+	}
+}
+void Object_base::restore_dirty_fields(const Field_set &fields) const {
+	const Recursive_mutex::Unique_lock lock(m_mutex);
+	for(std::size_t i = 0; i < std::min(m_dirty_fields.size(), fields.size()); ++i){
+		AUTO_REF(word, m_dirty_fields[i]);
+		atomic_store(word, atomic_load(word, memory_order_relaxed) | fields[i], memory_order_release);
+	}
+}
+void Object_base::clear_dirty_fields() const {
+	const Recursive_mutex::Unique_lock lock(m_mutex);
+	for(std::size_t i = 0; i < m_dirty_fields.size(); ++i){
+		atomic_store(m_dirty_fields[i], (boost::uint64_t)0, memory_order_release);
+	}
+}
+void Object_base::mark_all_fields_dirty() const {
+	const Recursive_mutex::Unique_lock lock(m_mutex);
+	for(std::size_t i = 0; i < m_field_count; ++i){
+		mark_field_dirty(i);
+	}
+}
+
 // Non-member functions.
 void enqueue_for_saving(const boost::shared_ptr<Object_base> &obj){
 	Mysql_daemon::enqueue_for_saving(obj, true, true);
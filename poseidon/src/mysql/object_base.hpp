@@ -17,6 +17,7 @@
 #include <boost/function.hpp>
 #include <boost/cstdint.hpp>
 #include <boost/type_traits/is_base_of.hpp>
+#include <boost/container/vector.hpp>
 #include <boost/utility/enable_if.hpp>
 #include "../rcnts.hpp"
 #include "../profiler.hpp"
@@ -33,23 +34,44 @@ public:
 	template<typename ValueT>
 	class Field;
 
+	// 每个字段占一位，按照字段声明的顺序排列。
+	typedef boost::container::vector<boost::uint64_t> Field_set;
+
 private:
 	mutable volatile bool m_auto_saves;
 	mutable void *volatile m_combined_write_stamp;
+	mutable volatile bool m_persistent;
+	mutable volatile boost::uint64_t m_persistent_generation;
+
+	std::size_t m_field_count;
+	// 只在持有 m_mutex 时修改，但是可以不加锁读取。
+	mutable Field_set m_dirty_fields;
 
 protected:
 	mutable Recursive_mutex m_mutex;
 
 public:
 	Object_base()
-		: m_auto_saves(false), m_combined_write_stamp(NULLPTR)
+		: m_auto_saves(false), m_combined_write_stamp(NULLPTR), m_persistent(false), m_persistent_generation(0)
+		, m_field_count(0), m_dirty_fields()
 	{
 		//
 	}
 	// 不要不写析构函数，否则 RTTI 将无法在动态库中使用。
 	~Object_base();
 
+private:
+	std::size_t add_field();
+	// 调用时 m_mutex 必须已被锁定。
+	void mark_field_dirty(std::size_t index) const NOEXCEPT;
+
 public:
+	static bool is_field_in_set(const Field_set &fields, std::size_t index) NOEXCEPT {
+		const std::size_t word = index / 64;
+		return (word < fields.size()) && ((fields[word] >> (index % 64)) & 1);
+	}
+	static std::size_t count_fields_in_set(const Field_set &fields) NOEXCEPT;
+
 	bool is_auto_saving_enabled() const NOEXCEPT;
 	void enable_auto_saving() const NOEXCEPT;
 	void disable_auto_saving() const NOEXCEPT;
@@ -59,8 +81,36 @@ public:
 	void * get_combined_write_stamp() const NOEXCEPT;
 	void set_combined_write_stamp(void *stamp) const NOEXCEPT;
 
+	// 数据库中已经有这一行（对象是通过 Mysql_daemon 读取出来的，或者已经成功写入过）。
+	// 通过其他途径调用 fetch() 读取的对象没有这个标记，下一次保存会写入整行。
+	// 如果这一行在别处被删除了，需要清除这个标记，否则只写入修改过的字段的 UPDATE 语句不会有任何效果。
+	// generation 由 Mysql_daemon 填写，是设置标记时这个表的删除操作的代数。通过 Mysql_daemon 删除之后代数改变，之前的标记即失效。
+	bool is_persistent() const NOEXCEPT;
+	boost::uint64_t get_persistent_generation() const NOEXCEPT;
+	void set_persistent(bool persistent, boost::uint64_t generation = 0) const NOEXCEPT;
+
+	std::size_t get_field_count() const NOEXCEPT {
+		return m_field_count;
+	}
+	// 不加锁，结果可能已经过时。
+	std::size_t get_dirty_field_count() const NOEXCEPT;
+	// 取走所有修改标记。如果写入失败，需要调用 restore_dirty_fields() 放回去。
+	void take_dirty_fields(Field_set &fields) const;
+	void restore_dirty_fields(const Field_set &fields) const;
+	void clear_dirty_fields() const;
+	// 显式保存时调用，这样之后执行的写入操作一定会写入整行。
+	void mark_all_fields_dirty() const;
+
 	virtual const char * get_table() const = 0;
 	virtual void generate_sql(std::ostream &os) const = 0;
+	// 用于合并多行写入：列名列表，以及按照相同顺序排列的值列表（末尾可能有多余的逗号和空格）。
+	virtual const char * get_column_list() const = 0;
+	virtual void generate_value_list(std::ostream &os) const = 0;
+	// 用于预处理语句：按照 get_column_list() 的顺序添加所有字段的值。
+	virtual void generate_parameters(Statement_parameters &params) const = 0;
+	virtual bool has_primary_key() const = 0;
+	// 生成只写入 fields 中的字段的 UPDATE 语句。如果没有定义主键，或者主键被修改过，返回 false。
+	virtual bool generate_update(std::string &sql, Statement_parameters &params, const Field_set &fields) const = 0;
 	virtual void fetch(const boost::shared_ptr<const Connection> &conn) = 0;
 };
 
@@ -68,16 +118,22 @@ template<typename ValueT>
 class Object_base::Field : NONCOPYABLE {
 private:
 	Object_base *const m_parent;
+	const std::size_t m_index;
 	ValueT m_value;
 
 public:
+	// 字段按照声明的顺序构造，因此下标与 OBJECT_FIELDS 中的顺序相同。
 	explicit Field(Object_base *parent, ValueT value = ValueT())
-		: m_parent(parent), m_value(STD_MOVE_IDN(value))
+		: m_parent(parent), m_index(parent->add_field()), m_value(STD_MOVE_IDN(value))
 	{
 		//
 	}
 
 public:
+	std::size_t get_index() const {
+		return m_index;
+	}
+
 	const ValueT & unlocked_get() const {
 		return m_value;
 	}
@@ -88,6 +144,7 @@ public:
 	void set(ValueT value, bool invalidates_parent = true){
 		const Recursive_mutex::Unique_lock lock(m_parent->m_mutex);
 		m_value = STD_MOVE_IDN(value);
+		m_parent->mark_field_dirty(m_index);
 
 		if(invalidates_parent){
 			m_parent->invalidate();
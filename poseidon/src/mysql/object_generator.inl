@@ -13,6 +13,10 @@
 #  error OBJECT_FIELDS is undefined.
 #endif
 
+// OBJECT_PRIMARY_KEY 是可选的，写法与 OBJECT_FIELDS 相同，列出组成主键的字段，例如：
+//   #define OBJECT_PRIMARY_KEY    FIELD_UUID(account_uuid) FIELD_UNSIGNED(slot)
+// 如果定义了主键，已经存在于数据库中的对象在自动保存时只写入修改过的字段。
+
 #ifndef POSEIDON_MYSQL_OBJECT_BASE_HPP_
 #  error Please #include <poseidon/mysql/object_base.hpp> first.
 #endif
@@ -89,6 +93,11 @@ public:
 public:
 	const char *get_table() const OVERRIDE;
 	void generate_sql(::std::ostream &os_) const OVERRIDE;
+	const char *get_column_list() const OVERRIDE;
+	void generate_value_list(::std::ostream &os_) const OVERRIDE;
+	void generate_parameters(::Poseidon::Mysql::Statement_parameters &params_) const OVERRIDE;
+	bool has_primary_key() const OVERRIDE;
+	bool generate_update(::std::string &sql_, ::Poseidon::Mysql::Statement_parameters &params_, const Field_set &fields_) const OVERRIDE;
 	void fetch(const ::boost::shared_ptr<const ::Poseidon::Mysql::Connection> &conn_) OVERRIDE;
 };
 
@@ -216,6 +225,191 @@ void OBJECT_NAME::generate_sql(::std::ostream &os_) const {
 
 	OBJECT_FIELDS
 }
+const char *OBJECT_NAME::get_column_list() const {
+#undef FIELD_BOOLEAN
+#undef FIELD_SIGNED
+#undef FIELD_UNSIGNED
+#undef FIELD_DOUBLE
+#undef FIELD_STRING
+#undef FIELD_DATETIME
+#undef FIELD_UUID
+#undef FIELD_BLOB
+
+#define FIELD_BOOLEAN(id_)                ", `" POSEIDON_STRINGIFY(id_) "`"
+#define FIELD_SIGNED(id_)                 ", `" POSEIDON_STRINGIFY(id_) "`"
+#define FIELD_UNSIGNED(id_)               ", `" POSEIDON_STRINGIFY(id_) "`"
+#define FIELD_DOUBLE(id_)                 ", `" POSEIDON_STRINGIFY(id_) "`"
+#define FIELD_STRING(id_)                 ", `" POSEIDON_STRINGIFY(id_) "`"
+#define FIELD_DATETIME(id_)               ", `" POSEIDON_STRINGIFY(id_) "`"
+#define FIELD_UUID(id_)                   ", `" POSEIDON_STRINGIFY(id_) "`"
+#define FIELD_BLOB(id_)                   ", `" POSEIDON_STRINGIFY(id_) "`"
+
+	// 去掉开头的逗号和空格。
+	static const char s_list_[] = "" OBJECT_FIELDS;
+	return (sizeof(s_list_) > 2) ? (s_list_ + 2) : s_list_;
+}
+void OBJECT_NAME::generate_value_list(::std::ostream &os_) const {
+	POSEIDON_PROFILE_ME;
+
+	const ::Poseidon::Recursive_mutex::Unique_lock lock_(m_mutex);
+
+#undef FIELD_BOOLEAN
+#undef FIELD_SIGNED
+#undef FIELD_UNSIGNED
+#undef FIELD_DOUBLE
+#undef FIELD_STRING
+#undef FIELD_DATETIME
+#undef FIELD_UUID
+#undef FIELD_BLOB
+
+#define FIELD_BOOLEAN(id_)                os_ <<id_.get() <<", ";
+#define FIELD_SIGNED(id_)                 os_ <<id_.get() <<", ";
+#define FIELD_UNSIGNED(id_)               os_ <<id_.get() <<", ";
+#define FIELD_DOUBLE(id_)                 os_ <<id_.get() <<", ";
+#define FIELD_STRING(id_)                 os_ << ::Poseidon::Mysql::String_escaper(id_.get()) <<", ";
+#define FIELD_DATETIME(id_)               os_ << ::Poseidon::Mysql::Date_time_formatter(id_.get()) <<", ";
+#define FIELD_UUID(id_)                   os_ << ::Poseidon::Mysql::Uuid_formatter(id_.get()) <<", ";
+#define FIELD_BLOB(id_)                   os_ << ::Poseidon::Mysql::String_escaper(id_.get()) <<", ";
+
+	OBJECT_FIELDS
+}
+void OBJECT_NAME::generate_parameters(::Poseidon::Mysql::Statement_parameters &params_) const {
+	POSEIDON_PROFILE_ME;
+
+	const ::Poseidon::Recursive_mutex::Unique_lock lock_(m_mutex);
+
+#undef FIELD_BOOLEAN
+#undef FIELD_SIGNED
+#undef FIELD_UNSIGNED
+#undef FIELD_DOUBLE
+#undef FIELD_STRING
+#undef FIELD_DATETIME
+#undef FIELD_UUID
+#undef FIELD_BLOB
+
+#define FIELD_BOOLEAN(id_)                params_.append_boolean  (id_.unlocked_get());
+#define FIELD_SIGNED(id_)                 params_.append_signed   (id_.unlocked_get());
+#define FIELD_UNSIGNED(id_)               params_.append_unsigned (id_.unlocked_get());
+#define FIELD_DOUBLE(id_)                 params_.append_double   (id_.unlocked_get());
+#define FIELD_STRING(id_)                 params_.append_string   (id_.unlocked_get());
+#define FIELD_DATETIME(id_)               params_.append_datetime (id_.unlocked_get());
+#define FIELD_UUID(id_)                   params_.append_uuid     (id_.unlocked_get());
+#define FIELD_BLOB(id_)                   params_.append_blob     (id_.unlocked_get().data(), id_.unlocked_get().size());
+
+	OBJECT_FIELDS
+}
+bool OBJECT_NAME::has_primary_key() const {
+#ifdef OBJECT_PRIMARY_KEY
+	return true;
+#else
+	return false;
+#endif
+}
+bool OBJECT_NAME::generate_update(::std::string &sql_, ::Poseidon::Mysql::Statement_parameters &params_, const Field_set &fields_) const {
+	POSEIDON_PROFILE_ME;
+
+#ifdef OBJECT_PRIMARY_KEY
+	const ::Poseidon::Recursive_mutex::Unique_lock lock_(m_mutex);
+
+#undef FIELD_BOOLEAN
+#undef FIELD_SIGNED
+#undef FIELD_UNSIGNED
+#undef FIELD_DOUBLE
+#undef FIELD_STRING
+#undef FIELD_DATETIME
+#undef FIELD_UUID
+#undef FIELD_BLOB
+
+#define FIELD_BOOLEAN(id_)                if(is_field_in_set(fields_, id_.get_index())){ return false; }
+#define FIELD_SIGNED(id_)                 if(is_field_in_set(fields_, id_.get_index())){ return false; }
+#define FIELD_UNSIGNED(id_)               if(is_field_in_set(fields_, id_.get_index())){ return false; }
+#define FIELD_DOUBLE(id_)                 if(is_field_in_set(fields_, id_.get_index())){ return false; }
+#define FIELD_STRING(id_)                 if(is_field_in_set(fields_, id_.get_index())){ return false; }
+#define FIELD_DATETIME(id_)               if(is_field_in_set(fields_, id_.get_index())){ return false; }
+#define FIELD_UUID(id_)                   if(is_field_in_set(fields_, id_.get_index())){ return false; }
+#define FIELD_BLOB(id_)                   if(is_field_in_set(fields_, id_.get_index())){ return false; }
+
+	// 主键被修改过的话，只能写入整行。
+	OBJECT_PRIMARY_KEY
+
+#undef FIELD_BOOLEAN
+#undef FIELD_SIGNED
+#undef FIELD_UNSIGNED
+#undef FIELD_DOUBLE
+#undef FIELD_STRING
+#undef FIELD_DATETIME
+#undef FIELD_UUID
+#undef FIELD_BLOB
+
+#define FIELD_BOOLEAN(id_)                if(is_field_in_set(fields_, id_.get_index())){ sql_ += "`" POSEIDON_STRINGIFY(id_) "` = ?, "; params_.append_boolean  (id_.unlocked_get()); }
+#define FIELD_SIGNED(id_)                 if(is_field_in_set(fields_, id_.get_index())){ sql_ += "`" POSEIDON_STRINGIFY(id_) "` = ?, "; params_.append_signed   (id_.unlocked_get()); }
+#define FIELD_UNSIGNED(id_)               if(is_field_in_set(fields_, id_.get_index())){ sql_ += "`" POSEIDON_STRINGIFY(id_) "` = ?, "; params_.append_unsigned (id_.unlocked_get()); }
+#define FIELD_DOUBLE(id_)                 if(is_field_in_set(fields_, id_.get_index())){ sql_ += "`" POSEIDON_STRINGIFY(id_) "` = ?, "; params_.append_double   (id_.unlocked_get()); }
+#define FIELD_STRING(id_)                 if(is_field_in_set(fields_, id_.get_index())){ sql_ += "`" POSEIDON_STRINGIFY(id_) "` = ?, "; params_.append_string   (id_.unlocked_get()); }
+#define FIELD_DATETIME(id_)               if(is_field_in_set(fields_, id_.get_index())){ sql_ += "`" POSEIDON_STRINGIFY(id_) "` = ?, "; params_.append_datetime (id_.unlocked_get()); }
+#define FIELD_UUID(id_)                   if(is_field_in_set(fields_, id_.get_index())){ sql_ += "`" POSEIDON_STRINGIFY(id_) "` = ?, "; params_.append_uuid     (id_.unlocked_get()); }
+#define FIELD_BLOB(id_)                   if(is_field_in_set(fields_, id_.get_index())){ sql_ += "`" POSEIDON_STRINGIFY(id_) "` = ?, "; params_.append_blob     (id_.unlocked_get().data(), id_.unlocked_get().size()); }
+
+	sql_ = "UPDATE `";
+	sql_ += OBJECT_TABLE;
+	sql_ += "` SET ";
+	const ::std::size_t set_begin_ = sql_.size();
+	OBJECT_FIELDS
+	if(sql_.size() == set_begin_){
+		return false;
+	}
+	sql_.erase(sql_.size() - 2);
+
+#undef FIELD_BOOLEAN
+#undef FIELD_SIGNED
+#undef FIELD_UNSIGNED
+#undef FIELD_DOUBLE
+#undef FIELD_STRING
+#undef FIELD_DATETIME
+#undef FIELD_UUID
+#undef FIELD_BLOB
+
+#define FIELD_BOOLEAN(id_)                " AND `" POSEIDON_STRINGIFY(id_) "` = ?"
+#define FIELD_SIGNED(id_)                 " AND `" POSEIDON_STRINGIFY(id_) "` = ?"
+#define FIELD_UNSIGNED(id_)               " AND `" POSEIDON_STRINGIFY(id_) "` = ?"
+#define FIELD_DOUBLE(id_)                 " AND `" POSEIDON_STRINGIFY(id_) "` = ?"
+#define FIELD_STRING(id_)                 " AND `" POSEIDON_STRINGIFY(id_) "` = ?"
+#define FIELD_DATETIME(id_)               " AND `" POSEIDON_STRINGIFY(id_) "` = ?"
+#define FIELD_UUID(id_)                   " AND `" POSEIDON_STRINGIFY(id_) "` = ?"
+#define FIELD_BLOB(id_)                   " AND `" POSEIDON_STRINGIFY(id_) "` = ?"
+
+	// 去掉开头的 ` AND `。
+	static const char s_where_[] = "" OBJECT_PRIMARY_KEY;
+	sql_ += " WHERE ";
+	sql_ += s_where_ + 5;
+
+#undef FIELD_BOOLEAN
+#undef FIELD_SIGNED
+#undef FIELD_UNSIGNED
+#undef FIELD_DOUBLE
+#undef FIELD_STRING
+#undef FIELD_DATETIME
+#undef FIELD_UUID
+#undef FIELD_BLOB
+
+#define FIELD_BOOLEAN(id_)                params_.append_boolean  (id_.unlocked_get());
+#define FIELD_SIGNED(id_)                 params_.append_signed   (id_.unlocked_get());
+#define FIELD_UNSIGNED(id_)               params_.append_unsigned (id_.unlocked_get());
+#define FIELD_DOUBLE(id_)                 params_.append_double   (id_.unlocked_get());
+#define FIELD_STRING(id_)                 params_.append_string   (id_.unlocked_get());
+#define FIELD_DATETIME(id_)               params_.append_datetime (id_.unlocked_get());
+#define FIELD_UUID(id_)                   params_.append_uuid     (id_.unlocked_get());
+#define FIELD_BLOB(id_)                   params_.append_blob     (id_.unlocked_get().data(), id_.unlocked_get().size());
+
+	OBJECT_PRIMARY_KEY
+	return true;
+#else
+	(void)sql_;
+	(void)params_;
+	(void)fields_;
+	return false;
+#endif
+}
 void OBJECT_NAME::fetch(const ::boost::shared_ptr<const ::Poseidon::Mysql::Connection> &conn_){
 	POSEIDON_PROFILE_ME;
 
@@ -240,6 +434,10 @@ void OBJECT_NAME::fetch(const ::boost::shared_ptr<const ::Poseidon::Mysql::Conne
 #define FIELD_BLOB(id_)                   id_.set(conn_->get_blob     ( POSEIDON_STRINGIFY(id_) ), false);
 
 	OBJECT_FIELDS
+
+	// 读取出来的值与数据库中相同。
+	// 持久标记由 Mysql_daemon 设置，因为只有它知道读取时这个表的删除代数。
+	clear_dirty_fields();
 }
 
 #pragma GCC diagnostic pop
@@ -247,3 +445,4 @@ void OBJECT_NAME::fetch(const ::boost::shared_ptr<const ::Poseidon::Mysql::Conne
 
 #undef OBJECT_NAME
 #undef OBJECT_FIELDS
+#undef OBJECT_PRIMARY_KEY
@@ -0,0 +1,188 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#include "../precompiled.hpp"
+#include "statement_parameters.hpp"
+#include "../exception.hpp"
+#include "../time.hpp"
+#include "../profiler.hpp"
+#include "../stream_buffer.hpp"
+#include <mysql/mysql.h>
+
+namespace Poseidon {
+namespace Mysql {
+
+void Statement_parameters::internal_bind(void *binds, void *times) const {
+	POSEIDON_PROFILE_ME;
+
+	const AUTO(bind_base, static_cast< ::MYSQL_BIND *>(binds));
+	const AUTO(time_base, static_cast< ::MYSQL_TIME *>(times));
+
+	for(std::size_t i = 0; i < m_elements.size(); ++i){
+		const AUTO_REF(elem, m_elements.at(i));
+		AUTO_REF(bind, bind_base[i]);
+		std::memset(&bind, 0, sizeof(bind));
+		// 参数缓冲区不会被写入。
+		char *const small = const_cast<char *>(elem.small);
+		switch(elem.type){
+		case type_boolean:
+			bind.buffer_type = MYSQL_TYPE_TINY;
+			bind.buffer = small;
+			break;
+		case type_signed:
+			bind.buffer_type = MYSQL_TYPE_LONGLONG;
+			bind.buffer = small;
+			break;
+		case type_unsigned:
+			bind.buffer_type = MYSQL_TYPE_LONGLONG;
+			bind.buffer = small;
+			bind.is_unsigned = true;
+			break;
+		case type_double:
+			bind.buffer_type = MYSQL_TYPE_DOUBLE;
+			bind.buffer = small;
+			break;
+		case type_string:
+		case type_uuid:
+			bind.buffer_type = MYSQL_TYPE_STRING;
+			bind.buffer = const_cast<char *>(elem.large.data());
+			bind.buffer_length = elem.large.size();
+			break;
+		case type_datetime: {
+			boost::uint64_t value;
+			std::memcpy(&value, elem.small, sizeof(value));
+			const AUTO(dt, break_down_time(value));
+			AUTO_REF(time, time_base[i]);
+			std::memset(&time, 0, sizeof(time));
+			time.year = dt.yr;
+			time.month = dt.mon;
+			time.day = dt.day;
+			time.hour = dt.hr;
+			time.minute = dt.min;
+			time.second = dt.sec;
+			time.second_part = dt.ms * 1000ul;
+			time.time_type = MYSQL_TIMESTAMP_DATETIME;
+			bind.buffer_type = MYSQL_TYPE_DATETIME;
+			bind.buffer = &time;
+			break; }
+		case type_blob:
+			bind.buffer_type = MYSQL_TYPE_BLOB;
+			bind.buffer = const_cast<char *>(elem.large.data());
+			bind.buffer_length = elem.large.size();
+			break;
+		case type_null:
+			bind.buffer_type = MYSQL_TYPE_NULL;
+			break;
+		default:
+			POSEIDON_THROW(Basic_exception, Rcnts::view("Statement parameters: Unknown element type"));
+		}
+	}
+}
+
+std::size_t Statement_parameters::get_data_size() const NOEXCEPT {
+	std::size_t size = 0;
+	for(AUTO(it, m_elements.begin()); it != m_elements.end(); ++it){
+		switch(it->type){
+		case type_boolean:
+			size += 1;
+			break;
+		case type_signed:
+		case type_unsigned:
+		case type_double:
+		case type_datetime:
+			size += 8;
+			break;
+		case type_null:
+			break;
+		default:
+			size += it->large.size();
+			break;
+		}
+	}
+	return size;
+}
+
+void Statement_parameters::serialize(std::string &str) const {
+	for(AUTO(it, m_elements.begin()); it != m_elements.end(); ++it){
+		str += static_cast<char>(it->type);
+		switch(it->type){
+		case type_boolean:
+			str.append(it->small, 1);
+			break;
+		case type_signed:
+		case type_unsigned:
+		case type_double:
+		case type_datetime:
+			str.append(it->small, 8);
+			break;
+		case type_null:
+			break;
+		default: {
+			// 先写入长度，以免相邻的两个参数混淆。
+			const boost::uint64_t size = it->large.size();
+			str.append(reinterpret_cast<const char *>(&size), sizeof(size));
+			str += it->large;
+			break; }
+		}
+	}
+}
+
+void Statement_parameters::append_boolean(bool value){
+	Element elem = { type_boolean };
+	const signed char byte = value;
+	BOOST_STATIC_ASSERT(sizeof(elem.small) >= sizeof(byte));
+	std::memcpy(elem.small, &byte, sizeof(byte));
+	m_elements.push_back(STD_MOVE(elem));
+}
+void Statement_parameters::append_signed(boost::int64_t value){
+	Element elem = { type_signed };
+	BOOST_STATIC_ASSERT(sizeof(elem.small) >= sizeof(value));
+	std::memcpy(elem.small, &value, sizeof(value));
+	m_elements.push_back(STD_MOVE(elem));
+}
+void Statement_parameters::append_unsigned(boost::uint64_t value){
+	Element elem = { type_unsigned };
+	BOOST_STATIC_ASSERT(sizeof(elem.small) >= sizeof(value));
+	std::memcpy(elem.small, &value, sizeof(value));
+	m_elements.push_back(STD_MOVE(elem));
+}
+void Statement_parameters::append_double(double value){
+	Element elem = { type_double };
+	BOOST_STATIC_ASSERT(sizeof(elem.small) >= sizeof(value));
+	std::memcpy(elem.small, &value, sizeof(value));
+	m_elements.push_back(STD_MOVE(elem));
+}
+void Statement_parameters::append_string(const std::string &value){
+	Element elem = { type_string };
+	elem.large = value;
+	m_elements.push_back(STD_MOVE(elem));
+}
+void Statement_parameters::append_datetime(boost::uint64_t value){
+	Element elem = { type_datetime };
+	BOOST_STATIC_ASSERT(sizeof(elem.small) >= sizeof(value));
+	std::memcpy(elem.small, &value, sizeof(value));
+	m_elements.push_back(STD_MOVE(elem));
+}
+void Statement_parameters::append_uuid(const Uuid &value){
+	// 与 Uuid_formatter 的格式相同。
+	Element elem = { type_uuid };
+	value.to_string(elem.large);
+	m_elements.push_back(STD_MOVE(elem));
+}
+void Statement_parameters::append_blob(const Stream_buffer &value){
+	Element elem = { type_blob };
+	elem.large = value.dump_string();
+	m_elements.push_back(STD_MOVE(elem));
+}
+void Statement_parameters::append_blob(const void *data, std::size_t size){
+	Element elem = { type_blob };
+	elem.large.assign(static_cast<const char *>(data), size);
+	m_elements.push_back(STD_MOVE(elem));
+}
+void Statement_parameters::append_null(){
+	Element elem = { type_null };
+	m_elements.push_back(STD_MOVE(elem));
+}
+
+}
+}
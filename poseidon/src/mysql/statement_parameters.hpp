@@ -0,0 +1,104 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_MYSQL_STATEMENT_PARAMETERS_HPP_
+#define POSEIDON_MYSQL_STATEMENT_PARAMETERS_HPP_
+
+#include "../cxx_ver.hpp"
+#include "../uuid.hpp"
+#include "../fwd.hpp"
+#include <boost/container/deque.hpp>
+#include <boost/cstdint.hpp>
+#include <string>
+#include <cstddef>
+
+namespace Poseidon {
+namespace Mysql {
+
+// 预处理语句的参数，按照 `?` 出现的顺序添加。
+class Statement_parameters {
+private:
+	enum Type {
+		type_boolean    =  1,
+		type_signed     =  2,
+		type_unsigned   =  3,
+		type_double     =  4,
+		type_string     =  5,
+		type_datetime   =  6,
+		type_uuid       =  7,
+		type_blob       =  8,
+
+		type_null       = 97,
+	};
+
+	struct Element {
+		Type type;
+		std::string large;
+		char small[16];
+	};
+
+private:
+	// 使用 deque，绑定之后元素的地址不会改变。
+	boost::container::deque<Element> m_elements;
+
+public:
+	Statement_parameters()
+		: m_elements()
+	{
+		//
+	}
+#ifndef POSEIDON_CXX11
+	Statement_parameters(const Statement_parameters &rhs)
+		: m_elements(rhs.m_elements)
+	{
+		//
+	}
+	Statement_parameters & operator=(const Statement_parameters &rhs){
+		m_elements = rhs.m_elements;
+		return *this;
+	}
+#endif
+
+public:
+	// 供 Connection 使用。binds 指向 size() 个 MYSQL_BIND，times 指向 size() 个 MYSQL_TIME。
+	void internal_bind(void *binds, void *times) const;
+
+	void append_boolean(bool value);
+	void append_signed(boost::int64_t value);
+	void append_unsigned(boost::uint64_t value);
+	void append_double(double value);
+	void append_string(const std::string &value);
+	void append_datetime(boost::uint64_t value);
+	void append_uuid(const Uuid &value);
+	void append_blob(const Stream_buffer &value);
+	void append_blob(const void *data, std::size_t size);
+	void append_null();
+
+	bool empty() const {
+		return m_elements.empty();
+	}
+	std::size_t size() const {
+		return m_elements.size();
+	}
+	// 所有参数的数据的总字节数，用于统计。
+	std::size_t get_data_size() const NOEXCEPT;
+	// 把所有参数的类型和数据追加到 str 中。参数不同时结果一定不同，可以用作缓存的键。
+	void serialize(std::string &str) const;
+	void clear() NOEXCEPT {
+		m_elements.clear();
+	}
+
+	void swap(Statement_parameters &rhs) NOEXCEPT {
+		using std::swap;
+		swap(m_elements, rhs.m_elements);
+	}
+};
+
+inline void swap(Statement_parameters &lhs, Statement_parameters &rhs) NOEXCEPT {
+	lhs.swap(rhs);
+}
+
+}
+}
+
+#endif
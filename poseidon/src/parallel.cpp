@@ -0,0 +1,117 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#include "precompiled.hpp"
+#include "parallel.hpp"
+#include "exception.hpp"
+#include "log.hpp"
+#include "atomic.hpp"
+#include "profiler.hpp"
+#include "singletons/workhorse_camp.hpp"
+
+namespace Poseidon {
+
+namespace {
+	class Parallel_for_state : NONCOPYABLE {
+	private:
+		const std::size_t m_grain;
+		const Parallel_procedure m_procedure;
+		const boost::shared_ptr<Promise> m_result;
+
+		volatile std::size_t m_remaining;
+		volatile bool m_cancelled;
+		mutable Mutex m_except_mutex;
+		STD_EXCEPTION_PTR m_except;
+
+	public:
+		Parallel_for_state(std::size_t count, std::size_t grain, Parallel_procedure procedure)
+			: m_grain(grain), m_procedure(STD_MOVE_IDN(procedure)), m_result(boost::make_shared<Promise>())
+			, m_remaining(count), m_cancelled(false)
+		{
+			//
+		}
+
+	private:
+		// 所有元素都被处理或跳过之后才满足 promise，以免调用者在仍有任务访问数据时就认为已经完成了。
+		void mark_done(std::size_t count){
+			if(atomic_sub(m_remaining, count, memory_order_acq_rel) != 0){
+				return;
+			}
+			STD_EXCEPTION_PTR except;
+			{
+				const Mutex::Unique_lock lock(m_except_mutex);
+				except = m_except;
+			}
+			if(except){
+				m_result->set_exception(STD_MOVE(except), false);
+			} else {
+				m_result->set_success(false);
+			}
+		}
+		void run_piece(std::size_t begin, std::size_t end){
+			if(atomic_load(m_cancelled, memory_order_consume)){
+				return;
+			}
+			try {
+				m_procedure(begin, end);
+			} catch(std::exception &e){
+				POSEIDON_LOG_DEBUG("std::exception thrown from parallel procedure: what = ", e.what());
+				const Mutex::Unique_lock lock(m_except_mutex);
+				if(!m_except){
+					m_except = STD_CURRENT_EXCEPTION();
+				}
+				atomic_store(m_cancelled, true, memory_order_release);
+			} catch(...){
+				POSEIDON_LOG_DEBUG("Unknown exception thrown from parallel procedure");
+				const Mutex::Unique_lock lock(m_except_mutex);
+				if(!m_except){
+					m_except = STD_CURRENT_EXCEPTION();
+				}
+				atomic_store(m_cancelled, true, memory_order_release);
+			}
+		}
+
+	public:
+		const boost::shared_ptr<Promise> & get_result() const {
+			return m_result;
+		}
+
+		void run(const boost::shared_ptr<Parallel_for_state> &self, std::size_t begin, std::size_t end){
+			POSEIDON_PROFILE_ME;
+
+			while(begin < end){
+				if((end - begin > m_grain) && (Workhorse_camp::get_local_backlog() == 0)){
+					// 自己的队列空了，把剩下的一半分出去，让空闲的线程来窃取。
+					const std::size_t middle = begin + (end - begin) / 2;
+					try {
+						Workhorse_camp::enqueue_isolated(boost::shared_ptr<Promise>(), boost::bind(&Parallel_for_state::run, self.get(), self, middle, end));
+						end = middle;
+						continue;
+					} catch(std::exception &e){
+						// 无法分出去的部分就由这个线程自己处理。
+						POSEIDON_LOG_WARNING("Failed to split parallel job: what = ", e.what());
+					}
+				}
+				const std::size_t piece_end = begin + std::min(end - begin, m_grain);
+				run_piece(begin, piece_end);
+				mark_done(piece_end - begin);
+				begin = piece_end;
+			}
+		}
+	};
+}
+
+boost::shared_ptr<const Promise> parallel_for(std::size_t begin, std::size_t end, std::size_t grain, Parallel_procedure procedure){
+	POSEIDON_PROFILE_ME;
+
+	if(begin >= end){
+		const AUTO(promise, boost::make_shared<Promise>());
+		promise->set_success(false);
+		return promise;
+	}
+	const AUTO(state, boost::make_shared<Parallel_for_state>(end - begin, std::max<std::size_t>(grain, 1), STD_MOVE_IDN(procedure)));
+	Workhorse_camp::enqueue_isolated(boost::shared_ptr<Promise>(), boost::bind(&Parallel_for_state::run, state.get(), state, begin, end));
+	return state->get_result();
+}
+
+}
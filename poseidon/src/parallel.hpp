@@ -0,0 +1,173 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_PARALLEL_HPP_
+#define POSEIDON_PARALLEL_HPP_
+
+#include "cxx_ver.hpp"
+#include "promise.hpp"
+#include "mutex.hpp"
+#include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/function.hpp>
+#include <boost/bind.hpp>
+#include <boost/container/map.hpp>
+#include <iterator>
+#include <algorithm>
+#include <functional>
+#include <cstddef>
+
+namespace Poseidon {
+
+// 以下函数在工作者线程中执行任务，返回的 promise 在所有任务都结束之后被满足，可以在纤程中使用 yield() 等待。
+// 调用者需要保证这些任务访问的数据在 promise 被满足之前有效。不要在工作者线程中同步等待返回的 promise，否则可能死锁。
+
+// 对 [begin, end) 中的每个长度不超过 grain 的子区间 [b, e) 调用 procedure(b, e)。
+// 区间按需二分：一个线程每处理完一段，如果自己的队列已经空了（说明其他线程窃取了其中的任务），就把剩下的一半放入队列。
+// 如果有任何一次调用抛出异常，剩余的子区间会被跳过，返回的 promise 以第一个异常被满足。
+typedef boost::function<void (std::size_t, std::size_t)> Parallel_procedure;
+
+extern boost::shared_ptr<const Promise> parallel_for(std::size_t begin, std::size_t end, std::size_t grain, Parallel_procedure procedure);
+
+template<typename ResultT, typename MapT, typename ReduceT>
+class Parallel_reduce_state {
+private:
+	mutable Mutex m_mutex;
+	ResultT m_identity;
+	MapT m_map;
+	ReduceT m_reduce;
+	boost::container::map<std::size_t, ResultT> m_partials;
+
+public:
+	Parallel_reduce_state(ResultT identity, MapT map, ReduceT reduce)
+		: m_identity(STD_MOVE(identity)), m_map(STD_MOVE_IDN(map)), m_reduce(STD_MOVE_IDN(reduce))
+	{
+		//
+	}
+
+public:
+	void map(std::size_t begin, std::size_t end){
+		ResultT partial = m_map(begin, end);
+		const Mutex::Unique_lock lock(m_mutex);
+		m_partials.emplace(begin, STD_MOVE(partial));
+	}
+	ResultT reduce(){
+		// 按照子区间的顺序合并，因此 reduce() 只需要满足结合律。
+		const Mutex::Unique_lock lock(m_mutex);
+		ResultT result = STD_MOVE(m_identity);
+		for(AUTO(it, m_partials.begin()); it != m_partials.end(); ++it){
+			result = m_reduce(STD_MOVE(result), STD_MOVE(it->second));
+		}
+		m_partials.clear();
+		return result;
+	}
+};
+
+// 对每个子区间计算 map(b, e)，然后从 identity 开始按照子区间的顺序用 reduce(lhs, rhs) 合并。
+template<typename ResultT, typename MapT, typename ReduceT>
+boost::shared_ptr<const Promise_container<ResultT> > parallel_reduce(std::size_t begin, std::size_t end, std::size_t grain, ResultT identity, MapT map, ReduceT reduce){
+	typedef Parallel_reduce_state<ResultT, MapT, ReduceT> State;
+	const AUTO(state, boost::make_shared<State>(STD_MOVE(identity), STD_MOVE_IDN(map), STD_MOVE_IDN(reduce)));
+	const AUTO(promise, parallel_for(begin, end, grain, boost::bind(&State::map, state, _1, _2)));
+	// 返回的 promise 持有这个回调函数，而回调函数持有 state。
+	return promise->template then<ResultT>(boost::bind(&State::reduce, state));
+}
+
+template<typename IteratorT, typename ComparatorT>
+class Parallel_sort_state : public boost::enable_shared_from_this<Parallel_sort_state<IteratorT, ComparatorT> > {
+private:
+	const IteratorT m_first;
+	const std::size_t m_count;
+	const std::size_t m_chunk_size;
+	ComparatorT m_comp;
+	const boost::shared_ptr<Promise> m_result;
+
+	std::size_t m_width;
+	boost::shared_ptr<const Promise> m_round;
+
+public:
+	Parallel_sort_state(IteratorT first, std::size_t count, std::size_t chunk_size, ComparatorT comp)
+		: m_first(STD_MOVE_IDN(first)), m_count(count), m_chunk_size(chunk_size), m_comp(STD_MOVE_IDN(comp)), m_result(boost::make_shared<Promise>())
+		, m_width(0)
+	{
+		//
+	}
+
+private:
+	IteratorT get_iterator(std::size_t index) const {
+		IteratorT it = m_first;
+		std::advance(it, static_cast<typename std::iterator_traits<IteratorT>::difference_type>(std::min(index, m_count)));
+		return it;
+	}
+
+	void sort_chunks(std::size_t begin, std::size_t end){
+		for(std::size_t i = begin; i < end; ++i){
+			std::stable_sort(get_iterator(i * m_chunk_size), get_iterator((i + 1) * m_chunk_size), m_comp);
+		}
+	}
+	void merge_pairs(std::size_t begin, std::size_t end){
+		for(std::size_t i = begin; i < end; ++i){
+			const std::size_t lower = i * m_width * 2;
+			if(lower + m_width >= m_count){
+				continue;
+			}
+			std::inplace_merge(get_iterator(lower), get_iterator(lower + m_width), get_iterator(lower + m_width * 2), m_comp);
+		}
+	}
+	// 每一轮结束之后由回调函数调用，开始下一轮合并。
+	void on_round_complete(){
+		try {
+			m_round->check_and_rethrow();
+			if(m_width == 0){
+				m_width = m_chunk_size;
+			} else {
+				m_width *= 2;
+			}
+			if(m_width >= m_count){
+				m_round.reset();
+				m_result->set_success(false);
+				return;
+			}
+			const std::size_t pair_count = (m_count - 1) / (m_width * 2) + 1;
+			start_round(boost::bind(&Parallel_sort_state::merge_pairs, this->shared_from_this(), _1, _2), pair_count);
+		} catch(...){
+			m_round.reset();
+			m_result->set_exception(STD_CURRENT_EXCEPTION(), false);
+		}
+	}
+	void start_round(Parallel_procedure procedure, std::size_t count){
+		// 如果这一轮已经结束，回调函数会被立即调用并覆盖 m_round，因此这里要使用局部变量。
+		const AUTO(round, parallel_for(0, count, 1, STD_MOVE(procedure)));
+		m_round = round;
+		round->add_callback(boost::bind(&Parallel_sort_state::on_round_complete, this->shared_from_this()));
+	}
+
+public:
+	boost::shared_ptr<const Promise> start(){
+		if(m_count <= 1){
+			m_result->set_success(false);
+			return m_result;
+		}
+		// 先把每一块分别排序，然后两两合并，直到整个区间有序。
+		const std::size_t chunk_count = (m_count - 1) / m_chunk_size + 1;
+		start_round(boost::bind(&Parallel_sort_state::sort_chunks, this->shared_from_this(), _1, _2), chunk_count);
+		return m_result;
+	}
+};
+
+// 稳定排序。每块不超过 grain 个元素，分别排序之后两两合并。
+template<typename IteratorT, typename ComparatorT>
+boost::shared_ptr<const Promise> parallel_sort(IteratorT first, IteratorT last, std::size_t grain, ComparatorT comp){
+	const std::size_t count = static_cast<std::size_t>(std::distance(first, last));
+	const AUTO(state, boost::make_shared<Parallel_sort_state<IteratorT, ComparatorT> >(STD_MOVE_IDN(first), count, std::max<std::size_t>(grain, 1), STD_MOVE_IDN(comp)));
+	return state->start();
+}
+template<typename IteratorT>
+boost::shared_ptr<const Promise> parallel_sort(IteratorT first, IteratorT last, std::size_t grain){
+	return parallel_sort(STD_MOVE_IDN(first), STD_MOVE_IDN(last), grain, std::less<typename std::iterator_traits<IteratorT>::value_type>());
+}
+
+}
+
+#endif
@@ -5,10 +5,72 @@
 #include "promise.hpp"
 #include "exception.hpp"
 #include "log.hpp"
+#include "atomic.hpp"
 #include "singletons/job_dispatcher.hpp"
 
 namespace Poseidon {
 
+namespace {
+	void invoke_callback(const boost::function<void ()> &callback) NOEXCEPT {
+		try {
+			callback();
+		} catch(std::exception &e){
+			POSEIDON_LOG_WARNING("std::exception thrown from promise callback: what = ", e.what());
+		} catch(...){
+			POSEIDON_LOG_WARNING("Unknown exception thrown from promise callback");
+		}
+	}
+
+	struct When_all_state {
+		volatile std::size_t remaining;
+		boost::shared_ptr<Promise> result;
+	};
+
+	class When_all_callback {
+	private:
+		const Promise *m_source;
+		boost::shared_ptr<When_all_state> m_state;
+
+	public:
+		When_all_callback(const Promise *source, boost::shared_ptr<When_all_state> state)
+			: m_source(source), m_state(STD_MOVE(state))
+		{
+			//
+		}
+
+	public:
+		void operator()() const {
+			try {
+				m_source->check_and_rethrow();
+			} catch(...){
+				m_state->result->set_exception(STD_CURRENT_EXCEPTION(), false);
+				return;
+			}
+			if(atomic_sub(m_state->remaining, 1, memory_order_acq_rel) == 0){
+				m_state->result->set_success(false);
+			}
+		}
+	};
+
+	class When_any_callback {
+	private:
+		std::size_t m_index;
+		boost::shared_ptr<Promise_container<std::size_t> > m_result;
+
+	public:
+		When_any_callback(std::size_t index, boost::shared_ptr<Promise_container<std::size_t> > result)
+			: m_index(index), m_result(STD_MOVE(result))
+		{
+			//
+		}
+
+	public:
+		void operator()() const {
+			m_result->set_success(m_index, false);
+		}
+	};
+}
+
 Promise::~Promise(){
 	//
 }
@@ -38,14 +100,54 @@ void Promise::set_success(bool throw_if_already_set){
 	set_exception(STD_EXCEPTION_PTR(), throw_if_already_set);
 }
 void Promise::set_exception(STD_EXCEPTION_PTR except, bool throw_if_already_set){
-	const Recursive_mutex::Unique_lock lock(m_mutex);
-	if(m_except){
-		if(throw_if_already_set){
-			POSEIDON_THROW(Exception, Rcnts::view("Promise has already been satisfied"));
+	boost::container::vector<boost::function<void ()> > callbacks;
+	{
+		const Recursive_mutex::Unique_lock lock(m_mutex);
+		if(m_except){
+			if(throw_if_already_set){
+				POSEIDON_THROW(Exception, Rcnts::view("Promise has already been satisfied"));
+			}
+			return;
+		}
+		m_except = STD_MOVE_IDN(except);
+		callbacks.swap(m_callbacks);
+	}
+	for(AUTO(it, callbacks.begin()); it != callbacks.end(); ++it){
+		invoke_callback(*it);
+	}
+}
+
+void Promise::add_callback(boost::function<void ()> callback) const {
+	{
+		const Recursive_mutex::Unique_lock lock(m_mutex);
+		if(!m_except){
+			m_callbacks.push_back(STD_MOVE_IDN(callback));
+			return;
 		}
-		return;
 	}
-	m_except = STD_MOVE_IDN(except);
+	invoke_callback(callback);
+}
+
+boost::shared_ptr<const Promise> when_all(const boost::container::vector<boost::shared_ptr<const Promise> > &promises){
+	const AUTO(state, boost::make_shared<When_all_state>());
+	// 多出来的一个计数在注册完所有回调函数之后减去，以免在此之前满足返回的 promise。
+	state->remaining = promises.size() + 1;
+	state->result = boost::make_shared<Promise>();
+	for(AUTO(it, promises.begin()); it != promises.end(); ++it){
+		(*it)->add_callback(When_all_callback(it->get(), state));
+	}
+	if(atomic_sub(state->remaining, 1, memory_order_acq_rel) == 0){
+		state->result->set_success(false);
+	}
+	return state->result;
+}
+boost::shared_ptr<const Promise_container<std::size_t> > when_any(const boost::container::vector<boost::shared_ptr<const Promise> > &promises){
+	POSEIDON_THROW_UNLESS(!promises.empty(), Exception, Rcnts::view("No promises to wait for"));
+	const AUTO(result, boost::make_shared<Promise_container<std::size_t> >());
+	for(std::size_t i = 0; i < promises.size(); ++i){
+		promises.at(i)->add_callback(When_any_callback(i, result));
+	}
+	return result;
 }
 
 void yield(const boost::shared_ptr<const Promise> &promise, bool insignificant){
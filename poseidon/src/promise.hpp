@@ -8,19 +8,27 @@
 #include "cxx_util.hpp"
 #include "recursive_mutex.hpp"
 #include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
 #include <boost/type_traits/remove_const.hpp>
 #include <boost/optional.hpp>
+#include <boost/function.hpp>
+#include <boost/container/vector.hpp>
+#include <cstddef>
 
 namespace Poseidon {
 
+template<typename ResultT>
+class Promise_container;
+
 class Promise : NONCOPYABLE {
 protected:
 	mutable Recursive_mutex m_mutex;
 	boost::optional<STD_EXCEPTION_PTR> m_except;
+	mutable boost::container::vector<boost::function<void ()> > m_callbacks;
 
 public:
 	Promise()
-		: m_mutex(), m_except()
+		: m_mutex(), m_except(), m_callbacks()
 	{
 		//
 	}
@@ -33,8 +41,22 @@ public:
 
 	void set_success(bool throw_if_already_set = true);
 	void set_exception(STD_EXCEPTION_PTR except, bool throw_if_already_set = true);
+
+	// 注册一个回调函数，在 promise 被满足之后调用。如果 promise 已被满足，则立即在当前线程中调用。
+	// 回调函数在满足 promise 的线程中调用，调用时不持有 promise 的锁。回调函数应当尽快返回，抛出的异常会被忽略。
+	void add_callback(boost::function<void ()> callback) const;
+
+	// 返回一个新的 promise，在这个 promise 被满足之后以 func() 的返回值满足它。
+	// 如果这个 promise 或 func() 抛出异常，新的 promise 会以同一个异常被满足。func() 的调用方式同 add_callback()。
+	template<typename NewResultT, typename FunctionT>
+	boost::shared_ptr<const Promise_container<NewResultT> > then(FunctionT func) const;
 };
 
+// 所有 promise 都被满足之后满足返回的 promise。如果其中有任何一个 promise 抛出异常，则返回的 promise 立即以该异常被满足。
+extern boost::shared_ptr<const Promise> when_all(const boost::container::vector<boost::shared_ptr<const Promise> > &promises);
+// 任何一个 promise 被满足之后以其下标满足返回的 promise。调用者需要自行检查该 promise 是否抛出了异常。
+extern boost::shared_ptr<const Promise_container<std::size_t> > when_any(const boost::container::vector<boost::shared_ptr<const Promise> > &promises);
+
 template<typename ResultT>
 class Promise_container : public Promise {
 private:
@@ -65,14 +87,21 @@ public:
 		return m_result.get();
 	}
 	void set_success(typename boost::remove_const<ResultT>::type result, bool throw_if_already_set = true){
-		const Recursive_mutex::Unique_lock lock(m_mutex);
-		// If `m_result_accepted` is true, `Promise::set_success()` will throw an exception eventually. Hence we do not set the value here.
-		if(!m_result_accepted){
-			m_result = STD_MOVE_IDN(result);
+		{
+			const Recursive_mutex::Unique_lock lock(m_mutex);
+			// If `m_result_accepted` is true, `Promise::set_success()` will throw an exception eventually. Hence we do not set the value here.
+			if(!m_result_accepted){
+				m_result = STD_MOVE_IDN(result);
+			}
+			m_result_accepted = true;
 		}
+		// The lock must not be held when callbacks are invoked.
 		Promise::set_success(throw_if_already_set);
-		m_result_accepted = true;
 	}
+
+	// 同 Promise::then()，但是 func() 的参数是这个 promise 的结果。
+	template<typename NewResultT, typename FunctionT>
+	boost::shared_ptr<const Promise_container<NewResultT> > then(FunctionT func) const;
 };
 
 template<typename ResultT>
@@ -80,6 +109,70 @@ Promise_container<ResultT>::~Promise_container(){
 	//
 }
 
+template<typename NewResultT, typename FunctionT>
+class Promise_then_callback {
+private:
+	const Promise *m_source;
+	boost::shared_ptr<Promise_container<NewResultT> > m_result;
+	FunctionT m_func;
+
+public:
+	Promise_then_callback(const Promise *source, boost::shared_ptr<Promise_container<NewResultT> > result, FunctionT func)
+		: m_source(source), m_result(STD_MOVE(result)), m_func(STD_MOVE_IDN(func))
+	{
+		//
+	}
+
+public:
+	void operator()(){
+		try {
+			m_source->check_and_rethrow();
+			m_result->set_success(m_func(), false);
+		} catch(...){
+			m_result->set_exception(STD_CURRENT_EXCEPTION(), false);
+		}
+	}
+};
+
+template<typename ResultT, typename NewResultT, typename FunctionT>
+class Promise_container_then_callback {
+private:
+	const Promise_container<ResultT> *m_source;
+	boost::shared_ptr<Promise_container<NewResultT> > m_result;
+	FunctionT m_func;
+
+public:
+	Promise_container_then_callback(const Promise_container<ResultT> *source, boost::shared_ptr<Promise_container<NewResultT> > result, FunctionT func)
+		: m_source(source), m_result(STD_MOVE(result)), m_func(STD_MOVE_IDN(func))
+	{
+		//
+	}
+
+public:
+	void operator()(){
+		try {
+			m_result->set_success(m_func(m_source->get()), false);
+		} catch(...){
+			m_result->set_exception(STD_CURRENT_EXCEPTION(), false);
+		}
+	}
+};
+
+// 回调函数只会在 promise 的成员函数中被调用，因此这里保存指向 promise 的裸指针是安全的。
+template<typename NewResultT, typename FunctionT>
+boost::shared_ptr<const Promise_container<NewResultT> > Promise::then(FunctionT func) const {
+	const AUTO(result, boost::make_shared<Promise_container<NewResultT> >());
+	add_callback(Promise_then_callback<NewResultT, FunctionT>(this, result, STD_MOVE_IDN(func)));
+	return result;
+}
+template<typename ResultT>
+template<typename NewResultT, typename FunctionT>
+boost::shared_ptr<const Promise_container<NewResultT> > Promise_container<ResultT>::then(FunctionT func) const {
+	const AUTO(result, boost::make_shared<Promise_container<NewResultT> >());
+	add_callback(Promise_container_then_callback<ResultT, NewResultT, FunctionT>(this, result, STD_MOVE_IDN(func)));
+	return result;
+}
+
 extern void yield(const boost::shared_ptr<const Promise> &promise, bool insignificant = true);
 
 template<typename ResultT>
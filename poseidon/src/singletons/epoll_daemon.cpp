@@ -12,22 +12,20 @@
 #include "../profiler.hpp"
 #include "../recursive_mutex.hpp"
 #include "../raii.hpp"
-#include "../multi_index_map.hpp"
 #include "../checked_arithmetic.hpp"
 #include "../system_exception.hpp"
 #include "../errno.hpp"
 #include "../flags.hpp"
+#include <boost/intrusive/list.hpp>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <unistd.h>
 
 namespace Poseidon {
 
 namespace {
-	volatile bool g_running = false;
-	Thread g_thread;
-
 	class Weakable_socket {
 	private:
 		boost::shared_ptr<Socket_base> m_strong;
@@ -50,258 +48,678 @@ namespace {
 		}
 	};
 
-	struct Socket_element {
+	struct Readable_tag;
+	struct Writable_tag;
+	struct Closed_tag;
+	struct Idle_tag;
+	struct Deadline_tag;
+	struct Sweep_tag;
+
+	typedef boost::intrusive::list_base_hook<boost::intrusive::tag<Readable_tag>, boost::intrusive::link_mode<boost::intrusive::auto_unlink> > Readable_hook;
+	typedef boost::intrusive::list_base_hook<boost::intrusive::tag<Writable_tag>, boost::intrusive::link_mode<boost::intrusive::auto_unlink> > Writable_hook;
+	typedef boost::intrusive::list_base_hook<boost::intrusive::tag<Closed_tag>, boost::intrusive::link_mode<boost::intrusive::auto_unlink> > Closed_hook;
+	typedef boost::intrusive::list_base_hook<boost::intrusive::tag<Idle_tag>, boost::intrusive::link_mode<boost::intrusive::auto_unlink> > Idle_hook;
+	typedef boost::intrusive::list_base_hook<boost::intrusive::tag<Deadline_tag>, boost::intrusive::link_mode<boost::intrusive::auto_unlink> > Deadline_hook;
+	typedef boost::intrusive::list_base_hook<boost::intrusive::tag<Sweep_tag>, boost::intrusive::link_mode<boost::intrusive::auto_unlink> > Sweep_hook;
+
+	// 各个钩子分别将此元素挂到 Epoll_reactor 的就绪队列和超时清扫队列上。
+	// 元素只由 Socket_map 持有，因此它的析构（并自动从所有队列中摘除）总是在 reactor 的互斥锁保护之下进行的。
+	struct Socket_element : public Readable_hook, public Writable_hook, public Closed_hook, public Idle_hook, public Deadline_hook, public Sweep_hook {
 		// Invariants.
 		boost::shared_ptr<const Weakable_socket> weakable;
-		// Indices.
 		const volatile Socket_base *ptr;
-		boost::uint64_t read_time;
-		boost::uint64_t write_time;
-		int err_code;
 		// Variables.
-		mutable bool readable;
-		mutable bool writable;
+		boost::uint64_t throttled_until;
+		int err_code;
+		bool readable;
+		bool writable;
+		// 以下成员仅在 Sweep_hook 被链入时有意义。
+		boost::uint64_t last_use_time;
+		boost::uint64_t shutdown_time;
+		boost::uint64_t next_sweep_time;
+		boost::uint64_t sweep_round;
 	};
-	POSEIDON_MULTI_INDEX_MAP(Socket_map, Socket_element,
-		POSEIDON_UNIQUE_MEMBER_INDEX(ptr)
-		POSEIDON_MULTI_MEMBER_INDEX(read_time)
-		POSEIDON_MULTI_MEMBER_INDEX(write_time)
-		POSEIDON_MULTI_MEMBER_INDEX(err_code)
-	);
-
-	Recursive_mutex g_mutex;
-	Unique_file g_epoll;
-	Socket_map g_socket_map;
-
-	bool wait_for_sockets(unsigned timeout) NOEXCEPT {
-		POSEIDON_PROFILE_ME;
+	typedef boost::container::map<const volatile Socket_base *, boost::shared_ptr<Socket_element> > Socket_map;
+
+	typedef boost::intrusive::list<Socket_element, boost::intrusive::base_hook<Readable_hook>, boost::intrusive::constant_time_size<false> > Readable_list;
+	typedef boost::intrusive::list<Socket_element, boost::intrusive::base_hook<Writable_hook>, boost::intrusive::constant_time_size<false> > Writable_list;
+	typedef boost::intrusive::list<Socket_element, boost::intrusive::base_hook<Closed_hook>, boost::intrusive::constant_time_size<false> > Closed_list;
+	typedef boost::intrusive::list<Socket_element, boost::intrusive::base_hook<Idle_hook>, boost::intrusive::constant_time_size<false> > Idle_list;
+	typedef boost::intrusive::list<Socket_element, boost::intrusive::base_hook<Deadline_hook>, boost::intrusive::constant_time_size<false> > Deadline_list;
+	typedef boost::intrusive::list<Socket_element, boost::intrusive::base_hook<Sweep_hook>, boost::intrusive::constant_time_size<false> > Sweep_list;
+
+	struct Batch_element {
+		Socket_element *elem;
+		boost::shared_ptr<Socket_base> socket;
+		bool ready;
+		int err_code;
+	};
+
+	class Epoll_reactor : NONCOPYABLE {
+	private:
+		enum {
+			batch_size = 256,
+		};
+
+	private:
+		const std::size_t m_index;
+		const boost::uint64_t m_sweep_interval;
+		const boost::uint64_t m_sweep_period;
+		const boost::uint64_t m_response_timeout;
+		Thread m_thread;
+		volatile bool m_running;
+
+		mutable Recursive_mutex m_mutex;
+		Unique_file m_epoll;
+		Unique_file m_wakeup;
+		bool m_sleeping;
+		Socket_map m_socket_map;
+		// 以下队列中的元素都是 m_socket_map 中的元素。
+		Readable_list m_readable_list;
+		Readable_list m_throttled_list; // 按 throttled_until 升序排列。
+		Writable_list m_writable_list;
+		Closed_list m_closed_list;
+		// 超时清扫队列。所有需要清扫的元素都在 m_sweep_list 中，另外两个队列是它的子集。
+		Idle_list m_idle_list; // 按 last_use_time 升序排列。
+		Deadline_list m_deadline_list; // 按 shutdown_time 升序排列。
+		Sweep_list m_sweep_list; // 按 next_sweep_time 升序排列。
+		boost::uint64_t m_next_sweep_time;
+		boost::uint64_t m_sweep_round;
 
-		boost::array< ::epoll_event, 256> events;
-		const int result = ::epoll_wait(g_epoll.get(), events.data(), static_cast<int>(events.size()), static_cast<int>(std::min<unsigned>(timeout, INT_MAX)));
-		if(result < 0){
-			const int err_code = errno;
-			if(err_code != EINTR){
-				POSEIDON_LOG_ERROR("::epoll_wait() failed! errno was ", err_code, " (", get_error_desc(err_code), ")");
+	public:
+		explicit Epoll_reactor(std::size_t index)
+			: m_index(index)
+			, m_sweep_interval(std::max<boost::uint64_t>(Main_config::get<boost::uint64_t>("epoll_sweep_interval", 1000), 1))
+			, m_sweep_period(std::max<boost::uint64_t>(Main_config::get<boost::uint64_t>("tcp_shutdown_timer_period", 15000), 1))
+			, m_response_timeout(Main_config::get<boost::uint64_t>("tcp_response_timeout", 30000))
+			, m_running(false)
+			, m_sleeping(false), m_next_sweep_time(0), m_sweep_round(0)
+		{
+			POSEIDON_THROW_UNLESS(m_epoll.reset(::epoll_create(100)), System_exception);
+			POSEIDON_THROW_UNLESS(m_wakeup.reset(::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)), System_exception);
+			::epoll_event event = { };
+			event.events = EPOLLIN;
+			event.data.ptr = NULLPTR;
+			POSEIDON_THROW_UNLESS(::epoll_ctl(m_epoll.get(), EPOLL_CTL_ADD, m_wakeup.get(), &event) == 0, System_exception);
+		}
+		~Epoll_reactor(){
+			// 元素析构时会自动从队列中摘除。
+			m_socket_map.clear();
+		}
+
+	private:
+		void signal_wakeup() NOEXCEPT {
+			const boost::uint64_t one = 1;
+			if(::write(m_wakeup.get(), &one, sizeof(one)) < 0){
+				const int err_code = errno;
+				if(err_code != EAGAIN){
+					POSEIDON_LOG_ERROR("::write() failed! errno was ", err_code, " (", get_error_desc(err_code), ")");
+				}
 			}
-			return false;
 		}
-		if(result == 0){
-			return false;
+		// 调用者必须持有 m_mutex。
+		void wake_up_unlocked() NOEXCEPT {
+			if(!m_sleeping){
+				return;
+			}
+			m_sleeping = false;
+			signal_wakeup();
 		}
-		const AUTO(now, get_fast_mono_clock());
-		const Recursive_mutex::Unique_lock lock(g_mutex);
-		for(unsigned i = 0; i < static_cast<unsigned>(result); ++i){
-			const AUTO(ptr, static_cast<Socket_base *>(events[i].data.ptr));
-			const AUTO(it, g_socket_map.find<0>(ptr));
-			if(it == g_socket_map.end()){
-				POSEIDON_LOG_TRACE("Socket reported by epoll is not registered: ptr = ", static_cast<void *>(ptr));
-				continue;
+		void drain_wakeup() NOEXCEPT {
+			boost::uint64_t count;
+			if(::read(m_wakeup.get(), &count, sizeof(count)) < 0){
+				const int err_code = errno;
+				if(err_code != EAGAIN){
+					POSEIDON_LOG_ERROR("::read() failed! errno was ", err_code, " (", get_error_desc(err_code), ")");
+				}
 			}
-			const AUTO(socket, it->weakable->lock());
-			if(!socket){
-				g_socket_map.erase<0>(it);
-				continue;
+		}
+
+		// 如果有就绪的套接字，返回 0；否则返回距离下一个被节流的套接字恢复或者下一次超时清扫的时间，或者 -1 表示无限等待。
+		int get_wait_timeout_unlocked(boost::uint64_t now) const NOEXCEPT {
+			if(!m_readable_list.empty() || !m_writable_list.empty() || !m_closed_list.empty()){
+				return 0;
 			}
-			if(has_any_flags_of(events[i].events, EPOLLIN) && has_none_flags_of(events[i].events, EPOLLERR)){
-				it->readable = true;
-				g_socket_map.set_key<0, 1>(it, now);
+			if(m_throttled_list.empty() && m_sweep_list.empty()){
+				return -1;
 			}
-			if(has_any_flags_of(events[i].events, EPOLLOUT) && has_none_flags_of(events[i].events, EPOLLERR)){
-				it->writable = true;
-				g_socket_map.set_key<0, 2>(it, now);
+			boost::uint64_t timeout = UINT64_MAX;
+			if(!m_throttled_list.empty()){
+				timeout = std::min(timeout, saturated_sub(m_throttled_list.front().throttled_until, now));
 			}
-			if(has_any_flags_of(events[i].events, EPOLLHUP | EPOLLERR)){
-				int err_code;
-				if(socket->did_time_out()){
-					err_code = ETIMEDOUT;
-				} else if(has_any_flags_of(events[i].events, EPOLLERR)){
-					::socklen_t err_len = sizeof(err_code);
-					if(::getsockopt(socket->get_fd(), SOL_SOCKET, SO_ERROR, &err_code, &err_len) != 0){
-						err_code = errno;
-						POSEIDON_LOG_WARNING("::getsockopt() failed: fd = ", socket->get_fd(), ", err_code = ", err_code, " (", get_error_desc(err_code), ")");
+			if(!m_sweep_list.empty()){
+				timeout = std::min(timeout, saturated_sub(m_next_sweep_time, now));
+			}
+			return static_cast<int>(std::min<boost::uint64_t>(timeout, INT_MAX));
+		}
+
+		void wait_for_sockets() NOEXCEPT {
+			POSEIDON_PROFILE_ME;
+
+			int timeout;
+			{
+				const Recursive_mutex::Unique_lock lock(m_mutex);
+				timeout = get_wait_timeout_unlocked(get_fast_mono_clock());
+				if(!atomic_load(m_running, memory_order_consume)){
+					timeout = 0;
+				}
+				// 在此之后有套接字就绪的话，eventfd 会唤醒我们。
+				m_sleeping = (timeout != 0);
+			}
+
+			boost::array< ::epoll_event, 256> events;
+			const int result = ::epoll_wait(m_epoll.get(), events.data(), static_cast<int>(events.size()), timeout);
+			if(result < 0){
+				const int err_code = errno;
+				if(err_code != EINTR){
+					POSEIDON_LOG_ERROR("::epoll_wait() failed! errno was ", err_code, " (", get_error_desc(err_code), ")");
+				}
+			}
+			const AUTO(now, get_fast_mono_clock());
+			const Recursive_mutex::Unique_lock lock(m_mutex);
+			m_sleeping = false;
+			for(unsigned i = 0; i < static_cast<unsigned>(std::max(result, 0)); ++i){
+				const AUTO(ptr, static_cast<Socket_base *>(events[i].data.ptr));
+				if(!ptr){
+					drain_wakeup();
+					continue;
+				}
+				const AUTO(it, m_socket_map.find(ptr));
+				if(it == m_socket_map.end()){
+					POSEIDON_LOG_TRACE("Socket reported by epoll is not registered: ptr = ", static_cast<void *>(ptr));
+					continue;
+				}
+				const AUTO(elem, it->second.get());
+				const AUTO(socket, elem->weakable->lock());
+				if(!socket){
+					m_socket_map.erase(it);
+					continue;
+				}
+				// 先取得错误码。EPOLLERR 可能只是错误队列中有数据（例如 MSG_ZEROCOPY 的完成通知），此时 SO_ERROR 为零。
+				int err_code = 0;
+				if(has_any_flags_of(events[i].events, EPOLLHUP | EPOLLERR)){
+					if(socket->did_time_out()){
+						err_code = ETIMEDOUT;
+					} else if(has_any_flags_of(events[i].events, EPOLLERR)){
+						::socklen_t err_len = sizeof(err_code);
+						if(::getsockopt(socket->get_fd(), SOL_SOCKET, SO_ERROR, &err_code, &err_len) != 0){
+							err_code = errno;
+							POSEIDON_LOG_WARNING("::getsockopt() failed: fd = ", socket->get_fd(), ", err_code = ", err_code, " (", get_error_desc(err_code), ")");
+						}
+					}
+				}
+				// 边沿触发，同一个事件中的可读和可写状态如果在这里丢掉就不会再报告了。
+				if(has_any_flags_of(events[i].events, EPOLLIN) && (err_code == 0)){
+					elem->readable = true;
+					if(!elem->Readable_hook::is_linked()){
+						m_readable_list.push_back(*elem);
+					}
+				}
+				if(has_any_flags_of(events[i].events, EPOLLOUT | EPOLLERR) && (err_code == 0)){
+					// 错误队列中的完成通知也交给写入方处理。
+					elem->writable = elem->writable || has_any_flags_of(events[i].events, EPOLLOUT);
+					if(!elem->Writable_hook::is_linked()){
+						m_writable_list.push_back(*elem);
 					}
-				} else {
-					err_code = 0;
 				}
-				POSEIDON_LOG(Logger::special_major | Logger::level_debug, "Socket closed: remote = ", socket->get_remote_info(), ", typeid = ", typeid(*socket).name(), ", err_code = ", err_code, " (", get_error_desc(err_code), ")");
-				g_socket_map.set_key<0, 3>(it, err_code);
+				if(has_any_flags_of(events[i].events, EPOLLHUP) || (err_code != 0)){
+					POSEIDON_LOG(Logger::special_major | Logger::level_debug, "Socket closed: remote = ", socket->get_remote_info(), ", typeid = ", typeid(*socket).name(), ", err_code = ", err_code, " (", get_error_desc(err_code), ")");
+					elem->err_code = err_code;
+					if(!elem->Closed_hook::is_linked()){
+						m_closed_list.push_back(*elem);
+					}
+				}
+			}
+			// 恢复节流期满的套接字。
+			while(!m_throttled_list.empty() && (m_throttled_list.front().throttled_until <= now)){
+				AUTO_REF(elem, m_throttled_list.front());
+				m_throttled_list.pop_front();
+				m_readable_list.push_back(elem);
 			}
 		}
-		return true;
-	}
-
-	bool pump_one_readable_socket(boost::container::vector<unsigned char> &io_buffer) NOEXCEPT {
-		POSEIDON_PROFILE_ME;
 
-		const AUTO(now, get_fast_mono_clock());
-		boost::shared_ptr<Socket_base> socket;
-		bool readable;
-		{
-			const Recursive_mutex::Unique_lock lock(g_mutex);
-			const AUTO(it, g_socket_map.begin<1>());
-			if(it == g_socket_map.end<1>()){
-				return false;
+		// 以下函数的调用者必须持有 m_mutex。
+		void touch_unlocked(Socket_element &elem, boost::uint64_t now) NOEXCEPT {
+			elem.last_use_time = now;
+			if(elem.Idle_hook::is_linked()){
+				elem.Idle_hook::unlink();
 			}
-			if(now < it->read_time){
-				return false;
+			m_idle_list.push_back(elem);
+		}
+		void link_deadline_unlocked(Socket_element &elem) NOEXCEPT {
+			if(elem.Deadline_hook::is_linked()){
+				elem.Deadline_hook::unlink();
+			}
+			if(elem.shutdown_time == -1ull){
+				return;
 			}
-			socket = it->weakable->lock();
+			// 超时通常都是相同的，因此从队尾开始查找。
+			AUTO(pos, m_deadline_list.end());
+			while(pos != m_deadline_list.begin()){
+				AUTO(prev, pos);
+				--prev;
+				if(prev->shutdown_time <= elem.shutdown_time){
+					break;
+				}
+				pos = prev;
+			}
+			m_deadline_list.insert(pos, elem);
+		}
+		// 每一轮清扫中每个元素至多被取出一次。如果套接字已经被释放，元素会被销毁。
+		void push_sweep_unlocked(boost::container::vector<Batch_element> &batch, Socket_element &elem){
+			if(elem.sweep_round == m_sweep_round){
+				return;
+			}
+			elem.sweep_round = m_sweep_round;
+			AUTO(socket, elem.weakable->lock());
 			if(!socket){
-				g_socket_map.erase<1>(it);
-				return true;
+				m_socket_map.erase(elem.ptr);
+				return;
 			}
-			readable = it->readable;
+			Batch_element batch_elem = { &elem, STD_MOVE_IDN(socket) };
+			batch.push_back(STD_MOVE(batch_elem));
 		}
 
-		if(socket->is_throttled()){
-			POSEIDON_LOG(Logger::special_major | Logger::level_debug, "Socket is throttled: socket = ", socket, ", typeid = ", typeid(*socket).name());
-			const Recursive_mutex::Unique_lock lock(g_mutex);
-			const AUTO(it, g_socket_map.find<0>(socket.get()));
-			if(it != g_socket_map.end<0>()){
-				g_socket_map.set_key<0, 1>(it, now + 5000);
+		// 从队列头部取出至多 batch_size 个元素。调用者必须持有 m_mutex。
+		template<typename ListT>
+		void pop_batch_unlocked(boost::container::vector<Batch_element> &batch, ListT &list){
+			while(!list.empty() && (batch.size() < batch_size)){
+				AUTO_REF(elem, list.front());
+				list.pop_front();
+				AUTO(socket, elem.weakable->lock());
+				if(!socket){
+					m_socket_map.erase(elem.ptr);
+					continue;
+				}
+				Batch_element batch_elem = { &elem, STD_MOVE_IDN(socket) };
+				batch.push_back(STD_MOVE(batch_elem));
 			}
-			return true;
 		}
+		bool pump_readable_sockets(boost::container::vector<Batch_element> &batch, boost::container::vector<unsigned char> &io_buffer) NOEXCEPT {
+			POSEIDON_PROFILE_ME;
+
+			batch.clear();
+			{
+				const Recursive_mutex::Unique_lock lock(m_mutex);
+				pop_batch_unlocked(batch, m_readable_list);
+				for(AUTO(it, batch.begin()); it != batch.end(); ++it){
+					it->ready = it->elem->readable;
+				}
+			}
+			if(batch.empty()){
+				return false;
+			}
 
-		int err_code;
-		try {
-			err_code = socket->poll_read_and_process(io_buffer.data(), io_buffer.size(), readable);
-			POSEIDON_LOG_TRACE("Socket read result: socket = ", socket, ", typeid = ", typeid(*socket).name(), ", err_code = ", err_code);
-		} catch(std::exception &e){
-			POSEIDON_LOG_WARNING("std::exception thrown: what = ", e.what(), ", socket = ", socket, ", typeid = ", typeid(*socket).name());
-			err_code = ECONNRESET;
-		} catch(...){
-			POSEIDON_LOG_WARNING("Unknown exception thrown: socket = ", socket, ", typeid = ", typeid(*socket).name());
-			err_code = ECONNRESET;
-		}
-		if((err_code == 0) || (err_code == EINTR)){
-			// Success.
-		} else if((err_code == EWOULDBLOCK) || (err_code == EAGAIN)){
-			const Recursive_mutex::Unique_lock lock(g_mutex);
-			const AUTO(it, g_socket_map.find<0>(socket.get()));
-			if(it != g_socket_map.end<0>()){
-				g_socket_map.set_key<0, 1>(it, -1ull);
-			}
-		} else {
-			POSEIDON_LOG_DEBUG("Socket read error: socket = ", socket, ", typeid = ", typeid(*socket).name(), ", err_code = ", err_code, " (", get_error_desc(err_code), ")");
-			socket->force_shutdown();
-		}
-		return true;
-	}
+			for(AUTO(it, batch.begin()); it != batch.end(); ++it){
+				const AUTO_REF(socket, it->socket);
+				if(socket->is_throttled()){
+					POSEIDON_LOG(Logger::special_major | Logger::level_debug, "Socket is throttled: socket = ", socket, ", typeid = ", typeid(*socket).name());
+					it->err_code = -1;
+					continue;
+				}
+				int err_code;
+				try {
+					err_code = socket->poll_read_and_process(io_buffer.data(), io_buffer.size(), it->ready);
+					POSEIDON_LOG_TRACE("Socket read result: socket = ", socket, ", typeid = ", typeid(*socket).name(), ", err_code = ", err_code);
+				} catch(std::exception &e){
+					POSEIDON_LOG_WARNING("std::exception thrown: what = ", e.what(), ", socket = ", socket, ", typeid = ", typeid(*socket).name());
+					err_code = ECONNRESET;
+				} catch(...){
+					POSEIDON_LOG_WARNING("Unknown exception thrown: socket = ", socket, ", typeid = ", typeid(*socket).name());
+					err_code = ECONNRESET;
+				}
+				if((err_code != 0) && (err_code != EINTR) && (err_code != EWOULDBLOCK) && (err_code != EAGAIN)){
+					POSEIDON_LOG_DEBUG("Socket read error: socket = ", socket, ", typeid = ", typeid(*socket).name(), ", err_code = ", err_code, " (", get_error_desc(err_code), ")");
+					socket->force_shutdown();
+				}
+				it->err_code = err_code;
+			}
 
-	bool pump_one_writable_socket(boost::container::vector<unsigned char> &io_buffer) NOEXCEPT {
-		POSEIDON_PROFILE_ME;
+			const AUTO(now, get_fast_mono_clock());
+			const Recursive_mutex::Unique_lock lock(m_mutex);
+			for(AUTO(it, batch.begin()); it != batch.end(); ++it){
+				const AUTO(elem, it->elem);
+				if((it->err_code == 0) && elem->Sweep_hook::is_linked()){
+					touch_unlocked(*elem, now);
+				}
+				if(elem->Readable_hook::is_linked()){
+					// 在我们读取的同时 epoll 又报告了新的数据。
+					continue;
+				}
+				if(it->err_code == -1){
+					elem->throttled_until = now + 5000;
+					m_throttled_list.push_back(*elem);
+				} else if((it->err_code == 0) || (it->err_code == EINTR)){
+					// 可能还有更多数据，排到队尾以保证公平。
+					m_readable_list.push_back(*elem);
+				}
+				// 否则等待 epoll 的通知。
+			}
+			return true;
+		}
 
-		const AUTO(now, get_fast_mono_clock());
-		boost::shared_ptr<Socket_base> socket;
-		bool writable;
-		{
-			const Recursive_mutex::Unique_lock lock(g_mutex);
-			const AUTO(it, g_socket_map.begin<2>());
-			if(it == g_socket_map.end<2>()){
-				return false;
+		bool pump_writable_sockets(boost::container::vector<Batch_element> &batch, boost::container::vector<unsigned char> &io_buffer) NOEXCEPT {
+			POSEIDON_PROFILE_ME;
+
+			batch.clear();
+			{
+				const Recursive_mutex::Unique_lock lock(m_mutex);
+				pop_batch_unlocked(batch, m_writable_list);
+				for(AUTO(it, batch.begin()); it != batch.end(); ++it){
+					it->ready = it->elem->writable;
+				}
 			}
-			if(now < it->write_time){
+			if(batch.empty()){
 				return false;
 			}
-			socket = it->weakable->lock();
-			if(!socket){
-				g_socket_map.erase<2>(it);
-				return true;
+
+			for(AUTO(it, batch.begin()); it != batch.end(); ++it){
+				const AUTO_REF(socket, it->socket);
+				Mutex::Unique_lock write_lock;
+				int err_code;
+				try {
+					err_code = socket->poll_write(write_lock, io_buffer.data(), io_buffer.size(), it->ready);
+					POSEIDON_LOG_TRACE("Socket write result: socket = ", socket, ", typeid = ", typeid(*socket).name(), ", err_code = ", err_code);
+				} catch(std::exception &e){
+					POSEIDON_LOG(Logger::special_major | Logger::level_info, "std::exception thrown: what = ", e.what(), ", socket = ", socket, ", typeid = ", typeid(*socket).name());
+					err_code = ECONNRESET;
+				} catch(...){
+					POSEIDON_LOG(Logger::special_major | Logger::level_info, "Unknown exception thrown: socket = ", socket, ", typeid = ", typeid(*socket).name());
+					err_code = ECONNRESET;
+				}
+				if((err_code != 0) && (err_code != EINTR) && (err_code != EWOULDBLOCK) && (err_code != EAGAIN)){
+					POSEIDON_LOG_DEBUG("Socket write error: socket = ", socket, ", typeid = ", typeid(*socket).name(), ", err_code = ", err_code, " (", get_error_desc(err_code), ")");
+					socket->force_shutdown();
+				}
+				it->err_code = err_code;
 			}
-			writable = it->writable;
-		}
 
-		Mutex::Unique_lock write_lock;
-		int err_code;
-		try {
-			err_code = socket->poll_write(write_lock, io_buffer.data(), io_buffer.size(), writable);
-			POSEIDON_LOG_TRACE("Socket write result: socket = ", socket, ", typeid = ", typeid(*socket).name(), ", err_code = ", err_code);
-		} catch(std::exception &e){
-			POSEIDON_LOG(Logger::special_major | Logger::level_info, "std::exception thrown: what = ", e.what(), ", socket = ", socket, ", typeid = ", typeid(*socket).name());
-			err_code = ECONNRESET;
-		} catch(...){
-			POSEIDON_LOG(Logger::special_major | Logger::level_info, "Unknown exception thrown: socket = ", socket, ", typeid = ", typeid(*socket).name());
-			err_code = ECONNRESET;
-		}
-		if((err_code == 0) || (err_code == EINTR)){
-			// Success.
-		} else if((err_code == EWOULDBLOCK) || (err_code == EAGAIN)){
-			const Recursive_mutex::Unique_lock lock(g_mutex);
-			const AUTO(it, g_socket_map.find<0>(socket.get()));
-			if(it != g_socket_map.end<0>()){
-				g_socket_map.set_key<0, 2>(it, -1ull);
-			}
-		} else {
-			POSEIDON_LOG_DEBUG("Socket write error: socket = ", socket, ", typeid = ", typeid(*socket).name(), ", err_code = ", err_code, " (", get_error_desc(err_code), ")");
-			socket->force_shutdown();
-		}
-		return true;
-	}
+			const AUTO(now, get_fast_mono_clock());
+			const Recursive_mutex::Unique_lock lock(m_mutex);
+			for(AUTO(it, batch.begin()); it != batch.end(); ++it){
+				const AUTO(elem, it->elem);
+				if((it->err_code == 0) && elem->Sweep_hook::is_linked()){
+					touch_unlocked(*elem, now);
+				}
+				if(elem->Writable_hook::is_linked()){
+					// 在我们写入的同时有新的数据被放入发送队列。
+					continue;
+				}
+				if((it->err_code == 0) || (it->err_code == EINTR)){
+					m_writable_list.push_back(*elem);
+				}
+				// 否则等待 epoll 或 mark_socket_writable() 的通知。
+			}
+			return true;
+		}
 
-	bool pump_one_closed_socket() NOEXCEPT {
-		POSEIDON_PROFILE_ME;
+		bool pump_closed_sockets(boost::container::vector<Batch_element> &batch) NOEXCEPT {
+			POSEIDON_PROFILE_ME;
 
-		// const AUTO(now, get_fast_mono_clock());
-		boost::shared_ptr<Socket_base> socket;
-		int err_code;
-		{
-			const Recursive_mutex::Unique_lock lock(g_mutex);
-			const AUTO(it, g_socket_map.lower_bound<3>(0));
-			if(it == g_socket_map.end<3>()){
+			batch.clear();
+			{
+				const Recursive_mutex::Unique_lock lock(m_mutex);
+				pop_batch_unlocked(batch, m_closed_list);
+				for(AUTO(it, batch.begin()); it != batch.end(); ++it){
+					it->err_code = it->elem->err_code;
+				}
+			}
+			if(batch.empty()){
 				return false;
 			}
-			socket = it->weakable->lock();
-			if(!socket){
-				g_socket_map.erase<3>(it);
-				return true;
+
+			for(AUTO(it, batch.begin()); it != batch.end(); ++it){
+				const AUTO_REF(socket, it->socket);
+				socket->mark_shutdown();
+				try {
+					POSEIDON_LOG_DEBUG("Socket closed: socket = ", socket, ", typeid = ", typeid(*socket).name(), ", err_code = ", it->err_code, " (", get_error_desc(it->err_code), ")");
+					socket->on_close(it->err_code);
+				} catch(std::exception &e){
+					POSEIDON_LOG(Logger::special_major | Logger::level_info, "std::exception thrown: what = ", e.what(), ", socket = ", socket, ", typeid = ", typeid(*socket).name());
+				} catch(...){
+					POSEIDON_LOG(Logger::special_major | Logger::level_info, "Unknown exception thrown: socket = ", socket, ", typeid = ", typeid(*socket).name());
+				}
 			}
-			err_code = it->err_code;
+
+			const Recursive_mutex::Unique_lock lock(m_mutex);
+			for(AUTO(it, batch.begin()); it != batch.end(); ++it){
+				m_socket_map.erase(it->socket.get());
+			}
+			return true;
 		}
 
-		socket->mark_shutdown();
-		try {
-			POSEIDON_LOG_DEBUG("Socket closed: socket = ", socket, ", typeid = ", typeid(*socket).name(), ", err_code = ", err_code, " (", get_error_desc(err_code), ")");
-			socket->on_close(err_code);
-		} catch(std::exception &e){
-			POSEIDON_LOG(Logger::special_major | Logger::level_info, "std::exception thrown: what = ", e.what(), ", socket = ", socket, ", typeid = ", typeid(*socket).name());
-		} catch(...){
-			POSEIDON_LOG(Logger::special_major | Logger::level_info, "Unknown exception thrown: socket = ", socket, ", typeid = ", typeid(*socket).name());
+		bool sweep_sockets(boost::container::vector<Batch_element> &batch) NOEXCEPT {
+			POSEIDON_PROFILE_ME;
+
+			batch.clear();
+			const AUTO(now, get_fast_mono_clock());
+			{
+				const Recursive_mutex::Unique_lock lock(m_mutex);
+				if(m_sweep_list.empty() || (now < m_next_sweep_time)){
+					return false;
+				}
+				++m_sweep_round;
+				// 截止时间已过的。
+				while(!m_deadline_list.empty() && (m_deadline_list.front().shutdown_time < now) && (batch.size() < batch_size)){
+					AUTO_REF(elem, m_deadline_list.front());
+					m_deadline_list.pop_front();
+					push_sweep_unlocked(batch, elem);
+				}
+				// 长时间没有收发数据的。在下一次成功收发数据之前不会再被放回队列。
+				while(!m_idle_list.empty() && (saturated_sub(now, m_idle_list.front().last_use_time) > m_response_timeout) && (batch.size() < batch_size)){
+					AUTO_REF(elem, m_idle_list.front());
+					m_idle_list.pop_front();
+					push_sweep_unlocked(batch, elem);
+				}
+				// 周期性地调用，用于 PING 等。
+				while(!m_sweep_list.empty() && (m_sweep_list.front().next_sweep_time <= now) && (batch.size() < batch_size)){
+					AUTO_REF(elem, m_sweep_list.front());
+					m_sweep_list.pop_front();
+					elem.next_sweep_time = saturated_add(now, m_sweep_period);
+					m_sweep_list.push_back(elem);
+					push_sweep_unlocked(batch, elem);
+				}
+				if(batch.size() < batch_size){
+					// 已经处理完所有到期的元素，否则立即开始下一批。
+					m_next_sweep_time = saturated_add(now, m_sweep_interval);
+				}
+			}
+			if(batch.empty()){
+				return false;
+			}
+
+			for(AUTO(it, batch.begin()); it != batch.end(); ++it){
+				const AUTO_REF(socket, it->socket);
+				try {
+					socket->on_sweep(now);
+				} catch(std::exception &e){
+					POSEIDON_LOG_WARNING("std::exception thrown: what = ", e.what(), ", socket = ", socket, ", typeid = ", typeid(*socket).name());
+					socket->force_shutdown();
+				} catch(...){
+					POSEIDON_LOG_WARNING("Unknown exception thrown: socket = ", socket, ", typeid = ", typeid(*socket).name());
+					socket->force_shutdown();
+				}
+			}
+			return true;
 		}
-		const Recursive_mutex::Unique_lock lock(g_mutex);
-		const AUTO(it, g_socket_map.find<0>(socket.get()));
-		if(it != g_socket_map.end<0>()){
-			g_socket_map.erase<0>(it);
+
+		void thread_proc(){
+			POSEIDON_PROFILE_ME;
+			POSEIDON_LOG(Logger::special_major | Logger::level_info, "Epoll daemon started.");
+
+			boost::container::vector<unsigned char> io_buffer;
+			const AUTO(io_buffer_size, Main_config::get<std::size_t>("epoll_io_buffer_size", 4096));
+			io_buffer.resize(std::max<std::size_t>(io_buffer_size, 508)); // 508 is the maximum size of UDP packets guaranteed to be transmitted.
+
+			boost::container::vector<Batch_element> batch;
+			batch.reserve(batch_size);
+			for(;;){
+				wait_for_sockets();
+
+				bool busy = false;
+				busy += pump_readable_sockets(batch, io_buffer);
+				busy += pump_writable_sockets(batch, io_buffer);
+				busy += pump_closed_sockets(batch);
+				busy += sweep_sockets(batch);
+				batch.clear();
+
+				if(!busy && !atomic_load(m_running, memory_order_consume)){
+					break;
+				}
+			}
+
+			POSEIDON_LOG(Logger::special_major | Logger::level_info, "Epoll daemon stopped.");
 		}
-		return true;
-	}
 
-	void thread_proc(){
-		POSEIDON_PROFILE_ME;
-		POSEIDON_LOG(Logger::special_major | Logger::level_info, "Epoll daemon started.");
+	public:
+		std::size_t get_index() const NOEXCEPT {
+			return m_index;
+		}
 
-		boost::container::vector<unsigned char> io_buffer;
-		const AUTO(io_buffer_size, Main_config::get<std::size_t>("epoll_io_buffer_size", 4096));
-		io_buffer.resize(std::max<std::size_t>(io_buffer_size, 508)); // 508 is the maximum size of UDP packets guaranteed to be transmitted.
+		void start(){
+			const Recursive_mutex::Unique_lock lock(m_mutex);
+			atomic_store(m_running, true, memory_order_release);
+			Thread(boost::bind(&Epoll_reactor::thread_proc, this), Rcnts::view("   N"), Rcnts::view("Network")).swap(m_thread);
+		}
+		void stop(){
+			const Recursive_mutex::Unique_lock lock(m_mutex);
+			atomic_store(m_running, false, memory_order_release);
+			signal_wakeup();
+		}
+		void safe_join(){
+			if(m_thread.joinable()){
+				m_thread.join();
+			}
 
-		unsigned timeout = 0;
-		for(;;){
-			bool busy;
-			do {
-				busy = wait_for_sockets(0);
-				busy += pump_one_readable_socket(io_buffer);
-				busy += pump_one_writable_socket(io_buffer);
-				busy += pump_one_closed_socket();
-				timeout = std::min(timeout * 2u + 1u, !busy * 100u);
-			} while(busy);
+			const Recursive_mutex::Unique_lock lock(m_mutex);
+			m_socket_map.clear();
+		}
 
-			if(!atomic_load(g_running, memory_order_consume)){
-				break;
+		std::size_t get_socket_count() const {
+			const Recursive_mutex::Unique_lock lock(m_mutex);
+			return m_socket_map.size();
+		}
+		void add_socket(const boost::shared_ptr<Socket_base> &socket, bool take_ownership){
+			POSEIDON_PROFILE_ME;
+
+			const AUTO(elem, boost::make_shared<Socket_element>());
+			elem->weakable = boost::make_shared<Weakable_socket>(take_ownership, socket);
+			elem->ptr = socket.get();
+			elem->throttled_until = 0;
+			elem->err_code = -1;
+			elem->readable = false;
+			elem->writable = false;
+			elem->last_use_time = 0;
+			elem->shutdown_time = -1ull;
+			elem->next_sweep_time = 0;
+			elem->sweep_round = 0;
+
+			const Recursive_mutex::Unique_lock lock(m_mutex);
+			// 停止之后加入的套接字永远不会被处理，也不会被释放。
+			POSEIDON_THROW_UNLESS(atomic_load(m_running, memory_order_consume), Exception, Rcnts::view("Epoll daemon is not running"));
+			const AUTO(result, m_socket_map.emplace(socket.get(), elem));
+			POSEIDON_THROW_UNLESS(result.second, Exception, Rcnts::view("Socket is already in epoll"));
+			try {
+				::epoll_event event = { };
+				event.events = static_cast<boost::uint32_t>(EPOLLIN | EPOLLOUT | EPOLLET);
+				event.data.ptr = socket.get();
+				POSEIDON_THROW_UNLESS(::epoll_ctl(m_epoll.get(), EPOLL_CTL_ADD, socket->get_fd(), &event) == 0, System_exception);
+			} catch(...){
+				m_socket_map.erase(result.first);
+				throw;
+			}
+			m_readable_list.push_back(*elem);
+			m_writable_list.push_back(*elem);
+			wake_up_unlocked();
+		}
+		bool mark_socket_writable(const volatile Socket_base *ptr) NOEXCEPT {
+			const Recursive_mutex::Unique_lock lock(m_mutex);
+			const AUTO(it, m_socket_map.find(ptr));
+			if(it == m_socket_map.end()){
+				return false;
+			}
+			const AUTO(elem, it->second.get());
+			if(!elem->Writable_hook::is_linked()){
+				m_writable_list.push_back(*elem);
+				wake_up_unlocked();
+			}
+			return true;
+		}
+		bool set_socket_deadline(const volatile Socket_base *ptr, boost::uint64_t shutdown_time) NOEXCEPT {
+			const AUTO(now, get_fast_mono_clock());
+			const Recursive_mutex::Unique_lock lock(m_mutex);
+			const AUTO(it, m_socket_map.find(ptr));
+			if(it == m_socket_map.end()){
+				return false;
+			}
+			const AUTO(elem, it->second.get());
+			if(!elem->Sweep_hook::is_linked()){
+				const bool was_empty = m_sweep_list.empty();
+				elem->next_sweep_time = saturated_add(now, m_sweep_period);
+				m_sweep_list.push_back(*elem);
+				touch_unlocked(*elem, now);
+				if(was_empty){
+					// 可能正在无限等待，需要重新计算超时。
+					wake_up_unlocked();
+				}
+			}
+			elem->shutdown_time = shutdown_time;
+			link_deadline_unlocked(*elem);
+			return true;
+		}
+		void snapshot(boost::container::vector<Epoll_daemon::Snapshot_element> &ret) const {
+			const Recursive_mutex::Unique_lock lock(m_mutex);
+			ret.reserve(ret.size() + m_socket_map.size());
+			for(AUTO(it, m_socket_map.begin()); it != m_socket_map.end(); ++it){
+				const AUTO(socket, it->second->weakable->lock());
+				if(!socket){
+					continue;
+				}
+				Epoll_daemon::Snapshot_element elem = { };
+				elem.remote_info = socket->get_remote_info();
+				elem.local_info = socket->get_local_info();
+				elem.creation_time = socket->get_creation_time();
+				elem.listening = socket->is_listening();
+				elem.readable = it->second->readable;
+				elem.writable = it->second->writable;
+				elem.shard = m_index;
+				ret.push_back(STD_MOVE(elem));
 			}
-			wait_for_sockets(timeout);
 		}
+	};
+
+	volatile bool g_running = false;
+	volatile Epoll_daemon::Shard_policy g_shard_policy = Epoll_daemon::shard_policy_round_robin;
+	volatile std::size_t g_round_robin_counter = 0;
+	// 只在 start() 中修改。停止之后其他守护线程仍然可能访问，因此不会被销毁。
+	boost::container::vector<boost::shared_ptr<Epoll_reactor> > g_reactors;
 
-		POSEIDON_LOG(Logger::special_major | Logger::level_info, "Epoll daemon stopped.");
+	std::size_t select_shard(const Socket_base &socket){
+		POSEIDON_PROFILE_ME;
+
+		const std::size_t count = g_reactors.size();
+		if(count <= 1){
+			return 0;
+		}
+		switch(atomic_load(g_shard_policy, memory_order_relaxed)){
+		case Epoll_daemon::shard_policy_least_loaded:
+			{
+				std::size_t index = 0;
+				std::size_t min_load = SIZE_MAX;
+				for(std::size_t i = 0; i < count; ++i){
+					const AUTO(load, g_reactors.at(i)->get_socket_count());
+					if(load < min_load){
+						index = i;
+						min_load = load;
+					}
+				}
+				return index;
+			}
+		case Epoll_daemon::shard_policy_fd_hash:
+			return (static_cast<std::size_t>(socket.get_fd()) * 0x9E3779B9u >> 8) % count;
+		default:
+			return atomic_add(g_round_robin_counter, 1, memory_order_relaxed) % count;
+		}
 	}
 }
 
@@ -312,8 +730,30 @@ void Epoll_daemon::start(){
 	}
 	POSEIDON_LOG(Logger::special_major | Logger::level_info, "Starting epoll daemon...");
 
-	POSEIDON_THROW_UNLESS(g_epoll.reset(::epoll_create(100)), System_exception);
-	Thread(&thread_proc, Rcnts::view("   N"), Rcnts::view("Network")).swap(g_thread);
+	const AUTO(thread_count, Main_config::get<std::size_t>("epoll_thread_count", 1));
+	if(thread_count == 0){
+		POSEIDON_LOG_FATAL("You shall not set `epoll_thread_count` in `main.conf` to zero.");
+		std::terminate();
+	}
+	const AUTO(policy, Main_config::get<std::string>("epoll_shard_policy", "round_robin"));
+	if(policy == "least_loaded"){
+		set_shard_policy(shard_policy_least_loaded);
+	} else if(policy == "fd_hash"){
+		set_shard_policy(shard_policy_fd_hash);
+	} else {
+		if(policy != "round_robin"){
+			POSEIDON_LOG_WARNING("Unknown `epoll_shard_policy` in `main.conf`: ", policy, ". Using `round_robin` instead.");
+		}
+		set_shard_policy(shard_policy_round_robin);
+	}
+
+	g_reactors.resize(thread_count);
+	for(std::size_t i = 0; i < g_reactors.size(); ++i){
+		POSEIDON_LOG(Logger::special_major | Logger::level_debug, "Creating epoll reactor ", i);
+		AUTO_REF(reactor, g_reactors.at(i));
+		reactor = boost::make_shared<Epoll_reactor>(i);
+		reactor->start();
+	}
 }
 void Epoll_daemon::stop(){
 	if(atomic_exchange(g_running, false, memory_order_acq_rel) == false){
@@ -321,65 +761,85 @@ void Epoll_daemon::stop(){
 	}
 	POSEIDON_LOG(Logger::special_major | Logger::level_info, "Stopping epoll daemon...");
 
-	if(g_thread.joinable()){
-		g_thread.join();
+	for(std::size_t i = 0; i < g_reactors.size(); ++i){
+		const AUTO_REF(reactor, g_reactors.at(i));
+		if(!reactor){
+			continue;
+		}
+		reactor->stop();
 	}
+	for(std::size_t i = 0; i < g_reactors.size(); ++i){
+		const AUTO_REF(reactor, g_reactors.at(i));
+		if(!reactor){
+			continue;
+		}
+		POSEIDON_LOG(Logger::special_major | Logger::level_info, "Waiting for epoll reactor ", i, " to terminate...");
+		reactor->safe_join();
+	}
+}
 
-	const Recursive_mutex::Unique_lock lock(g_mutex);
-	g_socket_map.clear();
-	g_epoll.reset();
+std::size_t Epoll_daemon::get_shard_count() NOEXCEPT {
+	return g_reactors.size();
+}
+Epoll_daemon::Shard_policy Epoll_daemon::get_shard_policy() NOEXCEPT {
+	return atomic_load(g_shard_policy, memory_order_relaxed);
+}
+void Epoll_daemon::set_shard_policy(Epoll_daemon::Shard_policy policy) NOEXCEPT {
+	atomic_store(g_shard_policy, policy, memory_order_relaxed);
 }
 
 void Epoll_daemon::add_socket(const boost::shared_ptr<Socket_base> &socket, bool take_ownership){
 	POSEIDON_PROFILE_ME;
+	POSEIDON_THROW_UNLESS(atomic_load(g_running, memory_order_consume), Exception, Rcnts::view("Epoll daemon is not running"));
 
-	const AUTO(now, get_fast_mono_clock());
-	const Recursive_mutex::Unique_lock lock(g_mutex);
-	Socket_element elem = { boost::make_shared<Weakable_socket>(take_ownership, socket), socket.get(), now, now, -1 };
-	const AUTO(result, g_socket_map.insert(STD_MOVE(elem)));
-	POSEIDON_THROW_UNLESS(result.second, Exception, Rcnts::view("Socket is already in epoll"));
-	try {
-		::epoll_event event = { };
-		event.events = static_cast<boost::uint32_t>(EPOLLIN | EPOLLOUT | EPOLLET);
-		event.data.ptr = socket.get();
-		POSEIDON_THROW_UNLESS(::epoll_ctl(g_epoll.get(), EPOLL_CTL_ADD, socket->get_fd(), &event) == 0, System_exception);
-	} catch(...){
-		g_socket_map.erase(result.first);
-		throw;
-	}
+	const AUTO(shard, select_shard(*socket));
+	atomic_store(socket->m_epoll_shard, shard, memory_order_release);
+	g_reactors.at(shard)->add_socket(socket, take_ownership);
+	POSEIDON_LOG_TRACE("Added socket to epoll reactor ", shard, ": socket = ", socket, ", typeid = ", typeid(*socket).name());
 }
 bool Epoll_daemon::mark_socket_writable(const volatile Socket_base *ptr) NOEXCEPT {
 	POSEIDON_PROFILE_ME;
 
-	const Recursive_mutex::Unique_lock lock(g_mutex);
-	const AUTO(it, g_socket_map.find<0>(ptr));
-	if(it == g_socket_map.end()){
+	if(!atomic_load(g_running, memory_order_consume)){
+		POSEIDON_LOG_TRACE("Epoll daemon is not running: ptr = ", ptr);
+		return false;
+	}
+	const AUTO(shard, atomic_load(ptr->m_epoll_shard, memory_order_acquire));
+	if(shard >= g_reactors.size()){
+		POSEIDON_LOG_TRACE("Epoll reactor not found: ptr = ", ptr, ", shard = ", shard);
+		return false;
+	}
+	if(!g_reactors.at(shard)->mark_socket_writable(ptr)){
+		POSEIDON_LOG_TRACE("Socket not found in epoll: ptr = ", ptr);
+		return false;
+	}
+	return true;
+}
+
+bool Epoll_daemon::set_socket_deadline(const volatile Socket_base *ptr, boost::uint64_t shutdown_time) NOEXCEPT {
+	POSEIDON_PROFILE_ME;
+
+	if(!atomic_load(g_running, memory_order_consume)){
+		POSEIDON_LOG_TRACE("Epoll daemon is not running: ptr = ", ptr);
+		return false;
+	}
+	const AUTO(shard, atomic_load(ptr->m_epoll_shard, memory_order_acquire));
+	if(shard >= g_reactors.size()){
+		POSEIDON_LOG_TRACE("Epoll reactor not found: ptr = ", ptr, ", shard = ", shard);
+		return false;
+	}
+	if(!g_reactors.at(shard)->set_socket_deadline(ptr, shutdown_time)){
 		POSEIDON_LOG_TRACE("Socket not found in epoll: ptr = ", ptr);
 		return false;
 	}
-	const AUTO(now, get_fast_mono_clock());
-	g_socket_map.set_key<0, 2>(it, now);
 	return true;
 }
 
 void Epoll_daemon::snapshot(boost::container::vector<Epoll_daemon::Snapshot_element> &ret){
 	POSEIDON_PROFILE_ME;
 
-	const Recursive_mutex::Unique_lock lock(g_mutex);
-	ret.reserve(ret.size() + g_socket_map.size());
-	for(AUTO(it, g_socket_map.begin()); it != g_socket_map.end(); ++it){
-		const AUTO(socket, it->weakable->lock());
-		if(!socket){
-			continue;
-		}
-		Snapshot_element elem = { };
-		elem.remote_info = socket->get_remote_info();
-		elem.local_info = socket->get_local_info();
-		elem.creation_time = socket->get_creation_time();
-		elem.listening = socket->is_listening();
-		elem.readable = it->readable;
-		elem.writable = it->writable;
-		ret.push_back(STD_MOVE(elem));
+	for(std::size_t i = 0; i < g_reactors.size(); ++i){
+		g_reactors.at(i)->snapshot(ret);
 	}
 }
 
@@ -23,6 +23,14 @@ public:
 		bool listening;
 		bool readable;
 		bool writable;
+		std::size_t shard;
+	};
+
+	// 新的套接字按照此策略分配到各个 epoll 线程上。
+	enum Shard_policy {
+		shard_policy_round_robin   = 0,
+		shard_policy_least_loaded  = 1,
+		shard_policy_fd_hash       = 2,
 	};
 
 private:
@@ -32,8 +40,16 @@ public:
 	static void start();
 	static void stop();
 
+	static std::size_t get_shard_count() NOEXCEPT;
+	static Shard_policy get_shard_policy() NOEXCEPT;
+	static void set_shard_policy(Shard_policy policy) NOEXCEPT;
+
 	static void add_socket(const boost::shared_ptr<Socket_base> &socket, bool take_ownership = false);
 	static bool mark_socket_writable(const volatile Socket_base *ptr) NOEXCEPT;
+	// 把套接字加入所属 epoll 线程的超时清扫队列并设定截止时间（-1 表示没有）。
+	// 此后其 on_sweep() 会在截止时间已过、长时间没有收发数据或者每隔 tcp_shutdown_timer_period 毫秒时被调用。
+	// 套接字不在 epoll 中时返回 false。
+	static bool set_socket_deadline(const volatile Socket_base *ptr, boost::uint64_t shutdown_time) NOEXCEPT;
 
 	static void snapshot(boost::container::vector<Snapshot_element> &ret);
 };
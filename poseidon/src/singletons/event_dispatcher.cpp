@@ -4,52 +4,316 @@
 #include "../precompiled.hpp"
 #include "event_dispatcher.hpp"
 #include "job_dispatcher.hpp"
+#include "timer_daemon.hpp"
 #include "../event_base.hpp"
 #include "../log.hpp"
 #include "../mutex.hpp"
+#include "../atomic.hpp"
+#include "../time.hpp"
+#include "../checked_arithmetic.hpp"
 #include "../job_base.hpp"
 #include "../profiler.hpp"
+#include <pthread.h>
 
 namespace Poseidon {
 
 typedef Event_dispatcher::Event_listener_callback Event_listener_callback;
 
+namespace {
+	struct Type_info_comparator {
+		bool operator()(const std::type_info *lhs, const std::type_info *rhs) const NOEXCEPT {
+			return (*lhs).before(*rhs);
+		}
+	};
+
+	struct Event_counters {
+		volatile unsigned long long sync_raises;
+		volatile unsigned long long async_raises;
+		volatile unsigned long long coalesced;
+		volatile unsigned long long listener_calls;
+		volatile unsigned long long exceptions;
+		volatile unsigned long long total_time;
+		volatile unsigned long long max_time;
+		volatile unsigned long long total_queue_time;
+		volatile unsigned long long max_queue_time;
+	};
+
+	void update_max(volatile unsigned long long &max, unsigned long long value) NOEXCEPT {
+		AUTO(old, atomic_load(max, memory_order_relaxed));
+		while(old < value){
+			if(atomic_compare_exchange(max, old, value, memory_order_relaxed, memory_order_relaxed)){
+				break;
+			}
+		}
+	}
+
+	void record_dispatch(Event_counters &counters, std::size_t calls, boost::uint64_t elapsed) NOEXCEPT {
+		atomic_add(counters.listener_calls, calls, memory_order_relaxed);
+		atomic_add(counters.total_time, elapsed, memory_order_relaxed);
+		update_max(counters.max_time, elapsed);
+	}
+	void record_queue_time(Event_counters &counters, boost::uint64_t raise_time) NOEXCEPT {
+		const AUTO(queue_time, get_mono_clock_us() - raise_time);
+		atomic_add(counters.total_queue_time, queue_time, memory_order_relaxed);
+		update_max(counters.max_queue_time, queue_time);
+	}
+
+	struct Coalescing_key {
+		const std::type_info *type_info;
+		boost::uint64_t key;
+	};
+	struct Coalescing_key_comparator {
+		bool operator()(const Coalescing_key &lhs, const Coalescing_key &rhs) const NOEXCEPT {
+			if(lhs.type_info != rhs.type_info){
+				return (*(lhs.type_info)).before(*(rhs.type_info));
+			}
+			return lhs.key < rhs.key;
+		}
+	};
+
+	// 尚未投递的异步事件。
+	struct Pending_event {
+		boost::shared_ptr<Event_base> event;
+		boost::shared_ptr<const bool> withdrawn;
+		boost::uint64_t raise_time;
+	};
+
+	// 有合并 key 的事件，在被处理之前保存在这里，再次触发时只替换 event 和 withdrawn。
+	Mutex g_pending_mutex;
+	boost::container::map<Coalescing_key, Pending_event, Coalescing_key_comparator> g_pending_events;
+}
+
 class Event_listener : NONCOPYABLE {
 private:
-	Event_listener_callback m_callback;
+	const Event_listener_callback m_callback;
+	const boost::uint64_t m_delivery_interval;
+	const boost::shared_ptr<Event_counters> m_counters;
+
+	// 以下成员只用于有 delivery_interval 的响应器。
+	mutable Mutex m_mutex;
+	mutable boost::container::vector<Pending_event> m_pending;
+	mutable boost::container::flat_map<Coalescing_key, std::size_t, Coalescing_key_comparator> m_pending_keys;
+	mutable boost::shared_ptr<Timer> m_timer;
+	mutable boost::uint64_t m_last_delivery;
 
 public:
-	explicit Event_listener(Event_listener_callback callback)
-		: m_callback(STD_MOVE_IDN(callback))
+	Event_listener(Event_listener_callback callback, boost::uint64_t delivery_interval, boost::shared_ptr<Event_counters> counters)
+		: m_callback(STD_MOVE_IDN(callback)), m_delivery_interval(delivery_interval), m_counters(STD_MOVE(counters))
+		, m_last_delivery(0)
 	{
 		//
 	}
 
+private:
+	static void deliver_timer_proc(const boost::weak_ptr<const Event_listener> &weak_listener){
+		const AUTO(listener, weak_listener.lock());
+		if(!listener){
+			return;
+		}
+		listener->deliver_pending();
+	}
+
+	void deliver_pending() const {
+		POSEIDON_PROFILE_ME;
+
+		boost::container::vector<Pending_event> pending;
+		{
+			const Mutex::Unique_lock lock(m_mutex);
+			pending.swap(m_pending);
+			m_pending_keys.clear();
+			m_timer.reset();
+			m_last_delivery = get_fast_mono_clock();
+		}
+		AUTO_REF(counters, *m_counters);
+		const AUTO(begin, get_mono_clock_us());
+		std::size_t calls = 0;
+		for(AUTO(it, pending.begin()); it != pending.end(); ++it){
+			if(it->withdrawn && *(it->withdrawn)){
+				continue;
+			}
+			record_queue_time(counters, it->raise_time);
+			++calls;
+			try {
+				m_callback(it->event);
+			} catch(std::exception &e){
+				POSEIDON_LOG_WARNING("std::exception thrown from event listener: what = ", e.what());
+				atomic_add(counters.exceptions, 1, memory_order_relaxed);
+			} catch(...){
+				POSEIDON_LOG_WARNING("Unknown exception thrown from event listener");
+				atomic_add(counters.exceptions, 1, memory_order_relaxed);
+			}
+		}
+		record_dispatch(counters, calls, get_mono_clock_us() - begin);
+	}
+
 public:
 	const Event_listener_callback & get_callback() const {
 		return m_callback;
 	}
+	boost::uint64_t get_delivery_interval() const {
+		return m_delivery_interval;
+	}
+
+	// 暂存一个异步事件，如果还没有计时器就创建一个。返回 true 表示这个事件替换了暂存的同一个 key 的事件。
+	bool post(const boost::shared_ptr<const Event_listener> &self, const boost::shared_ptr<Event_base> &event, const Coalescing_key *key, const boost::shared_ptr<const bool> &withdrawn) const {
+		const Mutex::Unique_lock lock(m_mutex);
+		bool coalesced = false;
+		if(key){
+			const AUTO(it, m_pending_keys.find(*key));
+			if(it != m_pending_keys.end()){
+				AUTO_REF(elem, m_pending.at(it->second));
+				elem.event = event;
+				elem.withdrawn = withdrawn;
+				coalesced = true;
+			}
+		}
+		if(!coalesced){
+			Pending_event elem = { event, withdrawn, get_mono_clock_us() };
+			m_pending.push_back(STD_MOVE(elem));
+			if(key){
+				try {
+					m_pending_keys.emplace(*key, m_pending.size() - 1);
+				} catch(...){
+					m_pending.pop_back();
+					throw;
+				}
+			}
+		}
+		if(!m_timer){
+			const AUTO(now, get_fast_mono_clock());
+			const AUTO(next, saturated_add(m_last_delivery, m_delivery_interval));
+			m_timer = Timer_daemon::register_timer((next > now) ? (next - now) : 0, 0, boost::bind(&Event_listener::deliver_timer_proc, boost::weak_ptr<const Event_listener>(self)));
+		}
+		return coalesced;
+	}
 };
 
 namespace {
-	struct Type_info_comparator {
-		bool operator()(const std::type_info *lhs, const std::type_info *rhs) const NOEXCEPT {
-			return (*lhs).before(*rhs);
-		}
+	struct Listener_slot {
+		boost::container::vector<boost::weak_ptr<const Event_listener> > listeners;
+		// 有 delivery_interval 的响应器。
+		boost::container::vector<boost::weak_ptr<const Event_listener> > limited_listeners;
+		boost::shared_ptr<Event_counters> counters;
+	};
+	typedef boost::container::flat_map<const std::type_info *, Listener_slot, Type_info_comparator> Listener_map;
+
+	// 响应器表创建之后就不再修改。注册响应器时复制一份新的表，然后替换掉旧的。
+	struct Listener_table {
+		unsigned long version;
+		Listener_map map;
 	};
-	typedef boost::container::flat_multimap<const std::type_info *, boost::weak_ptr<const Event_listener>, Type_info_comparator> Listener_map;
 
 	Mutex g_mutex;
-	Listener_map g_listeners;
+	boost::shared_ptr<const Listener_table> g_table;
+	volatile unsigned long g_version = 0;
+
+	// 每个线程缓存一份响应器表。只有在版本号改变之后才需要锁定 g_mutex 取得新的表。
+	struct Listener_thread_cache {
+		boost::shared_ptr<const Listener_table> *table;
+		unsigned long version;
+	};
+	__thread Listener_thread_cache t_listener_cache;
+
+	::pthread_once_t g_listener_key_once = PTHREAD_ONCE_INIT;
+	::pthread_key_t g_listener_key;
+
+	void listener_flush_thread_cache(void *param) NOEXCEPT {
+		const AUTO(cache, static_cast<Listener_thread_cache *>(param));
+		delete cache->table;
+		cache->table = NULLPTR;
+	}
+	void listener_create_key() NOEXCEPT {
+		if(::pthread_key_create(&g_listener_key, &listener_flush_thread_cache) != 0){
+			std::terminate();
+		}
+	}
+
+	boost::shared_ptr<const Listener_table> get_current_table(){
+		AUTO_REF(cache, t_listener_cache);
+		if(!cache.table){
+			// 线程退出时释放缓存的表。
+			::pthread_once(&g_listener_key_once, &listener_create_key);
+			cache.table = new boost::shared_ptr<const Listener_table>();
+			::pthread_setspecific(g_listener_key, &cache);
+			cache.version = 0;
+		}
+		const AUTO(version, atomic_load(g_version, memory_order_acquire));
+		if(cache.version != version){
+			const Mutex::Unique_lock lock(g_mutex);
+			*cache.table = g_table;
+			cache.version = atomic_load(g_version, memory_order_relaxed);
+		}
+		// 复制一份，以免响应器中注册新的响应器时这个表被释放。
+		return *cache.table;
+	}
+
+	void publish_table_unlocked(boost::shared_ptr<Listener_table> table){
+		const AUTO(version, atomic_load(g_version, memory_order_relaxed) + 1);
+		if(table){
+			table->version = version;
+		}
+		g_table = STD_MOVE_IDN(table);
+		atomic_store(g_version, version, memory_order_release);
+	}
+
+	typedef boost::container::vector<boost::weak_ptr<const Event_listener> > Weak_listener_vector;
+
+	bool has_expired_listeners(const Weak_listener_vector &listeners){
+		for(AUTO(it, listeners.begin()); it != listeners.end(); ++it){
+			if(it->expired()){
+				return true;
+			}
+		}
+		return false;
+	}
+	void erase_expired_listeners(Weak_listener_vector &listeners){
+		for(AUTO(it, listeners.begin()); it != listeners.end(); ){
+			if(it->expired()){
+				it = listeners.erase(it);
+			} else {
+				++it;
+			}
+		}
+	}
+
+	// 从表中删除已经失效的响应器。
+	void purge_expired_listeners(const std::type_info &type_info){
+		POSEIDON_PROFILE_ME;
+
+		const Mutex::Unique_lock lock(g_mutex);
+		if(!g_table){
+			return;
+		}
+		const AUTO(it, g_table->map.find(&type_info));
+		if(it == g_table->map.end()){
+			return;
+		}
+		if(!has_expired_listeners(it->second.listeners) && !has_expired_listeners(it->second.limited_listeners)){
+			// 其他线程已经清理过了。
+			return;
+		}
+		AUTO(table, boost::make_shared<Listener_table>(*g_table));
+		AUTO_REF(slot, table->map.at(&type_info));
+		erase_expired_listeners(slot.listeners);
+		erase_expired_listeners(slot.limited_listeners);
+		publish_table_unlocked(STD_MOVE_IDN(table));
+	}
 
 	class Event_job : public Job_base {
 	private:
-		const boost::weak_ptr<const Event_listener> m_weak_listener;
+		// 持有整个表，这样 m_slot 不会失效。
+		const boost::shared_ptr<const Listener_table> m_table;
+		const Listener_slot *const m_slot;
 		const boost::shared_ptr<Event_base> m_event;
+		const boost::uint64_t m_raise_time;
+		// 如果事件有合并 key，真正要投递的事件在 g_pending_events 中。
+		const bool m_coalescing;
+		const Coalescing_key m_key;
 
 	public:
-		Event_job(boost::weak_ptr<const Event_listener> weak_listener, boost::shared_ptr<Event_base> event)
-			: m_weak_listener(STD_MOVE(weak_listener)), m_event(STD_MOVE(event))
+		Event_job(boost::shared_ptr<const Listener_table> table, const Listener_slot *slot, boost::shared_ptr<Event_base> event, const Coalescing_key *key)
+			: m_table(STD_MOVE(table)), m_slot(slot), m_event(STD_MOVE(event)), m_raise_time(get_mono_clock_us())
+			, m_coalescing(key), m_key(key ? *key : Coalescing_key())
 		{
 			//
 		}
@@ -61,11 +325,55 @@ namespace {
 		void perform() OVERRIDE {
 			POSEIDON_PROFILE_ME;
 
-			const AUTO(listener, m_weak_listener.lock());
-			if(!listener){
-				return;
+			AUTO(event, m_event);
+			AUTO(raise_time, m_raise_time);
+			if(m_coalescing){
+				// 取出最后一次触发的事件。在此之后触发的同一个 key 的事件会投递新的任务。
+				boost::shared_ptr<const bool> withdrawn;
+				{
+					const Mutex::Unique_lock lock(g_pending_mutex);
+					const AUTO(it, g_pending_events.find(m_key));
+					if(it == g_pending_events.end()){
+						return;
+					}
+					event.swap(it->second.event);
+					withdrawn.swap(it->second.withdrawn);
+					raise_time = it->second.raise_time;
+					g_pending_events.erase(it);
+				}
+				if(withdrawn && *withdrawn){
+					return;
+				}
+			}
+
+			AUTO_REF(counters, *(m_slot->counters));
+			record_queue_time(counters, raise_time);
+
+			// 与每个响应器一个任务的情况相同，一个响应器抛出异常不影响其他响应器。
+			const AUTO(begin, get_mono_clock_us());
+			std::size_t calls = 0;
+			bool expired = false;
+			for(AUTO(it, m_slot->listeners.begin()); it != m_slot->listeners.end(); ++it){
+				const AUTO(listener, it->lock());
+				if(!listener){
+					expired = true;
+					continue;
+				}
+				++calls;
+				try {
+					listener->get_callback()(event);
+				} catch(std::exception &e){
+					POSEIDON_LOG_WARNING("std::exception thrown from event listener: what = ", e.what());
+					atomic_add(counters.exceptions, 1, memory_order_relaxed);
+				} catch(...){
+					POSEIDON_LOG_WARNING("Unknown exception thrown from event listener");
+					atomic_add(counters.exceptions, 1, memory_order_relaxed);
+				}
+			}
+			record_dispatch(counters, calls, get_mono_clock_us() - begin);
+			if(expired){
+				purge_expired_listeners(typeid(*event));
 			}
-			listener->get_callback()(m_event);
 		}
 	};
 }
@@ -78,33 +386,62 @@ void Event_dispatcher::start(){
 void Event_dispatcher::stop(){
 	POSEIDON_LOG(Logger::special_major | Logger::level_info, "Stopping event dispatcher...");
 
-	const Mutex::Unique_lock lock(g_mutex);
-	g_listeners.clear();
+	{
+		const Mutex::Unique_lock lock(g_mutex);
+		publish_table_unlocked(boost::shared_ptr<Listener_table>());
+	}
+	{
+		const Mutex::Unique_lock lock(g_pending_mutex);
+		g_pending_events.clear();
+	}
 }
 
 void Event_dispatcher::get_listeners(boost::container::vector<boost::shared_ptr<const Event_listener> > &ret, const std::type_info &type_info){
 	POSEIDON_PROFILE_ME;
 
-	const Mutex::Unique_lock lock(g_mutex);
-	const AUTO(range, g_listeners.equal_range(&type_info));
-	ret.reserve(ret.size() + static_cast<std::size_t>(std::distance(range.first, range.second)));
-	bool expired;
-	for(AUTO(it, range.first); it != range.second; expired ? (it = g_listeners.erase(it)) : ++it){
-		AUTO(listener, it->second.lock());
-		expired = !listener;
-		if(listener){
+	const AUTO(table, get_current_table());
+	if(!table){
+		return;
+	}
+	const AUTO(it, table->map.find(&type_info));
+	if(it == table->map.end()){
+		return;
+	}
+	const Weak_listener_vector *const lists[] = { &(it->second.listeners), &(it->second.limited_listeners) };
+	bool expired = false;
+	for(std::size_t i = 0; i < COUNT_OF(lists); ++i){
+		for(AUTO(wit, lists[i]->begin()); wit != lists[i]->end(); ++wit){
+			AUTO(listener, wit->lock());
+			if(!listener){
+				expired = true;
+				continue;
+			}
 			ret.push_back(STD_MOVE_IDN(listener));
 		}
 	}
+	if(expired){
+		purge_expired_listeners(type_info);
+	}
 }
 
-boost::shared_ptr<const Event_listener> Event_dispatcher::register_listener_explicit(const std::type_info &type_info, Event_listener_callback callback){
+boost::shared_ptr<const Event_listener> Event_dispatcher::register_listener_explicit(const std::type_info &type_info, Event_listener_callback callback, boost::uint64_t delivery_interval){
 	POSEIDON_PROFILE_ME;
 
-	AUTO(listener, boost::make_shared<Event_listener>(STD_MOVE_IDN(callback)));
+	boost::shared_ptr<Event_listener> listener;
 	{
 		const Mutex::Unique_lock lock(g_mutex);
-		g_listeners.emplace(&type_info, listener);
+		AUTO(table, g_table ? boost::make_shared<Listener_table>(*g_table) : boost::make_shared<Listener_table>());
+		AUTO_REF(slot, table->map[&type_info]);
+		if(!slot.counters){
+			slot.counters = boost::make_shared<Event_counters>();
+		}
+		listener = boost::make_shared<Event_listener>(STD_MOVE_IDN(callback), delivery_interval, slot.counters);
+		if(delivery_interval == 0){
+			slot.listeners.push_back(listener);
+		} else {
+			slot.limited_listeners.push_back(listener);
+		}
+		publish_table_unlocked(STD_MOVE_IDN(table));
 	}
 	return STD_MOVE_IDN(listener);
 }
@@ -112,21 +449,164 @@ boost::shared_ptr<const Event_listener> Event_dispatcher::register_listener_expl
 void Event_dispatcher::sync_raise(const boost::shared_ptr<Event_base> &event){
 	POSEIDON_PROFILE_ME;
 
-	boost::container::vector<boost::shared_ptr<const Event_listener> > listeners;
-	get_listeners(listeners, typeid(*event));
-	for(AUTO(it, listeners.begin()); it != listeners.end(); ++it){
-		AUTO_REF(listener, *it);
-		listener->get_callback()(event);
+	const AUTO(table, get_current_table());
+	if(!table){
+		return;
+	}
+	const AUTO(it, table->map.find(&typeid(*event)));
+	if(it == table->map.end()){
+		return;
+	}
+	const AUTO_REF(slot, it->second);
+	AUTO_REF(counters, *(slot.counters));
+	atomic_add(counters.sync_raises, 1, memory_order_relaxed);
+	// 同步事件直接调用所有的响应器，包括有 delivery_interval 的。
+	// 响应器抛出的异常被传递给调用者，剩下的响应器不会被调用。
+	const Weak_listener_vector *const lists[] = { &(slot.listeners), &(slot.limited_listeners) };
+	const AUTO(begin, get_mono_clock_us());
+	std::size_t calls = 0;
+	bool expired = false;
+	try {
+		for(std::size_t i = 0; i < COUNT_OF(lists); ++i){
+			for(AUTO(wit, lists[i]->begin()); wit != lists[i]->end(); ++wit){
+				const AUTO(listener, wit->lock());
+				if(!listener){
+					expired = true;
+					continue;
+				}
+				++calls;
+				listener->get_callback()(event);
+			}
+		}
+	} catch(...){
+		atomic_add(counters.exceptions, 1, memory_order_relaxed);
+		record_dispatch(counters, calls, get_mono_clock_us() - begin);
+		throw;
+	}
+	record_dispatch(counters, calls, get_mono_clock_us() - begin);
+	if(expired){
+		purge_expired_listeners(typeid(*event));
 	}
 }
 void Event_dispatcher::async_raise(const boost::shared_ptr<Event_base> &event, const boost::shared_ptr<const bool> &withdrawn){
 	POSEIDON_PROFILE_ME;
 
-	boost::container::vector<boost::shared_ptr<const Event_listener> > listeners;
-	get_listeners(listeners, typeid(*event));
-	for(AUTO(it, listeners.begin()); it != listeners.end(); ++it){
-		AUTO_REF(listener, *it);
-		Job_dispatcher::enqueue(boost::make_shared<Event_job>(STD_MOVE_IDN(listener), event), withdrawn);
+	AUTO(table, get_current_table());
+	if(!table){
+		return;
+	}
+	const AUTO(it, table->map.find(&typeid(*event)));
+	if(it == table->map.end()){
+		return;
+	}
+	const AUTO_REF(slot, it->second);
+	if(slot.listeners.empty() && slot.limited_listeners.empty()){
+		return;
+	}
+	AUTO_REF(counters, *(slot.counters));
+	atomic_add(counters.async_raises, 1, memory_order_relaxed);
+
+	Coalescing_key key = { &typeid(*event), 0 };
+	const bool coalescing = event->get_coalescing_key(key.key);
+
+	// 一个事件可能同时被合并到多个响应器暂存的事件中，但是只计数一次。
+	bool coalesced = false;
+
+	// 有 delivery_interval 的响应器各自暂存事件。
+	bool expired = false;
+	for(AUTO(wit, slot.limited_listeners.begin()); wit != slot.limited_listeners.end(); ++wit){
+		const AUTO(listener, wit->lock());
+		if(!listener){
+			expired = true;
+			continue;
+		}
+		if(listener->post(listener, event, coalescing ? &key : NULLPTR, withdrawn)){
+			coalesced = true;
+		}
+	}
+	if(expired){
+		purge_expired_listeners(typeid(*event));
+	}
+
+	// 其他的响应器由同一个任务调用。
+	if(!slot.listeners.empty()){
+		if(!coalescing){
+			Job_dispatcher::enqueue(boost::make_shared<Event_job>(STD_MOVE(table), &slot, event, NULLPTR), withdrawn);
+			return;
+		}
+		bool pending;
+		{
+			const Mutex::Unique_lock lock(g_pending_mutex);
+			const AUTO(pit, g_pending_events.find(key));
+			pending = (pit != g_pending_events.end());
+			if(pending){
+				pit->second.event = event;
+				pit->second.withdrawn = withdrawn;
+				coalesced = true;
+			} else {
+				Pending_event elem = { event, withdrawn, get_mono_clock_us() };
+				g_pending_events.emplace(key, STD_MOVE(elem));
+			}
+		}
+		if(!pending){
+			try {
+				// withdrawn 在任务执行时检查，因为它可能被后来的事件替换掉。
+				Job_dispatcher::enqueue(boost::make_shared<Event_job>(STD_MOVE(table), &slot, event, &key), VAL_INIT);
+			} catch(...){
+				const Mutex::Unique_lock lock(g_pending_mutex);
+				g_pending_events.erase(key);
+				throw;
+			}
+		}
+	}
+	if(coalesced){
+		atomic_add(counters.coalesced, 1, memory_order_relaxed);
+	}
+}
+
+void Event_dispatcher::snapshot_events(boost::container::vector<Event_snapshot> &ret){
+	POSEIDON_PROFILE_ME;
+
+	const AUTO(table, get_current_table());
+	if(!table){
+		return;
+	}
+	ret.reserve(ret.size() + table->map.size());
+	for(AUTO(it, table->map.begin()); it != table->map.end(); ++it){
+		const AUTO_REF(counters, *(it->second.counters));
+		Event_snapshot snapshot;
+		snapshot.type_info = it->first;
+		snapshot.listener_count = it->second.listeners.size() + it->second.limited_listeners.size();
+		snapshot.sync_raises = atomic_load(counters.sync_raises, memory_order_relaxed);
+		snapshot.async_raises = atomic_load(counters.async_raises, memory_order_relaxed);
+		snapshot.coalesced = atomic_load(counters.coalesced, memory_order_relaxed);
+		snapshot.listener_calls = atomic_load(counters.listener_calls, memory_order_relaxed);
+		snapshot.exceptions = atomic_load(counters.exceptions, memory_order_relaxed);
+		snapshot.total_time = atomic_load(counters.total_time, memory_order_relaxed);
+		snapshot.max_time = atomic_load(counters.max_time, memory_order_relaxed);
+		snapshot.total_queue_time = atomic_load(counters.total_queue_time, memory_order_relaxed);
+		snapshot.max_queue_time = atomic_load(counters.max_queue_time, memory_order_relaxed);
+		ret.push_back(snapshot);
+	}
+}
+void Event_dispatcher::clear_event_counters(){
+	POSEIDON_PROFILE_ME;
+
+	const AUTO(table, get_current_table());
+	if(!table){
+		return;
+	}
+	for(AUTO(it, table->map.begin()); it != table->map.end(); ++it){
+		AUTO_REF(counters, *(it->second.counters));
+		atomic_store(counters.sync_raises, 0u, memory_order_relaxed);
+		atomic_store(counters.async_raises, 0u, memory_order_relaxed);
+		atomic_store(counters.coalesced, 0u, memory_order_relaxed);
+		atomic_store(counters.listener_calls, 0u, memory_order_relaxed);
+		atomic_store(counters.exceptions, 0u, memory_order_relaxed);
+		atomic_store(counters.total_time, 0u, memory_order_relaxed);
+		atomic_store(counters.max_time, 0u, memory_order_relaxed);
+		atomic_store(counters.total_queue_time, 0u, memory_order_relaxed);
+		atomic_store(counters.max_queue_time, 0u, memory_order_relaxed);
 	}
 }
 
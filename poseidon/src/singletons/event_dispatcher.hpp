@@ -12,6 +12,8 @@
 #include <boost/function.hpp>
 #include <boost/bind.hpp>
 #include <boost/container/vector.hpp>
+#include <boost/cstdint.hpp>
+#include <cstddef>
 
 namespace Poseidon {
 
@@ -25,16 +27,35 @@ private:
 public:
 	typedef boost::function<void (const boost::shared_ptr<Event_base> &event)> Event_listener_callback;
 
+	// 所有时间都以微秒为单位。
+	struct Event_snapshot {
+		const std::type_info *type_info;
+		std::size_t listener_count;
+		unsigned long long sync_raises;
+		unsigned long long async_raises;
+		// 异步事件被合并到尚未处理的同类事件中的次数。一次触发至多计数一次。
+		unsigned long long coalesced;
+		unsigned long long listener_calls;
+		unsigned long long exceptions;
+		// 每次触发事件时调用所有响应器的总时间。
+		unsigned long long total_time;
+		unsigned long long max_time;
+		// 异步事件从触发到开始执行的时间。
+		unsigned long long total_queue_time;
+		unsigned long long max_queue_time;
+	};
+
 	static void start();
 	static void stop();
 
 	static void get_listeners(boost::container::vector<boost::shared_ptr<const Event_listener> > &ret, const std::type_info &type_inf);
 
 	// 返回的 shared_ptr 是该响应器的唯一持有者。
-	static boost::shared_ptr<const Event_listener> register_listener_explicit(const std::type_info &type_info, Event_listener_callback callback);
+	// 如果 delivery_interval 不为零，异步事件会被暂存起来，每隔 delivery_interval 毫秒用一个任务一次性投递给该响应器。同步事件不受影响。
+	static boost::shared_ptr<const Event_listener> register_listener_explicit(const std::type_info &type_info, Event_listener_callback callback, boost::uint64_t delivery_interval = 0);
 
 	template<typename EventT>
-	static boost::shared_ptr<const Event_listener> register_listener(boost::function<void (const boost::shared_ptr<EventT> &)> callback){
+	static boost::shared_ptr<const Event_listener> register_listener(boost::function<void (const boost::shared_ptr<EventT> &)> callback, boost::uint64_t delivery_interval = 0){
 		struct Helper {
 			static void safe_fwd(boost::function<void (const boost::shared_ptr<EventT> &)> &callback, const boost::shared_ptr<Event_base> &event){
 				AUTO(derived, boost::dynamic_pointer_cast<EventT>(event));
@@ -45,11 +66,17 @@ public:
 				callback(STD_MOVE(derived));
 			}
 		};
-		return register_listener_explicit(typeid(EventT), boost::bind(&Helper::safe_fwd, STD_MOVE_IDN(callback), _1));
+		return register_listener_explicit(typeid(EventT), boost::bind(&Helper::safe_fwd, STD_MOVE_IDN(callback), _1), delivery_interval);
 	}
 
 	static void sync_raise(const boost::shared_ptr<Event_base> &event);
+	// 只投递一个任务，由它依次调用所有的响应器。
+	// 如果 Event_base::get_coalescing_key() 返回 true，并且类型和 key 都相同的事件尚未被处理，则只替换掉那个事件，不再投递任务。
 	static void async_raise(const boost::shared_ptr<Event_base> &event, const boost::shared_ptr<const bool> &withdrawn);
+
+	// 获取每种事件的统计信息。
+	static void snapshot_events(boost::container::vector<Event_snapshot> &ret);
+	static void clear_event_counters();
 };
 
 }
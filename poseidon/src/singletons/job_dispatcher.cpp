@@ -4,8 +4,11 @@
 #include "../precompiled.hpp"
 #include "job_dispatcher.hpp"
 #include "main_config.hpp"
-#include <ucontext.h>
+#ifndef POSEIDON_ENABLE_FAST_CONTEXT
+#  include <ucontext.h>
+#endif
 #include <sys/mman.h>
+#include <boost/intrusive/list.hpp>
 #include "../job_base.hpp"
 #include "../promise.hpp"
 #include "../atomic.hpp"
@@ -13,10 +16,10 @@
 #include "../log.hpp"
 #include "../profiler.hpp"
 #include "../mutex.hpp"
-#include "../recursive_mutex.hpp"
 #include "../condition_variable.hpp"
 #include "../time.hpp"
 #include "../checked_arithmetic.hpp"
+#include "../thread.hpp"
 
 namespace Poseidon {
 
@@ -25,6 +28,7 @@ namespace {
 		fiber_state_ready      = 0,
 		fiber_state_running    = 1,
 		fiber_state_suspended  = 2,
+		fiber_state_stackless  = 3,
 	};
 
 	struct Job_element {
@@ -36,134 +40,694 @@ namespace {
 		bool insignificant;
 	};
 
-	struct Stack_storage FINAL {
-		static void *operator new(std::size_t cb){
-			assert(cb == sizeof(Stack_storage));
-			(void)cb;
+	// 纤程栈。
+	// 预留的地址空间最低处是一个不可访问的保护页，栈溢出时会立即触发段错误，而不是覆盖相邻的内存。
+	// 其余部分以 MAP_NORESERVE 映射，只有被访问过的页面才会被提交，因此可以预留较大的栈而不占用物理内存。
+	class Stack_storage : NONCOPYABLE {
+	private:
+		void *m_base;
+		std::size_t m_guard_size;
+		std::size_t m_size;
+		bool m_lazily_released; // MADV_FREE 归还的页面在被回收之前仍然被 mincore() 视为驻留。
+
+	public:
+		Stack_storage *next_free;
 
-			void *const ptr = mmap(NULLPTR, sizeof(Stack_storage), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+	public:
+		Stack_storage(std::size_t guard_size, std::size_t size)
+			: m_base(NULLPTR), m_guard_size(guard_size), m_size(size), m_lazily_released(false)
+			, next_free(NULLPTR)
+		{
+			void *const ptr = ::mmap(NULLPTR, m_guard_size + m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK | MAP_NORESERVE, -1, 0);
 			if(ptr == MAP_FAILED){
 				const int err_code = errno;
 				POSEIDON_LOG_ERROR("Failed to allocate stack: err_code = ", err_code);
 				throw std::bad_alloc();
 			}
-			return ptr;
+			if(::mprotect(ptr, m_guard_size, PROT_NONE) != 0){
+				const int err_code = errno;
+				POSEIDON_LOG_ERROR("Failed to protect stack guard page: err_code = ", err_code);
+				::munmap(ptr, m_guard_size + m_size);
+				throw std::bad_alloc();
+			}
+			m_base = ptr;
 		}
-		static void operator delete(void *ptr) NOEXCEPT {
-			if(::munmap(ptr, sizeof(Stack_storage)) != 0){
+		~Stack_storage(){
+			if(::munmap(m_base, m_guard_size + m_size) != 0){
 				const int err_code = errno;
 				POSEIDON_LOG_ERROR("Failed to deallocate stack: err_code = ", err_code);
 				std::terminate();
 			}
 		}
 
-		char bytes[0x40000];
+	public:
+		void *bottom() const NOEXCEPT {
+			return static_cast<char *>(m_base) + m_guard_size;
+		}
+		void *top() const NOEXCEPT {
+			return static_cast<char *>(m_base) + m_guard_size + m_size;
+		}
+		std::size_t size() const NOEXCEPT {
+			return m_size;
+		}
+		bool is_lazily_released() const NOEXCEPT {
+			return m_lazily_released;
+		}
+
+		// 栈向下增长，最低的驻留页面到栈顶的距离就是栈的最大使用量。大的局部数组可能跳过一些页面，因此从栈底开始查找。
+		std::size_t measure_high_water(std::size_t page_size) const NOEXCEPT {
+			const AUTO(top, static_cast<char *>(this->top()));
+			char *begin = static_cast<char *>(bottom());
+			unsigned char vec[256];
+			while(begin != top){
+				const AUTO(count, std::min<std::size_t>(static_cast<std::size_t>(top - begin) / page_size, sizeof(vec)));
+				if(::mincore(begin, count * page_size, vec) != 0){
+					break;
+				}
+				for(std::size_t i = 0; i < count; ++i){
+					if(vec[i] & 1){
+						return static_cast<std::size_t>(top - (begin + i * page_size));
+					}
+				}
+				begin += count * page_size;
+			}
+			return 0;
+		}
+		// 归还物理页面，地址空间保持预留。
+		void release_pages(bool lazy) NOEXCEPT {
+#ifdef MADV_FREE
+			if(lazy && (::madvise(bottom(), m_size, MADV_FREE) == 0)){
+				m_lazily_released = true;
+				return;
+			}
+#else
+			(void)lazy;
+#endif
+			m_lazily_released = false;
+			if(::madvise(bottom(), m_size, MADV_DONTNEED) != 0){
+				const int err_code = errno;
+				POSEIDON_LOG_WARNING("Failed to release stack pages: err_code = ", err_code);
+			}
+		}
 	};
 
-	class Fiber_stack_allocator : NONCOPYABLE {
-	private:
-		mutable Mutex m_mutex;
-		boost::array<boost::scoped_ptr<Stack_storage>, 64> m_pool;
-		std::size_t m_size;
+	// 纤程栈池。
+	// 每个线程缓存若干个空闲的栈，超出的部分直接释放。纤程可能在一个线程上创建，在另一个线程上销毁。
+	// 栈在放入缓存之前归还其物理页面，并统计使用量的最大值。
+	// 以 MADV_FREE 归还过的栈的统计结果偏大，不计入；启用 MADV_FREE 时每隔若干次仍然使用 MADV_DONTNEED，以便这个栈下一次被归还时可以统计。
+	enum {
+		stack_histogram_size = 12,
+		stack_sample_interval = 8,
+	};
 
-	public:
-		Fiber_stack_allocator()
-			: m_mutex(), m_pool(), m_size(0)
-		{
-			//
+	struct Stack_thread_cache {
+		Stack_storage *head;
+		std::size_t count;
+		std::size_t release_count;
+		bool registered;
+	};
+	__thread Stack_thread_cache t_stack_cache;
+
+	::pthread_once_t g_stack_key_once = PTHREAD_ONCE_INIT;
+	::pthread_key_t g_stack_key;
+
+	std::size_t g_stack_page_size = 4096;
+	std::size_t g_stack_size = 0x40000;
+	std::size_t g_stack_cache_limit = 16;
+	bool g_stack_lazy_free = false;
+
+	volatile unsigned long long g_stack_system_allocations = 0;
+	volatile unsigned long long g_stack_system_deallocations = 0;
+	volatile unsigned long long g_stack_cache_hits = 0;
+	volatile std::size_t g_stacks_in_use = 0;
+	volatile std::size_t g_stacks_cached = 0;
+
+	Mutex g_stack_stats_mutex;
+	std::size_t g_stack_high_water_max = 0;
+	unsigned long long g_stack_high_water_samples = 0;
+	unsigned long long g_stack_high_water_total = 0;
+	boost::array<unsigned long long, stack_histogram_size> g_stack_high_water_histogram;
+
+	void stack_flush_thread_cache(void *param) NOEXCEPT {
+		const AUTO(cache, static_cast<Stack_thread_cache *>(param));
+		while(cache->head){
+			const AUTO(stack, cache->head);
+			cache->head = stack->next_free;
+			cache->count -= 1;
+			atomic_sub(g_stacks_cached, 1, memory_order_relaxed);
+			delete stack;
+			atomic_add(g_stack_system_deallocations, 1, memory_order_relaxed);
+		}
+		cache->registered = false;
+	}
+	void stack_create_key() NOEXCEPT {
+		if(::pthread_key_create(&g_stack_key, &stack_flush_thread_cache) != 0){
+			std::terminate();
+		}
+	}
+	Stack_thread_cache & stack_get_thread_cache() NOEXCEPT {
+		AUTO_REF(cache, t_stack_cache);
+		if(!cache.registered){
+			// 线程退出时释放缓存的栈。
+			::pthread_once(&g_stack_key_once, &stack_create_key);
+			::pthread_setspecific(g_stack_key, &cache);
+			cache.registered = true;
 		}
+		return cache;
+	}
 
-	public:
-		void allocate(boost::scoped_ptr<Stack_storage> &ptr){
-			const Mutex::Unique_lock lock(m_mutex);
-			if(m_size == 0){
-				ptr.reset(new Stack_storage);
-			} else {
-				ptr.swap(m_pool.at(--m_size));
-			}
+	void stack_record_high_water(std::size_t high_water) NOEXCEPT {
+		std::size_t index = 0;
+		while((index + 1 < stack_histogram_size) && (high_water > (g_stack_page_size << index))){
+			++index;
 		}
-		void deallocate(boost::scoped_ptr<Stack_storage> &ptr) NOEXCEPT {
-			const Mutex::Unique_lock lock(m_mutex);
-			if(m_size == m_pool.size()){
-				ptr.reset();
-			} else {
-				ptr.swap(m_pool.at(m_size++));
+		const Mutex::Unique_lock lock(g_stack_stats_mutex);
+		g_stack_high_water_max = std::max(g_stack_high_water_max, high_water);
+		g_stack_high_water_samples += 1;
+		g_stack_high_water_total += high_water;
+		g_stack_high_water_histogram[index] += 1;
+	}
+
+	Stack_storage * allocate_stack(){
+		AUTO_REF(cache, stack_get_thread_cache());
+		atomic_add(g_stacks_in_use, 1, memory_order_relaxed);
+		// 配置改变之前缓存的栈大小可能不同。
+		while(cache.head){
+			const AUTO(stack, cache.head);
+			cache.head = stack->next_free;
+			cache.count -= 1;
+			atomic_sub(g_stacks_cached, 1, memory_order_relaxed);
+			if(stack->size() == g_stack_size){
+				stack->next_free = NULLPTR;
+				atomic_add(g_stack_cache_hits, 1, memory_order_relaxed);
+				return stack;
 			}
+			delete stack;
+			atomic_add(g_stack_system_deallocations, 1, memory_order_relaxed);
 		}
-	} g_stack_allocator;
+		Stack_storage *stack;
+		try {
+			stack = new Stack_storage(g_stack_page_size, g_stack_size);
+		} catch(...){
+			atomic_sub(g_stacks_in_use, 1, memory_order_relaxed);
+			throw;
+		}
+		atomic_add(g_stack_system_allocations, 1, memory_order_relaxed);
+		return stack;
+	}
+	void deallocate_stack(Stack_storage *stack) NOEXCEPT {
+		atomic_sub(g_stacks_in_use, 1, memory_order_relaxed);
+		if(!stack->is_lazily_released()){
+			stack_record_high_water(stack->measure_high_water(g_stack_page_size));
+		}
+		AUTO_REF(cache, stack_get_thread_cache());
+		if(cache.count >= g_stack_cache_limit){
+			delete stack;
+			atomic_add(g_stack_system_deallocations, 1, memory_order_relaxed);
+			return;
+		}
+		cache.release_count += 1;
+		stack->release_pages(g_stack_lazy_free && (cache.release_count % stack_sample_interval != 0));
+		stack->next_free = cache.head;
+		cache.head = stack;
+		cache.count += 1;
+		atomic_add(g_stacks_cached, 1, memory_order_relaxed);
+	}
+
+#ifdef POSEIDON_ENABLE_FAST_CONTEXT
+	// 只保存被调用者保存的寄存器，不像 swapcontext() 那样每次都通过系统调用保存和恢复信号掩码。
+	// 被切出的上下文的所有寄存器都保存在它自己的栈上，只有栈指针保存在 *from_sp 中。
+	// 新纤程的栈被预先布置成刚刚被切出的样子，第一次切入时返回到 fiber_context_trampoline，以 param 为参数调用 entry。
+	extern "C" void poseidon_fiber_context_switch(void **from_sp, void *to_sp) NOEXCEPT __attribute__((__visibility__("hidden")));
+	extern "C" void poseidon_fiber_context_trampoline() NOEXCEPT __attribute__((__visibility__("hidden")));
+
+#  if defined(__x86_64__)
+	__asm__(
+		".pushsection .text \n"
+		".p2align 4 \n"
+		".globl poseidon_fiber_context_switch \n"
+		".hidden poseidon_fiber_context_switch \n"
+		".type poseidon_fiber_context_switch, @function \n"
+		"poseidon_fiber_context_switch: \n"
+		"	pushq %rbp \n"
+		"	pushq %rbx \n"
+		"	pushq %r12 \n"
+		"	pushq %r13 \n"
+		"	pushq %r14 \n"
+		"	pushq %r15 \n"
+		"	subq $8, %rsp \n"
+		"	stmxcsr (%rsp) \n"
+		"	fnstcw 4(%rsp) \n"
+		"	movq %rsp, (%rdi) \n"
+		"	movq %rsi, %rsp \n"
+		"	ldmxcsr (%rsp) \n"
+		"	fldcw 4(%rsp) \n"
+		"	addq $8, %rsp \n"
+		"	popq %r15 \n"
+		"	popq %r14 \n"
+		"	popq %r13 \n"
+		"	popq %r12 \n"
+		"	popq %rbx \n"
+		"	popq %rbp \n"
+		"	ret \n"
+		".size poseidon_fiber_context_switch, .-poseidon_fiber_context_switch \n"
+		".p2align 4 \n"
+		".globl poseidon_fiber_context_trampoline \n"
+		".hidden poseidon_fiber_context_trampoline \n"
+		".type poseidon_fiber_context_trampoline, @function \n"
+		"poseidon_fiber_context_trampoline: \n"
+		"	movq %r12, %rdi \n"
+		"	callq *%r13 \n"
+		"	ud2 \n"
+		".size poseidon_fiber_context_trampoline, .-poseidon_fiber_context_trampoline \n"
+		".popsection \n"
+	);
+
+	enum {
+		fast_context_frame_words  = 8, // MXCSR 和 x87 控制字、r15、r14、r13、r12、rbx、rbp、返回地址。
+		fast_context_param_index  = 4, // r12
+		fast_context_entry_index  = 3, // r13
+		fast_context_return_index = 7,
+	};
+#  elif defined(__aarch64__)
+	__asm__(
+		".pushsection .text \n"
+		".p2align 4 \n"
+		".globl poseidon_fiber_context_switch \n"
+		".hidden poseidon_fiber_context_switch \n"
+		".type poseidon_fiber_context_switch, %function \n"
+		"poseidon_fiber_context_switch: \n"
+		"	sub sp, sp, #160 \n"
+		"	stp x19, x20, [sp, #0] \n"
+		"	stp x21, x22, [sp, #16] \n"
+		"	stp x23, x24, [sp, #32] \n"
+		"	stp x25, x26, [sp, #48] \n"
+		"	stp x27, x28, [sp, #64] \n"
+		"	stp x29, x30, [sp, #80] \n"
+		"	stp d8, d9, [sp, #96] \n"
+		"	stp d10, d11, [sp, #112] \n"
+		"	stp d12, d13, [sp, #128] \n"
+		"	stp d14, d15, [sp, #144] \n"
+		"	mov x9, sp \n"
+		"	str x9, [x0] \n"
+		"	mov sp, x1 \n"
+		"	ldp x19, x20, [sp, #0] \n"
+		"	ldp x21, x22, [sp, #16] \n"
+		"	ldp x23, x24, [sp, #32] \n"
+		"	ldp x25, x26, [sp, #48] \n"
+		"	ldp x27, x28, [sp, #64] \n"
+		"	ldp x29, x30, [sp, #80] \n"
+		"	ldp d8, d9, [sp, #96] \n"
+		"	ldp d10, d11, [sp, #112] \n"
+		"	ldp d12, d13, [sp, #128] \n"
+		"	ldp d14, d15, [sp, #144] \n"
+		"	add sp, sp, #160 \n"
+		"	ret \n"
+		".size poseidon_fiber_context_switch, .-poseidon_fiber_context_switch \n"
+		".p2align 4 \n"
+		".globl poseidon_fiber_context_trampoline \n"
+		".hidden poseidon_fiber_context_trampoline \n"
+		".type poseidon_fiber_context_trampoline, %function \n"
+		"poseidon_fiber_context_trampoline: \n"
+		"	mov x0, x19 \n"
+		"	blr x20 \n"
+		"	brk #0 \n"
+		".size poseidon_fiber_context_trampoline, .-poseidon_fiber_context_trampoline \n"
+		".popsection \n"
+	);
+
+	enum {
+		fast_context_frame_words  = 20, // x19 至 x30、d8 至 d15。
+		fast_context_param_index  = 0,  // x19
+		fast_context_entry_index  = 1,  // x20
+		fast_context_return_index = 11, // x30
+	};
+#  else
+#    error Fast context switching is not supported on this architecture. Reconfigure with `--disable-fast-context`.
+#  endif
+#endif
+
+	// 纤程在调度器中的位置。
+	enum Fiber_schedule {
+		fiber_schedule_idle     = 0, // 没有任务，不在任何链表中。
+		fiber_schedule_queued   = 1, // 位于某个工作线程的就绪链表中。
+		fiber_schedule_running  = 2, // 正在某个工作线程上运行。
+		fiber_schedule_waiting  = 3, // 位于等待链表中。
+	};
 
-	struct Fiber_control : NONCOPYABLE {
+	// 每个纤程至多位于一个就绪链表或等待链表中，因此同一个类别的任务不会同时在两个线程上运行。
+	typedef boost::intrusive::list_base_hook<boost::intrusive::link_mode<boost::intrusive::auto_unlink> > Fiber_hook;
+
+	// 纤程可以在工作线程之间迁移。任务队列和调度状态由 queue_mutex 保护，其余成员只会被正在运行它的线程访问。
+	struct Fiber_control : public Fiber_hook, NONCOPYABLE {
 		struct Initializer { };
 
-		Recursive_mutex queue_mutex;
+		boost::weak_ptr<const void> category;
+		Mutex queue_mutex;
 		boost::container::deque<Job_element> queue;
+		Fiber_schedule schedule;
 
 		Fiber_state state;
-		boost::scoped_ptr<Stack_storage> stack;
+		Stack_storage *stack;
+#ifdef POSEIDON_ENABLE_FAST_CONTEXT
+		void *inner_sp;
+		void *outer_sp;
+#else
 		::ucontext_t inner;
 		::ucontext_t outer;
+#endif
+
+		// 以下成员由 g_waiting_mutex 保护。
+		// wait_token 指向这个纤程，promise 的回调函数只保存它的弱引用。纤程被唤醒时它被置空，此后的回调函数不会再访问这个纤程。
+		boost::shared_ptr<Fiber_control *> wait_token;
+		bool wait_signaled;
+		bool waiting;
 
 		explicit Fiber_control(Initializer){
+			schedule = fiber_schedule_idle;
 			state = fiber_state_ready;
-			g_stack_allocator.allocate(stack);
-#ifndef NDEBUG
+			wait_signaled = false;
+			waiting = false;
+			// 纤程栈在第一次运行需要栈的任务时才分配。
+			stack = NULLPTR;
+#ifdef POSEIDON_ENABLE_FAST_CONTEXT
+			inner_sp = NULLPTR;
+			outer_sp = NULLPTR;
+#elif !defined(NDEBUG)
 			std::memset(&inner, 0xCC, sizeof(outer));
 			std::memset(&outer, 0xCC, sizeof(outer));
 #endif
 		}
 		~Fiber_control(){
 			assert(state == fiber_state_ready);
-			g_stack_allocator.deallocate(stack);
-#ifndef NDEBUG
+			if(stack){
+				deallocate_stack(stack);
+			}
+#if !defined(POSEIDON_ENABLE_FAST_CONTEXT) && !defined(NDEBUG)
 			std::memset(&inner, 0xCC, sizeof(outer));
 			std::memset(&outer, 0xCC, sizeof(outer));
 #endif
 		}
 	};
 
+	typedef boost::container::map<boost::weak_ptr<const void>, Fiber_control> Fiber_map;
+	typedef boost::intrusive::list<Fiber_control, boost::intrusive::base_hook<Fiber_hook>, boost::intrusive::constant_time_size<false> > Fiber_list;
+
+	// 每个工作线程拥有一个就绪链表，空闲时从其他线程的链表末尾窃取纤程。
+	// 单线程模式下只有一个工作线程，即调用 do_modal() 的线程。
+	struct Job_worker : NONCOPYABLE {
+		std::size_t index;
+		Mutex mutex;
+		Fiber_list ready_list;
+		Thread thread;
+	};
+
 	__thread Fiber_control *volatile t_current_fiber = 0; // XXX: NULLPTR
 
+	boost::container::vector<boost::shared_ptr<Job_worker> > g_workers;
+	bool g_multi_threaded = false;
+	volatile bool g_running = false;
+	volatile bool g_force_expiry = false;
+
+	// 加锁顺序为 g_fiber_map_mutex、queue_mutex、工作线程或等待链表的锁。
 	Mutex g_fiber_map_mutex;
+	Fiber_map g_fiber_map;
+	// 队首的任务在等待 promise 的纤程。promise 被满足时，其回调函数把纤程移到 g_woken_list 中，由分发任务的线程放入就绪链表。
+	// 等待链表只在其中最早的纤程超时的时候才需要遍历。
+	Mutex g_waiting_mutex;
+	Fiber_list g_waiting_list;
+	Fiber_list g_woken_list;
+	volatile std::size_t g_woken_count = 0;
+	boost::uint64_t g_next_expiry_check = (boost::uint64_t)-1;
+	// 所有就绪链表中纤程的总数。
+	volatile std::size_t g_ready_count = 0;
+
+	// 新任务先放入一个无锁的多生产者单消费者队列中，由持有 g_dispatching 的工作线程取出之后再分配到各个纤程。
+	// 参考 Dmitry Vyukov 的 intrusive MPSC node-based queue。
+	struct Job_node {
+		Job_node *volatile next;
+		boost::weak_ptr<const void> category;
+		Job_element elem;
+	};
+
+	Job_node g_inbox_stub;
+	Job_node *volatile g_inbox_head = &g_inbox_stub;
+	Job_node *g_inbox_tail = &g_inbox_stub;
+	volatile bool g_dispatching = false;
+
+	void inbox_push(Job_node *node) NOEXCEPT {
+		atomic_store(node->next, NULLPTR, memory_order_relaxed);
+		const AUTO(prev, atomic_exchange(g_inbox_head, node, memory_order_seq_cst));
+		atomic_store(prev->next, node, memory_order_release);
+	}
+	Job_node * inbox_pop() NOEXCEPT {
+		AUTO(tail, g_inbox_tail);
+		AUTO(next, atomic_load(tail->next, memory_order_acquire));
+		if(tail == &g_inbox_stub){
+			if(!next){
+				return NULLPTR;
+			}
+			g_inbox_tail = next;
+			tail = next;
+			next = atomic_load(next->next, memory_order_acquire);
+		}
+		if(next){
+			g_inbox_tail = next;
+			return tail;
+		}
+		if(tail != atomic_load(g_inbox_head, memory_order_acquire)){
+			// 有生产者正在插入新节点，下次再取。
+			return NULLPTR;
+		}
+		inbox_push(&g_inbox_stub);
+		next = atomic_load(tail->next, memory_order_acquire);
+		if(next){
+			g_inbox_tail = next;
+			return tail;
+		}
+		return NULLPTR;
+	}
+	// 这个函数可以在任何线程中调用。取出节点的过程中会持有 g_fiber_map_mutex，因此在持有该锁时得到的结果是准确的。
+	bool inbox_empty() NOEXCEPT {
+		return atomic_load(g_inbox_head, memory_order_seq_cst) == &g_inbox_stub;
+	}
+
+	// 工作线程在睡眠之前增加这个计数，投递任务的线程只有看到它非零时才需要加锁唤醒。
+	Mutex g_sleep_mutex;
 	Condition_variable g_new_job;
-	boost::container::map<boost::weak_ptr<const void>, Fiber_control> g_fiber_map;
+	volatile std::size_t g_sleeping = 0;
 
-	void fiber_proc(int low, int high) NOEXCEPT {
-		POSEIDON_PROFILE_ME;
+	void wake_workers(std::size_t count) NOEXCEPT {
+		if(atomic_load(g_sleeping, memory_order_seq_cst) == 0){
+			return;
+		}
+		const Mutex::Unique_lock lock(g_sleep_mutex);
+		if(count > 1){
+			g_new_job.broadcast();
+		} else {
+			g_new_job.signal();
+		}
+	}
+	void wait_for_jobs(unsigned timeout) NOEXCEPT {
+		Mutex::Unique_lock lock(g_sleep_mutex);
+		atomic_add(g_sleeping, 1, memory_order_seq_cst);
+		if(inbox_empty() && (atomic_load(g_ready_count, memory_order_seq_cst) == 0) && (atomic_load(g_woken_count, memory_order_seq_cst) == 0)){
+			g_new_job.timed_wait(lock, timeout);
+		}
+		atomic_sub(g_sleeping, 1, memory_order_relaxed);
+	}
 
-		Fiber_control *fiber;
-		const int params[2] = { low, high };
-		std::memcpy(&fiber, params, sizeof(fiber));
+	void push_ready_fibers(Job_worker &worker, Fiber_list &fibers, std::size_t count) NOEXCEPT {
+		if(count == 0){
+			return;
+		}
+		{
+			const Mutex::Unique_lock lock(worker.mutex);
+			worker.ready_list.splice(worker.ready_list.end(), fibers);
+		}
+		atomic_add(g_ready_count, count, memory_order_seq_cst);
+		wake_workers(count);
+	}
+	Fiber_control * pop_ready_fiber(Job_worker &worker) NOEXCEPT {
+		{
+			const Mutex::Unique_lock lock(worker.mutex);
+			if(!worker.ready_list.empty()){
+				const AUTO(fiber, &(worker.ready_list.front()));
+				worker.ready_list.pop_front();
+				atomic_sub(g_ready_count, 1, memory_order_relaxed);
+				return fiber;
+			}
+		}
+		// 从其他工作线程的链表末尾窃取一个。
+		for(std::size_t i = 1; i < g_workers.size(); ++i){
+			AUTO_REF(victim, *(g_workers.at((worker.index + i) % g_workers.size())));
+			const Mutex::Unique_lock lock(victim.mutex);
+			if(!victim.ready_list.empty()){
+				const AUTO(fiber, &(victim.ready_list.back()));
+				victim.ready_list.pop_back();
+				atomic_sub(g_ready_count, 1, memory_order_relaxed);
+				return fiber;
+			}
+		}
+		return NULLPTR;
+	}
 
-		POSEIDON_LOG_TRACE("Entering fiber ", static_cast<void *>(fiber));
+	// 调用者必须持有 g_waiting_mutex。
+	void release_wait_token(Fiber_control *fiber) NOEXCEPT {
+		if(fiber->wait_token){
+			*(fiber->wait_token) = NULLPTR;
+			fiber->wait_token.reset();
+		}
+	}
+	void wake_waiting_fiber(const boost::weak_ptr<Fiber_control *> &weak_token) NOEXCEPT {
+		bool woken = false;
+		{
+			const Mutex::Unique_lock lock(g_waiting_mutex);
+			const AUTO(token, weak_token.lock());
+			if(!token || !*token){
+				return;
+			}
+			const AUTO(fiber, *token);
+			fiber->wait_signaled = true;
+			// 如果纤程尚未进入等待链表，pump_one_fiber() 会发现 wait_signaled 已经被设置。
+			if(fiber->waiting){
+				fiber->waiting = false;
+				release_wait_token(fiber);
+				fiber->unlink();
+				g_woken_list.push_back(*fiber);
+				atomic_add(g_woken_count, 1, memory_order_seq_cst);
+				woken = true;
+			}
+		}
+		if(woken){
+			wake_workers(1);
+		}
+	}
+
+	void perform_front_job(Fiber_control *fiber) NOEXCEPT {
 		try {
-			fiber->queue.front().job->perform();
+			Mutex::Unique_lock queue_lock(fiber->queue_mutex);
+			const AUTO(job, fiber->queue.front().job);
+			queue_lock.unlock();
+			job->perform();
 		} catch(std::exception &e){
 			POSEIDON_LOG_WARNING("std::exception thrown: what = ", e.what());
 		} catch(...){
 			POSEIDON_LOG_WARNING("Unknown exception thrown");
 		}
+	}
+
+	void fiber_proc(Fiber_control *fiber) NOEXCEPT {
+		POSEIDON_PROFILE_ME;
+
+		POSEIDON_LOG_TRACE("Entering fiber ", static_cast<void *>(fiber));
+		perform_front_job(fiber);
 		POSEIDON_LOG_TRACE("Exited from fiber ", static_cast<void *>(fiber));
 
 		fiber->state = fiber_state_ready;
 	}
 
+#ifdef POSEIDON_ENABLE_FAST_CONTEXT
+	void fiber_entry(void *param) NOEXCEPT {
+		const AUTO(fiber, static_cast<Fiber_control *>(param));
+		fiber_proc(fiber);
+		// 这个上下文不会再被恢复。
+		poseidon_fiber_context_switch(&(fiber->inner_sp), fiber->outer_sp);
+		std::terminate();
+	}
+
+	void initialize_fiber_context(Fiber_control *fiber) NOEXCEPT {
+		AUTO(top, reinterpret_cast<boost::uintptr_t>(fiber->stack->top()));
+		top &= ~static_cast<boost::uintptr_t>(15);
+		const AUTO(frame, reinterpret_cast<boost::uintptr_t *>(top) - fast_context_frame_words);
+		std::memset(frame, 0, fast_context_frame_words * sizeof(*frame));
+#  if defined(__x86_64__)
+		// MXCSR 和 x87 控制字的默认值。
+		frame[0] = 0x1F80 | (static_cast<boost::uintptr_t>(0x037F) << 32);
+#  endif
+		frame[fast_context_param_index] = reinterpret_cast<boost::uintptr_t>(fiber);
+		frame[fast_context_entry_index] = reinterpret_cast<boost::uintptr_t>(&fiber_entry);
+		frame[fast_context_return_index] = reinterpret_cast<boost::uintptr_t>(&poseidon_fiber_context_trampoline);
+		fiber->inner_sp = frame;
+	}
+	void switch_into_fiber(Fiber_control *fiber) NOEXCEPT {
+		poseidon_fiber_context_switch(&(fiber->outer_sp), fiber->inner_sp);
+	}
+	void switch_out_of_fiber(Fiber_control *fiber) NOEXCEPT {
+		poseidon_fiber_context_switch(&(fiber->inner_sp), fiber->outer_sp);
+	}
+#else
+	void fiber_proc_ucontext(int low, int high) NOEXCEPT {
+		Fiber_control *fiber;
+		const int params[2] = { low, high };
+		std::memcpy(&fiber, params, sizeof(fiber));
+		fiber_proc(fiber);
+	}
+
+	void initialize_fiber_context(Fiber_control *fiber) NOEXCEPT {
+		if(::getcontext(&(fiber->inner)) != 0){
+			const int err_code = errno;
+			POSEIDON_LOG_FATAL("::getcontext() failed: err_code = ", err_code);
+			std::terminate();
+		}
+		fiber->inner.uc_stack.ss_sp = fiber->stack->bottom();
+		fiber->inner.uc_stack.ss_size = fiber->stack->size();
+		fiber->inner.uc_link = &(fiber->outer);
+
+		int params[2] = { };
+		BOOST_STATIC_ASSERT(sizeof(fiber) <= sizeof(params));
+		std::memcpy(params, &fiber, sizeof(fiber));
+		::makecontext(&(fiber->inner), reinterpret_cast<void (*)()>(&fiber_proc_ucontext), 2, params[0], params[1]);
+	}
+	void switch_into_fiber(Fiber_control *fiber) NOEXCEPT {
+		if(::swapcontext(&(fiber->outer), &(fiber->inner)) != 0){
+			const int err_code = errno;
+			POSEIDON_LOG_FATAL("::swapcontext() failed: err_code = ", err_code);
+			std::terminate();
+		}
+	}
+	void switch_out_of_fiber(Fiber_control *fiber) NOEXCEPT {
+		if(::swapcontext(&(fiber->inner), &(fiber->outer)) != 0){
+			const int err_code = errno;
+			POSEIDON_LOG_FATAL("::swapcontext() failed: err_code = ", err_code);
+			std::terminate();
+		}
+	}
+#endif
+
+	// 不会 yield 的任务直接在当前线程的栈上运行。
+	void perform_stackless(Fiber_control *fiber) NOEXCEPT {
+		POSEIDON_PROFILE_ME;
+
+		t_current_fiber = fiber;
+		fiber->state = fiber_state_stackless;
+		perform_front_job(fiber);
+		fiber->state = fiber_state_ready;
+		t_current_fiber = NULLPTR;
+	}
+
 	void schedule_fiber(Fiber_control *fiber) NOEXCEPT {
 		POSEIDON_PROFILE_ME;
 
 		if(fiber->state == fiber_state_ready){
-			if(::getcontext(&(fiber->inner)) != 0){
-				const int err_code = errno;
-				POSEIDON_LOG_FATAL("::getcontext() failed: err_code = ", err_code);
-				std::terminate();
+			bool stackless;
+			{
+				const Mutex::Unique_lock queue_lock(fiber->queue_mutex);
+				stackless = fiber->queue.front().job->is_stackless();
 			}
-			fiber->inner.uc_stack.ss_sp = fiber->stack.get();
-			fiber->inner.uc_stack.ss_size = sizeof(*(fiber->stack));
-			fiber->inner.uc_link = &(fiber->outer);
-
-			int params[2] = { };
-			BOOST_STATIC_ASSERT(sizeof(fiber) <= sizeof(params));
-			std::memcpy(params, &fiber, sizeof(fiber));
-			::makecontext(&(fiber->inner), reinterpret_cast<void (*)()>(&fiber_proc), 2, params[0], params[1]);
+			if(stackless){
+				perform_stackless(fiber);
+				return;
+			}
+			if(!fiber->stack){
+				try {
+					fiber->stack = allocate_stack();
+				} catch(std::exception &e){
+					POSEIDON_LOG_ERROR("Failed to allocate fiber stack, job dropped: what = ", e.what());
+					return;
+				}
+			}
+			initialize_fiber_context(fiber);
 		}
 
 		t_current_fiber = fiber;
@@ -174,95 +738,345 @@ namespace {
 				std::terminate();
 			}
 			fiber->state = fiber_state_running;
-			if(::swapcontext(&(fiber->outer), &(fiber->inner)) != 0){
-				const int err_code = errno;
-				POSEIDON_LOG_FATAL("::swapcontext() failed: err_code = ", err_code);
-				std::terminate();
-			}
+			switch_into_fiber(fiber);
 		}
 		Profiler::end_stack_switch(profiler_hook);
 		t_current_fiber = NULLPTR;
 	}
 
-	bool pump_one_fiber(Fiber_control *fiber, bool force_expiry) NOEXCEPT {
-		POSEIDON_PROFILE_ME;
-
-		const AUTO(now, get_fast_mono_clock());
+	bool fiber_should_wake(Fiber_control *fiber, boost::uint64_t now, bool force_expiry) NOEXCEPT {
+		AUTO_REF(elem, fiber->queue.front());
+		if(!elem.promise || elem.promise->is_satisfied()){
+			return true;
+		}
+		if((now < elem.expiry_time) && !(elem.insignificant && force_expiry)){
+			return false;
+		}
+		POSEIDON_LOG_WARNING("Job timed out");
+		return true;
+	}
 
-		Job_element *elem;
+	void try_erase_fiber(const boost::weak_ptr<const void> &category) NOEXCEPT {
+		Stack_storage *stack;
 		{
-			const Recursive_mutex::Unique_lock queue_lock(fiber->queue_mutex);
-			if(fiber->queue.empty()){
-				return false;
+			// 在此期间其他线程可能已经向这个纤程投递了新任务，甚至已经销毁并重建了它，因此需要重新查找。
+			const Mutex::Unique_lock lock(g_fiber_map_mutex);
+			const AUTO(it, g_fiber_map.find(category));
+			if(it == g_fiber_map.end()){
+				return;
 			}
-			elem = &(fiber->queue.front());
-			if(elem->promise && !elem->promise->is_satisfied()){
-				if((now < elem->expiry_time) && !(elem->insignificant && force_expiry)){
-					return false;
+			const AUTO(fiber, &(it->second));
+			{
+				const Mutex::Unique_lock queue_lock(fiber->queue_mutex);
+				if((fiber->schedule != fiber_schedule_idle) || !fiber->queue.empty()){
+					return;
 				}
-				POSEIDON_LOG_WARNING("Job timed out");
 			}
-			elem->promise.reset();
+			// 统计和归还栈需要系统调用，在解锁之后进行，以免阻塞其他分发任务的线程。
+			stack = fiber->stack;
+			fiber->stack = NULLPTR;
+			g_fiber_map.erase(it);
+		}
+		if(stack){
+			deallocate_stack(stack);
 		}
-		if((fiber->state == fiber_state_ready) && elem->withdrawn && *(elem->withdrawn)){
+	}
+
+	void pump_one_fiber(Job_worker &worker, Fiber_control *fiber) NOEXCEPT {
+		POSEIDON_PROFILE_ME;
+
+		bool withdrawn;
+		{
+			const Mutex::Unique_lock queue_lock(fiber->queue_mutex);
+			fiber->schedule = fiber_schedule_running;
+			AUTO_REF(elem, fiber->queue.front());
+			elem.promise.reset();
+			withdrawn = (fiber->state == fiber_state_ready) && elem.withdrawn && *(elem.withdrawn);
+		}
+		if(withdrawn){
 			POSEIDON_LOG_DEBUG("Job is withdrawn");
 		} else {
 			schedule_fiber(fiber);
 		}
-		if(fiber->state == fiber_state_ready){
-			const Recursive_mutex::Unique_lock queue_lock(fiber->queue_mutex);
-			fiber->queue.pop_front();
+		Fiber_schedule schedule;
+		boost::uint64_t expiry_time = 0;
+		// 一旦标记为空闲并解锁，其他线程就可能销毁这个纤程，因此要在解锁之前复制。
+		boost::weak_ptr<const void> category;
+		{
+			const Mutex::Unique_lock queue_lock(fiber->queue_mutex);
+			category = fiber->category;
+			if(fiber->state == fiber_state_suspended){
+				schedule = fiber_schedule_waiting;
+				expiry_time = fiber->queue.front().expiry_time;
+			} else {
+				fiber->queue.pop_front();
+				schedule = fiber->queue.empty() ? fiber_schedule_idle : fiber_schedule_queued;
+			}
+			fiber->schedule = schedule;
+		}
+		if(schedule == fiber_schedule_waiting){
+			bool signaled;
+			{
+				const Mutex::Unique_lock lock(g_waiting_mutex);
+				signaled = fiber->wait_signaled;
+				if(signaled){
+					release_wait_token(fiber);
+				} else {
+					g_waiting_list.push_back(*fiber);
+					fiber->waiting = true;
+					g_next_expiry_check = std::min(g_next_expiry_check, expiry_time);
+				}
+			}
+			if(signaled){
+				// promise 在纤程切出之前就已经被满足了，不需要进入等待链表。
+				const Mutex::Unique_lock queue_lock(fiber->queue_mutex);
+				fiber->schedule = fiber_schedule_queued;
+				schedule = fiber_schedule_queued;
+			}
+		}
+		switch(schedule){
+		case fiber_schedule_waiting:
+			break;
+		case fiber_schedule_queued: {
+			Fiber_list fibers;
+			fibers.push_back(*fiber);
+			push_ready_fibers(worker, fibers, 1);
+			break; }
+		default:
+			// 没有任务了，销毁纤程。此后不能再访问 fiber。
+			try_erase_fiber(category);
+			break;
 		}
-		return true;
 	}
-	bool pump_one_round(bool force_expiry) NOEXCEPT {
+
+	bool dispatch_jobs(Job_worker &worker, bool force_expiry) NOEXCEPT {
 		POSEIDON_PROFILE_ME;
 
+		// 同一时刻只有一个工作线程分发任务。
+		if(atomic_exchange(g_dispatching, true, memory_order_acquire)){
+			return false;
+		}
 		bool busy = false;
-		Mutex::Unique_lock lock(g_fiber_map_mutex);
-		bool erase_it;
-		for(AUTO(it, g_fiber_map.begin()); it != g_fiber_map.end(); erase_it ? (it = g_fiber_map.erase(it)) : ++it){
-			AUTO(fiber, &(it->second));
-			lock.unlock();
-			{
-				busy += pump_one_fiber(fiber, force_expiry);
+		Fiber_list ready;
+		std::size_t ready_count = 0;
+		// 把新任务分配到各个纤程中。之前空闲的纤程进入就绪链表。
+		{
+			const Mutex::Unique_lock lock(g_fiber_map_mutex);
+			for(;;){
+				Job_node *const node = inbox_pop();
+				if(!node){
+					break;
+				}
+				try {
+					AUTO(it, g_fiber_map.find(node->category));
+					if(it == g_fiber_map.end()){
+						it = g_fiber_map.emplace(node->category, Fiber_control::Initializer()).first;
+						it->second.category = node->category;
+					}
+					const AUTO(fiber, &(it->second));
+					const Mutex::Unique_lock queue_lock(fiber->queue_mutex);
+					fiber->queue.push_back(STD_MOVE(node->elem));
+					if(fiber->schedule == fiber_schedule_idle){
+						fiber->schedule = fiber_schedule_queued;
+						ready.push_back(*fiber);
+						++ready_count;
+					}
+				} catch(std::exception &e){
+					POSEIDON_LOG_ERROR("std::exception thrown: what = ", e.what());
+				}
+				delete node;
+				busy = true;
+			}
+		}
+		// 收集被 promise 唤醒的纤程，然后检查超时。只有分发任务的线程会向这些纤程的队列追加任务，因此这里不需要锁定队列。
+		const AUTO(now, get_fast_mono_clock());
+		{
+			const Mutex::Unique_lock lock(g_waiting_mutex);
+			ready_count += atomic_exchange(g_woken_count, 0, memory_order_relaxed);
+			ready.splice(ready.end(), g_woken_list);
+			if(force_expiry || (now >= g_next_expiry_check)){
+				g_next_expiry_check = (boost::uint64_t)-1;
+				for(AUTO(it, g_waiting_list.begin()); it != g_waiting_list.end(); ){
+					const AUTO(fiber, &*it);
+					++it;
+					if(fiber_should_wake(fiber, now, force_expiry)){
+						fiber->waiting = false;
+						release_wait_token(fiber);
+						fiber->unlink();
+						ready.push_back(*fiber);
+						++ready_count;
+					} else {
+						g_next_expiry_check = std::min(g_next_expiry_check, fiber->queue.front().expiry_time);
+					}
+				}
+			}
+		}
+		atomic_store(g_dispatching, false, memory_order_release);
+
+		for(AUTO(it, ready.begin()); it != ready.end(); ++it){
+			const Mutex::Unique_lock queue_lock(it->queue_mutex);
+			it->schedule = fiber_schedule_queued;
+		}
+		push_ready_fibers(worker, ready, ready_count);
+		return busy;
+	}
+
+	bool pump_one_round(Job_worker &worker, bool force_expiry) NOEXCEPT {
+		POSEIDON_PROFILE_ME;
+
+		bool busy = dispatch_jobs(worker, force_expiry);
+		// 每轮至多运行这么多个纤程，然后回去分发新任务。
+		for(std::size_t i = 0; i < 256; ++i){
+			const AUTO(fiber, pop_ready_fiber(worker));
+			if(!fiber){
+				break;
 			}
-			lock.lock();
-			erase_it = fiber->queue.empty();
+			pump_one_fiber(worker, fiber);
+			busy = true;
 		}
 		return busy;
 	}
+
+	void worker_thread_proc(Job_worker *worker) NOEXCEPT {
+		POSEIDON_PROFILE_ME;
+		POSEIDON_LOG(Logger::special_major | Logger::level_info, "Job worker ", worker->index, " started.");
+
+		unsigned timeout = 0;
+		for(;;){
+			bool busy;
+			do {
+				busy = pump_one_round(*worker, atomic_load(g_force_expiry, memory_order_relaxed));
+				timeout = std::min(timeout * 2u + 1u, !busy * 100u);
+			} while(busy);
+
+			if(!atomic_load(g_running, memory_order_consume)){
+				break;
+			}
+			wait_for_jobs(timeout);
+		}
+
+		POSEIDON_LOG(Logger::special_major | Logger::level_info, "Job worker ", worker->index, " stopped.");
+	}
 }
 
 void Job_dispatcher::start(){
 	POSEIDON_LOG(Logger::special_major | Logger::level_info, "Starting job dispatcher...");
 
-	//
+	const AUTO(thread_count, Main_config::get<std::size_t>("job_thread_count", 0));
+
+	const long page_size = ::sysconf(_SC_PAGESIZE);
+	if(page_size > 0){
+		g_stack_page_size = static_cast<std::size_t>(page_size);
+	}
+	const AUTO(stack_size, Main_config::get<std::size_t>("job_fiber_stack_size", 0x40000));
+	const AUTO(stack_pages, std::max<std::size_t>((stack_size + g_stack_page_size - 1) / g_stack_page_size, 4));
+	g_stack_size = stack_pages * g_stack_page_size;
+	g_stack_cache_limit = Main_config::get<std::size_t>("job_fiber_stack_cache_size", 16);
+	g_stack_lazy_free = Main_config::get<bool>("job_fiber_stack_lazy_free", false);
+	POSEIDON_LOG(Logger::special_major | Logger::level_info, "Fiber stack size = ", g_stack_size, ", cache size per thread = ", g_stack_cache_limit);
+	g_multi_threaded = (thread_count != 0);
+	atomic_store(g_force_expiry, false, memory_order_relaxed);
+	atomic_store(g_running, true, memory_order_release);
+	g_workers.resize(std::max<std::size_t>(thread_count, 1));
+	for(std::size_t i = 0; i < g_workers.size(); ++i){
+		const AUTO(worker, boost::make_shared<Job_worker>());
+		worker->index = i;
+		g_workers.at(i) = worker;
+	}
+	if(g_multi_threaded){
+		POSEIDON_LOG(Logger::special_major | Logger::level_info, "Creating ", thread_count, " job worker thread(s)...");
+		for(std::size_t i = 0; i < g_workers.size(); ++i){
+			const AUTO(worker, g_workers.at(i).get());
+			Thread(boost::bind(&worker_thread_proc, worker), Rcnts::view("  J "), Rcnts::view("Job")).swap(worker->thread);
+		}
+	}
 }
 void Job_dispatcher::stop(){
 	POSEIDON_LOG(Logger::special_major | Logger::level_info, "Stopping job dispatcher...");
 
-	Mutex::Unique_lock lock(g_fiber_map_mutex);
+	atomic_store(g_force_expiry, true, memory_order_relaxed);
+	wake_workers(g_workers.size());
 	boost::uint64_t last_info_time = 0;
 	for(;;){
-		const AUTO(pending_fibers, g_fiber_map.size());
-		if(pending_fibers == 0){
+		std::size_t pending_fibers;
+		bool inbox_drained;
+		{
+			const Mutex::Unique_lock lock(g_fiber_map_mutex);
+			pending_fibers = g_fiber_map.size();
+			inbox_drained = inbox_empty();
+		}
+		if((pending_fibers == 0) && inbox_drained){
 			break;
 		}
-		lock.unlock();
 
 		const AUTO(now, get_fast_mono_clock());
 		if(last_info_time + 500 < now){
 			POSEIDON_LOG(Logger::special_major | Logger::level_info, "There are ", pending_fibers, " fiber(s) remaining.");
 			last_info_time = now;
 		}
-		pump_one_round(true);
+		if(g_multi_threaded){
+			::usleep(1000);
+		} else {
+			pump_one_round(*(g_workers.front()), true);
+		}
+	}
+
+	atomic_store(g_running, false, memory_order_release);
+	if(g_multi_threaded){
+		POSEIDON_LOG(Logger::special_major | Logger::level_info, "Waiting for job worker threads to terminate...");
+		{
+			const Mutex::Unique_lock lock(g_sleep_mutex);
+			g_new_job.broadcast();
+		}
+		for(std::size_t i = 0; i < g_workers.size(); ++i){
+			g_workers.at(i)->thread.join();
+		}
+		// 线程退出前投递的任务由当前线程处理。
+		while(pump_one_round(*(g_workers.front()), true)){
+			//
+		}
+	}
+	g_workers.clear();
+}
+
+void Job_dispatcher::snapshot_stacks(Job_dispatcher::Stack_snapshot &ret){
+	ret.stack_size = g_stack_size;
+	ret.guard_size = g_stack_page_size;
+	ret.system_allocations = atomic_load(g_stack_system_allocations, memory_order_relaxed);
+	ret.system_deallocations = atomic_load(g_stack_system_deallocations, memory_order_relaxed);
+	ret.cache_hits = atomic_load(g_stack_cache_hits, memory_order_relaxed);
+	ret.stacks_in_use = atomic_load(g_stacks_in_use, memory_order_relaxed);
+	ret.stacks_cached = atomic_load(g_stacks_cached, memory_order_relaxed);
 
-		lock.lock();
+	const Mutex::Unique_lock lock(g_stack_stats_mutex);
+	ret.high_water_max = g_stack_high_water_max;
+	ret.high_water_samples = g_stack_high_water_samples;
+	ret.high_water_total = g_stack_high_water_total;
+	ret.high_water_histogram.clear();
+	ret.high_water_histogram.reserve(stack_histogram_size);
+	for(std::size_t i = 0; i < stack_histogram_size; ++i){
+		Stack_snapshot::Histogram_bucket bucket = { };
+		bucket.limit = (i + 1 < stack_histogram_size) ? (g_stack_page_size << i) : 0;
+		bucket.count = g_stack_high_water_histogram[i];
+		ret.high_water_histogram.push_back(bucket);
 	}
 }
 
 void Job_dispatcher::do_modal(volatile int &sig_recv){
+	if(g_multi_threaded){
+		// 任务在工作线程中运行，这里只需要等待信号。
+		for(;;){
+			const int sig = atomic_exchange(sig_recv, 0, memory_order_acquire);
+			if(sig != 0){
+				POSEIDON_LOG_WARNING("Received signal: ", sig, " (", ::strsignal(sig), ")");
+				break;
+			}
+			::usleep(100000);
+		}
+		return;
+	}
+
+	AUTO_REF(worker, *(g_workers.front()));
 	unsigned timeout = 0;
 	for(;;){
 		const int sig = atomic_exchange(sig_recv, 0, memory_order_acquire);
@@ -271,15 +1085,14 @@ void Job_dispatcher::do_modal(volatile int &sig_recv){
 		}
 		bool busy;
 		do {
-			busy = pump_one_round(sig != 0);
+			busy = pump_one_round(worker, sig != 0);
 			timeout = std::min(timeout * 2u + 1u, !busy * 100u);
 		} while(busy);
 
-		Mutex::Unique_lock lock(g_fiber_map_mutex);
 		if(sig != 0){
 			break;
 		}
-		g_new_job.timed_wait(lock, timeout);
+		wait_for_jobs(timeout);
 	}
 }
 
@@ -292,45 +1105,54 @@ void Job_dispatcher::enqueue(boost::shared_ptr<Job_base> job, boost::shared_ptr<
 		category = job;
 	}
 
-	const Mutex::Unique_lock lock(g_fiber_map_mutex);
-	AUTO(it, g_fiber_map.find(category));
-	if(it == g_fiber_map.end()){
-		it = g_fiber_map.emplace(category, Fiber_control::Initializer()).first;
-	}
-	const AUTO(fiber, &(it->second));
-	{
-		const Recursive_mutex::Unique_lock queue_lock(fiber->queue_mutex);
-		Job_element elem = { STD_MOVE(job), STD_MOVE(withdrawn) };
-		fiber->queue.push_back(STD_MOVE(elem));
-	}
-	g_new_job.signal();
+	const AUTO(node, new Job_node);
+	node->category = STD_MOVE(category);
+	node->elem.job = STD_MOVE(job);
+	node->elem.withdrawn = STD_MOVE(withdrawn);
+	inbox_push(node);
+	wake_workers(1);
 }
 void Job_dispatcher::yield(boost::shared_ptr<const Promise> promise, bool insignificant){
 	POSEIDON_PROFILE_ME;
 
 	const AUTO(fiber, t_current_fiber);
 	POSEIDON_THROW_UNLESS(fiber, Exception, Rcnts::view("No current fiber"));
-	if(fiber->queue.empty()){
-		POSEIDON_LOG_FATAL("Not in current fiber?!");
-		std::terminate();
-	}
 	if(promise && promise->is_satisfied()){
 		POSEIDON_LOG_TRACE("Skipped yielding from fiber ", static_cast<void *>(fiber));
 	} else {
+		POSEIDON_THROW_UNLESS(fiber->state != fiber_state_stackless, Exception, Rcnts::view("Stackless jobs cannot yield"));
 		POSEIDON_LOG_TRACE("Yielding from fiber ", static_cast<void *>(fiber));
 		const AUTO(job_timeout, Main_config::get<boost::uint64_t>("job_timeout", 60000));
-		AUTO_REF(elem, fiber->queue.front());
-		elem.promise = promise;
-		elem.expiry_time = saturated_add(get_fast_mono_clock(), job_timeout);
-		elem.insignificant = insignificant;
-		const AUTO(profiler_hook, Profiler::begin_stack_switch());
 		{
-			fiber->state = fiber_state_suspended;
-			if(::swapcontext(&(fiber->inner), &(fiber->outer)) != 0){
-				const int err_code = errno;
-				POSEIDON_LOG_FATAL("::swapcontext() failed: err_code = ", err_code);
+			const Mutex::Unique_lock queue_lock(fiber->queue_mutex);
+			if(fiber->queue.empty()){
+				POSEIDON_LOG_FATAL("Not in current fiber?!");
 				std::terminate();
 			}
+			AUTO_REF(elem, fiber->queue.front());
+			elem.promise = promise;
+			elem.expiry_time = saturated_add(get_fast_mono_clock(), job_timeout);
+			elem.insignificant = insignificant;
+		}
+		boost::shared_ptr<Fiber_control *> wait_token;
+		{
+			const Mutex::Unique_lock lock(g_waiting_mutex);
+			if(promise){
+				wait_token = boost::make_shared<Fiber_control *>(fiber);
+			}
+			fiber->wait_token = wait_token;
+			fiber->wait_signaled = !promise;
+		}
+		if(promise){
+			// 如果 promise 已经被满足，回调函数会被立即调用，这是安全的。
+			promise->add_callback(boost::bind(&wake_waiting_fiber, boost::weak_ptr<Fiber_control *>(wait_token)));
+		}
+		// 纤程恢复时可能位于另一个工作线程上。Profiler 的线程局部栈顶在切换前后由 begin_stack_switch() 和 end_stack_switch() 保存和恢复，
+		// 这两个函数位于另一个翻译单元中，每次都会重新取得当前线程的变量。
+		const AUTO(profiler_hook, Profiler::begin_stack_switch());
+		{
+			fiber->state = fiber_state_suspended;
+			switch_out_of_fiber(fiber);
 		}
 		Profiler::end_stack_switch(profiler_hook);
 		POSEIDON_LOG_TRACE("Resumed to fiber ", static_cast<void *>(fiber));
@@ -6,6 +6,8 @@
 
 #include "../cxx_ver.hpp"
 #include <boost/shared_ptr.hpp>
+#include <boost/container/vector.hpp>
+#include <cstddef>
 
 namespace Poseidon {
 
@@ -13,6 +15,28 @@ class Job_base;
 class Promise;
 
 class Job_dispatcher {
+public:
+	struct Stack_snapshot {
+		struct Histogram_bucket {
+			std::size_t limit; // 最后一个桶的上限为零，表示不限。
+			unsigned long long count;
+		};
+
+		std::size_t stack_size;
+		std::size_t guard_size;
+		unsigned long long system_allocations;
+		unsigned long long system_deallocations;
+		unsigned long long cache_hits;
+		std::size_t stacks_in_use;
+		std::size_t stacks_cached;
+
+		// 纤程结束时统计其栈的最大使用量。
+		std::size_t high_water_max;
+		unsigned long long high_water_samples;
+		unsigned long long high_water_total;
+		boost::container::vector<Histogram_bucket> high_water_histogram;
+	};
+
 private:
 	Job_dispatcher();
 
@@ -25,6 +49,9 @@ public:
 	static void enqueue(boost::shared_ptr<Job_base> job, boost::shared_ptr<const bool> withdrawn);
 	// Pass `promise` by value to avoid false aliasing.
 	static void yield(boost::shared_ptr<const Promise> promise, bool insignificant);
+
+	// 获取纤程栈的统计信息。
+	static void snapshot_stacks(Stack_snapshot &ret);
 };
 
 }
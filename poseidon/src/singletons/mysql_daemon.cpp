@@ -20,6 +20,9 @@
 #include "../errno.hpp"
 #include "../buffer_streams.hpp"
 #include "../checked_arithmetic.hpp"
+#include "../multi_index_map.hpp"
+#include "../stream_buffer.hpp"
+#include <typeinfo>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -52,7 +55,8 @@ namespace {
 		std::string schema = Main_config::get<std::string>("mysql_schema", "poseidon");
 		bool use_ssl = Main_config::get<bool>("mysql_use_ssl", false);
 		std::string charset = Main_config::get<std::string>("mysql_charset", "utf8");
-		return Mysql::Connection::create(server_addr.c_str(), server_port, username.c_str(), password.c_str(), schema.c_str(), use_ssl, charset.c_str());
+		std::size_t statement_cache_size = Main_config::get<std::size_t>("mysql_statement_cache_size", 64);
+		return Mysql::Connection::create(server_addr.c_str(), server_port, username.c_str(), password.c_str(), schema.c_str(), use_ssl, charset.c_str(), statement_cache_size);
 	}
 
 	// 对于日志文件的写操作应当互斥。
@@ -111,13 +115,515 @@ namespace {
 		POSEIDON_LOG_ERROR("Error writing SQL dump: what = ", e.what());
 	}
 
+	// 合并写入的语句长度不能超过服务器的 max_allowed_packet。返回 0 表示未知。
+	std::size_t query_max_allowed_packet(const boost::shared_ptr<Mysql::Connection> &conn) NOEXCEPT
+	try {
+		POSEIDON_PROFILE_ME;
+
+		conn->execute_sql("SELECT @@max_allowed_packet AS `value`");
+		std::size_t value = 0;
+		if(conn->fetch_row()){
+			value = static_cast<std::size_t>(conn->get_unsigned("value"));
+		}
+		conn->discard_result();
+		POSEIDON_LOG_DEBUG("MySQL max_allowed_packet = ", value);
+		return value;
+	} catch(std::exception &e){
+		POSEIDON_LOG_WARNING("Could not get max_allowed_packet from MySQL server: what = ", e.what());
+		conn->discard_result();
+		return 0;
+	}
+
+	// 生成的 SQL 的统计。
+	Mutex g_stats_mutex;
+	boost::uint64_t g_stats_since = 0;
+	unsigned long long g_stats_statements = 0;
+	unsigned long long g_stats_sql_bytes = 0;
+	unsigned long long g_stats_parameter_bytes = 0;
+	unsigned long long g_stats_full_saves = 0;
+	unsigned long long g_stats_partial_saves = 0;
+	unsigned long long g_stats_skipped_saves = 0;
+
+	void record_statement(const std::string &sql, const Mysql::Statement_parameters *params) NOEXCEPT {
+		const Mutex::Unique_lock lock(g_stats_mutex);
+		g_stats_statements += 1;
+		g_stats_sql_bytes += sql.size();
+		if(params){
+			g_stats_parameter_bytes += params->get_data_size();
+		}
+	}
+	void record_saves(unsigned long long full, unsigned long long partial, unsigned long long skipped) NOEXCEPT {
+		const Mutex::Unique_lock lock(g_stats_mutex);
+		g_stats_full_saves += full;
+		g_stats_partial_saves += partial;
+		g_stats_skipped_saves += skipped;
+	}
+
+	// 每个表的操作的统计，时间以微秒为单位。
+	struct Table_counters {
+		unsigned long long operations;
+		unsigned long long failures;
+		unsigned long long total_latency;
+		unsigned long long max_latency;
+		unsigned long long total_execution_time;
+		unsigned long long max_execution_time;
+	};
+	boost::container::flat_map<Rcnts, Table_counters> g_table_counters;
+
+	void record_operation(const char *table, boost::uint64_t latency, boost::uint64_t execution_time, bool failed) NOEXCEPT
+	try {
+		const Mutex::Unique_lock lock(g_stats_mutex);
+		AUTO(it, g_table_counters.find(Rcnts::view(table)));
+		if(it == g_table_counters.end()){
+			const Table_counters empty = { };
+			it = g_table_counters.emplace(Rcnts(table), empty).first;
+		}
+		AUTO_REF(counters, it->second);
+		counters.operations += 1;
+		counters.failures += failed;
+		counters.total_latency += latency;
+		counters.max_latency = std::max<unsigned long long>(counters.max_latency, latency);
+		counters.total_execution_time += execution_time;
+		counters.max_execution_time = std::max<unsigned long long>(counters.max_execution_time, execution_time);
+	} catch(std::exception &e){
+		POSEIDON_LOG_ERROR("std::exception thrown: what = ", e.what());
+	}
+
+	// 每次通过这里删除一个表中的行都会递增它的代数。对象的 persistent 标记只在代数相同时有效。
+	Mutex g_delete_mutex;
+	boost::container::flat_map<Rcnts, boost::uint64_t> g_delete_generations;
+
+	boost::uint64_t get_delete_generation(const char *table){
+		const Mutex::Unique_lock lock(g_delete_mutex);
+		const AUTO(it, g_delete_generations.find(Rcnts::view(table)));
+		if(it == g_delete_generations.end()){
+			return 0;
+		}
+		return it->second;
+	}
+	void bump_delete_generation(const char *table){
+		const Mutex::Unique_lock lock(g_delete_mutex);
+		AUTO(it, g_delete_generations.find(Rcnts::view(table)));
+		if(it == g_delete_generations.end()){
+			it = g_delete_generations.emplace(Rcnts(table), 0).first;
+		}
+		it->second += 1;
+	}
+	bool is_row_persistent(const Mysql::Object_base &object, boost::uint64_t generation){
+		return object.is_persistent() && (object.get_persistent_generation() == generation);
+	}
+
+	// 读取结果的缓存。
+	enum Cached_field_type {
+		cached_boolean   = 1,
+		cached_signed    = 2,
+		cached_unsigned  = 3,
+		cached_double    = 4,
+		cached_string    = 5,
+		cached_datetime  = 6,
+		cached_uuid      = 7,
+		cached_blob      = 8,
+	};
+
+	// 只记录被读取过的字段，读取时使用的函数也必须相同。
+	struct Cached_field {
+		std::string name;
+		Cached_field_type type;
+		boost::uint64_t integer;
+		double real;
+		std::string bytes;
+	};
+	typedef boost::container::vector<Cached_field> Cached_row;
+	typedef boost::container::vector<Cached_row> Cached_rows;
+
+	struct Cache_element {
+		std::string key;
+		Rcnts table;
+		boost::shared_ptr<const Cached_rows> rows;
+		std::size_t size;
+	};
+	POSEIDON_MULTI_INDEX_MAP(Cache_map, Cache_element,
+		POSEIDON_UNIQUE_MEMBER_INDEX(key)
+		POSEIDON_MULTI_MEMBER_INDEX(table)
+		POSEIDON_SEQUENCE_INDEX()
+	);
+
+	// 为零表示不使用缓存。只在启动时设定。
+	std::size_t g_cache_max_size = 0;
+
+	Mutex g_cache_mutex;
+	Cache_map g_cache_map; // 按照最近使用的顺序排列，最久未使用的在最前面。
+	std::size_t g_cache_size = 0;
+	// 每次写入一个表都会递增它的代数。读取操作在加入队列时记下代数，如果执行完毕时代数已经改变，结果就不能写入缓存。
+	boost::container::flat_map<Rcnts, boost::uint64_t> g_cache_generations;
+	unsigned long long g_cache_hits = 0;
+	unsigned long long g_cache_misses = 0;
+	unsigned long long g_cache_evictions = 0;
+	unsigned long long g_cache_invalidations = 0;
+	unsigned long long g_cache_rejections = 0;
+
+	// 调用时 g_cache_mutex 必须已被锁定。
+	boost::uint64_t get_cache_generation(const char *table){
+		const AUTO(it, g_cache_generations.find(Rcnts::view(table)));
+		if(it == g_cache_generations.end()){
+			return 0;
+		}
+		return it->second;
+	}
+
+	void make_cache_key(std::string &key, const char *table, const char *type, const std::string &query, const Mysql::Statement_parameters *params){
+		key.reserve(255);
+		key += table;
+		key += '\0';
+		key += type;
+		key += '\0';
+		if(params){
+			key += 'P';
+			key += query;
+			key += '\0';
+			params->serialize(key);
+		} else {
+			key += 'T';
+			key += query;
+		}
+	}
+
+	boost::shared_ptr<const Cached_rows> find_in_cache(boost::uint64_t &generation, const std::string &key, const char *table){
+		POSEIDON_PROFILE_ME;
+
+		const Mutex::Unique_lock lock(g_cache_mutex);
+		generation = get_cache_generation(table);
+		const AUTO(it, g_cache_map.find<0>(key));
+		if(it == g_cache_map.end<0>()){
+			g_cache_misses += 1;
+			return VAL_INIT;
+		}
+		g_cache_hits += 1;
+		AUTO_REF(sequence, g_cache_map.get_index<2>());
+		sequence.relocate(sequence.end(), g_cache_map.project<2>(it));
+		return it->rows;
+	}
+	void insert_into_cache(std::string key, const char *table, boost::uint64_t generation, boost::shared_ptr<const Cached_rows> rows, std::size_t size){
+		POSEIDON_PROFILE_ME;
+
+		size += key.size() + sizeof(Cache_element);
+
+		const Mutex::Unique_lock lock(g_cache_mutex);
+		if(get_cache_generation(table) != generation){
+			POSEIDON_LOG_TRACE("Table has been modified since the query was enqueued: table = ", table);
+			g_cache_rejections += 1;
+			return;
+		}
+		if(size > g_cache_max_size){
+			POSEIDON_LOG_DEBUG("Result is too large to be cached: table = ", table, ", size = ", size);
+			return;
+		}
+		const AUTO(old_it, g_cache_map.find<0>(key));
+		if(old_it != g_cache_map.end<0>()){
+			g_cache_size -= old_it->size;
+			g_cache_map.erase<0>(old_it);
+		}
+		Cache_element elem = { STD_MOVE(key), Rcnts(table), STD_MOVE(rows), size };
+		g_cache_map.insert(STD_MOVE(elem));
+		g_cache_size += size;
+		while(g_cache_size > g_cache_max_size){
+			const AUTO(it, g_cache_map.begin<2>());
+			g_cache_size -= it->size;
+			g_cache_map.erase<2>(it);
+			g_cache_evictions += 1;
+		}
+	}
+	void erase_from_cache(const std::string &key) NOEXCEPT {
+		const Mutex::Unique_lock lock(g_cache_mutex);
+		const AUTO(it, g_cache_map.find<0>(key));
+		if(it == g_cache_map.end<0>()){
+			return;
+		}
+		g_cache_size -= it->size;
+		g_cache_map.erase<0>(it);
+	}
+	// 写入操作加入队列之后调用。在此之前加入队列的读取操作的结果都不能再写入缓存。
+	void invalidate_cache(const char *table){
+		POSEIDON_PROFILE_ME;
+
+		if(g_cache_max_size == 0){
+			return;
+		}
+		const Mutex::Unique_lock lock(g_cache_mutex);
+		AUTO(git, g_cache_generations.find(Rcnts::view(table)));
+		if(git == g_cache_generations.end()){
+			git = g_cache_generations.emplace(Rcnts(table), 0).first;
+		}
+		git->second += 1;
+		const AUTO(range, g_cache_map.equal_range<1>(Rcnts::view(table)));
+		for(AUTO(it, range.first); it != range.second; ++it){
+			g_cache_size -= it->size;
+			g_cache_invalidations += 1;
+		}
+		g_cache_map.erase<1>(range.first, range.second);
+	}
+
+	// 转发所有操作，同时记录读取到的字段。
+	class Recording_connection : public Mysql::Connection {
+	private:
+		const boost::shared_ptr<Mysql::Connection> m_conn;
+
+		mutable bool m_cacheable;
+		mutable boost::shared_ptr<Cached_rows> m_rows;
+		mutable std::size_t m_size;
+
+	public:
+		explicit Recording_connection(boost::shared_ptr<Mysql::Connection> conn)
+			: m_conn(STD_MOVE(conn))
+			, m_cacheable(true), m_rows(boost::make_shared<Cached_rows>()), m_size(0)
+		{
+			//
+		}
+
+	private:
+		void give_up() const NOEXCEPT {
+			m_cacheable = false;
+			m_rows.reset();
+		}
+		Cached_field * record(const char *name, Cached_field_type type, std::size_t bytes) const {
+			if(!m_cacheable){
+				return NULLPTR;
+			}
+			if(m_rows->empty()){
+				give_up();
+				return NULLPTR;
+			}
+			m_size += sizeof(Cached_field) + std::strlen(name) + bytes;
+			if(m_size > g_cache_max_size){
+				give_up();
+				return NULLPTR;
+			}
+			AUTO_REF(row, m_rows->back());
+			row.emplace_back();
+			AUTO_REF(field, row.back());
+			field.name = name;
+			field.type = type;
+			field.integer = 0;
+			field.real = 0;
+			return &field;
+		}
+		void record_integer(const char *name, Cached_field_type type, boost::uint64_t value) const {
+			const AUTO(field, record(name, type, 0));
+			if(field){
+				field->integer = value;
+			}
+		}
+		void record_bytes(const char *name, Cached_field_type type, std::string value) const {
+			const AUTO(field, record(name, type, value.size()));
+			if(field){
+				field->bytes.swap(value);
+			}
+		}
+
+	public:
+		// 如果结果可以被缓存，就写入缓存。
+		void commit(std::string key, const char *table, boost::uint64_t generation){
+			if(!m_cacheable){
+				return;
+			}
+			insert_into_cache(STD_MOVE(key), table, generation, m_rows, m_size);
+			give_up();
+		}
+
+		// 执行其他语句的结果不缓存。
+		void execute_sql_explicit(const char *sql, std::size_t len) OVERRIDE {
+			give_up();
+			m_conn->execute_sql_explicit(sql, len);
+		}
+		void execute_prepared_explicit(const char *sql, std::size_t len, const Mysql::Statement_parameters &params) OVERRIDE {
+			give_up();
+			m_conn->execute_prepared_explicit(sql, len, params);
+		}
+		void discard_result() NOEXCEPT OVERRIDE {
+			m_conn->discard_result();
+		}
+
+		boost::uint64_t get_insert_id() const OVERRIDE {
+			return m_conn->get_insert_id();
+		}
+		bool fetch_row() OVERRIDE {
+			const bool has_next = m_conn->fetch_row();
+			if(has_next && m_cacheable){
+				m_size += sizeof(Cached_row);
+				m_rows->emplace_back();
+			}
+			return has_next;
+		}
+
+		bool get_boolean(const char *name) const OVERRIDE {
+			const AUTO(value, m_conn->get_boolean(name));
+			record_integer(name, cached_boolean, value);
+			return value;
+		}
+		boost::int64_t get_signed(const char *name) const OVERRIDE {
+			const AUTO(value, m_conn->get_signed(name));
+			record_integer(name, cached_signed, static_cast<boost::uint64_t>(value));
+			return value;
+		}
+		boost::uint64_t get_unsigned(const char *name) const OVERRIDE {
+			const AUTO(value, m_conn->get_unsigned(name));
+			record_integer(name, cached_unsigned, value);
+			return value;
+		}
+		double get_double(const char *name) const OVERRIDE {
+			const AUTO(value, m_conn->get_double(name));
+			const AUTO(field, record(name, cached_double, 0));
+			if(field){
+				field->real = value;
+			}
+			return value;
+		}
+		std::string get_string(const char *name) const OVERRIDE {
+			AUTO(value, m_conn->get_string(name));
+			record_bytes(name, cached_string, value);
+			return value;
+		}
+		boost::uint64_t get_datetime(const char *name) const OVERRIDE {
+			const AUTO(value, m_conn->get_datetime(name));
+			record_integer(name, cached_datetime, value);
+			return value;
+		}
+		Uuid get_uuid(const char *name) const OVERRIDE {
+			const AUTO(value, m_conn->get_uuid(name));
+			record_bytes(name, cached_uuid, std::string(reinterpret_cast<const char *>(value.begin()), value.size()));
+			return value;
+		}
+		Stream_buffer get_blob(const char *name) const OVERRIDE {
+			AUTO(value, m_conn->get_blob(name));
+			record_bytes(name, cached_blob, value.dump_string());
+			return value;
+		}
+	};
+
+	// 从缓存中的结果读取。不能执行语句。
+	class Replay_connection : public Mysql::Connection {
+	private:
+		const boost::shared_ptr<const Cached_rows> m_rows;
+
+		std::size_t m_next;
+		const Cached_row *m_row;
+
+	public:
+		explicit Replay_connection(boost::shared_ptr<const Cached_rows> rows)
+			: m_rows(STD_MOVE(rows))
+			, m_next(0), m_row(NULLPTR)
+		{
+			//
+		}
+
+	private:
+		const Cached_field & find_field(const char *name, Cached_field_type type) const {
+			POSEIDON_THROW_UNLESS(m_row, Basic_exception, Rcnts::view("No more results available"));
+			for(AUTO(it, m_row->begin()); it != m_row->end(); ++it){
+				if((it->type == type) && (it->name == name)){
+					return *it;
+				}
+			}
+			POSEIDON_THROW(Mysql::Exception, Rcnts::view(""), ER_BAD_FIELD_ERROR, Rcnts::view("Field was not read when the result was cached"));
+		}
+
+	public:
+		void execute_sql_explicit(const char * /* sql */, std::size_t /* len */) OVERRIDE {
+			POSEIDON_THROW(Basic_exception, Rcnts::view("Cached MySQL results cannot be used to execute queries"));
+		}
+		void execute_prepared_explicit(const char * /* sql */, std::size_t /* len */, const Mysql::Statement_parameters & /* params */) OVERRIDE {
+			POSEIDON_THROW(Basic_exception, Rcnts::view("Cached MySQL results cannot be used to execute queries"));
+		}
+		void discard_result() NOEXCEPT OVERRIDE {
+			m_next = m_rows->size();
+			m_row = NULLPTR;
+		}
+
+		boost::uint64_t get_insert_id() const OVERRIDE {
+			return 0;
+		}
+		bool fetch_row() OVERRIDE {
+			if(m_next >= m_rows->size()){
+				m_row = NULLPTR;
+				return false;
+			}
+			m_row = &(m_rows->at(m_next));
+			++m_next;
+			return true;
+		}
+
+		bool get_boolean(const char *name) const OVERRIDE {
+			return find_field(name, cached_boolean).integer != 0;
+		}
+		boost::int64_t get_signed(const char *name) const OVERRIDE {
+			return static_cast<boost::int64_t>(find_field(name, cached_signed).integer);
+		}
+		boost::uint64_t get_unsigned(const char *name) const OVERRIDE {
+			return find_field(name, cached_unsigned).integer;
+		}
+		double get_double(const char *name) const OVERRIDE {
+			return find_field(name, cached_double).real;
+		}
+		std::string get_string(const char *name) const OVERRIDE {
+			return find_field(name, cached_string).bytes;
+		}
+		boost::uint64_t get_datetime(const char *name) const OVERRIDE {
+			return find_field(name, cached_datetime).integer;
+		}
+		Uuid get_uuid(const char *name) const OVERRIDE {
+			const AUTO_REF(bytes, find_field(name, cached_uuid).bytes);
+			boost::array<unsigned char, 16> data;
+			POSEIDON_THROW_UNLESS(bytes.size() == data.size(), Basic_exception, Rcnts::view("Cached UUID is corrupted"));
+			std::memcpy(data.data(), bytes.data(), data.size());
+			return Uuid(data);
+		}
+		Stream_buffer get_blob(const char *name) const OVERRIDE {
+			return Stream_buffer(find_field(name, cached_blob).bytes);
+		}
+	};
+
+	// 命中时在当前线程中读取对象并满足 promise，返回 true。
+	// 否则返回 false，key 和 generation 用于在执行之后写入缓存；如果 key 为空则不缓存。
+	bool load_object_from_cache(std::string &key, boost::uint64_t &generation, const boost::shared_ptr<Promise> &promise, const boost::shared_ptr<Mysql::Object_base> &object, const char *table, const std::string &query, const Mysql::Statement_parameters *params){
+		POSEIDON_PROFILE_ME;
+
+		if(g_cache_max_size == 0){
+			return false;
+		}
+		// 同一个类的 fetch() 总是以相同的方式读取所有的列，因此缓存的行总能完整地重放。
+		make_cache_key(key, table, typeid(*object).name(), query, params);
+		const AUTO(rows, find_in_cache(generation, key, table));
+		if(!rows){
+			return false;
+		}
+		try {
+			const AUTO(replay, boost::make_shared<Replay_connection>(rows));
+			POSEIDON_THROW_UNLESS(replay->fetch_row(), Mysql::Exception, Rcnts::view(table), ER_SP_FETCH_NO_DATA, Rcnts::view("No rows returned"));
+			object->fetch(replay);
+			object->set_persistent(true, get_delete_generation(table));
+		} catch(std::exception &e){
+			// 对象的读取可以重复，因此从数据库中重新读取即可。
+			POSEIDON_LOG_WARNING("Could not load object from MySQL cache: table = ", table, ", what = ", e.what());
+			erase_from_cache(key);
+			return false;
+		}
+		promise->set_success(false);
+		return true;
+	}
+
 	// 数据库线程操作。
 	class Operation_base : NONCOPYABLE {
+	public:
+		// 表名、列名和写入方式都相同的操作可以合并成一条多行语句。
+		struct Batch_key {
+			const char *table;
+			const char *columns;
+			bool to_replace;
+		};
+
 	private:
 		const boost::weak_ptr<Promise> m_weak_promise;
 
-		boost::shared_ptr<const void> m_probe;
-
 	public:
 		explicit Operation_base(const boost::shared_ptr<Promise> &promise)
 			: m_weak_promise(promise)
@@ -129,33 +635,71 @@ namespace {
 		}
 
 	public:
-		void set_probe(boost::shared_ptr<const void> probe){
-			m_probe = STD_MOVE(probe);
-		}
-
 		virtual boost::shared_ptr<Promise> get_promise() const {
 			return m_weak_promise.lock();
 		}
 		virtual bool should_use_slave() const = 0;
 		virtual boost::shared_ptr<const Mysql::Object_base> get_combinable_object() const = 0;
+		virtual bool get_batch_key(Batch_key &key) const = 0;
 		virtual const char * get_table() const = 0;
+		// 生成的 SQL 只用于日志和转储，执行时不一定使用。
 		virtual void generate_sql(std::string &query) const = 0;
-		virtual void execute(const boost::shared_ptr<Mysql::Connection> &conn, const std::string &query) = 0;
+		virtual void execute(const boost::shared_ptr<Mysql::Connection> &conn) = 0;
 	};
 
 	class Save_operation : public Operation_base {
 	private:
 		boost::shared_ptr<const Mysql::Object_base> m_object;
 		bool m_to_replace;
+		bool m_dirty_fields_only;
 
 	public:
-		Save_operation(const boost::shared_ptr<Promise> &promise, boost::shared_ptr<const Mysql::Object_base> object, bool to_replace)
+		Save_operation(const boost::shared_ptr<Promise> &promise, boost::shared_ptr<const Mysql::Object_base> object, bool to_replace, bool dirty_fields_only)
 			: Operation_base(promise)
-			, m_object(STD_MOVE(object)), m_to_replace(to_replace)
+			, m_object(STD_MOVE(object)), m_to_replace(to_replace), m_dirty_fields_only(dirty_fields_only)
 		{
 			//
 		}
 
+	private:
+		// 自动保存已经存在于数据库中的对象时，如果只修改了部分字段，就只写入这些字段。
+		bool may_skip_unmodified_fields(boost::uint64_t generation) const {
+			return m_dirty_fields_only && m_to_replace && m_object->has_primary_key() && is_row_persistent(*m_object, generation);
+		}
+		// 不加锁，结果只作参考。
+		bool may_update_columns() const {
+			if(!may_skip_unmodified_fields(get_delete_generation(get_table()))){
+				return false;
+			}
+			return m_object->get_dirty_field_count() < m_object->get_field_count();
+		}
+		void execute_full_row(const boost::shared_ptr<Mysql::Connection> &conn){
+			// 每种对象的语句都是相同的，会被连接缓存。
+			Mysql::Statement_parameters params;
+			m_object->generate_parameters(params);
+			std::string sql;
+			sql.reserve(255);
+			if(m_to_replace){
+				sql += "REPLACE";
+			} else {
+				sql += "INSERT";
+			}
+			sql += " INTO `";
+			sql += get_table();
+			sql += "` (";
+			sql += m_object->get_column_list();
+			sql += ") VALUES (";
+			for(std::size_t i = 0; i < params.size(); ++i){
+				if(i != 0){
+					sql += ", ";
+				}
+				sql += '?';
+			}
+			sql += ')';
+			record_statement(sql, &params);
+			conn->execute_prepared(sql, params);
+		}
+
 	protected:
 		bool should_use_slave() const OVERRIDE {
 			return false;
@@ -163,6 +707,16 @@ namespace {
 		boost::shared_ptr<const Mysql::Object_base> get_combinable_object() const OVERRIDE {
 			return m_object;
 		}
+		bool get_batch_key(Batch_key &key) const OVERRIDE {
+			if(may_update_columns()){
+				// 只写入修改过的字段，不能与整行写入合并。
+				return false;
+			}
+			key.table = m_object->get_table();
+			key.columns = m_object->get_column_list();
+			key.to_replace = m_to_replace;
+			return true;
+		}
 		const char * get_table() const OVERRIDE {
 			return m_object->get_table();
 		}
@@ -178,10 +732,40 @@ namespace {
 			query = os.get_buffer().dump_string();
 			query.erase(query.find_last_not_of(" ,") + 1);
 		}
-		void execute(const boost::shared_ptr<Mysql::Connection> &conn, const std::string &query) OVERRIDE {
+		void execute(const boost::shared_ptr<Mysql::Connection> &conn) OVERRIDE {
 			POSEIDON_PROFILE_ME;
 
-			conn->execute_sql(query);
+			// 在执行之前取得代数，这样执行期间加入的删除操作会使之后的写入操作写入整行。
+			const AUTO(generation, get_delete_generation(get_table()));
+			// 先取走修改标记再生成数据，这样在执行期间被修改的字段仍然会被标记。
+			Mysql::Object_base::Field_set fields;
+			m_object->take_dirty_fields(fields);
+			try {
+				if(may_skip_unmodified_fields(generation)){
+					const AUTO(dirty_count, Mysql::Object_base::count_fields_in_set(fields));
+					if(dirty_count == 0){
+						POSEIDON_LOG_TRACE("No fields have been modified: table = ", get_table());
+						record_saves(0, 0, 1);
+						return;
+					}
+					if(dirty_count < m_object->get_field_count()){
+						std::string sql;
+						Mysql::Statement_parameters params;
+						if(m_object->generate_update(sql, params, fields)){
+							record_statement(sql, &params);
+							conn->execute_prepared(sql, params);
+							record_saves(0, 1, 0);
+							return;
+						}
+					}
+				}
+				execute_full_row(conn);
+				record_saves(1, 0, 0);
+			} catch(...){
+				m_object->restore_dirty_fields(fields);
+				throw;
+			}
+			m_object->set_persistent(true, generation);
 		}
 	};
 
@@ -189,11 +773,16 @@ namespace {
 	private:
 		boost::shared_ptr<Mysql::Object_base> m_object;
 		std::string m_query;
+		bool m_prepared;
+		Mysql::Statement_parameters m_params;
+		std::string m_cache_key; // 如果为空则不写入缓存。
+		boost::uint64_t m_cache_generation;
 
 	public:
-		Load_operation(const boost::shared_ptr<Promise> &promise, boost::shared_ptr<Mysql::Object_base> object, std::string query)
+		Load_operation(const boost::shared_ptr<Promise> &promise, boost::shared_ptr<Mysql::Object_base> object, std::string query, bool prepared, Mysql::Statement_parameters params, std::string cache_key, boost::uint64_t cache_generation)
 			: Operation_base(promise)
-			, m_object(STD_MOVE(object)), m_query(STD_MOVE(query))
+			, m_object(STD_MOVE(object)), m_query(STD_MOVE(query)), m_prepared(prepared), m_params(STD_MOVE(params))
+			, m_cache_key(STD_MOVE(cache_key)), m_cache_generation(cache_generation)
 		{
 			//
 		}
@@ -205,22 +794,42 @@ namespace {
 		boost::shared_ptr<const Mysql::Object_base> get_combinable_object() const OVERRIDE {
 			return VAL_INIT; // 不能合并。
 		}
+		bool get_batch_key(Batch_key & /* key */) const OVERRIDE {
+			return false; // 不能合并。
+		}
 		const char * get_table() const OVERRIDE {
 			return m_object->get_table();
 		}
 		void generate_sql(std::string &query) const OVERRIDE {
 			query = m_query;
 		}
-		void execute(const boost::shared_ptr<Mysql::Connection> &conn, const std::string &query) OVERRIDE {
+		void execute(const boost::shared_ptr<Mysql::Connection> &conn) OVERRIDE {
 			POSEIDON_PROFILE_ME;
 
 			if(!get_promise()){
-				POSEIDON_LOG_WARNING("Discarding isolated MySQL query: table = ", get_table(), ", query = ", query);
+				POSEIDON_LOG_WARNING("Discarding isolated MySQL query: table = ", get_table(), ", query = ", m_query);
 				return;
 			}
-			conn->execute_sql(query);
-			POSEIDON_THROW_UNLESS(conn->fetch_row(), Mysql::Exception, Rcnts::view(get_table()), ER_SP_FETCH_NO_DATA, Rcnts::view("No rows returned"));
-			m_object->fetch(conn);
+			const AUTO(generation, get_delete_generation(get_table()));
+			if(m_prepared){
+				record_statement(m_query, &m_params);
+				conn->execute_prepared(m_query, m_params);
+			} else {
+				record_statement(m_query, NULLPTR);
+				conn->execute_sql(m_query);
+			}
+			boost::shared_ptr<Recording_connection> recorder;
+			boost::shared_ptr<Mysql::Connection> reader = conn;
+			if(!m_cache_key.empty()){
+				recorder = boost::make_shared<Recording_connection>(conn);
+				reader = recorder;
+			}
+			POSEIDON_THROW_UNLESS(reader->fetch_row(), Mysql::Exception, Rcnts::view(get_table()), ER_SP_FETCH_NO_DATA, Rcnts::view("No rows returned"));
+			m_object->fetch(reader);
+			m_object->set_persistent(true, generation);
+			if(recorder){
+				recorder->commit(m_cache_key, get_table(), m_cache_generation);
+			}
 		}
 	};
 
@@ -244,16 +853,27 @@ namespace {
 		boost::shared_ptr<const Mysql::Object_base> get_combinable_object() const OVERRIDE {
 			return VAL_INIT; // 不能合并。
 		}
+		bool get_batch_key(Batch_key & /* key */) const OVERRIDE {
+			return false; // 不能合并。
+		}
 		const char * get_table() const OVERRIDE {
 			return m_table_hint;
 		}
 		void generate_sql(std::string &query) const OVERRIDE {
 			query = m_query;
 		}
-		void execute(const boost::shared_ptr<Mysql::Connection> &conn, const std::string &query) OVERRIDE {
+		void execute(const boost::shared_ptr<Mysql::Connection> &conn) OVERRIDE {
 			POSEIDON_PROFILE_ME;
 
-			conn->execute_sql(query);
+			// 即使失败了，这一行也可能已经被删除了。
+			record_statement(m_query, NULLPTR);
+			try {
+				conn->execute_sql(m_query);
+			} catch(...){
+				bump_delete_generation(get_table());
+				throw;
+			}
+			bump_delete_generation(get_table());
 		}
 	};
 
@@ -262,11 +882,13 @@ namespace {
 		Query_callback m_callback;
 		const char *m_table_hint;
 		std::string m_query;
+		bool m_prepared;
+		Mysql::Statement_parameters m_params;
 
 	public:
-		Batch_load_operation(const boost::shared_ptr<Promise> &promise, Query_callback callback, const char *table_hint, std::string query)
+		Batch_load_operation(const boost::shared_ptr<Promise> &promise, Query_callback callback, const char *table_hint, std::string query, bool prepared, Mysql::Statement_parameters params)
 			: Operation_base(promise)
-			, m_callback(STD_MOVE_IDN(callback)), m_table_hint(table_hint), m_query(STD_MOVE(query))
+			, m_callback(STD_MOVE_IDN(callback)), m_table_hint(table_hint), m_query(STD_MOVE(query)), m_prepared(prepared), m_params(STD_MOVE(params))
 		{
 			//
 		}
@@ -278,20 +900,29 @@ namespace {
 		boost::shared_ptr<const Mysql::Object_base> get_combinable_object() const OVERRIDE {
 			return VAL_INIT; // 不能合并。
 		}
+		bool get_batch_key(Batch_key & /* key */) const OVERRIDE {
+			return false; // 不能合并。
+		}
 		const char * get_table() const OVERRIDE {
 			return m_table_hint;
 		}
 		void generate_sql(std::string &query) const OVERRIDE {
 			query = m_query;
 		}
-		void execute(const boost::shared_ptr<Mysql::Connection> &conn, const std::string &query) OVERRIDE {
+		void execute(const boost::shared_ptr<Mysql::Connection> &conn) OVERRIDE {
 			POSEIDON_PROFILE_ME;
 
 			if(!get_promise()){
-				POSEIDON_LOG_WARNING("Discarding isolated MySQL query: table = ", get_table(), ", query = ", query);
+				POSEIDON_LOG_WARNING("Discarding isolated MySQL query: table = ", get_table(), ", query = ", m_query);
 				return;
 			}
-			conn->execute_sql(query);
+			if(m_prepared){
+				record_statement(m_query, &m_params);
+				conn->execute_prepared(m_query, m_params);
+			} else {
+				record_statement(m_query, NULLPTR);
+				conn->execute_sql(m_query);
+			}
 			if(m_callback){
 				while(conn->fetch_row()){
 					m_callback(conn);
@@ -323,16 +954,30 @@ namespace {
 		boost::shared_ptr<const Mysql::Object_base> get_combinable_object() const OVERRIDE {
 			return VAL_INIT; // 不能合并。
 		}
+		bool get_batch_key(Batch_key & /* key */) const OVERRIDE {
+			return false; // 不能合并。
+		}
 		const char * get_table() const OVERRIDE {
 			return m_table_hint;
 		}
 		void generate_sql(std::string & /* query */) const OVERRIDE {
 			// no query
 		}
-		void execute(const boost::shared_ptr<Mysql::Connection> &conn, const std::string & /* query */) OVERRIDE {
+		void execute(const boost::shared_ptr<Mysql::Connection> &conn) OVERRIDE {
 			POSEIDON_PROFILE_ME;
 
-			m_callback(conn);
+			if(m_from_slave){
+				m_callback(conn);
+				return;
+			}
+			// 可能删除了任何行。
+			try {
+				m_callback(conn);
+			} catch(...){
+				bump_delete_generation(get_table());
+				throw;
+			}
+			bump_delete_generation(get_table());
 		}
 	};
 
@@ -360,25 +1005,44 @@ namespace {
 		boost::shared_ptr<const Mysql::Object_base> get_combinable_object() const OVERRIDE {
 			return VAL_INIT; // 不能合并。
 		}
+		bool get_batch_key(Batch_key & /* key */) const OVERRIDE {
+			return false; // 不能合并。
+		}
 		const char * get_table() const OVERRIDE {
 			return "";
 		}
 		void generate_sql(std::string &query) const OVERRIDE {
 			query = "DO 0";
 		}
-		void execute(const boost::shared_ptr<Mysql::Connection> &conn, const std::string &query) OVERRIDE {
+		void execute(const boost::shared_ptr<Mysql::Connection> &conn) OVERRIDE {
 			POSEIDON_PROFILE_ME;
 
-			conn->execute_sql(query);
+			conn->execute_sql("DO 0");
 		}
 	};
 
+	class Mysql_thread;
+
+	// 一个操作需要等待其他线程中之前加入的操作时，在那些线程中各插入一个 Fence_operation。
+	struct Fence_counter {
+		volatile std::size_t remaining;
+		boost::weak_ptr<Mysql_thread> waiter;
+	};
+
 	class Mysql_thread : NONCOPYABLE {
 	private:
 		struct Operation_queue_element {
-			boost::shared_ptr<Operation_base> operation;
+			boost::shared_ptr<Operation_base> operation; // 如果为空，说明已经被合并到之前的语句中执行了。
 			boost::uint64_t due_time;
 			std::size_t retry_count;
+			bool batch_failed; // 合并执行失败之后只能单独执行。
+			boost::uint64_t enqueued_time; // 微秒。
+			boost::shared_ptr<const Fence_counter> fence; // 如果不为空，要等到计数归零才能执行。
+		};
+		// 写入操作只需要排在其他线程中同一个表的独占操作之后，独占操作需要排在所有操作之后。
+		struct Pending_count {
+			std::size_t all;
+			std::size_t exclusive;
 		};
 
 	private:
@@ -389,6 +1053,14 @@ namespace {
 		mutable Condition_variable m_new_operation;
 		volatile bool m_urgent; // 无视延迟写入，一次性处理队列中所有操作。
 		boost::container::deque<Operation_queue_element> m_queue;
+		boost::container::flat_map<Rcnts, Pending_count> m_pending_tables;
+
+		// 以下成员只被 MySQL 线程访问。
+		boost::container::vector<Operation_queue_element *> m_batch_candidates;
+		boost::container::vector<Operation_queue_element *> m_batch_members;
+		boost::container::flat_set<const Mysql::Object_base *> m_batch_objects;
+		// 合并写入的对象和从它们那里取走的修改标记，写入失败时要放回去。
+		boost::container::vector<std::pair<boost::shared_ptr<const Mysql::Object_base>, Mysql::Object_base::Field_set> > m_batch_taken;
 
 	public:
 		Mysql_thread()
@@ -399,10 +1071,222 @@ namespace {
 		}
 
 	private:
-		bool pump_one_operation(boost::shared_ptr<Mysql::Connection> &master_conn, boost::shared_ptr<Mysql::Connection> &slave_conn) NOEXCEPT {
+		// 调用时 m_mutex 必须已被锁定。
+		void retire_operation(const Operation_base &operation) NOEXCEPT {
+			const AUTO(it, m_pending_tables.find(Rcnts::view(operation.get_table())));
+			if(it == m_pending_tables.end()){
+				return;
+			}
+			it->second.all -= 1;
+			if(!operation.get_combinable_object()){
+				it->second.exclusive -= 1;
+			}
+			if(it->second.all == 0){
+				m_pending_tables.erase(it);
+			}
+		}
+
+		static bool is_same_batch(const Operation_base::Batch_key &lhs, const Operation_base::Batch_key &rhs){
+			if(lhs.to_replace != rhs.to_replace){
+				return false;
+			}
+			if((lhs.table != rhs.table) && (std::strcmp(lhs.table, rhs.table) != 0)){
+				return false;
+			}
+			if((lhs.columns != rhs.columns) && (std::strcmp(lhs.columns, rhs.columns) != 0)){
+				return false;
+			}
+			return true;
+		}
+		void take_batch_fields(const boost::shared_ptr<const Mysql::Object_base> &object){
+			m_batch_taken.push_back(std::make_pair(object, Mysql::Object_base::Field_set()));
+			object->take_dirty_fields(m_batch_taken.back().second);
+		}
+		void restore_batch_fields() NOEXCEPT {
+			for(AUTO(it, m_batch_taken.begin()); it != m_batch_taken.end(); ++it){
+				try {
+					it->first->restore_dirty_fields(it->second);
+				} catch(std::exception &e){
+					POSEIDON_LOG_ERROR("std::exception thrown: what = ", e.what());
+				}
+			}
+			m_batch_taken.clear();
+		}
+		static void append_batch_row(std::string &query, const Mysql::Object_base &object){
+			Buffer_ostream os;
+			object.generate_value_list(os);
+			std::string values = os.get_buffer().dump_string();
+			values.erase(values.find_last_not_of(" ,") + 1);
+			query += '(';
+			query += values;
+			query += ')';
+		}
+
+		// 调用时 m_mutex 必须已被锁定。
+		void collect_batch_candidates(const Operation_queue_element &front, boost::uint64_t now, std::size_t max_rows){
+			POSEIDON_PROFILE_ME;
+
+			m_batch_candidates.clear();
+			Operation_base::Batch_key key;
+			if(front.batch_failed || !front.operation->get_batch_key(key)){
+				return;
+			}
+			const bool urgent = atomic_load(m_urgent, memory_order_consume);
+			// 限制扫描的元素数量，以免长时间阻塞生产者。
+			std::size_t scan_limit = max_rows * 4;
+			for(AUTO(it, m_queue.begin() + 1); (it != m_queue.end()) && (m_batch_candidates.size() + 1 < max_rows) && (scan_limit != 0); ++it){
+				--scan_limit;
+				if(!urgent && (now < it->due_time)){
+					break;
+				}
+				if(!it->operation){
+					continue;
+				}
+				if(it->fence && (atomic_load(it->fence->remaining, memory_order_consume) != 0)){
+					// 它要等待其他线程中的操作完成，不能提前执行，也不能越过它。
+					break;
+				}
+				Operation_base::Batch_key other;
+				if(!it->operation->get_batch_key(other)){
+					if(it->operation->get_combinable_object()){
+						// 只写入部分字段的操作，越过它不会改变读写顺序。
+						continue;
+					}
+					// 不能越过其他类型的操作，否则会改变读写顺序。
+					break;
+				}
+				if(it->batch_failed || !is_same_batch(key, other)){
+					continue;
+				}
+				m_batch_candidates.push_back(&*it);
+			}
+		}
+		// 把 front 和 m_batch_candidates 中的写入操作合并成一条语句执行，成功返回 true。
+		// 如果失败，所有参与合并的操作都会被标记，之后逐个单独执行，这样失败的那一行仍然会被重试和转储。
+		bool execute_batch(const boost::shared_ptr<Mysql::Connection> &conn, Operation_queue_element &front, std::size_t max_size) NOEXCEPT {
+			POSEIDON_PROFILE_ME;
+
+			const AUTO(begin_time, get_mono_clock_us());
+			m_batch_members.clear();
+			m_batch_objects.clear();
+			m_batch_taken.clear();
+			std::string query;
+			boost::uint64_t generation = 0;
+			try {
+				Operation_base::Batch_key key;
+				if(!front.operation->get_batch_key(key)){
+					return false;
+				}
+				generation = get_delete_generation(key.table);
+				const AUTO(front_object, front.operation->get_combinable_object());
+				Buffer_ostream os;
+				if(key.to_replace){
+					os <<"REPLACE";
+				} else {
+					os <<"INSERT";
+				}
+				os <<" INTO `" <<key.table <<"` (" <<key.columns <<") VALUES ";
+				query = os.get_buffer().dump_string();
+				take_batch_fields(front_object);
+				append_batch_row(query, *front_object);
+				m_batch_objects.insert(front_object.get());
+
+				for(AUTO(it, m_batch_candidates.begin()); it != m_batch_candidates.end(); ++it){
+					const AUTO(elem, *it);
+					const AUTO(object, elem->operation->get_combinable_object());
+					// 合并写入戳的处理与单独执行时相同。
+					const AUTO(old_write_stamp, object->get_combined_write_stamp());
+					if(old_write_stamp && (old_write_stamp != elem)){
+						continue;
+					}
+					if(old_write_stamp){
+						object->set_combined_write_stamp(NULLPTR);
+					}
+					if(!m_batch_objects.insert(object.get()).second){
+						// 这一行已经在语句中了，生成的数据不会比这个操作更旧。
+						m_batch_members.push_back(elem);
+						continue;
+					}
+					const std::size_t old_size = query.size();
+					query += ", ";
+					take_batch_fields(object);
+					append_batch_row(query, *object);
+					if(query.size() > max_size){
+						// 放不下的操作留在队列中，之后再处理。
+						query.erase(old_size);
+						object->restore_dirty_fields(m_batch_taken.back().second);
+						m_batch_taken.pop_back();
+						break;
+					}
+					m_batch_members.push_back(elem);
+				}
+				if(m_batch_members.empty()){
+					restore_batch_fields();
+					return false;
+				}
+				POSEIDON_LOG_DEBUG("Executing batched SQL: table = ", key.table, ", rows = ", m_batch_members.size() + 1, ", size = ", query.size());
+				record_statement(query, NULLPTR);
+				conn->execute_sql(query);
+			} catch(std::exception &e){
+				POSEIDON_LOG_WARNING("Batched MySQL write failed, falling back to single rows: rows = ", m_batch_members.size() + 1, ", what = ", e.what());
+				conn->discard_result();
+				restore_batch_fields();
+				front.batch_failed = true;
+				for(AUTO(it, m_batch_members.begin()); it != m_batch_members.end(); ++it){
+					(*it)->batch_failed = true;
+				}
+				return false;
+			} catch(...){
+				POSEIDON_LOG_WARNING("Batched MySQL write failed, falling back to single rows: rows = ", m_batch_members.size() + 1);
+				conn->discard_result();
+				restore_batch_fields();
+				front.batch_failed = true;
+				for(AUTO(it, m_batch_members.begin()); it != m_batch_members.end(); ++it){
+					(*it)->batch_failed = true;
+				}
+				return false;
+			}
+			conn->discard_result();
+
+			for(AUTO(it, m_batch_taken.begin()); it != m_batch_taken.end(); ++it){
+				it->first->set_persistent(true, generation);
+			}
+			record_saves(m_batch_taken.size(), 0, 0);
+			m_batch_taken.clear();
+
+			// 已经执行过的操作从队列中移除，但是元素本身要留下，因为合并写入戳指向它们。
+			const AUTO(now_us, get_mono_clock_us());
+			const AUTO(execution_time, saturated_sub(now_us, begin_time));
+			boost::container::vector<std::pair<boost::shared_ptr<Operation_base>, boost::uint64_t> > executed;
+			executed.reserve(m_batch_members.size());
+			{
+				const Mutex::Unique_lock lock(m_mutex);
+				for(AUTO(it, m_batch_members.begin()); it != m_batch_members.end(); ++it){
+					retire_operation(*((*it)->operation));
+					executed.push_back(std::make_pair(STD_MOVE((*it)->operation), (*it)->enqueued_time));
+					(*it)->operation.reset();
+				}
+			}
+			for(AUTO(it, executed.begin()); it != executed.end(); ++it){
+				record_operation(it->first->get_table(), saturated_sub(now_us, it->second), execution_time, false);
+				const AUTO(promise, it->first->get_promise());
+				if(promise){
+					promise->set_success(false);
+				}
+			}
+			return true;
+		}
+
+		bool pump_one_operation(boost::shared_ptr<Mysql::Connection> &master_conn, boost::shared_ptr<Mysql::Connection> &slave_conn, std::size_t max_allowed_packet) NOEXCEPT {
 			POSEIDON_PROFILE_ME;
 
 			const AUTO(now, get_fast_mono_clock());
+			const AUTO(max_batch_rows, Main_config::get<std::size_t>("mysql_max_batch_rows", 1000));
+			AUTO(max_batch_size, Main_config::get<std::size_t>("mysql_max_batch_size", 1048576));
+			if(max_allowed_packet != 0){
+				// 给协议头留一些余量。
+				max_batch_size = std::min(max_batch_size, saturated_sub<std::size_t>(max_allowed_packet, 1024));
+			}
 			Operation_queue_element *elem;
 			{
 				const Mutex::Unique_lock lock(m_mutex);
@@ -410,10 +1294,23 @@ namespace {
 					atomic_store(m_urgent, false, memory_order_relaxed);
 					return false;
 				}
+				if(!m_queue.front().operation){
+					m_queue.pop_front();
+					return true;
+				}
 				if(!atomic_load(m_urgent, memory_order_consume) && (now < m_queue.front().due_time)){
 					return false;
 				}
+				const AUTO_REF(fence, m_queue.front().fence);
+				if(fence && (atomic_load(fence->remaining, memory_order_consume) != 0)){
+					// 其他线程中之前加入的操作还没有完成。
+					return false;
+				}
 				elem = &m_queue.front();
+				m_batch_candidates.clear();
+				if(max_batch_rows > 1){
+					collect_batch_candidates(*elem, now, max_batch_rows);
+				}
 			}
 			const AUTO_REF(operation, elem->operation);
 			AUTO_REF(conn, elem->operation->should_use_slave() ? slave_conn : master_conn);
@@ -437,11 +1334,13 @@ namespace {
 					execute_it = true;
 				}
 			}
-			if(execute_it){
+			const AUTO(begin_time, get_mono_clock_us());
+			if(execute_it && !m_batch_candidates.empty() && execute_batch(conn, *elem, max_batch_size)){
+				// 已经和后面的写入操作一起执行了。
+			} else if(execute_it){
 				try {
-					operation->generate_sql(query);
-					POSEIDON_LOG_DEBUG("Executing SQL: table = ", operation->get_table(), ", query = ", query);
-					operation->execute(conn, query);
+					POSEIDON_LOG_DEBUG("Executing MySQL operation: table = ", operation->get_table());
+					operation->execute(conn);
 				} catch(Mysql::Exception &e){
 					POSEIDON_LOG_WARNING("Mysql::Exception thrown: code = ", e.get_code(), ", what = ", e.what());
 					except = STD_CURRENT_EXCEPTION();
@@ -460,6 +1359,7 @@ namespace {
 				}
 				conn->discard_result();
 			}
+			const AUTO(end_time, get_mono_clock_us());
 			if(except){
 				const AUTO(max_retry_count, Main_config::get<std::size_t>("mysql_max_retry_count", 3));
 				const AUTO(retry_count, ++(elem->retry_count));
@@ -471,8 +1371,14 @@ namespace {
 					return true;
 				}
 				POSEIDON_LOG_ERROR("Max retry count exceeded.");
+				try {
+					operation->generate_sql(query);
+				} catch(std::exception &e){
+					POSEIDON_LOG_ERROR("std::exception thrown while generating SQL for dump: what = ", e.what());
+				}
 				dump_sql_to_file(query, err_code, err_msg);
 			}
+			record_operation(operation->get_table(), saturated_sub(end_time, elem->enqueued_time), saturated_sub(end_time, begin_time), !!except);
 			const AUTO(promise, elem->operation->get_promise());
 			if(promise){
 				if(except){
@@ -482,16 +1388,46 @@ namespace {
 				}
 			}
 			const Mutex::Unique_lock lock(m_mutex);
+			retire_operation(*operation);
 			m_queue.pop_front();
 			return true;
 		}
 
+		// 空闲的连接可能已经被服务器断开，在这里检查，而不是等到下一个操作失败之后再重试。
+		static void check_connections(boost::shared_ptr<Mysql::Connection> &master_conn, boost::shared_ptr<Mysql::Connection> &slave_conn) NOEXCEPT {
+			POSEIDON_PROFILE_ME;
+
+			if(master_conn){
+				try {
+					master_conn->execute_sql("DO 0");
+					master_conn->discard_result();
+				} catch(std::exception &e){
+					POSEIDON_LOG_WARNING("MySQL master connection health check failed: what = ", e.what());
+					if(slave_conn == master_conn){
+						slave_conn.reset();
+					}
+					master_conn.reset();
+				}
+			}
+			if(slave_conn && (slave_conn != master_conn)){
+				try {
+					slave_conn->execute_sql("DO 0");
+					slave_conn->discard_result();
+				} catch(std::exception &e){
+					POSEIDON_LOG_WARNING("MySQL slave connection health check failed: what = ", e.what());
+					slave_conn.reset();
+				}
+			}
+		}
+
 		void thread_proc(){
 			POSEIDON_PROFILE_ME;
 			POSEIDON_LOG(Logger::special_major | Logger::level_info, "MySQL thread started.");
 
 			boost::shared_ptr<Mysql::Connection> master_conn, slave_conn;
+			std::size_t max_allowed_packet = 0;
 			unsigned timeout = 0;
+			boost::uint64_t last_active_time = get_fast_mono_clock();
 			for(;;){
 				const AUTO(reconnect_delay, Main_config::get<boost::uint64_t>("mysql_reconn_delay", 5000));
 				bool busy;
@@ -501,6 +1437,7 @@ namespace {
 						try {
 							master_conn = real_create_connection(false, VAL_INIT);
 							POSEIDON_LOG(Logger::special_major | Logger::level_info, "Successfully connected to MySQL master server.");
+							max_allowed_packet = query_max_allowed_packet(master_conn);
 						} catch(std::exception &e){
 							POSEIDON_LOG_ERROR("std::exception thrown: what = ", e.what());
 							::timespec req;
@@ -522,10 +1459,20 @@ namespace {
 							::nanosleep(&req, NULLPTR);
 						}
 					}
-					busy = pump_one_operation(master_conn, slave_conn);
+					busy = pump_one_operation(master_conn, slave_conn, max_allowed_packet);
 					timeout = std::min<unsigned>(timeout * 2u + 1u, !busy * 100u);
+					if(busy){
+						last_active_time = get_fast_mono_clock();
+					}
 				} while(busy);
 
+				const AUTO(health_check_interval, Main_config::get<boost::uint64_t>("mysql_health_check_interval", 30000));
+				const AUTO(now, get_fast_mono_clock());
+				if((health_check_interval != 0) && (now - last_active_time >= health_check_interval)){
+					check_connections(master_conn, slave_conn);
+					last_active_time = now;
+				}
+
 				Mutex::Unique_lock lock(m_mutex);
 				if(m_queue.empty() && !atomic_load(m_running, memory_order_consume)){
 					break;
@@ -563,7 +1510,9 @@ namespace {
 					if(pending_objects == 0){
 						break;
 					}
-					m_queue.front().operation->generate_sql(current_sql);
+					if(m_queue.front().operation){
+						m_queue.front().operation->generate_sql(current_sql);
+					}
 					atomic_store(m_urgent, true, memory_order_release);
 					m_new_operation.signal();
 				}
@@ -580,20 +1529,49 @@ namespace {
 			const Mutex::Unique_lock lock(m_mutex);
 			return m_queue.size();
 		}
-		void add_operation(boost::shared_ptr<Operation_base> operation, bool urgent){
+		bool has_pending_operations(const char *table, bool exclusive_only) const {
+			const Mutex::Unique_lock lock(m_mutex);
+			const AUTO(it, m_pending_tables.find(Rcnts::view(table)));
+			if(it == m_pending_tables.end()){
+				return false;
+			}
+			return !exclusive_only || (it->second.exclusive != 0);
+		}
+		void get_pending_tables(boost::container::flat_map<Rcnts, std::size_t> &ret) const {
+			const Mutex::Unique_lock lock(m_mutex);
+			for(AUTO(it, m_pending_tables.begin()); it != m_pending_tables.end(); ++it){
+				ret[it->first] += it->second.all;
+			}
+		}
+		void notify(){
+			const Mutex::Unique_lock lock(m_mutex);
+			m_new_operation.signal();
+		}
+		void add_operation(boost::shared_ptr<Operation_base> operation, bool urgent, boost::shared_ptr<const Fence_counter> fence = VAL_INIT){
 			POSEIDON_PROFILE_ME;
 
 			const AUTO(combinable_object, operation->get_combinable_object());
+			const AUTO(table, operation->get_table());
 
 			const AUTO(now, get_fast_mono_clock());
 			const AUTO(save_delay, Main_config::get<boost::uint64_t>("mysql_save_delay", 5000));
 			// 有紧急操作时无视写入延迟，这个逻辑不在这里处理。
 			const AUTO(due_time, saturated_add(now, save_delay));
+			const AUTO(enqueued_time, get_mono_clock_us());
 
 			const Mutex::Unique_lock lock(m_mutex);
 			POSEIDON_THROW_UNLESS(atomic_load(m_running, memory_order_consume), Exception, Rcnts::view("MySQL thread is being shut down"));
-			Operation_queue_element elem = { STD_MOVE(operation), due_time };
+			AUTO(it, m_pending_tables.find(Rcnts::view(table)));
+			if(it == m_pending_tables.end()){
+				const Pending_count zero = { 0, 0 };
+				it = m_pending_tables.emplace(Rcnts(table), zero).first;
+			}
+			Operation_queue_element elem = { STD_MOVE(operation), due_time, 0, false, enqueued_time, STD_MOVE(fence) };
 			m_queue.push_back(STD_MOVE(elem));
+			it->second.all += 1;
+			if(!combinable_object){
+				it->second.exclusive += 1;
+			}
 			if(combinable_object){
 				const AUTO(old_write_stamp, combinable_object->get_combined_write_stamp());
 				if(!old_write_stamp){
@@ -607,67 +1585,125 @@ namespace {
 		}
 	};
 
+	class Fence_operation : public Operation_base {
+	private:
+		const boost::shared_ptr<Fence_counter> m_counter;
+
+	public:
+		explicit Fence_operation(boost::shared_ptr<Fence_counter> counter)
+			: Operation_base(boost::shared_ptr<Promise>())
+			, m_counter(STD_MOVE(counter))
+		{
+			//
+		}
+
+	protected:
+		bool should_use_slave() const OVERRIDE {
+			return false;
+		}
+		boost::shared_ptr<const Mysql::Object_base> get_combinable_object() const OVERRIDE {
+			return VAL_INIT; // 不能合并。
+		}
+		bool get_batch_key(Batch_key & /* key */) const OVERRIDE {
+			return false; // 不能合并。
+		}
+		const char * get_table() const OVERRIDE {
+			return "";
+		}
+		void generate_sql(std::string & /* query */) const OVERRIDE {
+			// no query
+		}
+		void execute(const boost::shared_ptr<Mysql::Connection> & /* conn */) OVERRIDE {
+			POSEIDON_PROFILE_ME;
+
+			// 这里不能持有任何线程的锁，否则两个线程互相通知时会死锁。
+			if(atomic_sub(m_counter->remaining, 1, memory_order_acq_rel) != 0){
+				return;
+			}
+			const AUTO(waiter, m_counter->waiter.lock());
+			if(waiter){
+				waiter->notify();
+			}
+		}
+	};
+
 	volatile bool g_running = false;
 
+	// 所有需要等待的操作都在持有这个锁时加入队列，因此它们之间有全局的先后顺序，不会互相等待。
 	Mutex g_router_mutex;
-	struct Route {
-		boost::shared_ptr<const void> probe;
-		boost::shared_ptr<Mysql_thread> thread;
-	};
-	boost::container::flat_map<Rcnts, Route> g_router;
-	boost::container::flat_multimap<std::size_t, std::size_t> g_routing_map;
 	boost::container::vector<boost::shared_ptr<Mysql_thread> > g_threads;
 
+	// 调用时 g_router_mutex 必须已被锁定。
+	const boost::shared_ptr<Mysql_thread> & require_thread(std::size_t index){
+		AUTO_REF(thread, g_threads.at(index));
+		if(!thread){
+			POSEIDON_LOG(Logger::special_major | Logger::level_debug, "Creating new MySQL thread ", index);
+			AUTO(new_thread, boost::make_shared<Mysql_thread>());
+			new_thread->start();
+			thread = STD_MOVE_IDN(new_thread);
+		}
+		return thread;
+	}
+
+	// 同一个对象的写入操作总是由同一个线程按顺序执行，因此同一个表的写入可以分散到所有线程中。
+	// 其他操作由队列最短的线程执行，但是要等到其他线程中之前加入的同一个表的操作完成之后。写入操作也要等待之前加入的同一个表的其他操作。
 	void add_operation_by_table(const char *table, boost::shared_ptr<Operation_base> operation, bool urgent){
 		POSEIDON_PROFILE_ME;
 		POSEIDON_THROW_UNLESS(!g_threads.empty(), Basic_exception, Rcnts::view("MySQL support is not enabled"));
 
-		boost::shared_ptr<const void> probe;
-		boost::shared_ptr<Mysql_thread> thread;
-		{
-			const Mutex::Unique_lock lock(g_router_mutex);
-
-			AUTO_REF(route, g_router[Rcnts::view(table)]);
-			if(route.probe.use_count() > 1){
-				probe = route.probe;
-				thread = route.thread;
-				goto _use_thread;
-			}
-			if(!route.probe){
-				route.probe = boost::make_shared<int>();
-			}
-			probe = route.probe;
+		const AUTO(combinable_object, operation->get_combinable_object());
 
-			g_routing_map.clear();
-			g_routing_map.reserve(g_threads.size());
+		const Mutex::Unique_lock lock(g_router_mutex);
+		std::size_t index;
+		if(combinable_object){
+			// 对象的地址至少是 16 字节对齐的，把高位混进来。
+			std::size_t seed = reinterpret_cast<std::size_t>(combinable_object.get());
+			seed ^= seed >> 16;
+			seed ^= seed >> 8;
+			index = (seed >> 4) % g_threads.size();
+		} else {
+			index = 0;
+			std::size_t min_queue_size = static_cast<std::size_t>(-1);
 			for(std::size_t i = 0; i < g_threads.size(); ++i){
-				AUTO_REF(test_thread, g_threads.at(i));
+				const AUTO_REF(test_thread, g_threads.at(i));
 				if(!test_thread){
-					POSEIDON_LOG(Logger::special_major | Logger::level_debug, "Creating new MySQL thread ", i, " for table ", table);
-					thread = boost::make_shared<Mysql_thread>();
-					thread->start();
-					test_thread = thread;
-					route.thread = thread;
-					goto _use_thread;
+					index = i;
+					break;
 				}
 				const AUTO(queue_size, test_thread->get_queue_size());
 				POSEIDON_LOG_DEBUG("> MySQL thread ", i, "'s queue size: ", queue_size);
-				g_routing_map.emplace(queue_size, i);
+				if(queue_size < min_queue_size){
+					index = i;
+					min_queue_size = queue_size;
+				}
 			}
-			if(g_routing_map.empty()){
-				POSEIDON_LOG_FATAL("No available MySQL thread?!");
-				std::terminate();
+		}
+		const AUTO_REF(thread, require_thread(index));
+		POSEIDON_LOG_TRACE("Picking thread ", index, " for table ", table);
+
+		boost::shared_ptr<Fence_counter> fence;
+		for(std::size_t i = 0; i < g_threads.size(); ++i){
+			const AUTO_REF(test_thread, g_threads.at(i));
+			if(!test_thread || (test_thread == thread)){
+				continue;
+			}
+			if(!test_thread->has_pending_operations(table, !!combinable_object)){
+				continue;
+			}
+			if(!fence){
+				fence = boost::make_shared<Fence_counter>();
+				fence->remaining = 0;
+				fence->waiter = thread;
+			}
+			atomic_add(fence->remaining, 1, memory_order_relaxed);
+			try {
+				test_thread->add_operation(boost::make_shared<Fence_operation>(fence), urgent);
+			} catch(...){
+				atomic_sub(fence->remaining, 1, memory_order_relaxed);
+				throw;
 			}
-			const AUTO(index, g_routing_map.begin()->second);
-			POSEIDON_LOG(Logger::special_major | Logger::level_debug, "Picking thread ", index, " for table ", table);
-			thread = g_threads.at(index);
-			route.thread = thread;
 		}
-	_use_thread:
-		assert(probe);
-		assert(thread);
-		operation->set_probe(STD_MOVE(probe));
-		thread->add_operation(STD_MOVE(operation), urgent);
+		thread->add_operation(STD_MOVE(operation), urgent, fence);
 	}
 	void add_operation_all(boost::shared_ptr<Operation_base> operation, bool urgent){
 		POSEIDON_PROFILE_ME;
@@ -734,6 +1770,12 @@ void Mysql_daemon::start(){
 		}
 	}
 	g_threads.resize(max_thread_count);
+	clear_statistics();
+
+	g_cache_max_size = Main_config::get<std::size_t>("mysql_cache_max_size", 0);
+	if(g_cache_max_size != 0){
+		POSEIDON_LOG(Logger::special_major | Logger::level_info, "MySQL cache enabled: max_size = ", g_cache_max_size);
+	}
 
 	POSEIDON_LOG(Logger::special_major | Logger::level_info, "MySQL daemon started.");
 }
@@ -764,6 +1806,11 @@ void Mysql_daemon::stop(){
 
 	const Mutex::Unique_lock lock(g_router_mutex);
 	g_threads.clear();
+
+	const Mutex::Unique_lock cache_lock(g_cache_mutex);
+	g_cache_map.clear();
+	g_cache_size = 0;
+	g_cache_generations.clear();
 }
 
 boost::shared_ptr<Mysql::Connection> Mysql_daemon::create_connection(bool from_slave){
@@ -780,11 +1827,106 @@ void Mysql_daemon::wait_for_all_async_operations(){
 	}
 }
 
-boost::shared_ptr<const Promise> Mysql_daemon::enqueue_for_saving(boost::shared_ptr<const Mysql::Object_base> object, bool to_replace, bool urgent){
+void Mysql_daemon::snapshot_statistics(Mysql_daemon::Statistics_snapshot &ret){
+	const AUTO(now, get_fast_mono_clock());
+
+	const Mutex::Unique_lock lock(g_stats_mutex);
+	ret.elapsed = saturated_sub(now, g_stats_since);
+	ret.statements = g_stats_statements;
+	ret.sql_bytes = g_stats_sql_bytes;
+	ret.parameter_bytes = g_stats_parameter_bytes;
+	ret.full_saves = g_stats_full_saves;
+	ret.partial_saves = g_stats_partial_saves;
+	ret.skipped_saves = g_stats_skipped_saves;
+}
+void Mysql_daemon::snapshot_tables(boost::container::vector<Mysql_daemon::Table_snapshot> &ret){
+	boost::container::flat_map<Rcnts, std::size_t> pending;
+	{
+		const Mutex::Unique_lock lock(g_router_mutex);
+		for(AUTO(it, g_threads.begin()); it != g_threads.end(); ++it){
+			const AUTO_REF(thread, *it);
+			if(!thread){
+				continue;
+			}
+			thread->get_pending_tables(pending);
+		}
+	}
+	// 内部使用的操作没有表名。
+	pending.erase(Rcnts::view(""));
+
+	const Mutex::Unique_lock lock(g_stats_mutex);
+	ret.reserve(ret.size() + g_table_counters.size() + pending.size());
+	for(AUTO(it, g_table_counters.begin()); it != g_table_counters.end(); ++it){
+		if(it->first.empty()){
+			continue;
+		}
+		Table_snapshot snapshot;
+		snapshot.table = it->first.get();
+		const AUTO(pit, pending.find(it->first));
+		if(pit != pending.end()){
+			snapshot.pending = pit->second;
+			pending.erase(pit);
+		} else {
+			snapshot.pending = 0;
+		}
+		snapshot.operations = it->second.operations;
+		snapshot.failures = it->second.failures;
+		snapshot.total_latency = it->second.total_latency;
+		snapshot.max_latency = it->second.max_latency;
+		snapshot.total_execution_time = it->second.total_execution_time;
+		snapshot.max_execution_time = it->second.max_execution_time;
+		ret.push_back(STD_MOVE(snapshot));
+	}
+	// 尚未执行过任何操作的表。
+	for(AUTO(it, pending.begin()); it != pending.end(); ++it){
+		Table_snapshot snapshot = { };
+		snapshot.table = it->first.get();
+		snapshot.pending = it->second;
+		ret.push_back(STD_MOVE(snapshot));
+	}
+}
+void Mysql_daemon::snapshot_cache(Mysql_daemon::Cache_snapshot &ret){
+	const Mutex::Unique_lock lock(g_cache_mutex);
+	ret.max_size = g_cache_max_size;
+	ret.entries = g_cache_map.size();
+	ret.size = g_cache_size;
+	ret.hits = g_cache_hits;
+	ret.misses = g_cache_misses;
+	ret.evictions = g_cache_evictions;
+	ret.invalidations = g_cache_invalidations;
+	ret.rejections = g_cache_rejections;
+}
+void Mysql_daemon::clear_statistics(){
+	const AUTO(now, get_fast_mono_clock());
+
+	const Mutex::Unique_lock lock(g_stats_mutex);
+	g_stats_since = now;
+	g_stats_statements = 0;
+	g_stats_sql_bytes = 0;
+	g_stats_parameter_bytes = 0;
+	g_stats_full_saves = 0;
+	g_stats_partial_saves = 0;
+	g_stats_skipped_saves = 0;
+	g_table_counters.clear();
+
+	const Mutex::Unique_lock cache_lock(g_cache_mutex);
+	g_cache_hits = 0;
+	g_cache_misses = 0;
+	g_cache_evictions = 0;
+	g_cache_invalidations = 0;
+	g_cache_rejections = 0;
+}
+
+boost::shared_ptr<const Promise> Mysql_daemon::enqueue_for_saving(boost::shared_ptr<const Mysql::Object_base> object, bool to_replace, bool urgent, bool dirty_fields_only){
+	if(!dirty_fields_only){
+		// 这个对象可能已经有一个尚未执行的自动保存操作，而这个操作会被合并到那里，因此要用修改标记来要求写入整行。
+		object->mark_all_fields_dirty();
+	}
 	AUTO(promise, boost::make_shared<Promise>());
 	const char *const table = object->get_table();
-	AUTO(operation, boost::make_shared<Save_operation>(promise, STD_MOVE(object), to_replace));
+	AUTO(operation, boost::make_shared<Save_operation>(promise, STD_MOVE(object), to_replace, dirty_fields_only));
 	add_operation_by_table(table, STD_MOVE_IDN(operation), urgent);
+	invalidate_cache(table);
 	return STD_MOVE_IDN(promise);
 }
 boost::shared_ptr<const Promise> Mysql_daemon::enqueue_for_loading(boost::shared_ptr<Mysql::Object_base> object, std::string query){
@@ -792,7 +1934,26 @@ boost::shared_ptr<const Promise> Mysql_daemon::enqueue_for_loading(boost::shared
 
 	AUTO(promise, boost::make_shared<Promise>());
 	const char *const table = object->get_table();
-	AUTO(operation, boost::make_shared<Load_operation>(promise, STD_MOVE(object), STD_MOVE(query)));
+	std::string cache_key;
+	boost::uint64_t cache_generation = 0;
+	if(load_object_from_cache(cache_key, cache_generation, promise, object, table, query, NULLPTR)){
+		return STD_MOVE_IDN(promise);
+	}
+	AUTO(operation, boost::make_shared<Load_operation>(promise, STD_MOVE(object), STD_MOVE(query), false, Mysql::Statement_parameters(), STD_MOVE(cache_key), cache_generation));
+	add_operation_by_table(table, STD_MOVE_IDN(operation), true);
+	return STD_MOVE_IDN(promise);
+}
+boost::shared_ptr<const Promise> Mysql_daemon::enqueue_for_loading(boost::shared_ptr<Mysql::Object_base> object, std::string query, Mysql::Statement_parameters params){
+	POSEIDON_THROW_ASSERT(!query.empty());
+
+	AUTO(promise, boost::make_shared<Promise>());
+	const char *const table = object->get_table();
+	std::string cache_key;
+	boost::uint64_t cache_generation = 0;
+	if(load_object_from_cache(cache_key, cache_generation, promise, object, table, query, &params)){
+		return STD_MOVE_IDN(promise);
+	}
+	AUTO(operation, boost::make_shared<Load_operation>(promise, STD_MOVE(object), STD_MOVE(query), true, STD_MOVE(params), STD_MOVE(cache_key), cache_generation));
 	add_operation_by_table(table, STD_MOVE_IDN(operation), true);
 	return STD_MOVE_IDN(promise);
 }
@@ -803,6 +1964,8 @@ boost::shared_ptr<const Promise> Mysql_daemon::enqueue_for_deleting(const char *
 	const char *const table = table_hint;
 	AUTO(operation, boost::make_shared<Delete_operation>(promise, table_hint, STD_MOVE(query)));
 	add_operation_by_table(table, STD_MOVE_IDN(operation), true);
+	bump_delete_generation(table);
+	invalidate_cache(table);
 	return STD_MOVE_IDN(promise);
 }
 boost::shared_ptr<const Promise> Mysql_daemon::enqueue_for_batch_loading(Query_callback callback, const char *table_hint, std::string query){
@@ -810,7 +1973,16 @@ boost::shared_ptr<const Promise> Mysql_daemon::enqueue_for_batch_loading(Query_c
 
 	AUTO(promise, boost::make_shared<Promise>());
 	const char *const table = table_hint;
-	AUTO(operation, boost::make_shared<Batch_load_operation>(promise, STD_MOVE(callback), table_hint, STD_MOVE(query)));
+	AUTO(operation, boost::make_shared<Batch_load_operation>(promise, STD_MOVE(callback), table_hint, STD_MOVE(query), false, Mysql::Statement_parameters()));
+	add_operation_by_table(table, STD_MOVE_IDN(operation), true);
+	return STD_MOVE_IDN(promise);
+}
+boost::shared_ptr<const Promise> Mysql_daemon::enqueue_for_batch_loading(Query_callback callback, const char *table_hint, std::string query, Mysql::Statement_parameters params){
+	POSEIDON_THROW_ASSERT(!query.empty());
+
+	AUTO(promise, boost::make_shared<Promise>());
+	const char *const table = table_hint;
+	AUTO(operation, boost::make_shared<Batch_load_operation>(promise, STD_MOVE(callback), table_hint, STD_MOVE(query), true, STD_MOVE(params)));
 	add_operation_by_table(table, STD_MOVE_IDN(operation), true);
 	return STD_MOVE_IDN(promise);
 }
@@ -819,6 +1991,9 @@ void Mysql_daemon::enqueue_for_low_level_access(const boost::shared_ptr<Promise>
 	const char *const table = table_hint;
 	AUTO(operation, boost::make_shared<Low_level_access_operation>(promise, STD_MOVE(callback), table_hint, from_slave));
 	add_operation_by_table(table, STD_MOVE_IDN(operation), true);
+	if(!from_slave){
+		invalidate_cache(table);
+	}
 }
 
 boost::shared_ptr<const Promise> Mysql_daemon::enqueue_for_waiting_for_all_async_operations(){
@@ -8,7 +8,10 @@
 #include "../mysql/fwd.hpp"
 #include <boost/shared_ptr.hpp>
 #include <boost/function.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/container/vector.hpp>
 #include <string>
+#include <cstddef>
 
 namespace Poseidon {
 
@@ -21,6 +24,43 @@ private:
 public:
 	typedef boost::function<void (const boost::shared_ptr<Mysql::Connection> &)> Query_callback;
 
+	// 上次清零以来生成的 SQL 的统计。elapsed 以毫秒为单位。
+	struct Statistics_snapshot {
+		boost::uint64_t elapsed;
+		unsigned long long statements;
+		unsigned long long sql_bytes;
+		// 预处理语句的参数不在 SQL 中，单独统计。
+		unsigned long long parameter_bytes;
+		// 写入整行、只写入修改过的字段、以及没有字段被修改而跳过的保存操作。
+		unsigned long long full_saves;
+		unsigned long long partial_saves;
+		unsigned long long skipped_saves;
+	};
+	// 每个表的统计。时间以微秒为单位，latency 是从加入队列到执行完毕的时间。
+	struct Table_snapshot {
+		std::string table;
+		std::size_t pending;
+		unsigned long long operations;
+		unsigned long long failures;
+		unsigned long long total_latency;
+		unsigned long long max_latency;
+		unsigned long long total_execution_time;
+		unsigned long long max_execution_time;
+	};
+	// 读取结果的缓存。size 和 max_size 以字节为单位，是估算的内存用量。
+	struct Cache_snapshot {
+		std::size_t max_size;
+		std::size_t entries;
+		std::size_t size;
+		unsigned long long hits;
+		unsigned long long misses;
+		unsigned long long evictions;
+		// 因为写入而被丢弃的结果。
+		unsigned long long invalidations;
+		// 读取期间同一个表被写入，因而没有放入缓存的结果。
+		unsigned long long rejections;
+	};
+
 	static void start();
 	static void stop();
 
@@ -30,14 +70,25 @@ public:
 	static void wait_for_all_async_operations();
 
 	// 异步接口。
-	static boost::shared_ptr<const Promise> enqueue_for_saving(boost::shared_ptr<const Mysql::Object_base> object, bool to_replace, bool urgent);
+	// 如果 `mysql_cache_max_size` 不为零，enqueue_for_loading 读取的对象会以表名、对象的类型、语句和参数为键缓存起来，通过这里写入同一个表时作废。
+	// 命中缓存时，对象的读取在当前线程中完成，返回的 promise 已经被满足。enqueue_for_batch_loading 不使用缓存。
+	// dirty_fields_only 供自动保存使用：如果对象定义了主键，并且数据库中已经有这一行，就只写入修改过的字段，没有修改时跳过。否则总是写入整行。
+	static boost::shared_ptr<const Promise> enqueue_for_saving(boost::shared_ptr<const Mysql::Object_base> object, bool to_replace, bool urgent, bool dirty_fields_only = false);
 	static boost::shared_ptr<const Promise> enqueue_for_loading(boost::shared_ptr<Mysql::Object_base> object, std::string query);
 	static boost::shared_ptr<const Promise> enqueue_for_deleting(const char *table_hint, std::string query);
 	static boost::shared_ptr<const Promise> enqueue_for_batch_loading(Query_callback callback, const char *table_hint, std::string query);
+	// 使用预处理语句，query 中用 `?` 表示 params 中的参数。结果使用二进制协议传输。
+	static boost::shared_ptr<const Promise> enqueue_for_loading(boost::shared_ptr<Mysql::Object_base> object, std::string query, Mysql::Statement_parameters params);
+	static boost::shared_ptr<const Promise> enqueue_for_batch_loading(Query_callback callback, const char *table_hint, std::string query, Mysql::Statement_parameters params);
 
 	static void enqueue_for_low_level_access(const boost::shared_ptr<Promise> &promise, Query_callback callback, const char *table_hint, bool from_slave = false);
 
 	static boost::shared_ptr<const Promise> enqueue_for_waiting_for_all_async_operations();
+
+	static void snapshot_statistics(Statistics_snapshot &ret);
+	static void snapshot_tables(boost::container::vector<Table_snapshot> &ret);
+	static void snapshot_cache(Cache_snapshot &ret);
+	static void clear_statistics();
 };
 
 }
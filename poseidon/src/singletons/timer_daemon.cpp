@@ -4,6 +4,7 @@
 #include "../precompiled.hpp"
 #include "timer_daemon.hpp"
 #include "job_dispatcher.hpp"
+#include "main_config.hpp"
 #include "../thread.hpp"
 #include "../log.hpp"
 #include "../atomic.hpp"
@@ -14,26 +15,48 @@
 #include "../job_base.hpp"
 #include "../profiler.hpp"
 #include "../checked_arithmetic.hpp"
+#include "../raii.hpp"
+#include "../system_exception.hpp"
+#include <boost/intrusive/list.hpp>
+#include <sys/timerfd.h>
 
 namespace Poseidon {
 
 typedef Timer_daemon::Timer_callback Timer_callback;
 
-class Timer : NONCOPYABLE {
+typedef boost::intrusive::list_base_hook<boost::intrusive::link_mode<boost::intrusive::auto_unlink> > Timer_hook;
+
+// 计时器链接在时间轮的某个槽中。这个链接及 m_next 由 g_mutex 保护。
+// 内部的时间单位一律是微秒，m_unit 是传给回调函数的时间的单位。
+class Timer : public Timer_hook, NONCOPYABLE {
 private:
+	boost::weak_ptr<Timer> m_weak_self;
 	boost::uint64_t m_period;
 	unsigned long m_stamp;
 	Timer_callback m_callback;
 	bool m_low_level;
+	boost::uint64_t m_unit;
+	boost::uint64_t m_next;
 
 public:
-	Timer(boost::uint64_t period, Timer_callback callback, bool low_level)
-		: m_period(period), m_stamp(0), m_callback(STD_MOVE_IDN(callback)), m_low_level(low_level)
+	Timer(boost::uint64_t period, Timer_callback callback, bool low_level, boost::uint64_t unit)
+		: m_weak_self(), m_period(period), m_stamp(0), m_callback(STD_MOVE_IDN(callback)), m_low_level(low_level), m_unit(unit), m_next(0)
 	{
 		//
 	}
+	~Timer();
 
 public:
+	boost::shared_ptr<Timer> lock_self() const {
+		return m_weak_self.lock();
+	}
+	const boost::weak_ptr<Timer> & get_weak_self() const {
+		return m_weak_self;
+	}
+	void set_weak_self(const boost::shared_ptr<Timer> &self){
+		m_weak_self = self;
+	}
+
 	boost::uint64_t get_period() const {
 		return m_period;
 	}
@@ -46,6 +69,15 @@ public:
 	bool is_low_level() const {
 		return m_low_level;
 	}
+	boost::uint64_t get_unit() const {
+		return m_unit;
+	}
+	boost::uint64_t get_next() const {
+		return m_next;
+	}
+	void set_next(boost::uint64_t next){
+		m_next = next;
+	}
 
 	unsigned long set_period(boost::uint64_t period){
 		if(period != Timer_daemon::period_intact){
@@ -62,6 +94,16 @@ namespace {
 		ms_per_week = ms_per_day * 7,
 	};
 
+	inline boost::uint64_t ms_to_us(boost::uint64_t ms) NOEXCEPT {
+		return saturated_mul<boost::uint64_t>(ms, 1000);
+	}
+	inline boost::uint64_t period_to_us(boost::uint64_t period, boost::uint64_t unit) NOEXCEPT {
+		if(period == Timer_daemon::period_intact){
+			return period;
+		}
+		return saturated_mul(period, unit);
+	}
+
 	class Timer_job : public Job_base {
 	private:
 		const boost::weak_ptr<Timer> m_weak_timer;
@@ -90,6 +132,28 @@ namespace {
 		}
 	};
 
+	// 分层时间轮，时间单位为微秒。
+	// 第 0 层有 256 个槽，每个槽对应 1 微秒；往上每层有 64 个槽，每个槽对应下一层的一整圈。
+	// 第 0 层转完一圈时，把上一层的下一个槽中的计时器重新插入到下面的层中。
+	// 插入和删除都是 O(1) 的，重设或销毁计时器时会立即把它从时间轮中摘除。
+	// 每一层用位图记录哪些槽可能非空（摘除计时器时不清除），这样可以直接跳到下一个需要处理的时间点，也可以据此设定唤醒的时间。
+	// 超出时间轮范围（约 71.6 分钟）的计时器放在二叉堆中，进入范围之后再移到时间轮里。堆中的元素依然通过 stamp 延迟失效。
+	enum {
+		wheel_root_bits   = 8,
+		wheel_level_bits  = 6,
+		wheel_level_count = 4,
+		wheel_total_bits  = wheel_root_bits + wheel_level_bits * wheel_level_count,
+		wheel_root_words  = (1u << wheel_root_bits) / 64,
+	};
+
+	// 延迟统计的桶的上限依次为 16、32、64 …… 微秒。
+	enum {
+		jitter_histogram_size = 18,
+		jitter_histogram_base = 16,
+	};
+
+	typedef boost::intrusive::list<Timer, boost::intrusive::base_hook<Timer_hook>, boost::intrusive::constant_time_size<false> > Timer_list;
+
 	struct Timer_queue_element {
 		boost::weak_ptr<Timer> timer;
 		boost::uint64_t next;
@@ -100,81 +164,366 @@ namespace {
 		return lhs.next > rhs.next;
 	}
 
+	struct Due_timer {
+		boost::shared_ptr<Timer> timer;
+		boost::uint64_t period;
+		boost::uint64_t next;
+	};
+
 	volatile bool g_running = false;
 	Thread g_thread;
 
 	Mutex g_mutex;
 	Condition_variable g_new_timer;
+	// 如果 timerfd 有效，计时器线程在 timerfd 上等待，否则在 g_new_timer 上等待。
+	Unique_file g_timerfd;
+	// 计时器线程将在这个时间之前醒来。新的计时器早于这个时间到期时才需要唤醒它。
+	boost::uint64_t g_wakeup_time = 0;
+	// 时间早于 g_wheel_time 的槽都已经处理过了。
+	boost::uint64_t g_wheel_time = 0;
+	std::size_t g_wheel_size = 0;
+	boost::array<Timer_list, 1u << wheel_root_bits> g_wheel_root;
+	boost::array<boost::array<Timer_list, 1u << wheel_level_bits>, wheel_level_count> g_wheel_levels;
+	boost::array<boost::uint64_t, wheel_root_words> g_wheel_root_bitmap;
+	boost::array<boost::uint64_t, wheel_level_count> g_wheel_level_bitmaps;
 	boost::container::vector<Timer_queue_element> g_timers;
 
-	bool pump_one_element() NOEXCEPT {
-		POSEIDON_PROFILE_ME;
+	Mutex g_jitter_mutex;
+	boost::uint64_t g_jitter_max = 0;
+	unsigned long long g_jitter_samples = 0;
+	unsigned long long g_jitter_total = 0;
+	boost::array<unsigned long long, jitter_histogram_size> g_jitter_histogram;
+
+	// 调用者必须持有 g_mutex。
+	// 堆中总是预留一个空位，这样 wheel_insert() 不会抛出异常，调用者可以先把计时器摘下来再插入。
+	void heap_reserve(){
+		if(g_timers.size() == g_timers.capacity()){
+			g_timers.emplace_back();
+			g_timers.pop_back();
+		}
+	}
+	void wheel_insert(Timer &timer, boost::uint64_t next) NOEXCEPT {
+		timer.set_next(next);
+		// 已经过期的计时器放在下一个要处理的槽中。
+		const AUTO(expires, std::max(next, g_wheel_time));
+		const AUTO(delta, expires - g_wheel_time);
+		if(delta < (1ull << wheel_root_bits)){
+			const AUTO(index, expires & ((1u << wheel_root_bits) - 1));
+			g_wheel_root[index].push_back(timer);
+			g_wheel_root_bitmap[index / 64] |= 1ull << (index % 64);
+			++g_wheel_size;
+			return;
+		}
+		for(unsigned level = 0; level < wheel_level_count; ++level){
+			const unsigned shift = wheel_root_bits + wheel_level_bits * level;
+			if(delta < (1ull << (shift + wheel_level_bits))){
+				const AUTO(index, (expires >> shift) & ((1u << wheel_level_bits) - 1));
+				g_wheel_levels[level][index].push_back(timer);
+				g_wheel_level_bitmaps[level] |= 1ull << index;
+				++g_wheel_size;
+				return;
+			}
+		}
+		Timer_queue_element elem = { timer.get_weak_self(), next, timer.get_stamp() };
+		g_timers.push_back(STD_MOVE(elem));
+		std::push_heap(g_timers.begin(), g_timers.end());
+	}
+	void wheel_remove(Timer &timer) NOEXCEPT {
+		if(timer.is_linked()){
+			timer.unlink();
+			--g_wheel_size;
+		}
+	}
+	void wheel_reinsert_list(Timer_list &list) NOEXCEPT {
+		while(!list.empty()){
+			AUTO_REF(timer, list.front());
+			list.pop_front();
+			--g_wheel_size;
+			wheel_insert(timer, timer.get_next());
+		}
+	}
+	void wheel_cascade() NOEXCEPT {
+		for(unsigned level = 0; level < wheel_level_count; ++level){
+			const unsigned shift = wheel_root_bits + wheel_level_bits * level;
+			const AUTO(index, (g_wheel_time >> shift) & ((1u << wheel_level_bits) - 1));
+			// 重新插入的计时器只会进入更低的层，因此不会分配内存。
+			wheel_reinsert_list(g_wheel_levels[level][index]);
+			g_wheel_level_bitmaps[level] &= ~(1ull << index);
+			if(index != 0){
+				break;
+			}
+		}
+	}
+	void heap_migrate() NOEXCEPT {
+		while(!g_timers.empty() && (g_timers.front().next - std::min(g_timers.front().next, g_wheel_time) < (1ull << wheel_total_bits))){
+			std::pop_heap(g_timers.begin(), g_timers.end());
+			const AUTO(timer, g_timers.back().timer.lock());
+			const AUTO(next, g_timers.back().next);
+			const AUTO(stamp, g_timers.back().stamp);
+			g_timers.pop_back();
+			if(!timer || (timer->get_stamp() != stamp) || timer->is_linked()){
+				continue;
+			}
+			wheel_insert(*timer, next);
+		}
+	}
 
-		const AUTO(now, get_fast_mono_clock());
+	// 返回 mask 中不小于 from 的最低的位，没有则返回最低的位。mask 不得为零。
+	inline unsigned find_next_bit(boost::uint64_t mask, unsigned from) NOEXCEPT {
+		const AUTO(upper, (from < 64) ? (mask & (~0ull << from)) : 0);
+		return static_cast<unsigned>(__builtin_ctzll((upper != 0) ? upper : mask));
+	}
+	// 返回时间轮中下一个需要处理的时间点，即某个槽到期或者上层的某个槽需要向下转移的时间，不早于 g_wheel_time。没有则返回 -1。
+	boost::uint64_t wheel_next_event() NOEXCEPT {
+		boost::uint64_t next = UINT64_MAX;
+		// 第 0 层中编号小于当前槽的槽属于下一圈。
+		const unsigned root_index = g_wheel_time & ((1u << wheel_root_bits) - 1);
+		const AUTO(root_base, g_wheel_time - root_index);
+		for(unsigned i = 0; i <= wheel_root_words; ++i){
+			const unsigned word = (root_index / 64 + i) % wheel_root_words;
+			AUTO(mask, g_wheel_root_bitmap[word]);
+			if(i == 0){
+				mask &= ~0ull << (root_index % 64);
+			} else if(i == wheel_root_words){
+				mask &= ~(~0ull << (root_index % 64));
+			}
+			if(mask != 0){
+				const unsigned index = word * 64 + static_cast<unsigned>(__builtin_ctzll(mask));
+				next = root_base + index + ((index < root_index) << wheel_root_bits);
+				break;
+			}
+		}
+		// 上层的第 index 个槽在低位全为零且该层的编号等于 index 时向下转移。
+		for(unsigned level = 0; level < wheel_level_count; ++level){
+			const AUTO(mask, g_wheel_level_bitmaps[level]);
+			if(mask == 0){
+				continue;
+			}
+			const unsigned shift = wheel_root_bits + wheel_level_bits * level;
+			const unsigned current = (g_wheel_time >> shift) & ((1u << wheel_level_bits) - 1);
+			const bool aligned = (g_wheel_time & ((1ull << shift) - 1)) == 0;
+			const unsigned index = find_next_bit(mask, current + !aligned);
+			boost::uint64_t time = (g_wheel_time & ~((1ull << (shift + wheel_level_bits)) - 1)) + (static_cast<boost::uint64_t>(index) << shift);
+			if(time < g_wheel_time){
+				time += 1ull << (shift + wheel_level_bits);
+			}
+			next = std::min(next, time);
+		}
+		return next;
+	}
+	boost::uint64_t get_next_deadline() NOEXCEPT {
+		AUTO(next, wheel_next_event());
+		if(!g_timers.empty()){
+			next = std::min(next, g_timers.front().next);
+		}
+		return next;
+	}
 
-		boost::shared_ptr<Timer> timer;
-		boost::uint64_t period;
-		{
-			const Mutex::Unique_lock lock(g_mutex);
-		_pick_next:
-			if(g_timers.empty()){
-				return false;
+	// 调用者必须持有 g_mutex。
+	void wheel_collect(boost::container::vector<Due_timer> &due, boost::uint64_t now){
+		if(g_wheel_size == 0){
+			// 时间轮是空的，直接跳到当前时间。
+			g_wheel_time = std::max(g_wheel_time, now);
+		}
+		heap_migrate();
+		Timer_list expired;
+		for(;;){
+			// 跳过没有任何计时器的槽。
+			const AUTO(next, wheel_next_event());
+			if(next > now){
+				g_wheel_time = std::max(g_wheel_time, now + 1);
+				break;
 			}
-			if(now < g_timers.front().next){
-				return false;
+			g_wheel_time = next;
+			const AUTO(index, g_wheel_time & ((1u << wheel_root_bits) - 1));
+			if(index == 0){
+				wheel_cascade();
 			}
-			std::pop_heap(g_timers.begin(), g_timers.end());
-			timer = g_timers.back().timer.lock();
-			if(!timer || (timer->get_stamp() != g_timers.back().stamp)){
-				g_timers.pop_back();
-				goto _pick_next;
+			AUTO_REF(slot, g_wheel_root[index]);
+			expired.splice(expired.end(), slot);
+			g_wheel_root_bitmap[index / 64] &= ~(1ull << (index % 64));
+			++g_wheel_time;
+			heap_migrate();
+
+			try {
+				while(!expired.empty()){
+					AUTO_REF(timer, expired.front());
+					AUTO(shared, timer.lock_self());
+					if(shared){
+						heap_reserve();
+						Due_timer elem = { shared, timer.get_period(), timer.get_next() };
+						due.push_back(STD_MOVE(elem));
+					}
+					expired.pop_front();
+					--g_wheel_size;
+					if(!shared){
+						// 计时器正在被销毁。
+						continue;
+					}
+					const AUTO(period, timer.get_period());
+					if(period != 0){
+						wheel_insert(timer, saturated_add(timer.get_next(), period));
+					}
+				}
+			} catch(...){
+				// 没有处理的计时器放回到下一个槽中。
+				const AUTO(next_index, g_wheel_time & ((1u << wheel_root_bits) - 1));
+				AUTO_REF(next_slot, g_wheel_root[next_index]);
+				next_slot.splice(next_slot.end(), expired);
+				g_wheel_root_bitmap[next_index / 64] |= 1ull << (next_index % 64);
+				throw;
 			}
-			period = timer->get_period();
-			if(period == 0){
-				g_timers.pop_back();
-			} else {
-				g_timers.back().next = saturated_add(g_timers.back().next, period);
-				std::push_heap(g_timers.begin(), g_timers.end());
+		}
+	}
+
+	void record_jitter(const boost::container::vector<Due_timer> &due, boost::uint64_t now) NOEXCEPT {
+		const Mutex::Unique_lock lock(g_jitter_mutex);
+		for(AUTO(it, due.begin()); it != due.end(); ++it){
+			const AUTO(jitter, saturated_sub(now, it->next));
+			std::size_t index = 0;
+			while((index + 1 < jitter_histogram_size) && (jitter > (static_cast<boost::uint64_t>(jitter_histogram_base) << index))){
+				++index;
 			}
+			g_jitter_max = std::max(g_jitter_max, jitter);
+			g_jitter_samples += 1;
+			g_jitter_total += jitter;
+			g_jitter_histogram[index] += 1;
 		}
+	}
 
+	bool pump_timers(boost::container::vector<Due_timer> &due) NOEXCEPT {
+		POSEIDON_PROFILE_ME;
+
+		const AUTO(now, get_mono_clock_us());
 		try {
-			if(timer->is_low_level()){
-				POSEIDON_LOG_TRACE("Dispatching low level timer: timer = ", timer);
-				timer->get_callback()(timer, now, timer->get_period());
-			} else {
-				POSEIDON_LOG_TRACE("Preparing a timer job for dispatching: timer = ", timer);
-				Job_dispatcher::enqueue(boost::make_shared<Timer_job>(timer, now, period), VAL_INIT);
-			}
+			const Mutex::Unique_lock lock(g_mutex);
+			wheel_collect(due, now);
 		} catch(std::exception &e){
-			POSEIDON_LOG_WARNING("std::exception thrown while dispatching timer job, what = ", e.what());
-		} catch(...){
-			POSEIDON_LOG_WARNING("Unknown exception thrown while dispatching timer job.");
+			POSEIDON_LOG_ERROR("std::exception thrown while collecting timers, what = ", e.what());
 		}
+		if(due.empty()){
+			return false;
+		}
+		record_jitter(due, now);
+
+		for(AUTO(it, due.begin()); it != due.end(); ++it){
+			const AUTO_REF(timer, it->timer);
+			const AUTO(unit, timer->get_unit());
+			try {
+				if(timer->is_low_level()){
+					POSEIDON_LOG_TRACE("Dispatching low level timer: timer = ", timer);
+					timer->get_callback()(timer, now / unit, timer->get_period() / unit);
+				} else {
+					POSEIDON_LOG_TRACE("Preparing a timer job for dispatching: timer = ", timer);
+					Job_dispatcher::enqueue(boost::make_shared<Timer_job>(timer, now / unit, it->period / unit), VAL_INIT);
+				}
+			} catch(std::exception &e){
+				POSEIDON_LOG_WARNING("std::exception thrown while dispatching timer job, what = ", e.what());
+			} catch(...){
+				POSEIDON_LOG_WARNING("Unknown exception thrown while dispatching timer job.");
+			}
+		}
+		due.clear();
 		return true;
 	}
 
+	// 调用者必须持有 g_mutex。time 是绝对时间，-1 表示不设定。
+	void arm_timerfd(boost::uint64_t time) NOEXCEPT {
+		::itimerspec its = { };
+		if(time != UINT64_MAX){
+			// 全零会解除 timerfd，因此至少设定为 1 纳秒。
+			its.it_value.tv_sec = static_cast< ::time_t>(time / 1000000);
+			its.it_value.tv_nsec = static_cast<long>(time % 1000000 * 1000 + 1);
+		}
+		if(::timerfd_settime(g_timerfd.get(), TFD_TIMER_ABSTIME, &its, NULLPTR) != 0){
+			const int err_code = errno;
+			POSEIDON_LOG_ERROR("::timerfd_settime() failed! errno was ", err_code);
+		}
+	}
+	void wait_for_timerfd() NOEXCEPT {
+		boost::uint64_t expirations;
+		if(::read(g_timerfd.get(), &expirations, sizeof(expirations)) < 0){
+			const int err_code = errno;
+			if(err_code != EINTR){
+				POSEIDON_LOG_ERROR("::read() failed! errno was ", err_code);
+			}
+		}
+	}
+	// 调用者必须持有 g_mutex。
+	void notify_new_deadline(boost::uint64_t first) NOEXCEPT {
+		if(first >= g_wakeup_time){
+			return;
+		}
+		g_wakeup_time = first;
+		if(g_timerfd){
+			arm_timerfd(first);
+		} else {
+			g_new_timer.signal();
+		}
+	}
+
 	void thread_proc(){
 		POSEIDON_PROFILE_ME;
 		POSEIDON_LOG(Logger::special_major | Logger::level_info, "Timer daemon started.");
 
-		unsigned timeout = 0;
+		boost::container::vector<Due_timer> due;
 		for(;;){
-			bool busy;
-			do {
-				busy = pump_one_element();
-				timeout = std::min(timeout * 2u + 1u, !busy * 100u);
-			} while(busy);
+			while(pump_timers(due)){
+				// 处理所有到期的计时器。
+			}
 
 			Mutex::Unique_lock lock(g_mutex);
 			if(!atomic_load(g_running, memory_order_consume)){
 				break;
 			}
-			g_new_timer.timed_wait(lock, timeout);
+			heap_migrate();
+			const AUTO(next, get_next_deadline());
+			g_wakeup_time = next;
+			if(g_timerfd){
+				arm_timerfd(next);
+				lock.unlock();
+				wait_for_timerfd();
+				continue;
+			}
+			const AUTO(now, get_mono_clock_us());
+			if(next <= now){
+				continue;
+			}
+			if(next == UINT64_MAX){
+				g_new_timer.wait(lock);
+			} else {
+				// 条件变量只能精确到毫秒，向上取整。
+				g_new_timer.timed_wait(lock, (next - now + 999) / 1000);
+			}
 		}
 
 		POSEIDON_LOG(Logger::special_major | Logger::level_info, "Timer daemon stopped.");
 	}
+
+	boost::shared_ptr<Timer> create_timer(boost::uint64_t first, boost::uint64_t period, Timer_callback callback, bool low_level, boost::uint64_t unit){
+		AUTO(timer, boost::make_shared<Timer>(period, STD_MOVE_IDN(callback), low_level, unit));
+		timer->set_weak_self(timer);
+		{
+			const Mutex::Unique_lock lock(g_mutex);
+			heap_reserve();
+			wheel_insert(*timer, first);
+			notify_new_deadline(first);
+		}
+		return timer;
+	}
+	void reset_timer(const boost::shared_ptr<Timer> &timer, boost::uint64_t first, boost::uint64_t period){
+		const Mutex::Unique_lock lock(g_mutex);
+		heap_reserve(); // This may throw std::bad_alloc.
+		wheel_remove(*timer);
+		timer->set_period(period); // 使堆中原有的元素失效。
+		wheel_insert(*timer, first);
+		notify_new_deadline(first);
+	}
+}
+
+Timer::~Timer(){
+	const Mutex::Unique_lock lock(g_mutex);
+	wheel_remove(*this);
 }
 
 void Timer_daemon::start(){
@@ -184,6 +533,17 @@ void Timer_daemon::start(){
 	}
 	POSEIDON_LOG(Logger::special_major | Logger::level_info, "Starting timer daemon...");
 
+	const AUTO(use_timerfd, Main_config::get<bool>("timer_use_timerfd", false));
+	{
+		const Mutex::Unique_lock lock(g_mutex);
+		if(g_wheel_size == 0){
+			g_wheel_time = get_mono_clock_us();
+		}
+		if(use_timerfd){
+			POSEIDON_THROW_UNLESS(g_timerfd.reset(::timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)), System_exception);
+			POSEIDON_LOG(Logger::special_major | Logger::level_info, "Timer daemon will be driven by timerfd.");
+		}
+	}
 	Thread(&thread_proc, Rcnts::view("  T "), Rcnts::view("Timer")).swap(g_thread);
 }
 void Timer_daemon::stop(){
@@ -192,26 +552,36 @@ void Timer_daemon::stop(){
 	}
 	POSEIDON_LOG(Logger::special_major | Logger::level_info, "Stopping timer daemon...");
 
+	{
+		const Mutex::Unique_lock lock(g_mutex);
+		g_wakeup_time = UINT64_MAX;
+		notify_new_deadline(0);
+	}
 	if(g_thread.joinable()){
 		g_thread.join();
 	}
 
 	const Mutex::Unique_lock lock(g_mutex);
+	for(AUTO(it, g_wheel_root.begin()); it != g_wheel_root.end(); ++it){
+		it->clear();
+	}
+	for(AUTO(it, g_wheel_levels.begin()); it != g_wheel_levels.end(); ++it){
+		for(AUTO(lit, it->begin()); lit != it->end(); ++lit){
+			lit->clear();
+		}
+	}
+	g_wheel_root_bitmap.fill(0);
+	g_wheel_level_bitmaps.fill(0);
+	g_wheel_size = 0;
 	g_timers.clear();
+	g_timerfd.reset();
 }
 
 boost::shared_ptr<Timer> Timer_daemon::register_absolute_timer(boost::uint64_t first, boost::uint64_t period, Timer_callback callback){
 	POSEIDON_PROFILE_ME;
 
-	AUTO(timer, boost::make_shared<Timer>(period, STD_MOVE_IDN(callback), false));
-	{
-		const Mutex::Unique_lock lock(g_mutex);
-		Timer_queue_element elem = { timer, first, timer->get_stamp() };
-		g_timers.push_back(STD_MOVE(elem));
-		std::push_heap(g_timers.begin(), g_timers.end());
-		g_new_timer.signal();
-	}
-	POSEIDON_LOG_DEBUG("Created a timer which will be triggered ", saturated_sub(first, get_fast_mono_clock()), " microsecond(s) later and has a period of ", timer->get_period(), " microsecond(s).");
+	AUTO(timer, create_timer(ms_to_us(first), ms_to_us(period), STD_MOVE_IDN(callback), false, 1000));
+	POSEIDON_LOG_DEBUG("Created a timer which will be triggered ", saturated_sub(first, get_fast_mono_clock()), " millisecond(s) later and has a period of ", period, " millisecond(s).");
 	return timer;
 }
 boost::shared_ptr<Timer> Timer_daemon::register_timer(boost::uint64_t delta_first, boost::uint64_t period, Timer_callback callback){
@@ -239,15 +609,8 @@ boost::shared_ptr<Timer> Timer_daemon::register_weekly_timer(unsigned day_of_wee
 boost::shared_ptr<Timer> Timer_daemon::register_low_level_absolute_timer(boost::uint64_t first, boost::uint64_t period, Timer_callback callback){
 	POSEIDON_PROFILE_ME;
 
-	AUTO(timer, boost::make_shared<Timer>(period, STD_MOVE_IDN(callback), true));
-	{
-		const Mutex::Unique_lock lock(g_mutex);
-		Timer_queue_element elem = { timer, first, timer->get_stamp() };
-		g_timers.push_back(STD_MOVE(elem));
-		std::push_heap(g_timers.begin(), g_timers.end());
-		g_new_timer.signal();
-	}
-	POSEIDON_LOG_DEBUG("Created a low level timer which will be triggered ", saturated_sub(first, get_fast_mono_clock()), " microsecond(s) later and has a period of ", timer->get_period(), " microsecond(s).");
+	AUTO(timer, create_timer(ms_to_us(first), ms_to_us(period), STD_MOVE_IDN(callback), true, 1000));
+	POSEIDON_LOG_DEBUG("Created a low level timer which will be triggered ", saturated_sub(first, get_fast_mono_clock()), " millisecond(s) later and has a period of ", period, " millisecond(s).");
 	return timer;
 }
 boost::shared_ptr<Timer> Timer_daemon::register_low_level_timer(boost::uint64_t delta_first, boost::uint64_t period, Timer_callback callback){
@@ -258,16 +621,71 @@ boost::shared_ptr<Timer> Timer_daemon::register_low_level_timer(boost::uint64_t
 void Timer_daemon::set_absolute_time(const boost::shared_ptr<Timer> &timer, boost::uint64_t first, boost::uint64_t period){
 	POSEIDON_PROFILE_ME;
 
-	const Mutex::Unique_lock lock(g_mutex);
-	g_timers.emplace_back(); // This may throw std::bad_alloc.
-	Timer_queue_element elem = { timer, first, timer->set_period(period) }; // This throws no exception.
-	g_timers.back() = STD_MOVE_IDN(elem); // This does not throw an exception, either.
-	std::push_heap(g_timers.begin(), g_timers.end());
-	g_new_timer.signal();
+	reset_timer(timer, ms_to_us(first), period_to_us(period, 1000));
 }
 void Timer_daemon::set_time(const boost::shared_ptr<Timer> &timer, boost::uint64_t delta_first, boost::uint64_t period){
 	const AUTO(now, get_fast_mono_clock());
 	return set_absolute_time(timer, saturated_add(now, delta_first), period);
 }
 
+boost::shared_ptr<Timer> Timer_daemon::register_absolute_timer_us(boost::uint64_t first, boost::uint64_t period, Timer_callback callback){
+	POSEIDON_PROFILE_ME;
+
+	AUTO(timer, create_timer(first, period, STD_MOVE_IDN(callback), false, 1));
+	POSEIDON_LOG_DEBUG("Created a timer which will be triggered ", saturated_sub(first, get_mono_clock_us()), " microsecond(s) later and has a period of ", period, " microsecond(s).");
+	return timer;
+}
+boost::shared_ptr<Timer> Timer_daemon::register_timer_us(boost::uint64_t delta_first, boost::uint64_t period, Timer_callback callback){
+	const AUTO(now, get_mono_clock_us());
+	return register_absolute_timer_us(saturated_add(now, delta_first), period, STD_MOVE(callback));
+}
+
+boost::shared_ptr<Timer> Timer_daemon::register_low_level_absolute_timer_us(boost::uint64_t first, boost::uint64_t period, Timer_callback callback){
+	POSEIDON_PROFILE_ME;
+
+	AUTO(timer, create_timer(first, period, STD_MOVE_IDN(callback), true, 1));
+	POSEIDON_LOG_DEBUG("Created a low level timer which will be triggered ", saturated_sub(first, get_mono_clock_us()), " microsecond(s) later and has a period of ", period, " microsecond(s).");
+	return timer;
+}
+boost::shared_ptr<Timer> Timer_daemon::register_low_level_timer_us(boost::uint64_t delta_first, boost::uint64_t period, Timer_callback callback){
+	const AUTO(now, get_mono_clock_us());
+	return register_low_level_absolute_timer_us(saturated_add(now, delta_first), period, STD_MOVE(callback));
+}
+
+void Timer_daemon::set_absolute_time_us(const boost::shared_ptr<Timer> &timer, boost::uint64_t first, boost::uint64_t period){
+	POSEIDON_PROFILE_ME;
+
+	reset_timer(timer, first, period);
+}
+void Timer_daemon::set_time_us(const boost::shared_ptr<Timer> &timer, boost::uint64_t delta_first, boost::uint64_t period){
+	const AUTO(now, get_mono_clock_us());
+	return set_absolute_time_us(timer, saturated_add(now, delta_first), period);
+}
+
+void Timer_daemon::snapshot_jitter(Timer_daemon::Jitter_snapshot &ret){
+	{
+		const Mutex::Unique_lock lock(g_mutex);
+		ret.timerfd = !!g_timerfd;
+	}
+	const Mutex::Unique_lock lock(g_jitter_mutex);
+	ret.max = g_jitter_max;
+	ret.samples = g_jitter_samples;
+	ret.total = g_jitter_total;
+	ret.histogram.clear();
+	ret.histogram.reserve(jitter_histogram_size);
+	for(std::size_t i = 0; i < jitter_histogram_size; ++i){
+		Jitter_snapshot::Histogram_bucket bucket = { };
+		bucket.limit = (i + 1 < jitter_histogram_size) ? (static_cast<boost::uint64_t>(jitter_histogram_base) << i) : 0;
+		bucket.count = g_jitter_histogram[i];
+		ret.histogram.push_back(bucket);
+	}
+}
+void Timer_daemon::clear_jitter(){
+	const Mutex::Unique_lock lock(g_jitter_mutex);
+	g_jitter_max = 0;
+	g_jitter_samples = 0;
+	g_jitter_total = 0;
+	g_jitter_histogram.fill(0);
+}
+
 }
@@ -6,7 +6,9 @@
 
 #include <boost/shared_ptr.hpp>
 #include <boost/function.hpp>
+#include <boost/container/vector.hpp>
 #include <boost/cstdint.hpp>
+#include <cstddef>
 
 namespace Poseidon {
 
@@ -23,10 +25,24 @@ public:
 
 	typedef boost::function<void (const boost::shared_ptr<Timer> &item, boost::uint64_t now, boost::uint64_t period)> Timer_callback;
 
+	// 计时器实际触发的时间与预定时间之差的统计。
+	struct Jitter_snapshot {
+		struct Histogram_bucket {
+			boost::uint64_t limit; // 微秒。最后一个桶的上限为零，表示不限。
+			unsigned long long count;
+		};
+
+		bool timerfd;
+		boost::uint64_t max;
+		unsigned long long samples;
+		unsigned long long total;
+		boost::container::vector<Histogram_bucket> histogram;
+	};
+
 	static void start();
 	static void stop();
 
-	// 时间单位一律用毫秒。
+	// 除 *_us 函数以外，时间单位一律用毫秒。
 	// 返回的 shared_ptr 是该计时器的唯一持有者。
 
 	// first 用 get_fast_mono_clock() 作参考，period 填零表示只触发一次。
@@ -43,6 +59,20 @@ public:
 
 	static void set_absolute_time(const boost::shared_ptr<Timer> &item, boost::uint64_t first, boost::uint64_t period = period_intact);
 	static void set_time(const boost::shared_ptr<Timer> &item, boost::uint64_t delta_first, boost::uint64_t period = period_intact);
+
+	// 以下函数的时间单位是微秒，first 用 get_mono_clock_us() 作参考。
+	// 用这些函数创建的计时器，回调函数的 now 和 period 参数也以微秒计。
+	static boost::shared_ptr<Timer> register_absolute_timer_us(boost::uint64_t first, boost::uint64_t period, Timer_callback callback);
+	static boost::shared_ptr<Timer> register_timer_us(boost::uint64_t delta_first, boost::uint64_t period, Timer_callback callback);
+
+	static boost::shared_ptr<Timer> register_low_level_absolute_timer_us(boost::uint64_t first, boost::uint64_t period, Timer_callback callback);
+	static boost::shared_ptr<Timer> register_low_level_timer_us(boost::uint64_t delta_first, boost::uint64_t period, Timer_callback callback);
+
+	static void set_absolute_time_us(const boost::shared_ptr<Timer> &item, boost::uint64_t first, boost::uint64_t period = period_intact);
+	static void set_time_us(const boost::shared_ptr<Timer> &item, boost::uint64_t delta_first, boost::uint64_t period = period_intact);
+
+	static void snapshot_jitter(Jitter_snapshot &ret);
+	static void clear_jitter();
 };
 
 }
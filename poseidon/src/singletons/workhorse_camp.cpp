@@ -20,25 +20,149 @@ namespace Poseidon {
 typedef Workhorse_camp::Job_procedure Job_procedure;
 
 namespace {
-	class Workhorse_thread : NONCOPYABLE {
+	struct Job_element {
+		boost::weak_ptr<Promise> weak_promise;
+		Job_procedure procedure;
+	};
+
+	void run_job(Job_element &elem) NOEXCEPT {
+		POSEIDON_PROFILE_ME;
+
+		STD_EXCEPTION_PTR except;
+		try {
+			elem.procedure();
+		} catch(std::exception &e){
+			POSEIDON_LOG_WARNING("std::exception thrown: what = ", e.what());
+			except = STD_CURRENT_EXCEPTION();
+		} catch(...){
+			POSEIDON_LOG_WARNING("Unknown exception thrown");
+			except = STD_CURRENT_EXCEPTION();
+		}
+		const AUTO(promise, elem.weak_promise.lock());
+		if(promise){
+			if(except){
+				promise->set_exception(STD_MOVE(except), false);
+			} else {
+				promise->set_success(false);
+			}
+		}
+	}
+
+	// Chase-Lev 工作窃取双端队列。
+	// 只有所有者可以在底部压入和弹出元素，其他线程从顶部窃取。容量是固定的，满了的时候由调用者把元素放到公共队列中。
+	class Work_stealing_deque : NONCOPYABLE {
 	private:
-		struct Job_queue_element {
-			boost::weak_ptr<Promise> weak_promise;
-			Job_procedure procedure;
+		enum {
+			capacity = 1024,
 		};
 
 	private:
+		volatile long m_top;
+		volatile long m_bottom;
+		Job_element *volatile m_ring[capacity];
+
+	public:
+		Work_stealing_deque()
+			: m_top(0), m_bottom(0)
+		{
+			//
+		}
+
+	public:
+		std::size_t size_hint() const NOEXCEPT {
+			const AUTO(top, atomic_load(m_top, memory_order_acquire));
+			const AUTO(bottom, atomic_load(m_bottom, memory_order_acquire));
+			return static_cast<std::size_t>(std::max(bottom - top, 0l));
+		}
+
+		// 以下两个函数只能由所有者调用。
+		bool push(Job_element *elem) NOEXCEPT {
+			const AUTO(bottom, atomic_load(m_bottom, memory_order_relaxed));
+			const AUTO(top, atomic_load(m_top, memory_order_acquire));
+			if(bottom - top >= capacity){
+				return false;
+			}
+			atomic_store(m_ring[bottom & (capacity - 1)], elem, memory_order_relaxed);
+			atomic_store(m_bottom, bottom + 1, memory_order_release);
+			return true;
+		}
+		Job_element * pop() NOEXCEPT {
+			const AUTO(bottom, atomic_load(m_bottom, memory_order_relaxed) - 1);
+			atomic_store(m_bottom, bottom, memory_order_relaxed);
+			atomic_fence(memory_order_seq_cst);
+			AUTO(top, atomic_load(m_top, memory_order_relaxed));
+			if(top > bottom){
+				atomic_store(m_bottom, bottom + 1, memory_order_relaxed);
+				return NULLPTR;
+			}
+			AUTO(elem, atomic_load(m_ring[bottom & (capacity - 1)], memory_order_relaxed));
+			if(top == bottom){
+				// 只剩最后一个元素，与窃取者竞争。
+				if(!atomic_compare_exchange(m_top, top, top + 1, memory_order_seq_cst, memory_order_relaxed)){
+					elem = NULLPTR;
+				}
+				atomic_store(m_bottom, bottom + 1, memory_order_relaxed);
+			}
+			return elem;
+		}
+
+		// 这个函数可以由任何线程调用。
+		Job_element * steal() NOEXCEPT {
+			AUTO(top, atomic_load(m_top, memory_order_acquire));
+			atomic_fence(memory_order_seq_cst);
+			const AUTO(bottom, atomic_load(m_bottom, memory_order_acquire));
+			if(top >= bottom){
+				return NULLPTR;
+			}
+			const AUTO(elem, atomic_load(m_ring[top & (capacity - 1)], memory_order_relaxed));
+			if(!atomic_compare_exchange(m_top, top, top + 1, memory_order_seq_cst, memory_order_relaxed)){
+				return NULLPTR;
+			}
+			return elem;
+		}
+	};
+
+	class Workhorse_thread;
+
+	volatile bool g_running = false;
+
+	Mutex g_router_mutex;
+	// 线程对象在 start() 中全部创建，之后只读；其中的系统线程在第一次被用到时才启动。
+	boost::container::vector<boost::shared_ptr<Workhorse_thread> > g_threads;
+	volatile std::size_t g_started_count = 0;
+
+	// 不是从工作者线程中提交的（或者工作者线程的双端队列已满时提交的）隔离任务。
+	Mutex g_pool_mutex;
+	boost::container::deque<Job_element *> g_pool_queue;
+	volatile std::size_t g_pool_size = 0;
+
+	// 正在等待隔离任务的线程。
+	Mutex g_idle_mutex;
+	boost::container::vector<Workhorse_thread *> g_idle_threads;
+	volatile std::size_t g_idle_count = 0;
+
+	__thread Workhorse_thread *t_current_thread = 0; // XXX: NULLPTR
+
+	bool has_isolated_jobs() NOEXCEPT;
+	Job_element * take_isolated_job(Workhorse_thread *self) NOEXCEPT;
+
+	class Workhorse_thread : NONCOPYABLE {
+	private:
+		const std::size_t m_index;
 		Thread m_thread;
 		volatile bool m_running;
 
 		mutable Mutex m_mutex;
 		mutable Condition_variable m_new_job;
-		boost::container::deque<Job_queue_element> m_queue;
+		bool m_sleeping;
+		// 带有 thread_hint 的任务只能由这个线程执行，按提交的顺序。
+		boost::container::deque<Job_element> m_queue;
+		Work_stealing_deque m_deque;
 
 	public:
-		Workhorse_thread()
-			: m_running(false)
-			, m_queue()
+		explicit Workhorse_thread(std::size_t index)
+			: m_index(index), m_running(false)
+			, m_sleeping(false), m_queue()
 		{
 			//
 		}
@@ -47,117 +171,234 @@ namespace {
 		bool pump_one_job() NOEXCEPT {
 			POSEIDON_PROFILE_ME;
 
-			Job_queue_element *elem;
+			Job_element *elem;
 			{
 				const Mutex::Unique_lock lock(m_mutex);
 				if(m_queue.empty()){
 					return false;
 				}
+				// 其他线程只会在队尾追加元素，因此这个元素不会失效。
 				elem = &m_queue.front();
 			}
+			run_job(*elem);
+			const Mutex::Unique_lock lock(m_mutex);
+			m_queue.pop_front();
+			return true;
+		}
+		bool pump_isolated_job() NOEXCEPT {
+			Job_element *const elem = take_isolated_job(this);
+			if(!elem){
+				return false;
+			}
+			run_job(*elem);
+			delete elem;
+			return true;
+		}
 
-			STD_EXCEPTION_PTR except;
-			try {
-				elem->procedure();
-			} catch(std::exception &e){
-				POSEIDON_LOG_WARNING("std::exception thrown: what = ", e.what());
-				except = STD_CURRENT_EXCEPTION();
-			} catch(...){
-				POSEIDON_LOG_WARNING("Unknown exception thrown");
-				except = STD_CURRENT_EXCEPTION();
+		// 返回 false 表示线程应当退出。
+		bool wait_for_jobs() NOEXCEPT {
+			POSEIDON_PROFILE_ME;
+
+			Mutex::Unique_lock lock(m_mutex);
+			m_sleeping = true;
+			{
+				const Mutex::Unique_lock idle_lock(g_idle_mutex);
+				g_idle_threads.push_back(this);
+				atomic_add(g_idle_count, 1, memory_order_relaxed);
 			}
-			const AUTO(promise, elem->weak_promise.lock());
-			if(promise){
-				if(except){
-					promise->set_exception(STD_MOVE(except), false);
+			// 与提交任务的线程中的屏障配对，这样我们要么看到新的任务，要么被它唤醒。
+			atomic_fence(memory_order_seq_cst);
+			bool exiting = false;
+			if(m_queue.empty() && !has_isolated_jobs()){
+				if(!atomic_load(m_running, memory_order_consume)){
+					exiting = true;
 				} else {
-					promise->set_success(false);
+					while(m_sleeping){
+						m_new_job.wait(lock);
+					}
 				}
 			}
-			const Mutex::Unique_lock lock(m_mutex);
-			m_queue.pop_front();
-			return true;
+			m_sleeping = false;
+			lock.unlock();
+
+			const Mutex::Unique_lock idle_lock(g_idle_mutex);
+			const AUTO(it, std::find(g_idle_threads.begin(), g_idle_threads.end(), this));
+			if(it != g_idle_threads.end()){
+				g_idle_threads.erase(it);
+				atomic_sub(g_idle_count, 1, memory_order_relaxed);
+			}
+			return !exiting;
 		}
 
 		void thread_proc(){
 			POSEIDON_PROFILE_ME;
 			POSEIDON_LOG(Logger::special_major | Logger::level_info, "Workhorse thread started.");
 
-			unsigned timeout = 0;
+			t_current_thread = this;
 			for(;;){
-				bool busy;
-				do {
-					busy = pump_one_job();
-					timeout = std::min<unsigned>(timeout * 2u + 1u, !busy * 100u);
-				} while(busy);
-
-				Mutex::Unique_lock lock(m_mutex);
-				if(m_queue.empty() && !atomic_load(m_running, memory_order_consume)){
+				// 先处理只能由这个线程执行的任务，然后才去找隔离任务。
+				if(pump_one_job() || pump_isolated_job()){
+					continue;
+				}
+				if(!wait_for_jobs()){
 					break;
 				}
-				m_new_job.timed_wait(lock, timeout);
 			}
+			t_current_thread = NULLPTR;
 
 			POSEIDON_LOG(Logger::special_major | Logger::level_info, "Workhorse thread stopped.");
 		}
 
 	public:
+		std::size_t get_index() const NOEXCEPT {
+			return m_index;
+		}
+		Work_stealing_deque & get_deque() NOEXCEPT {
+			return m_deque;
+		}
+
+		bool is_started() const {
+			return m_thread.joinable();
+		}
 		void start(){
 			const Mutex::Unique_lock lock(m_mutex);
-			Thread(boost::bind(&Workhorse_thread::thread_proc, this), Rcnts::view("  W "), Rcnts::view("Workhorse")).swap(m_thread);
 			atomic_store(m_running, true, memory_order_release);
+			Thread(boost::bind(&Workhorse_thread::thread_proc, this), Rcnts::view("  W "), Rcnts::view("Workhorse")).swap(m_thread);
 		}
 		void stop(){
+			const Mutex::Unique_lock lock(m_mutex);
 			atomic_store(m_running, false, memory_order_release);
+			m_sleeping = false;
+			m_new_job.signal();
 		}
 		void safe_join(){
-			wait_till_idle();
-
 			if(m_thread.joinable()){
 				m_thread.join();
 			}
 		}
 
-		void wait_till_idle(){
-			for(;;){
-				std::size_t pending_objects;
-				{
-					const Mutex::Unique_lock lock(m_mutex);
-					pending_objects = m_queue.size();
-					if(pending_objects == 0){
-						break;
-					}
-					m_new_job.signal();
-				}
-				POSEIDON_LOG(Logger::special_major | Logger::level_info, "Waiting for jobs to complete: pending_objects = ", pending_objects);
-
-				::timespec req;
-				req.tv_sec = 0;
-				req.tv_nsec = 500 * 1000 * 1000;
-				::nanosleep(&req, NULLPTR);
-			}
-		}
-
-		std::size_t get_queue_size() const {
+		void wake_up() NOEXCEPT {
 			const Mutex::Unique_lock lock(m_mutex);
-			return m_queue.size();
+			m_sleeping = false;
+			m_new_job.signal();
 		}
 		void add_job(const boost::shared_ptr<Promise> &promise, Job_procedure procedure){
 			POSEIDON_PROFILE_ME;
 
 			const Mutex::Unique_lock lock(m_mutex);
 			POSEIDON_THROW_UNLESS(atomic_load(m_running, memory_order_consume), Exception, Rcnts::view("Workhorse thread is being shut down"));
-			Job_queue_element elem = { promise, STD_MOVE_IDN(procedure) };
+			Job_element elem = { promise, STD_MOVE_IDN(procedure) };
 			m_queue.push_back(STD_MOVE(elem));
+			m_sleeping = false;
 			m_new_job.signal();
 		}
 	};
 
-	volatile bool g_running = false;
+	bool has_isolated_jobs() NOEXCEPT {
+		if(atomic_load(g_pool_size, memory_order_acquire) != 0){
+			return true;
+		}
+		for(std::size_t i = 0; i < g_threads.size(); ++i){
+			if(g_threads.at(i)->get_deque().size_hint() != 0){
+				return true;
+			}
+		}
+		return false;
+	}
+	Job_element * take_isolated_job(Workhorse_thread *self) NOEXCEPT {
+		// 先从自己的双端队列底部取，即最近提交的任务，然后是公共队列，最后从其他线程那里窃取最早提交的任务。
+		AUTO(elem, self->get_deque().pop());
+		if(elem){
+			return elem;
+		}
+		if(atomic_load(g_pool_size, memory_order_acquire) != 0){
+			const Mutex::Unique_lock lock(g_pool_mutex);
+			if(!g_pool_queue.empty()){
+				elem = g_pool_queue.front();
+				g_pool_queue.pop_front();
+				atomic_sub(g_pool_size, 1, memory_order_relaxed);
+				return elem;
+			}
+		}
+		const std::size_t count = g_threads.size();
+		const std::size_t offset = random_uint32() % count;
+		for(std::size_t i = 0; i < count; ++i){
+			const AUTO_REF(victim, g_threads.at((offset + i) % count));
+			if(victim.get() == self){
+				continue;
+			}
+			elem = victim->get_deque().steal();
+			if(elem){
+				return elem;
+			}
+		}
+		return NULLPTR;
+	}
 
-	Mutex g_router_mutex;
-	boost::container::vector<boost::shared_ptr<Workhorse_thread> > g_threads;
+	// 调用时 g_router_mutex 必须已被锁定。关闭之后不再启动新线程，否则它永远不会退出。
+	void start_thread_unlocked(std::size_t i){
+		const AUTO_REF(thread, g_threads.at(i));
+		if(thread->is_started()){
+			return;
+		}
+		if(!atomic_load(g_running, memory_order_consume)){
+			return;
+		}
+		POSEIDON_LOG(Logger::special_major | Logger::level_debug, "Creating new workhorse thread ", i);
+		thread->start();
+		atomic_add(g_started_count, 1, memory_order_release);
+	}
+	// 唤醒一个空闲的线程来处理隔离任务。如果所有已经启动的线程都在忙，就再启动一个。
+	void notify_isolated_job(){
+		atomic_fence(memory_order_seq_cst);
+		if(atomic_load(g_idle_count, memory_order_relaxed) != 0){
+			Workhorse_thread *thread = NULLPTR;
+			{
+				const Mutex::Unique_lock idle_lock(g_idle_mutex);
+				if(!g_idle_threads.empty()){
+					thread = g_idle_threads.back();
+					g_idle_threads.pop_back();
+					atomic_sub(g_idle_count, 1, memory_order_relaxed);
+				}
+			}
+			if(thread){
+				thread->wake_up();
+				return;
+			}
+		}
+		if(atomic_load(g_started_count, memory_order_acquire) < g_threads.size()){
+			const Mutex::Unique_lock lock(g_router_mutex);
+			for(std::size_t i = 0; i < g_threads.size(); ++i){
+				if(!g_threads.at(i)->is_started()){
+					start_thread_unlocked(i);
+					break;
+				}
+			}
+		}
+	}
+
+	void add_isolated_job(const boost::shared_ptr<Promise> &promise, Job_procedure procedure){
+		POSEIDON_PROFILE_ME;
+		POSEIDON_THROW_UNLESS(!g_threads.empty(), Basic_exception, Rcnts::view("Workhorse support is not enabled"));
 
+		Job_element *const elem = new Job_element;
+		elem->weak_promise = promise;
+		elem->procedure.swap(procedure);
+		// 工作者线程提交的任务放在自己的双端队列中，可以被其他线程窃取。工作者线程在退出之前会处理完这些任务，因此关闭过程中也允许提交。
+		const AUTO(self, t_current_thread);
+		if(!self || !self->get_deque().push(elem)){
+			try {
+				const Mutex::Unique_lock lock(g_pool_mutex);
+				POSEIDON_THROW_UNLESS(self || atomic_load(g_running, memory_order_consume), Exception, Rcnts::view("Workhorse camp is being shut down"));
+				g_pool_queue.push_back(elem);
+				atomic_add(g_pool_size, 1, memory_order_release);
+			} catch(...){
+				delete elem;
+				throw;
+			}
+		}
+		notify_isolated_job();
+	}
 	void add_job_using_seed(const boost::shared_ptr<Promise> &promise, Job_procedure procedure, boost::uint64_t seed){
 		POSEIDON_PROFILE_ME;
 		POSEIDON_THROW_UNLESS(!g_threads.empty(), Basic_exception, Rcnts::view("Workhorse support is not enabled"));
@@ -165,16 +406,10 @@ namespace {
 		boost::shared_ptr<Workhorse_thread> thread;
 		{
 			const Mutex::Unique_lock lock(g_router_mutex);
-			std::size_t i = static_cast<std::size_t>(seed % g_threads.size());
+			const std::size_t i = static_cast<std::size_t>(seed % g_threads.size());
 			thread = g_threads.at(i);
-			if(!thread){
-				POSEIDON_LOG(Logger::special_major | Logger::level_debug, "Creating new workhorse thread ", i);
-				thread = boost::make_shared<Workhorse_thread>();
-				thread->start();
-				g_threads.at(i) = thread;
-			}
+			start_thread_unlocked(i);
 		}
-		assert(thread);
 		thread->add_job(promise, STD_MOVE_IDN(procedure));
 	}
 }
@@ -191,7 +426,10 @@ void Workhorse_camp::start(){
 		POSEIDON_LOG_FATAL("You shall not set `workhorse_max_thread_count` in `main.conf` to zero.");
 		std::terminate();
 	}
-	g_threads.resize(max_thread_count);
+	g_threads.reserve(max_thread_count);
+	for(std::size_t i = 0; i < max_thread_count; ++i){
+		g_threads.push_back(boost::make_shared<Workhorse_thread>(i));
+	}
 
 	POSEIDON_LOG(Logger::special_major | Logger::level_info, "Workhorse daemon started.");
 }
@@ -201,19 +439,32 @@ void Workhorse_camp::stop(){
 	}
 	POSEIDON_LOG(Logger::special_major | Logger::level_info, "Stopping workhorse daemon...");
 
-	for(std::size_t i = 0; i < g_threads.size(); ++i){
-		const AUTO_REF(thread, g_threads.at(i));
-		if(!thread){
-			continue;
+	{
+		// 等待 add_isolated_job() 完成。
+		const Mutex::Unique_lock lock(g_pool_mutex);
+	}
+	{
+		// 此后 start_thread_unlocked() 不会再启动新线程，因此解锁之后各个线程的状态不会再改变。
+		const Mutex::Unique_lock lock(g_router_mutex);
+		for(std::size_t i = 0; i < g_threads.size(); ++i){
+			const AUTO_REF(thread, g_threads.at(i));
+			if(!thread->is_started()){
+				continue;
+			}
+			POSEIDON_LOG(Logger::special_major | Logger::level_info, "Stopping workhorse thread ", i);
+			thread->stop();
+		}
+		const AUTO_REF(first, g_threads.at(0));
+		if(!first->is_started() && has_isolated_jobs()){
+			// 线程在处理完所有的隔离任务之后才会退出，因此至少要有一个线程在运行。
+			POSEIDON_LOG(Logger::special_major | Logger::level_debug, "Creating new workhorse thread 0");
+			first->start();
+			atomic_add(g_started_count, 1, memory_order_release);
+			first->stop();
 		}
-		POSEIDON_LOG(Logger::special_major | Logger::level_info, "Stopping workhorse thread ", i);
-		thread->stop();
 	}
 	for(std::size_t i = 0; i < g_threads.size(); ++i){
 		const AUTO_REF(thread, g_threads.at(i));
-		if(!thread){
-			continue;
-		}
 		POSEIDON_LOG(Logger::special_major | Logger::level_info, "Waiting for workhorse thread ", i, " to terminate...");
 		thread->safe_join();
 	}
@@ -222,13 +473,22 @@ void Workhorse_camp::stop(){
 
 	const Mutex::Unique_lock lock(g_router_mutex);
 	g_threads.clear();
+	atomic_store(g_started_count, 0u, memory_order_relaxed);
 }
 
 void Workhorse_camp::enqueue_isolated(const boost::shared_ptr<Promise> &promise, Job_procedure procedure){
-	add_job_using_seed(promise, STD_MOVE_IDN(procedure), random_uint32());
+	add_isolated_job(promise, STD_MOVE_IDN(procedure));
 }
 void Workhorse_camp::enqueue(const boost::shared_ptr<Promise> &promise, Job_procedure procedure, std::size_t thread_hint){
 	add_job_using_seed(promise, STD_MOVE_IDN(procedure), static_cast<boost::uint64_t>(thread_hint) * 134775813 / 65539);
 }
 
+std::size_t Workhorse_camp::get_local_backlog() NOEXCEPT {
+	const AUTO(self, t_current_thread);
+	if(!self){
+		return 0;
+	}
+	return self->get_deque().size_hint();
+}
+
 }
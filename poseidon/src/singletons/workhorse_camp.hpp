@@ -26,6 +26,9 @@ public:
 	static void enqueue_isolated(const boost::shared_ptr<Promise> &promise, Job_procedure procedure);
 	// 具有相同 thread_hint 的任务保证由同一个线程执行。
 	static void enqueue(const boost::shared_ptr<Promise> &promise, Job_procedure procedure, std::size_t thread_hint);
+
+	// 返回当前工作者线程自己的队列中尚未被执行（也未被其他线程窃取）的隔离任务数。如果当前线程不是工作者线程，返回零。
+	static std::size_t get_local_backlog() NOEXCEPT;
 };
 
 }
@@ -44,7 +44,7 @@ Socket_base::Delayed_shutdown_guard::~Delayed_shutdown_guard(){
 Socket_base::Socket_base(Move<Unique_file> socket)
 	: m_socket(STD_MOVE(socket)), m_creation_time(get_utc_time())
 	, m_shutdown_read(false), m_shutdown_write(false), m_really_shutdown_write(false)
-	, m_throttled(false), m_timed_out(false), m_delayed_shutdown_guard_count(0)
+	, m_throttled(false), m_timed_out(false), m_delayed_shutdown_guard_count(0), m_epoll_shard(0)
 {
 	//
 }
@@ -230,5 +230,8 @@ int Socket_base::poll_write(Mutex::Unique_lock &/*write_lock*/, unsigned char */
 void Socket_base::on_close(int /*err_code*/){
 	//
 }
+void Socket_base::on_sweep(boost::uint64_t /*now*/){
+	//
+}
 
 }
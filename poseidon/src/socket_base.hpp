@@ -16,8 +16,11 @@
 namespace Poseidon {
 
 class Ip_port;
+class Epoll_daemon;
 
 class Socket_base : public virtual Virtual_shared_from_this {
+	friend Epoll_daemon;
+
 public:
 	// 至少一个此对象存活的条件下连接不会由于 RDHUP 而被关掉。
 	class Delayed_shutdown_guard;
@@ -32,6 +35,7 @@ private:
 	volatile bool m_throttled;
 	volatile bool m_timed_out;
 	volatile std::size_t m_delayed_shutdown_guard_count;
+	volatile std::size_t m_epoll_shard;
 
 	mutable Mutex m_info_mutex;
 	mutable boost::optional<Ip_port> m_remote_info;
@@ -80,6 +84,8 @@ public:
 	virtual int poll_read_and_process(unsigned char *hint_buffer, std::size_t hint_capacity, bool readable);
 	virtual int poll_write(Mutex::Unique_lock &write_lock, unsigned char *hint_buffer, std::size_t hint_capacity, bool writable);
 	virtual void on_close(int err_code);
+	// 由所属 epoll 线程的超时清扫周期性地调用，参见 Epoll_daemon::set_socket_deadline()。
+	virtual void on_sweep(boost::uint64_t now);
 };
 
 class Socket_base::Delayed_shutdown_guard : NONCOPYABLE {
@@ -4,7 +4,11 @@
 #include "precompiled.hpp"
 #include "stream_buffer.hpp"
 #include "checked_arithmetic.hpp"
+#include "atomic.hpp"
 #include <boost/type_traits/common_type.hpp>
+#if defined(__x86_64__) || defined(__i386__)
+#  include <immintrin.h>
+#endif
 
 namespace Poseidon {
 
@@ -16,13 +20,339 @@ namespace {
 		t = STD_MOVE(u);
 		return v;
 	}
+
+	// 字节扫描。x86 上第一次调用时按照 CPU 支持的指令集选择 AVX2 或 SSE2 的实现，其他平台使用通用的实现。
+	// 查找单个字节直接使用 std::memchr()，因为 glibc 已经这么做了。
+	struct Byte_set {
+		std::size_t count;
+		unsigned char bytes[8];
+		bool table[256];
+	};
+
+	void make_byte_set(Byte_set &set, const void *data, std::size_t size) NOEXCEPT {
+		set.count = 0;
+		std::memset(set.table, 0, sizeof(set.table));
+		for(std::size_t i = 0; i < size; ++i){
+			const unsigned char byte = static_cast<const unsigned char *>(data)[i];
+			if(set.table[byte]){
+				continue;
+			}
+			set.table[byte] = true;
+			if(set.count < sizeof(set.bytes)){
+				set.bytes[set.count] = byte;
+			}
+			set.count += 1;
+		}
+	}
+
+	std::size_t count_byte_generic(const unsigned char *data, std::size_t size, unsigned char byte) NOEXCEPT {
+		std::size_t total = 0;
+		for(std::size_t i = 0; i < size; ++i){
+			total += (data[i] == byte);
+		}
+		return total;
+	}
+	// 返回第一个匹配的字节的偏移量，找不到返回 size。
+	std::size_t find_any_generic(const unsigned char *data, std::size_t size, const Byte_set &set) NOEXCEPT {
+		for(std::size_t i = 0; i < size; ++i){
+			if(set.table[data[i]]){
+				return i;
+			}
+		}
+		return size;
+	}
+
+#if defined(__x86_64__) || defined(__i386__)
+	__attribute__((__target__("sse2")))
+	std::size_t count_byte_sse2(const unsigned char *data, std::size_t size, unsigned char byte) NOEXCEPT {
+		const __m128i needle = _mm_set1_epi8(static_cast<char>(byte));
+		std::size_t total = 0;
+		std::size_t i = 0;
+		for(; size - i >= 16; i += 16){
+			const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+			total += static_cast<unsigned>(__builtin_popcount(static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, needle)))));
+		}
+		return total + count_byte_generic(data + i, size - i, byte);
+	}
+	__attribute__((__target__("sse2")))
+	std::size_t find_any_sse2(const unsigned char *data, std::size_t size, const Byte_set &set) NOEXCEPT {
+		if(set.count > sizeof(set.bytes)){
+			return find_any_generic(data, size, set);
+		}
+		__m128i needles[sizeof(set.bytes)];
+		for(std::size_t k = 0; k < set.count; ++k){
+			needles[k] = _mm_set1_epi8(static_cast<char>(set.bytes[k]));
+		}
+		std::size_t i = 0;
+		for(; size - i >= 16; i += 16){
+			const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+			__m128i hits = _mm_setzero_si128();
+			for(std::size_t k = 0; k < set.count; ++k){
+				hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, needles[k]));
+			}
+			const AUTO(mask, static_cast<unsigned>(_mm_movemask_epi8(hits)));
+			if(mask != 0){
+				return i + static_cast<unsigned>(__builtin_ctz(mask));
+			}
+		}
+		return i + find_any_generic(data + i, size - i, set);
+	}
+
+	__attribute__((__target__("avx2")))
+	std::size_t count_byte_avx2(const unsigned char *data, std::size_t size, unsigned char byte) NOEXCEPT {
+		const __m256i needle = _mm256_set1_epi8(static_cast<char>(byte));
+		std::size_t total = 0;
+		std::size_t i = 0;
+		for(; size - i >= 32; i += 32){
+			const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+			total += static_cast<unsigned>(__builtin_popcount(static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle)))));
+		}
+		return total + count_byte_generic(data + i, size - i, byte);
+	}
+	__attribute__((__target__("avx2")))
+	std::size_t find_any_avx2(const unsigned char *data, std::size_t size, const Byte_set &set) NOEXCEPT {
+		if(set.count > sizeof(set.bytes)){
+			return find_any_generic(data, size, set);
+		}
+		__m256i needles[sizeof(set.bytes)];
+		for(std::size_t k = 0; k < set.count; ++k){
+			needles[k] = _mm256_set1_epi8(static_cast<char>(set.bytes[k]));
+		}
+		std::size_t i = 0;
+		for(; size - i >= 32; i += 32){
+			const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+			__m256i hits = _mm256_setzero_si256();
+			for(std::size_t k = 0; k < set.count; ++k){
+				hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(block, needles[k]));
+			}
+			const AUTO(mask, static_cast<unsigned>(_mm256_movemask_epi8(hits)));
+			if(mask != 0){
+				return i + static_cast<unsigned>(__builtin_ctz(mask));
+			}
+		}
+		return i + find_any_generic(data + i, size - i, set);
+	}
+#endif
+
+	struct Scan_kernels {
+		std::size_t (*count_byte)(const unsigned char *data, std::size_t size, unsigned char byte);
+		std::size_t (*find_any)(const unsigned char *data, std::size_t size, const Byte_set &set);
+	};
+
+	const Scan_kernels s_scan_kernels_generic = { &count_byte_generic, &find_any_generic };
+#if defined(__x86_64__) || defined(__i386__)
+	const Scan_kernels s_scan_kernels_sse2 = { &count_byte_sse2, &find_any_sse2 };
+	const Scan_kernels s_scan_kernels_avx2 = { &count_byte_avx2, &find_any_avx2 };
+#endif
+
+	const Scan_kernels * select_scan_kernels() NOEXCEPT {
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_cpu_init();
+		if(__builtin_cpu_supports("avx2")){
+			return &s_scan_kernels_avx2;
+		}
+		if(__builtin_cpu_supports("sse2")){
+			return &s_scan_kernels_sse2;
+		}
+#endif
+		return &s_scan_kernels_generic;
+	}
+	const Scan_kernels & get_scan_kernels() NOEXCEPT {
+		static const Scan_kernels *const s_kernels = select_scan_kernels();
+		return *s_kernels;
+	}
+
+	// 不超过这个大小的数据在复制或切分时直接复制字节，更大的数据则共享存储。
+	const std::size_t g_copy_threshold = 256;
+
+	// 块内存池。
+	// 每个线程为每种大小的块维护一个空闲链表，链表过长时将其中一半作为一批归还到全局仓库中，链表为空时从全局仓库中取回一批。
+	// 仓库使用静态初始化的互斥锁并且没有析构函数，因此在静态对象析构之后释放块也是安全的。
+	// 第 0 类不含数据，用于引用其他块的存储的节点。
+	enum {
+		pool_class_reference = 0,
+		pool_class_count = 5,
+		pool_depot_max_batches = 64,
+	};
+
+	const std::size_t s_pool_chunk_sizes[pool_class_count]  = {    0, 1024, 4096, 16384, 65536 };
+	const std::size_t s_pool_cache_limits[pool_class_count] = { 1024,  256,   64,    16,     4 };
+
+	// 空闲块的前两个指针分别用于链接同一批中的下一个块，和仓库中的下一批。
+	inline void *& next_block(void *block) NOEXCEPT {
+		return static_cast<void **>(block)[0];
+	}
+	inline void *& next_batch(void *block) NOEXCEPT {
+		return static_cast<void **>(block)[1];
+	}
+
+	struct Pool_depot {
+		::pthread_mutex_t mutex;
+		void *batches;
+		std::size_t batch_count;
+		std::size_t chunk_count;
+
+		volatile unsigned long long system_allocations;
+		volatile unsigned long long system_deallocations;
+		volatile unsigned long long depot_fetches;
+		volatile unsigned long long depot_returns;
+	};
+	Pool_depot g_pool_depots[pool_class_count] = {
+		{ PTHREAD_MUTEX_INITIALIZER },
+		{ PTHREAD_MUTEX_INITIALIZER },
+		{ PTHREAD_MUTEX_INITIALIZER },
+		{ PTHREAD_MUTEX_INITIALIZER },
+		{ PTHREAD_MUTEX_INITIALIZER },
+	};
+	volatile unsigned long long g_pool_oversized_allocations = 0;
+	volatile unsigned long long g_pool_oversized_deallocations = 0;
+
+	struct Pool_thread_cache {
+		void *heads[pool_class_count];
+		std::size_t counts[pool_class_count];
+		bool registered;
+	};
+	__thread Pool_thread_cache t_pool_cache;
+
+	::pthread_once_t g_pool_key_once = PTHREAD_ONCE_INIT;
+	::pthread_key_t g_pool_key;
+
+	void pool_return_batch(std::size_t index, void *batch, std::size_t count) NOEXCEPT {
+		AUTO_REF(depot, g_pool_depots[index]);
+		::pthread_mutex_lock(&depot.mutex);
+		if(depot.batch_count < pool_depot_max_batches){
+			next_batch(batch) = depot.batches;
+			depot.batches = batch;
+			depot.batch_count += 1;
+			depot.chunk_count += count;
+			batch = NULLPTR;
+		}
+		::pthread_mutex_unlock(&depot.mutex);
+		if(!batch){
+			atomic_add(depot.depot_returns, 1, memory_order_relaxed);
+			return;
+		}
+		// 仓库已满，直接释放。
+		while(batch){
+			const AUTO(next, next_block(batch));
+			::operator delete(batch);
+			atomic_add(depot.system_deallocations, 1, memory_order_relaxed);
+			batch = next;
+		}
+	}
+	void * pool_fetch_batch(std::size_t index, std::size_t &count) NOEXCEPT {
+		AUTO_REF(depot, g_pool_depots[index]);
+		void *batch = NULLPTR;
+		::pthread_mutex_lock(&depot.mutex);
+		if(depot.batches){
+			batch = depot.batches;
+			depot.batches = next_batch(batch);
+			depot.batch_count -= 1;
+			count = 0;
+			for(AUTO(block, batch); block; block = next_block(block)){
+				++count;
+			}
+			depot.chunk_count -= count;
+		}
+		::pthread_mutex_unlock(&depot.mutex);
+		if(batch){
+			atomic_add(depot.depot_fetches, 1, memory_order_relaxed);
+		}
+		return batch;
+	}
+
+	void pool_flush_thread_cache(void *param) NOEXCEPT {
+		const AUTO(cache, static_cast<Pool_thread_cache *>(param));
+		for(std::size_t i = 0; i < pool_class_count; ++i){
+			const AUTO(batch, exchange(cache->heads[i], NULLPTR));
+			const AUTO(count, exchange(cache->counts[i], 0));
+			if(batch){
+				pool_return_batch(i, batch, count);
+			}
+		}
+		cache->registered = false;
+	}
+	void pool_create_key() NOEXCEPT {
+		if(::pthread_key_create(&g_pool_key, &pool_flush_thread_cache) != 0){
+			std::terminate();
+		}
+	}
+	Pool_thread_cache & pool_get_thread_cache() NOEXCEPT {
+		AUTO_REF(cache, t_pool_cache);
+		if(!cache.registered){
+			// 线程退出时将缓存的块归还到仓库中。
+			::pthread_once(&g_pool_key_once, &pool_create_key);
+			::pthread_setspecific(g_pool_key, &cache);
+			cache.registered = true;
+		}
+		return cache;
+	}
+
+	std::size_t pool_get_class(std::size_t min_size) NOEXCEPT {
+		for(std::size_t i = pool_class_reference + 1; i < pool_class_count; ++i){
+			if(min_size <= s_pool_chunk_sizes[i]){
+				return i;
+			}
+		}
+		return pool_class_count;
+	}
+	void * pool_allocate(std::size_t index, std::size_t header_size){
+		AUTO_REF(cache, pool_get_thread_cache());
+		AUTO(block, cache.heads[index]);
+		if(!block){
+			block = pool_fetch_batch(index, cache.counts[index]);
+		}
+		if(block){
+			cache.heads[index] = next_block(block);
+			cache.counts[index] -= 1;
+			return block;
+		}
+		block = ::operator new(header_size + s_pool_chunk_sizes[index]);
+		atomic_add(g_pool_depots[index].system_allocations, 1, memory_order_relaxed);
+		return block;
+	}
+	void pool_deallocate(std::size_t index, void *block) NOEXCEPT {
+		AUTO_REF(cache, pool_get_thread_cache());
+		next_block(block) = cache.heads[index];
+		cache.heads[index] = block;
+		cache.counts[index] += 1;
+		if(cache.counts[index] <= s_pool_cache_limits[index]){
+			return;
+		}
+		// 把一半留在本地，另一半归还到仓库中。
+		const std::size_t keep = s_pool_cache_limits[index] / 2;
+		AUTO(last_kept, cache.heads[index]);
+		for(std::size_t i = 1; i < keep; ++i){
+			last_kept = next_block(last_kept);
+		}
+		const AUTO(batch, exchange(next_block(last_kept), NULLPTR));
+		const AUTO(count, cache.counts[index] - keep);
+		cache.counts[index] = keep;
+		pool_return_batch(index, batch, count);
+	}
 }
 
+// 块的存储带有引用计数，可以被多个缓冲区中的多个节点共享。
+// 拥有存储的块本身也是一个节点；引用其他块的节点单独分配，不含数据。
+// 共享的存储是只读的，只有引用计数为一时才允许在原地写入。
 struct Stream_buffer::Chunk_header {
 	static Chunk_header * create(std::size_t min_capacity, Chunk_header *prev, Chunk_header *next, bool backward){
-		const std::size_t capacity = min_capacity | 1024;
+		std::size_t capacity;
+		void *storage;
+		const AUTO(index, pool_get_class(min_capacity));
+		if(index < pool_class_count){
+			capacity = s_pool_chunk_sizes[index];
+			storage = pool_allocate(index, sizeof(Chunk_header));
+		} else {
+			capacity = min_capacity | 1024;
+			storage = ::operator new(checked_add(sizeof(Chunk_header), capacity));
+			atomic_add(g_pool_oversized_allocations, 1, memory_order_relaxed);
+		}
 		const std::size_t origin = backward ? capacity : 0;
-		const AUTO(chunk, static_cast<Chunk_header *>(::operator new(checked_add(sizeof(Chunk_header), capacity))));
+		const AUTO(chunk, static_cast<Chunk_header *>(storage));
+		chunk->ref_count = 1;
+		chunk->owner = chunk;
+		chunk->data = chunk->storage;
 		chunk->capacity = capacity;
 		chunk->prev = prev;
 		chunk->next = next;
@@ -30,19 +360,75 @@ struct Stream_buffer::Chunk_header {
 		chunk->end = origin;
 		return chunk;
 	}
+	static Chunk_header * create_reference(const Chunk_header *src, std::size_t begin, std::size_t end, Chunk_header *prev, Chunk_header *next){
+		const AUTO(chunk, static_cast<Chunk_header *>(pool_allocate(pool_class_reference, sizeof(Chunk_header))));
+		const AUTO(owner, src->owner);
+		atomic_add(owner->ref_count, 1, memory_order_relaxed);
+		chunk->ref_count = 0;
+		chunk->owner = owner;
+		chunk->data = owner->storage;
+		chunk->capacity = owner->capacity;
+		chunk->prev = prev;
+		chunk->next = next;
+		chunk->begin = begin;
+		chunk->end = end;
+		return chunk;
+	}
 	static void destroy(Chunk_header *chunk) NOEXCEPT {
-		::operator delete(chunk);
+		const AUTO(owner, chunk->owner);
+		if(owner != chunk){
+			pool_deallocate(pool_class_reference, chunk);
+		}
+		// 拥有存储的块在最后一个引用被释放之前不会被回收，但是其中的节点部分已经不再使用了。
+		if(atomic_sub(owner->ref_count, 1, memory_order_acq_rel) != 0){
+			return;
+		}
+		const AUTO(index, pool_get_class(owner->capacity));
+		if((index < pool_class_count) && (owner->capacity == s_pool_chunk_sizes[index])){
+			pool_deallocate(index, owner);
+			return;
+		}
+		::operator delete(owner);
+		atomic_add(g_pool_oversized_deallocations, 1, memory_order_relaxed);
 	}
 
+	volatile std::size_t ref_count;
+	Chunk_header *owner;
+	unsigned char *data;
 	std::size_t capacity;
+
 	Chunk_header *prev;
 	Chunk_header *next;
-
 	std::size_t begin;
 	std::size_t end;
-	__extension__ unsigned char data[];
+	__extension__ unsigned char storage[];
+
+	bool is_writable() const NOEXCEPT {
+		return atomic_load(owner->ref_count, memory_order_acquire) == 1;
+	}
 };
 
+void Stream_buffer::snapshot_pool(boost::container::vector<Stream_buffer::Pool_snapshot_element> &ret){
+	ret.reserve(ret.size() + pool_class_count);
+	for(std::size_t i = pool_class_reference + 1; i < pool_class_count; ++i){
+		AUTO_REF(depot, g_pool_depots[i]);
+		Pool_snapshot_element elem = { };
+		elem.chunk_size = s_pool_chunk_sizes[i];
+		elem.system_allocations = atomic_load(depot.system_allocations, memory_order_relaxed);
+		elem.system_deallocations = atomic_load(depot.system_deallocations, memory_order_relaxed);
+		elem.depot_fetches = atomic_load(depot.depot_fetches, memory_order_relaxed);
+		elem.depot_returns = atomic_load(depot.depot_returns, memory_order_relaxed);
+		::pthread_mutex_lock(&depot.mutex);
+		elem.depot_chunks = depot.chunk_count;
+		::pthread_mutex_unlock(&depot.mutex);
+		ret.push_back(elem);
+	}
+	Pool_snapshot_element elem = { };
+	elem.system_allocations = atomic_load(g_pool_oversized_allocations, memory_order_relaxed);
+	elem.system_deallocations = atomic_load(g_pool_oversized_deallocations, memory_order_relaxed);
+	ret.push_back(elem);
+}
+
 Stream_buffer::Stream_buffer(const void *data, std::size_t count)
 	: m_first(NULLPTR), m_last(NULLPTR), m_size(0)
 {
@@ -144,6 +530,9 @@ bool Stream_buffer::discard() NOEXCEPT {
 void Stream_buffer::put(int data){
 	AUTO(chunk, m_last);
 	AUTO(prev, chunk);
+	if(chunk && !chunk->is_writable()){
+		chunk = NULLPTR;
+	}
 	if(chunk && (chunk->capacity == chunk->end)){
 		const std::size_t avail = chunk->end - chunk->begin;
 		if(chunk->capacity > avail){
@@ -198,6 +587,9 @@ int Stream_buffer::unput() NOEXCEPT {
 void Stream_buffer::unget(int data){
 	AUTO(chunk, m_first);
 	AUTO(next, chunk);
+	if(chunk && !chunk->is_writable()){
+		chunk = NULLPTR;
+	}
 	if(chunk && (chunk->begin == 0)){
 		const std::size_t avail = chunk->end - chunk->begin;
 		if(chunk->capacity > avail){
@@ -295,55 +687,47 @@ std::size_t Stream_buffer::discard(std::size_t count) NOEXCEPT {
 	return total;
 }
 void Stream_buffer::put(int data, std::size_t count){
-	AUTO(chunk, m_last);
-	AUTO(prev, chunk);
-	if(chunk && (chunk->capacity - chunk->end < count)){
-		const std::size_t avail = chunk->end - chunk->begin;
-		if(chunk->capacity - avail >= count){
-			std::memmove(chunk->data, chunk->data + chunk->begin, avail);
-			chunk->begin = 0;
-			chunk->end = avail;
-		} else {
-			chunk = NULLPTR;
-		}
-	}
-	if(!chunk){
-		const AUTO(next, Chunk_header::create(count, prev, NULLPTR, false));
-		(prev ? prev->next : m_first) = next;
-		chunk = next;
-		m_last = next;
-	}
-	std::memset(chunk->data + chunk->end, data, count);
-	chunk->end += count;
-	m_size += count;
+	std::memset(prepare(count), data, count);
+	commit(count);
 }
 void Stream_buffer::put(const void *data, std::size_t count){
-	AUTO(chunk, m_last);
-	AUTO(prev, chunk);
-	if(chunk && (chunk->capacity - chunk->end < count)){
-		const std::size_t avail = chunk->end - chunk->begin;
-		if(chunk->capacity - avail >= count){
-			std::memmove(chunk->data, chunk->data + chunk->begin, avail);
-			chunk->begin = 0;
-			chunk->end = avail;
-		} else {
-			chunk = NULLPTR;
+	std::memcpy(prepare(count), data, count);
+	commit(count);
+}
+void Stream_buffer::put(const Stream_buffer &data){
+	const AUTO(count, data.size());
+	if(count <= g_copy_threshold){
+		// 数据较少时直接复制，避免产生大量零碎的节点。
+		AUTO(write, static_cast<unsigned char *>(prepare(count)));
+		for(AUTO(src, data.m_first); src; src = src->next){
+			const std::size_t avail = src->end - src->begin;
+			std::memcpy(write, src->data + src->begin, avail);
+			write += avail;
 		}
+		commit(count);
+		return;
 	}
-	if(!chunk){
-		const AUTO(next, Chunk_header::create(count, prev, NULLPTR, false));
-		(prev ? prev->next : m_first) = next;
-		chunk = next;
-		m_last = next;
+	// 否则只复制节点，存储由两个缓冲区共享。
+	Stream_buffer temp;
+	for(AUTO(src, data.m_first); src; src = src->next){
+		if(src->end == src->begin){
+			continue;
+		}
+		const AUTO(prev, temp.m_last);
+		const AUTO(chunk, Chunk_header::create_reference(src, src->begin, src->end, prev, NULLPTR));
+		(prev ? prev->next : temp.m_first) = chunk;
+		temp.m_last = chunk;
+		temp.m_size += src->end - src->begin;
 	}
-	std::memcpy(chunk->data + chunk->end, data, count);
-	chunk->end += count;
-	m_size += count;
+	splice(temp);
 }
-void Stream_buffer::put(const Stream_buffer &data){
-	const AUTO(count, data.size());
+
+void * Stream_buffer::prepare(std::size_t count){
 	AUTO(chunk, m_last);
 	AUTO(prev, chunk);
+	if(chunk && !chunk->is_writable()){
+		chunk = NULLPTR;
+	}
 	if(chunk && (chunk->capacity - chunk->end < count)){
 		const std::size_t avail = chunk->end - chunk->begin;
 		if(chunk->capacity - avail >= count){
@@ -360,11 +744,17 @@ void Stream_buffer::put(const Stream_buffer &data){
 		chunk = next;
 		m_last = next;
 	}
-	for(AUTO(src, data.m_first); src; src = src->next){
-		const std::size_t avail = src->end - src->begin;
-		std::memcpy(chunk->data + chunk->end, src->data + src->begin, avail);
-		chunk->end += avail;
+	return chunk->data + chunk->end;
+}
+void Stream_buffer::commit(std::size_t count) NOEXCEPT {
+	if(count == 0){
+		return;
 	}
+	const AUTO(chunk, m_last);
+	assert(chunk);
+	assert(chunk->is_writable());
+	assert(chunk->capacity - chunk->end >= count);
+	chunk->end += count;
 	m_size += count;
 }
 
@@ -373,9 +763,20 @@ void * Stream_buffer::squash(){
 	if(!chunk){
 		return NULLPTR;
 	}
-	if(chunk != m_last){
-		Stream_buffer(*this).swap(*this);
-		chunk = m_first;
+	if((chunk != m_last) || !chunk->is_writable()){
+		// 把所有数据复制到一个新块中。返回的指针是可写的，因此共享的存储也需要复制。
+		const AUTO(squashed, Chunk_header::create(m_size, NULLPTR, NULLPTR, false));
+		while(chunk){
+			const std::size_t avail = chunk->end - chunk->begin;
+			std::memcpy(squashed->data + squashed->end, chunk->data + chunk->begin, avail);
+			squashed->end += avail;
+			const AUTO(next, chunk->next);
+			Chunk_header::destroy(chunk);
+			chunk = next;
+		}
+		m_first = squashed;
+		m_last = squashed;
+		chunk = squashed;
 	}
 	return chunk->data + chunk->begin;
 }
@@ -393,9 +794,14 @@ Stream_buffer Stream_buffer::cut_off(std::size_t count){
 			if(avail > remaining){
 				const AUTO(prev, chunk->prev);
 				const AUTO(next, chunk);
-				chunk = Chunk_header::create(remaining, prev, next, false);
-				std::memcpy(chunk->data, next->data + next->begin, remaining);
-				chunk->end = remaining;
+				if(remaining <= g_copy_threshold){
+					chunk = Chunk_header::create(remaining, prev, next, false);
+					std::memcpy(chunk->data, next->data + next->begin, remaining);
+					chunk->end = remaining;
+				} else {
+					// 被切开的块由前后两部分共享，不复制数据。
+					chunk = Chunk_header::create_reference(next, next->begin, next->begin + remaining, prev, next);
+				}
 				next->begin += remaining;
 				(prev ? prev->next : m_first) = chunk;
 				next->prev = chunk;
@@ -433,6 +839,99 @@ void Stream_buffer::splice(Stream_buffer &rhs) NOEXCEPT {
 	m_size += exchange(rhs.m_size, 0);
 }
 
+std::ptrdiff_t Stream_buffer::find(int byte, std::size_t from) const NOEXCEPT {
+	std::size_t offset = 0;
+	for(AUTO(chunk, m_first); chunk; chunk = chunk->next){
+		const std::size_t avail = chunk->end - chunk->begin;
+		if(from < offset + avail){
+			const std::size_t skip = (from > offset) ? (from - offset) : 0;
+			const AUTO(begin, chunk->data + chunk->begin);
+			const AUTO(pos, static_cast<const unsigned char *>(std::memchr(begin + skip, byte, avail - skip)));
+			if(pos){
+				return static_cast<std::ptrdiff_t>(offset + static_cast<std::size_t>(pos - begin));
+			}
+		}
+		offset += avail;
+	}
+	return -1;
+}
+std::ptrdiff_t Stream_buffer::find_any(const void *set, std::size_t set_size, std::size_t from) const NOEXCEPT {
+	if(set_size == 0){
+		return -1;
+	}
+	Byte_set byte_set;
+	make_byte_set(byte_set, set, set_size);
+	const AUTO_REF(kernels, get_scan_kernels());
+	std::size_t offset = 0;
+	for(AUTO(chunk, m_first); chunk; chunk = chunk->next){
+		const std::size_t avail = chunk->end - chunk->begin;
+		if(from < offset + avail){
+			const std::size_t skip = (from > offset) ? (from - offset) : 0;
+			const AUTO(pos, skip + (*kernels.find_any)(chunk->data + chunk->begin + skip, avail - skip, byte_set));
+			if(pos < avail){
+				return static_cast<std::ptrdiff_t>(offset + pos);
+			}
+		}
+		offset += avail;
+	}
+	return -1;
+}
+std::ptrdiff_t Stream_buffer::find(const void *data, std::size_t count, std::size_t from) const NOEXCEPT {
+	if(from > m_size){
+		return -1;
+	}
+	if(count == 0){
+		return static_cast<std::ptrdiff_t>(from);
+	}
+	const AUTO(needle, static_cast<const unsigned char *>(data));
+	std::size_t offset = 0;
+	for(AUTO(chunk, m_first); chunk; chunk = chunk->next){
+		const std::size_t avail = chunk->end - chunk->begin;
+		std::size_t i = (from > offset) ? (from - offset) : 0;
+		while(i < avail){
+			// 先用首字节定位候选位置，再逐块比较。
+			const AUTO(begin, chunk->data + chunk->begin);
+			const AUTO(pos, static_cast<const unsigned char *>(std::memchr(begin + i, needle[0], avail - i)));
+			if(!pos){
+				break;
+			}
+			i = static_cast<std::size_t>(pos - begin);
+			if(m_size - (offset + i) < count){
+				return -1;
+			}
+			AUTO(cmp_chunk, chunk);
+			std::size_t cmp_begin = chunk->begin + i;
+			std::size_t matched = 0;
+			while(matched < count){
+				const std::size_t cmp_count = std::min(cmp_chunk->end - cmp_begin, count - matched);
+				if(std::memcmp(cmp_chunk->data + cmp_begin, needle + matched, cmp_count) != 0){
+					break;
+				}
+				matched += cmp_count;
+				cmp_chunk = cmp_chunk->next;
+				if(!cmp_chunk){
+					break;
+				}
+				cmp_begin = cmp_chunk->begin;
+			}
+			if(matched == count){
+				return static_cast<std::ptrdiff_t>(offset + i);
+			}
+			++i;
+		}
+		offset += avail;
+	}
+	return -1;
+}
+std::size_t Stream_buffer::count(int byte) const NOEXCEPT {
+	const AUTO_REF(kernels, get_scan_kernels());
+	std::size_t total = 0;
+	for(AUTO(chunk, m_first); chunk; chunk = chunk->next){
+		total += (*kernels.count_byte)(chunk->data + chunk->begin, chunk->end - chunk->begin, static_cast<unsigned char>(byte));
+	}
+	return total;
+}
+
 bool Stream_buffer::enumerate_chunk(const void **data, std::size_t *count, Stream_buffer::Enumeration_cookie &cookie) const NOEXCEPT {
 	const AUTO(chunk, cookie.m_prev ? cookie.m_prev->next : m_first);
 	cookie.m_prev = chunk;
@@ -447,8 +946,21 @@ bool Stream_buffer::enumerate_chunk(const void **data, std::size_t *count, Strea
 	}
 	return true;
 }
-bool Stream_buffer::enumerate_chunk(void **data, std::size_t *count, Stream_buffer::Enumeration_cookie &cookie) NOEXCEPT {
-	const AUTO(chunk, cookie.m_prev ? cookie.m_prev->next : m_first);
+bool Stream_buffer::enumerate_chunk(void **data, std::size_t *count, Stream_buffer::Enumeration_cookie &cookie){
+	AUTO(chunk, cookie.m_prev ? cookie.m_prev->next : m_first);
+	if(chunk && data && !chunk->is_writable()){
+		// 调用者可能修改返回的数据，因此共享的存储需要先复制一份。
+		const std::size_t avail = chunk->end - chunk->begin;
+		const AUTO(prev, chunk->prev);
+		const AUTO(next, chunk->next);
+		const AUTO(copy, Chunk_header::create(avail, prev, next, false));
+		std::memcpy(copy->data, chunk->data + chunk->begin, avail);
+		copy->end = avail;
+		(prev ? prev->next : m_first) = copy;
+		(next ? next->prev : m_last) = copy;
+		Chunk_header::destroy(chunk);
+		chunk = copy;
+	}
 	cookie.m_prev = chunk;
 	if(!chunk){
 		return false;
@@ -5,6 +5,7 @@
 #define POSEIDON_STREAM_BUFFER_HPP_
 
 #include "cxx_ver.hpp"
+#include <boost/container/vector.hpp>
 #include <string>
 #include <utility>
 #include <iterator>
@@ -23,6 +24,19 @@ public:
 	class Read_iterator;
 	class Write_iterator;
 
+	struct Pool_snapshot_element {
+		std::size_t chunk_size;
+		unsigned long long system_allocations;
+		unsigned long long system_deallocations;
+		unsigned long long depot_fetches;
+		unsigned long long depot_returns;
+		std::size_t depot_chunks;
+	};
+
+public:
+	// 获取块内存池的统计信息。块大小为零的元素表示不经过内存池的大块。
+	static void snapshot_pool(boost::container::vector<Pool_snapshot_element> &ret);
+
 private:
 	Chunk_header *m_first;
 	Chunk_header *m_last;
@@ -38,6 +52,7 @@ public:
 	explicit Stream_buffer(const char *str);
 	explicit Stream_buffer(const std::string &str);
 	explicit Stream_buffer(const std::basic_string<unsigned char> &str);
+	// 复制时较大的块只增加引用计数，数据在被修改时才会复制。
 	Stream_buffer(const Stream_buffer &rhs);
 	Stream_buffer & operator=(const Stream_buffer &rhs){
 		Stream_buffer(rhs).swap(*this);
@@ -92,6 +107,12 @@ public:
 		put(str.data(), str.size());
 	}
 
+	// 在末尾预留至少 count 字节的连续可写空间并返回其首地址，不改变 size()。
+	// 写入数据之后调用 commit() 将其中的前若干字节追加到缓冲区中。在此之前调用任何其他修改缓冲区的函数都会使预留的空间失效。
+	void * prepare(std::size_t count);
+	void commit(std::size_t count) NOEXCEPT;
+
+	// 把所有数据合并到一个连续的块中，返回的指针是可写的。
 	void * squash();
 
 	Stream_buffer cut_off(std::size_t count);
@@ -102,8 +123,18 @@ public:
 	}
 #endif
 
+	// 跨越块的边界查找。返回值是相对于缓冲区开头的偏移量，从 from 开始查找，找不到返回 -1。
+	std::ptrdiff_t find(int byte, std::size_t from = 0) const NOEXCEPT;
+	std::ptrdiff_t find_any(const void *set, std::size_t set_size, std::size_t from = 0) const NOEXCEPT;
+	std::ptrdiff_t find(const void *data, std::size_t count, std::size_t from = 0) const NOEXCEPT;
+	std::ptrdiff_t find(const std::string &str, std::size_t from = 0) const NOEXCEPT {
+		return find(str.data(), str.size(), from);
+	}
+	std::size_t count(int byte) const NOEXCEPT;
+
 	bool enumerate_chunk(const void **data, std::size_t *count, Enumeration_cookie &cookie) const NOEXCEPT;
-	bool enumerate_chunk(void **data, std::size_t *count, Enumeration_cookie &cookie) NOEXCEPT;
+	// 与其他缓冲区共享的块会被复制一份，以便调用者修改其中的数据。只读的场合请使用上面的版本。
+	bool enumerate_chunk(void **data, std::size_t *count, Enumeration_cookie &cookie);
 
 	void swap(Stream_buffer &rhs) NOEXCEPT {
 		using std::swap;
@@ -17,6 +17,8 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <sys/uio.h>
+#include <linux/errqueue.h>
 
 namespace Poseidon {
 
@@ -28,18 +30,14 @@ void Tcp_session_base::shutdown_timer_proc(const boost::weak_ptr<Tcp_session_bas
 		return;
 	}
 
-	try {
-		session->on_shutdown_timer(now);
-	} catch(std::exception &e){
-		POSEIDON_LOG_WARNING("std::exception thrown: what = ", e.what());
-		session->force_shutdown();
-	}
+	session->on_sweep(now);
 }
 
 Tcp_session_base::Tcp_session_base(Move<Unique_file> socket)
 	: Socket_base(STD_MOVE(socket)), Session_base()
 	, m_connected_notified(false), m_read_hup_notified(false)
-	, m_shutdown_time(-1ull), m_last_use_time(-1ull)
+	, m_zero_copy_threshold(Main_config::get<std::size_t>("tcp_zero_copy_threshold", 0)), m_zero_copy_enabled(false), m_zero_copy_next_seq(0)
+	, m_response_timeout(Main_config::get<boost::uint64_t>("tcp_response_timeout", 30000)), m_shutdown_time(-1ull), m_last_use_time(-1ull), m_sweeping(false)
 {
 	//
 }
@@ -51,37 +49,98 @@ void Tcp_session_base::init_ssl(boost::scoped_ptr<Ssl_filter> &ssl_filter){
 	POSEIDON_THROW_ASSERT(!m_ssl_filter);
 	swap(m_ssl_filter, ssl_filter);
 }
-void Tcp_session_base::create_shutdown_timer(){
+void Tcp_session_base::enable_sweeping(){
+	if(atomic_load(m_sweeping, memory_order_acquire)){
+		return;
+	}
 	POSEIDON_PROFILE_ME;
 
 	const Mutex::Unique_lock lock(m_shutdown_mutex);
-	if(m_shutdown_timer){
+	if(atomic_load(m_sweeping, memory_order_relaxed)){
 		return;
 	}
-	const AUTO(period, Main_config::get<boost::uint64_t>("tcp_shutdown_timer_period", 15000));
-	m_shutdown_timer = Timer_daemon::register_low_level_timer(period, period, boost::bind(&shutdown_timer_proc, virtual_weak_from_this<Tcp_session_base>(), _2));
+	if(!Epoll_daemon::set_socket_deadline(this, atomic_load(m_shutdown_time, memory_order_relaxed))){
+		// 不在 epoll 中的套接字（例如同步的 HTTP 客户端）。
+		const AUTO(period, Main_config::get<boost::uint64_t>("tcp_shutdown_timer_period", 15000));
+		m_shutdown_timer = Timer_daemon::register_low_level_timer(period, period, boost::bind(&shutdown_timer_proc, virtual_weak_from_this<Tcp_session_base>(), _2));
+	}
+	atomic_store(m_sweeping, true, memory_order_release);
 }
 
-int Tcp_session_base::poll_read_and_process(unsigned char *hint_buffer, std::size_t hint_capacity, bool /*readable*/){
+bool Tcp_session_base::should_use_zero_copy(std::size_t size) NOEXCEPT {
+#ifdef MSG_ZEROCOPY
+	if((m_zero_copy_threshold == 0) || (size < m_zero_copy_threshold) || m_ssl_filter){
+		return false;
+	}
+	if(!m_zero_copy_enabled){
+		static CONSTEXPR const int s_true_value = true;
+		if(::setsockopt(get_fd(), SOL_SOCKET, SO_ZEROCOPY, &s_true_value, sizeof(s_true_value)) != 0){
+			const int err_code = errno;
+			POSEIDON_LOG_WARNING("MSG_ZEROCOPY is not supported: remote = ", get_remote_info(), ", err_code = ", err_code);
+			m_zero_copy_threshold = 0;
+			return false;
+		}
+		m_zero_copy_enabled = true;
+	}
+	return true;
+#else
+	(void)size;
+	return false;
+#endif
+}
+void Tcp_session_base::reap_zero_copy_completions() NOEXCEPT {
+	POSEIDON_PROFILE_ME;
+
+	// 完成通知在错误队列中，每条通知确认一段连续的序号。
+	for(;;){
+		boost::array<char, 256> control;
+		::msghdr msg = { };
+		msg.msg_control = control.data();
+		msg.msg_controllen = control.size();
+		if(::recvmsg(get_fd(), &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0){
+			break;
+		}
+		for(AUTO(cmsg, CMSG_FIRSTHDR(&msg)); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)){
+			const AUTO(serr, reinterpret_cast<const ::sock_extended_err *>(CMSG_DATA(cmsg)));
+			if((serr->ee_errno != 0) || (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)){
+				continue;
+			}
+			const boost::uint32_t last_done = serr->ee_data;
+			while(!m_zero_copy_queue.empty() && (static_cast<boost::int32_t>(m_zero_copy_queue.front().first - last_done) <= 0)){
+				m_zero_copy_queue.pop_front();
+			}
+		}
+	}
+}
+
+int Tcp_session_base::poll_read_and_process(unsigned char */*hint_buffer*/, std::size_t hint_capacity, bool /*readable*/){
 	POSEIDON_PROFILE_ME;
 
 	Stream_buffer data;
 	try {
+		enable_sweeping();
+
+		// 直接读入缓冲区的块中，避免一次复制。
+		const AUTO(buffer, data.prepare(hint_capacity));
 		::ssize_t result;
 		if(m_ssl_filter){
-			result = m_ssl_filter->recv(hint_buffer, hint_capacity);
+			result = m_ssl_filter->recv(buffer, hint_capacity);
 		} else {
-			result = ::recv(get_fd(), hint_buffer, hint_capacity, MSG_NOSIGNAL | MSG_DONTWAIT);
+			result = ::recv(get_fd(), buffer, hint_capacity, MSG_NOSIGNAL | MSG_DONTWAIT);
 		}
 		if(result < 0){
 			return errno;
 		}
-		data.put(hint_buffer, static_cast<std::size_t>(result));
+		if(static_cast<std::size_t>(result) < hint_capacity / 8){
+			// 数据很少，复制到一个较小的块中，以免浪费内存。
+			Stream_buffer(buffer, static_cast<std::size_t>(result)).swap(data);
+		} else {
+			data.commit(static_cast<std::size_t>(result));
+		}
 		POSEIDON_LOG_TRACE("Read ", result, " byte(s) from ", get_remote_info());
 
 		const AUTO(now, get_fast_mono_clock());
 		atomic_store(m_last_use_time, now, memory_order_release);
-		create_shutdown_timer();
 
 		if(data.empty() && !m_read_hup_notified){
 			POSEIDON_LOG(Logger::special_major | Logger::level_debug, "TCP connection read hung up: local = ", get_local_info(), ", remote = ", get_remote_info());
@@ -104,21 +163,40 @@ int Tcp_session_base::poll_read_and_process(unsigned char *hint_buffer, std::siz
 	}
 	return 0;
 }
-int Tcp_session_base::poll_write(Mutex::Unique_lock &write_lock, unsigned char *hint_buffer, std::size_t hint_capacity, bool writable){
+int Tcp_session_base::poll_write(Mutex::Unique_lock &write_lock, unsigned char */*hint_buffer*/, std::size_t /*hint_capacity*/, bool writable){
 	POSEIDON_PROFILE_ME;
 
 	assert(!write_lock);
 
-	Stream_buffer data;
 	try {
+		enable_sweeping();
+
 		if(writable && !m_connected_notified){
 			POSEIDON_LOG(Logger::special_major | Logger::level_debug, "TCP connection established: local = ", get_local_info(), ", remote = ", get_remote_info());
 			on_connect();
 			m_connected_notified = true;
 		}
+		if(!m_zero_copy_queue.empty()){
+			reap_zero_copy_completions();
+		}
 
+		// 直接从发送缓冲区的各个块中收集数据，一次系统调用发出。
+		boost::array< ::iovec, 64> iov;
+		std::size_t iov_count = 0;
+		std::size_t avail = 0;
 		Mutex::Unique_lock lock(m_send_mutex);
-		const std::size_t avail = m_send_buffer.peek(hint_buffer, hint_capacity);
+		Stream_buffer::Enumeration_cookie cookie;
+		const void *chunk_data;
+		std::size_t chunk_size;
+		while((iov_count < iov.size()) && m_send_buffer.enumerate_chunk(&chunk_data, &chunk_size, cookie)){
+			if(chunk_size == 0){
+				continue;
+			}
+			iov[iov_count].iov_base = const_cast<void *>(chunk_data);
+			iov[iov_count].iov_len = chunk_size;
+			++iov_count;
+			avail += chunk_size;
+		}
 		if(avail == 0){
 _check_shutdown:
 			if(should_really_shutdown_write()){
@@ -130,13 +208,38 @@ _check_shutdown:
 			}
 			return EWOULDBLOCK;
 		}
+		// 其他线程只会通过 splice() 在发送缓冲区末尾追加新的块，已有的块不会被修改或释放，因此这里不需要持有锁。
 		lock.unlock();
 
+		bool zero_copy = false;
 		::ssize_t result;
 		if(m_ssl_filter){
-			result = m_ssl_filter->send(hint_buffer, avail);
+			result = 0;
+			for(std::size_t i = 0; i < iov_count; ++i){
+				const AUTO(written, m_ssl_filter->send(iov[i].iov_base, iov[i].iov_len));
+				if(written < 0){
+					if(result == 0){
+						result = written;
+					}
+					break;
+				}
+				result += written;
+				if(static_cast<std::size_t>(written) < iov[i].iov_len){
+					break;
+				}
+			}
 		} else {
-			result = ::send(get_fd(), hint_buffer, avail, MSG_NOSIGNAL | MSG_DONTWAIT);
+			::msghdr msg = { };
+			msg.msg_iov = iov.data();
+			msg.msg_iovlen = iov_count;
+			int flags = MSG_NOSIGNAL | MSG_DONTWAIT;
+#ifdef MSG_ZEROCOPY
+			zero_copy = should_use_zero_copy(avail);
+			if(zero_copy){
+				flags |= MSG_ZEROCOPY;
+			}
+#endif
+			result = ::sendmsg(get_fd(), &msg, flags);
 		}
 		if(result < 0){
 			return errno;
@@ -145,10 +248,16 @@ _check_shutdown:
 
 		const AUTO(now, get_fast_mono_clock());
 		atomic_store(m_last_use_time, now, memory_order_release);
-		create_shutdown_timer();
 
 		lock.lock();
-		m_send_buffer.discard(static_cast<std::size_t>(result));
+		if(zero_copy || !m_zero_copy_queue.empty()){
+			// 内核在确认之前仍然会引用这些数据，因此不能释放。
+			// 没有使用 MSG_ZEROCOPY 发出的数据也要排在后面，因为它们可能与之前发出的数据共用同一个块。
+			const boost::uint32_t seq = zero_copy ? m_zero_copy_next_seq++ : m_zero_copy_next_seq - 1;
+			m_zero_copy_queue.push_back(std::make_pair(seq, m_send_buffer.cut_off(static_cast<std::size_t>(result))));
+		} else {
+			m_send_buffer.discard(static_cast<std::size_t>(result));
+		}
 		swap(write_lock, lock);
 		if(m_send_buffer.empty()){
 			goto _check_shutdown;
@@ -165,6 +274,16 @@ _check_shutdown:
 	return 0;
 }
 
+void Tcp_session_base::on_sweep(boost::uint64_t now){
+	POSEIDON_PROFILE_ME;
+
+	try {
+		on_shutdown_timer(now);
+	} catch(std::exception &e){
+		POSEIDON_LOG_WARNING("std::exception thrown: what = ", e.what());
+		force_shutdown();
+	}
+}
 void Tcp_session_base::on_shutdown_timer(boost::uint64_t now){
 	POSEIDON_PROFILE_ME;
 
@@ -186,8 +305,7 @@ force_time_out:
 	}
 
 	const AUTO(last_use_time, atomic_load(m_last_use_time, memory_order_consume));
-	const AUTO(tcp_response_timeout, Main_config::get<boost::uint64_t>("tcp_response_timeout", 30000));
-	if(saturated_sub(now, last_use_time) > tcp_response_timeout){
+	if(saturated_sub(now, last_use_time) > m_response_timeout){
 		POSEIDON_LOG(Logger::special_major | Logger::level_debug, "The connection seems dead: remote = ", get_remote_info());
 		goto force_time_out;
 	}
@@ -230,8 +348,13 @@ void Tcp_session_base::set_timeout(boost::uint64_t timeout){
 	POSEIDON_PROFILE_ME;
 
 	const AUTO(now, get_fast_mono_clock());
-	atomic_store(m_shutdown_time, saturated_add(now, timeout), memory_order_release);
-	create_shutdown_timer();
+	const AUTO(shutdown_time, saturated_add(now, timeout));
+	const Mutex::Unique_lock lock(m_shutdown_mutex);
+	atomic_store(m_shutdown_time, shutdown_time, memory_order_release);
+	// 尚未开始清扫的话，enable_sweeping() 会读取新的截止时间。
+	if(atomic_load(m_sweeping, memory_order_relaxed) && !m_shutdown_timer){
+		Epoll_daemon::set_socket_deadline(this, shutdown_time);
+	}
 }
 
 bool Tcp_session_base::send(Stream_buffer buffer){
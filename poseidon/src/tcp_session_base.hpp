@@ -9,6 +9,7 @@
 #include "socket_base.hpp"
 #include "session_base.hpp"
 #include <boost/scoped_ptr.hpp>
+#include <boost/container/deque.hpp>
 
 namespace Poseidon {
 
@@ -33,9 +34,19 @@ private:
 	mutable Mutex m_send_mutex;
 	Stream_buffer m_send_buffer;
 
+	// 以下成员只能在 epoll 线程中访问。
+	std::size_t m_zero_copy_threshold;
+	bool m_zero_copy_enabled;
+	boost::uint32_t m_zero_copy_next_seq;
+	// 已经以 MSG_ZEROCOPY 发出但内核尚未确认的数据。
+	boost::container::deque<std::pair<boost::uint32_t, Stream_buffer> > m_zero_copy_queue;
+
+	const boost::uint64_t m_response_timeout;
 	volatile boost::uint64_t m_shutdown_time;
 	volatile boost::uint64_t m_last_use_time;
+	volatile bool m_sweeping;
 	mutable Mutex m_shutdown_mutex;
+	// 超时检测通常由 epoll 线程统一进行。只有不在 epoll 中的套接字才会使用这个定时器。
 	boost::shared_ptr<Timer> m_shutdown_timer;
 
 public:
@@ -44,7 +55,10 @@ public:
 
 private:
 	void init_ssl(boost::scoped_ptr<Ssl_filter> &ssl_filter);
-	void create_shutdown_timer();
+	void enable_sweeping();
+
+	bool should_use_zero_copy(std::size_t size) NOEXCEPT;
+	void reap_zero_copy_completions() NOEXCEPT;
 
 protected:
 	// 注意，只能在 epoll 线程中调用这些函数。
@@ -55,8 +69,9 @@ protected:
 	void on_read_hup() OVERRIDE = 0;
 	void on_close(int err_code) OVERRIDE = 0; // 参数就是 errno。
 	void on_receive(Stream_buffer data) OVERRIDE = 0;
+	void on_sweep(boost::uint64_t now) OVERRIDE;
 
-	// 注意，只能在 timer 线程中调用这些函数。
+	// 由 on_sweep() 调用。至少每隔 tcp_shutdown_timer_period 毫秒调用一次，超时的时候也会调用。
 	virtual void on_shutdown_timer(boost::uint64_t now);
 
 public:
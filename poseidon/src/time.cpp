@@ -57,6 +57,14 @@ double get_hi_res_mono_clock() NOEXCEPT {
 	}
 	return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
 }
+boost::uint64_t get_mono_clock_us() NOEXCEPT {
+	::timespec ts;
+	if(::clock_gettime(CLOCK_MONOTONIC, &ts) != 0){
+		POSEIDON_LOG_FATAL("Monotonic clock is not supported.");
+		std::terminate();
+	}
+	return (boost::uint64_t)(ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wsign-conversion"
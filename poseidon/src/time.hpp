@@ -18,6 +18,8 @@ extern boost::uint64_t get_local_time_from_utc(boost::uint64_t utc);
 
 extern boost::uint64_t get_fast_mono_clock() NOEXCEPT;
 extern double get_hi_res_mono_clock() NOEXCEPT;
+// 与 get_fast_mono_clock() 使用同一个时钟，但是时间单位是微秒。
+extern boost::uint64_t get_mono_clock_us() NOEXCEPT;
 
 struct Date_time {
 	unsigned yr;
@@ -82,21 +82,28 @@ void Udp_session_base::force_shutdown() NOEXCEPT {
 	Socket_base::force_shutdown();
 }
 
-int Udp_session_base::poll_read_and_process(unsigned char *hint_buffer, std::size_t hint_capacity, bool /*readable*/){
+int Udp_session_base::poll_read_and_process(unsigned char */*hint_buffer*/, std::size_t hint_capacity, bool /*readable*/){
 	POSEIDON_PROFILE_ME;
 
 	for(unsigned i = 0; i < 256; ++i){
 		Sock_addr sock_addr;
 		Stream_buffer data;
 		try {
+			// 直接读入缓冲区的块中，避免一次复制。
+			const AUTO(buffer, data.prepare(hint_capacity));
 			::sockaddr_storage sa;
 			::socklen_t sa_len = sizeof(sa);
-			::ssize_t result = ::recvfrom(get_fd(), hint_buffer, hint_capacity, MSG_NOSIGNAL | MSG_DONTWAIT, static_cast< ::sockaddr *>(static_cast<void *>(&sa)), &sa_len);
+			::ssize_t result = ::recvfrom(get_fd(), buffer, hint_capacity, MSG_NOSIGNAL | MSG_DONTWAIT, static_cast< ::sockaddr *>(static_cast<void *>(&sa)), &sa_len);
 			if(result < 0){
 				return errno;
 			}
 			sock_addr = Sock_addr(&sa, sa_len);
-			data.put(hint_buffer, static_cast<std::size_t>(result));
+			if(static_cast<std::size_t>(result) < hint_capacity / 8){
+				// 数据报很小，复制到一个较小的块中，以免浪费内存。
+				Stream_buffer(buffer, static_cast<std::size_t>(result)).swap(data);
+			} else {
+				data.commit(static_cast<std::size_t>(result));
+			}
 			POSEIDON_LOG_TRACE("Read ", result, " byte(s) from ", Ip_port(sock_addr));
 		} catch(std::exception &e){
 			POSEIDON_LOG_ERROR("std::exception thrown: what = ", e.what());